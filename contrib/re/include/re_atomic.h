@@ -0,0 +1,124 @@
+/**
+ * @file re_atomic.h  Atomic operations
+ *
+ * The interlocked functions of Windows are full barriers, which is
+ * stronger than needed.
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+#ifndef RE_ATOMIC_H__
+#define RE_ATOMIC_H__
+
+
+#if defined(__GNUC__) || defined(__clang__)
+
+static inline uint32_t re_atomic_load_acquire(uint32_t *p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+
+static inline uint32_t re_atomic_load_relaxed(uint32_t *p)
+{
+	return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+
+static inline void re_atomic_store_release(uint32_t *p, uint32_t v)
+{
+	__atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+
+/* On failure, *expected is set to the current value */
+static inline bool re_atomic_cas_weak(uint32_t *p, uint32_t *expected,
+				      uint32_t v)
+{
+	return __atomic_compare_exchange_n(p, expected, v, true,
+					   __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+
+static inline int32_t re_atomic_add_fetch(int32_t *p, int32_t v)
+{
+	return __atomic_add_fetch(p, v, __ATOMIC_ACQ_REL);
+}
+
+
+static inline uint64_t re_atomic_load64(uint64_t *p)
+{
+	return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+
+/* For counters, no ordering with other memory */
+static inline void re_atomic_add64(uint64_t *p, uint64_t v)
+{
+	(void)__atomic_add_fetch(p, v, __ATOMIC_RELAXED);
+}
+
+#elif defined(_MSC_VER)
+
+#include <intrin.h>
+
+
+static __inline uint32_t re_atomic_load_acquire(uint32_t *p)
+{
+	return (uint32_t)_InterlockedCompareExchange((volatile long *)p,
+						     0, 0);
+}
+
+
+static __inline uint32_t re_atomic_load_relaxed(uint32_t *p)
+{
+	return *(volatile uint32_t *)p;
+}
+
+
+static __inline void re_atomic_store_release(uint32_t *p, uint32_t v)
+{
+	(void)_InterlockedExchange((volatile long *)p, (long)v);
+}
+
+
+static __inline bool re_atomic_cas_weak(uint32_t *p, uint32_t *expected,
+					uint32_t v)
+{
+	const long old = _InterlockedCompareExchange((volatile long *)p,
+						     (long)v,
+						     (long)*expected);
+
+	if ((uint32_t)old == *expected)
+		return true;
+
+	*expected = (uint32_t)old;
+
+	return false;
+}
+
+
+static __inline int32_t re_atomic_add_fetch(int32_t *p, int32_t v)
+{
+	return _InterlockedExchangeAdd((volatile long *)p, v) + v;
+}
+
+
+static __inline uint64_t re_atomic_load64(uint64_t *p)
+{
+	return (uint64_t)_InterlockedCompareExchange64(
+		(volatile __int64 *)p, 0, 0);
+}
+
+
+static __inline void re_atomic_add64(uint64_t *p, uint64_t v)
+{
+	(void)_InterlockedExchangeAdd64((volatile __int64 *)p, (__int64)v);
+}
+
+#else
+#error "re_atomic: no atomic operations for this compiler"
+#endif
+
+
+#endif
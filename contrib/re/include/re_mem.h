@@ -13,6 +13,19 @@
  */
 typedef void (mem_destroy_h)(void *data);
 
+/** Number of slab allocator size classes */
+enum {
+	MEM_SLAB_CLASSES = 9
+};
+
+/** Memory Statistics of one slab size class */
+struct memstat_slab {
+	size_t size;         /**< Block size of the class      */
+	size_t blocks_cur;   /**< Blocks currently in use      */
+	size_t blocks_free;  /**< Blocks cached in free lists  */
+	uint64_t allocs;     /**< Total number of allocations  */
+};
+
 /** Memory Statistics */
 struct memstat {
 	size_t bytes_cur;    /**< Current bytes allocated      */
@@ -21,6 +34,7 @@ struct memstat {
 	size_t blocks_peak;  /**< Peak blocks allocated        */
 	size_t size_min;     /**< Lowest block size allocated  */
 	size_t size_max;     /**< Largest block size allocated */
+	struct memstat_slab slab[MEM_SLAB_CLASSES]; /**< Slab allocator */
 };
 
 #define mem_alloc(s, d) \
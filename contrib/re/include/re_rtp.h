@@ -31,6 +31,20 @@ struct rtp_header {
 	} x;
 };
 
+/**
+ * Metadata of a received RTP/RTCP packet, decoded once so that the
+ * receive pipeline does not parse the header again. The offsets are
+ * relative to the start of the packet. For RTCP only the packet type
+ * and the SSRC of the sender are set.
+ */
+struct rtp_meta {
+	struct rtp_header hdr;  /**< Decoded RTP header               */
+	bool rtcp;              /**< RTCP packet, hdr.pt is full type  */
+	size_t start;           /**< Position of the packet in mbuf   */
+	size_t hdr_len;         /**< Header length, CSRCs+extension   */
+	size_t ext_off;         /**< Offset of extension data, or 0   */
+};
+
 /** RTCP Packet Types */
 enum rtcp_type {
 	RTCP_FIR   = 192,  /**< Full INTRA-frame Request (RFC 2032)    */
@@ -204,6 +218,7 @@ int   rtp_listen(struct rtp_sock **rsp, int proto, const struct sa *ip,
 		 rtp_recv_h *recvh, rtcp_recv_h *rtcph, void *arg);
 int   rtp_hdr_encode(struct mbuf *mb, const struct rtp_header *hdr);
 int   rtp_hdr_decode(struct rtp_header *hdr, struct mbuf *mb);
+int   rtp_meta_decode(struct rtp_meta *meta, const struct mbuf *mb);
 int   rtp_encode(struct rtp_sock *rs, bool marker, uint8_t pt,
 		 uint32_t ts, struct mbuf *mb);
 int   rtp_decode(struct rtp_sock *rs, struct mbuf *mb, struct rtp_header *hdr);
@@ -10,19 +10,38 @@ enum srtp_suite {
 	SRTP_AES_CM_128_HMAC_SHA1_80,
 	SRTP_AES_256_CM_HMAC_SHA1_32,
 	SRTP_AES_256_CM_HMAC_SHA1_80,
+	SRTP_AES_128_GCM,
+	SRTP_AES_256_GCM,
 };
 
 enum srtp_flags {
 	SRTP_UNENCRYPTED_SRTCP = 1<<1,
 };
 
+/** SRTP statistics */
+struct srtp_stats {
+	uint64_t replay;  /**< Packets dropped as replayed           */
+	uint64_t old;     /**< Packets dropped as older than window  */
+};
+
 struct srtp;
+struct rtp_meta;
 
 int srtp_alloc(struct srtp **srtpp, enum srtp_suite suite,
 	       const uint8_t *key, size_t key_bytes, int flags);
 int srtp_encrypt(struct srtp *srtp, struct mbuf *mb);
 int srtp_decrypt(struct srtp *srtp, struct mbuf *mb);
+int srtp_decrypt_meta(struct srtp *srtp, struct mbuf *mb,
+		      const struct rtp_meta *meta);
+int srtp_encrypt_batch(struct srtp *srtp, struct mbuf **mbv, int *errv,
+		       size_t n);
+int srtp_decrypt_batch(struct srtp *srtp, struct mbuf **mbv, int *errv,
+		       size_t n);
 int srtcp_encrypt(struct srtp *srtp, struct mbuf *mb);
 int srtcp_decrypt(struct srtp *srtp, struct mbuf *mb);
 
+int srtp_set_max_streams(struct srtp *srtp, uint32_t n);
+int srtp_set_replay_window(struct srtp *srtp, uint32_t window);
+int srtp_stats_get(const struct srtp *srtp, struct srtp_stats *stats);
+
 const char *srtp_suite_name(enum srtp_suite suite);
@@ -106,3 +106,37 @@ int tcp_register_helper(struct tcp_helper **thp, struct tcp_conn *tc,
 			tcp_helper_recv_h *rh, void *arg);
 int tcp_send_helper(struct tcp_conn *tc, struct mbuf *mb,
 		    struct tcp_helper *th);
+
+
+/* Stream framer */
+
+/**
+ * Defines the frame length handler of a stream framer
+ *
+ * @param lenp Returns the frame length in bytes, including the header
+ * @param mb   Buffer with the start of the frame
+ * @param arg  Handler argument
+ *
+ * @return 0 if success, ENODATA if the header is incomplete, otherwise
+ *         errorcode
+ */
+typedef int (tcp_framer_len_h)(size_t *lenp, const struct mbuf *mb,
+			       void *arg);
+
+/**
+ * Defines the frame handler of a stream framer
+ *
+ * @param mb  Buffer with one complete frame, including the header
+ * @param arg Handler argument
+ *
+ * @return True to continue with the next frame, false to stop
+ */
+typedef bool (tcp_framer_frame_h)(struct mbuf *mb, void *arg);
+
+struct tcp_framer;
+
+int  tcp_framer_alloc(struct tcp_framer **frmp, size_t size, size_t align,
+		      tcp_framer_len_h *lenh, tcp_framer_frame_h *frameh,
+		      void *arg);
+int  tcp_framer_recv(struct tcp_framer *frm, struct mbuf *mb);
+size_t tcp_framer_pending(const struct tcp_framer *frm);
@@ -20,10 +20,32 @@ struct tmr {
 	uint64_t jfs;       /**< Jiffies for timeout */
 };
 
+/** Timer wheel geometry */
+enum {
+	TMR_WHEEL_BITS0  = 8,                       /**< Bits in level 0  */
+	TMR_WHEEL_BITSN  = 6,                       /**< Bits per level   */
+	TMR_WHEEL_SIZE0  = 1 << TMR_WHEEL_BITS0,    /**< Slots in level 0 */
+	TMR_WHEEL_SIZEN  = 1 << TMR_WHEEL_BITSN,    /**< Slots per level  */
+	TMR_WHEEL_LEVELS = 4                        /**< Upper levels     */
+};
+
+/**
+ * Defines a list of timers, organised as a hierarchical timing wheel.
+ * Level 0 has one slot per jiffy, each upper level covers the full
+ * range of the level below in one slot.
+ */
+struct tmrl {
+	struct list vec0[TMR_WHEEL_SIZE0];                   /**< Level 0 */
+	struct list vecn[TMR_WHEEL_LEVELS][TMR_WHEEL_SIZEN]; /**< Upper   */
+	struct list due;    /**< Expired timers, for the next poll */
+	uint64_t jfs;       /**< Next jiffy to be processed      */
+	uint32_t n;         /**< Number of active timers         */
+};
+
 
-void     tmr_poll(struct list *tmrl);
+void     tmr_poll(struct tmrl *tmrl);
 uint64_t tmr_jiffies(void);
-uint64_t tmr_next_timeout(struct list *tmrl);
+uint64_t tmr_next_timeout(struct tmrl *tmrl);
 void     tmr_debug(void);
 int      tmr_status(struct re_printf *pf, void *unused);
 
@@ -19,6 +19,14 @@ typedef void(turnc_h)(int err, uint16_t scode, const char *reason,
 typedef void(turnc_perm_h)(void *arg);
 typedef void(turnc_chan_h)(void *arg);
 
+/** TURN Client data counters, in bytes on the wire */
+struct turnc_stats {
+	uint64_t ind_tx;   /**< Sent as Send indications       */
+	uint64_t ind_rx;   /**< Received as Data indications   */
+	uint64_t chan_tx;  /**< Sent as ChannelData            */
+	uint64_t chan_rx;  /**< Received as ChannelData        */
+};
+
 struct turnc;
 
 int turnc_alloc(struct turnc **turncp, const struct stun_conf *conf, int proto,
@@ -31,3 +39,4 @@ int turnc_add_perm(struct turnc *turnc, const struct sa *peer,
 		   turnc_perm_h *ph, void *arg);
 int turnc_add_chan(struct turnc *turnc, const struct sa *peer,
 		   turnc_chan_h *ch, void *arg);
+const struct turnc_stats *turnc_stats_get(const struct turnc *turnc);
@@ -19,6 +19,16 @@ struct udp_sock;
 typedef void (udp_recv_h)(const struct sa *src, struct mbuf *mb, void *arg);
 typedef void (udp_error_h)(int err, void *arg);
 
+/** Defines the UDP transmit queue statistics */
+struct udp_txstat {
+	uint64_t n_pkt;       /**< Datagrams sent from the queue     */
+	uint64_t n_syscall;   /**< System calls used to send them    */
+	uint64_t n_gso;       /**< Datagrams sent with UDP GSO       */
+	uint64_t n_direct;    /**< Datagrams too large for the queue */
+	uint64_t n_handoff;   /**< Datagrams queued by other threads */
+	uint64_t n_err;       /**< Datagrams dropped on send errors  */
+};
+
 
 int  udp_listen(struct udp_sock **usp, const struct sa *local,
 		udp_recv_h *rh, void *arg);
@@ -31,6 +41,10 @@ int  udp_setsockopt(struct udp_sock *us, int level, int optname,
 int  udp_sockbuf_set(struct udp_sock *us, int size);
 void udp_rxsz_set(struct udp_sock *us, size_t rxsz);
 void udp_rxbuf_presz_set(struct udp_sock *us, size_t rx_presz);
+int  udp_rxbatch_set(struct udp_sock *us, unsigned n);
+int  udp_txqueue_set(struct udp_sock *us, unsigned n);
+int  udp_txqueue_flush(struct udp_sock *us);
+const struct udp_txstat *udp_txqueue_stat(const struct udp_sock *us);
 void udp_handler_set(struct udp_sock *us, udp_recv_h *rh, void *arg);
 void udp_error_handler_set(struct udp_sock *us, udp_error_h *eh);
 int  udp_thread_attach(struct udp_sock *us);
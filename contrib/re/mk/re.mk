@@ -18,6 +18,7 @@
 #   RELEASE        Release build
 #   SYSROOT        System root of library and include files
 #   SYSROOT_ALT    Alternative system root of library and include files
+#   USE_MEM_SLAB   If non-empty, use the slab allocator for memory objects
 #   USE_OPENSSL    If non-empty, link to libssl library
 #   USE_ZLIB       If non-empty, link to libz library
 #   VERSION        Version number
@@ -238,6 +239,9 @@ ifeq ($(OS),linux)
 	APP_LFLAGS	+= -rdynamic
 	AR		:= ar
 	AFLAGS		:= cru
+	HAVE_RECVMMSG	:= 1
+	HAVE_SENDMMSG	:= 1
+	HAVE_EVENTFD	:= 1
 endif
 ifeq ($(OS),darwin)
 	CFLAGS		+= -fPIC -dynamic -DDARWIN
@@ -470,6 +474,10 @@ CFLAGS  += -DUSE_ZLIB
 LIBS    += -lz
 endif
 
+ifneq ($(USE_MEM_SLAB),)
+CFLAGS  += -DMEM_SLAB
+endif
+
 
 ifneq ($(OS),win32)
 
@@ -574,6 +582,15 @@ endif
 ifneq ($(HAVE_KQUEUE),)
 CFLAGS  += -DHAVE_KQUEUE
 endif
+ifneq ($(HAVE_RECVMMSG),)
+CFLAGS  += -DHAVE_RECVMMSG
+endif
+ifneq ($(HAVE_SENDMMSG),)
+CFLAGS  += -DHAVE_SENDMMSG
+endif
+ifneq ($(HAVE_EVENTFD),)
+CFLAGS  += -DHAVE_EVENTFD
+endif
 CFLAGS  += -DHAVE_UNAME
 CFLAGS  += -DHAVE_UNISTD_H
 ifneq ($(OS),cygwin)
@@ -667,6 +684,7 @@ info:
 	@echo "  USE_DTLS:      $(USE_DTLS)"
 	@echo "  USE_DTLS_SRTP: $(USE_DTLS_SRTP)"
 	@echo "  USE_ZLIB:      $(USE_ZLIB)"
+	@echo "  USE_MEM_SLAB:  $(USE_MEM_SLAB)"
 	@echo "  GCOV:          $(GCOV)"
 	@echo "  GPROF:         $(GPROF)"
 	@echo "  CROSS_COMPILE: $(CROSS_COMPILE)"
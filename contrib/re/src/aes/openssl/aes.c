@@ -17,7 +17,10 @@
 
 
 struct aes {
-	EVP_CIPHER_CTX ctx;
+	EVP_CIPHER_CTX *ctx;
+	enum aes_mode mode;
+	uint8_t iv[AES_BLOCK_SIZE];  /**< Pending IV for GCM       */
+	bool iv_pending;             /**< GCM context needs an IV  */
 };
 
 
@@ -25,7 +28,46 @@ static void destructor(void *arg)
 {
 	struct aes *st = arg;
 
-	EVP_CIPHER_CTX_cleanup(&st->ctx);
+	if (st->ctx)
+		EVP_CIPHER_CTX_free(st->ctx);
+}
+
+
+static const EVP_CIPHER *aes_cipher(enum aes_mode mode, size_t key_bits)
+{
+	switch (mode) {
+
+	case AES_MODE_CTR:
+		switch (key_bits) {
+
+		case 128: return EVP_aes_128_ctr();
+		case 192: return EVP_aes_192_ctr();
+		case 256: return EVP_aes_256_ctr();
+		default:  return NULL;
+		}
+
+	case AES_MODE_ECB:
+		switch (key_bits) {
+
+		case 128: return EVP_aes_128_ecb();
+		case 192: return EVP_aes_192_ecb();
+		case 256: return EVP_aes_256_ecb();
+		default:  return NULL;
+		}
+
+#ifdef EVP_CIPH_GCM_MODE
+	case AES_MODE_GCM:
+		switch (key_bits) {
+
+		case 128: return EVP_aes_128_gcm();
+		case 256: return EVP_aes_256_gcm();
+		default:  return NULL;
+		}
+#endif
+
+	default:
+		return NULL;
+	}
 }
 
 
@@ -40,32 +82,47 @@ int aes_alloc(struct aes **aesp, enum aes_mode mode,
 	if (!aesp || !key)
 		return EINVAL;
 
-	if (mode != AES_MODE_CTR)
+	if (!aes_cipher(mode, 128))
 		return ENOTSUP;
 
 	st = mem_zalloc(sizeof(*st), destructor);
 	if (!st)
 		return ENOMEM;
 
-	EVP_CIPHER_CTX_init(&st->ctx);
+	st->mode = mode;
 
-	switch (key_bits) {
+	st->ctx = EVP_CIPHER_CTX_new();
+	if (!st->ctx) {
+		ERR_clear_error();
+		err = ENOMEM;
+		goto out;
+	}
 
-	case 128: cipher = EVP_aes_128_ctr(); break;
-	case 192: cipher = EVP_aes_192_ctr(); break;
-	case 256: cipher = EVP_aes_256_ctr(); break;
-	default:
+	cipher = aes_cipher(mode, key_bits);
+	if (!cipher) {
 		re_fprintf(stderr, "aes: unknown key: %zu bits\n", key_bits);
 		err = EINVAL;
 		goto out;
 	}
 
-	r = EVP_EncryptInit_ex(&st->ctx, cipher, NULL, key, iv);
+	/* GCM: the IV is applied when the direction is known */
+	r = EVP_EncryptInit_ex(st->ctx, cipher, NULL, key,
+			       mode == AES_MODE_CTR ? iv : NULL);
 	if (!r) {
 		ERR_clear_error();
 		err = EPROTO;
+		goto out;
 	}
 
+	if (mode == AES_MODE_GCM && iv) {
+		memcpy(st->iv, iv, sizeof(st->iv));
+		st->iv_pending = true;
+	}
+
+	/* ECB: whole blocks only, e.g. counter blocks for a keystream */
+	if (mode == AES_MODE_ECB)
+		EVP_CIPHER_CTX_set_padding(st->ctx, 0);
+
  out:
 	if (err)
 		mem_deref(st);
@@ -76,6 +133,13 @@ int aes_alloc(struct aes **aesp, enum aes_mode mode,
 }
 
 
+/**
+ * Set the IV of an AES context. For GCM, the first 12 bytes are used
+ * as the nonce and the authentication state is reset.
+ *
+ * @param aes AES Context
+ * @param iv  Initialization Vector
+ */
 void aes_set_iv(struct aes *aes, const uint8_t iv[AES_BLOCK_SIZE])
 {
 	int r;
@@ -83,20 +147,70 @@ void aes_set_iv(struct aes *aes, const uint8_t iv[AES_BLOCK_SIZE])
 	if (!aes || !iv)
 		return;
 
-	r = EVP_EncryptInit_ex(&aes->ctx, NULL, NULL, NULL, iv);
+	if (aes->mode == AES_MODE_ECB)
+		return;
+
+	if (aes->mode == AES_MODE_GCM) {
+		memcpy(aes->iv, iv, sizeof(aes->iv));
+		aes->iv_pending = true;
+		return;
+	}
+
+	r = EVP_EncryptInit_ex(aes->ctx, NULL, NULL, NULL, iv);
 	if (!r)
 		ERR_clear_error();
 }
 
 
+static int gcm_init(struct aes *aes, int enc)
+{
+	if (!aes->iv_pending)
+		return 0;
+
+	if (!EVP_CipherInit_ex(aes->ctx, NULL, NULL, NULL, aes->iv, enc)) {
+		ERR_clear_error();
+		return EPROTO;
+	}
+
+	aes->iv_pending = false;
+
+	return 0;
+}
+
+
+/**
+ * Encrypt data. For GCM, a NULL output buffer adds the input as
+ * additional authenticated data. For ECB, the length must be a
+ * multiple of the block size.
+ *
+ * @param aes AES Context
+ * @param out Output buffer, NULL for GCM associated data
+ * @param in  Input buffer
+ * @param len Number of bytes
+ *
+ * @return 0 if success, otherwise errorcode
+ */
 int aes_encr(struct aes *aes, uint8_t *out, const uint8_t *in, size_t len)
 {
 	int c_len = (int)len;
+	int err;
 
-	if (!aes || !out || !in)
+	if (!aes || !in)
+		return EINVAL;
+
+	if (aes->mode != AES_MODE_GCM && !out)
+		return EINVAL;
+
+	if (aes->mode == AES_MODE_ECB && len % AES_BLOCK_SIZE)
 		return EINVAL;
 
-	if (!EVP_EncryptUpdate(&aes->ctx, out, &c_len, in, (int)len)) {
+	if (aes->mode == AES_MODE_GCM) {
+		err = gcm_init(aes, 1);
+		if (err)
+			return err;
+	}
+
+	if (!EVP_EncryptUpdate(aes->ctx, out, &c_len, in, (int)len)) {
 		ERR_clear_error();
 		return EPROTO;
 	}
@@ -105,6 +219,129 @@ int aes_encr(struct aes *aes, uint8_t *out, const uint8_t *in, size_t len)
 }
 
 
+/**
+ * Decrypt data. For GCM, a NULL output buffer adds the input as
+ * additional authenticated data.
+ *
+ * @param aes AES Context
+ * @param out Output buffer, NULL for GCM associated data
+ * @param in  Input buffer
+ * @param len Number of bytes
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aes_decr(struct aes *aes, uint8_t *out, const uint8_t *in, size_t len)
+{
+	int c_len = (int)len;
+	int err;
+
+	if (!aes || !in)
+		return EINVAL;
+
+	/* CTR mode is symmetric */
+	if (aes->mode == AES_MODE_CTR)
+		return aes_encr(aes, out, in, len);
+
+	if (aes->mode != AES_MODE_GCM)
+		return ENOTSUP;
+
+	err = gcm_init(aes, 0);
+	if (err)
+		return err;
+
+	if (!EVP_DecryptUpdate(aes->ctx, out, &c_len, in, (int)len)) {
+		ERR_clear_error();
+		return EPROTO;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Finish a GCM encryption and get the authentication tag
+ *
+ * @param aes    AES Context
+ * @param tag    Buffer for the authentication tag
+ * @param taglen Length of the authentication tag in bytes
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aes_get_authtag(struct aes *aes, uint8_t *tag, size_t taglen)
+{
+#ifdef EVP_CIPH_GCM_MODE
+	int tmplen;
+
+	if (!aes || !tag || !taglen)
+		return EINVAL;
+
+	if (aes->mode != AES_MODE_GCM)
+		return ENOTSUP;
+
+	if (!EVP_EncryptFinal_ex(aes->ctx, NULL, &tmplen)) {
+		ERR_clear_error();
+		return EPROTO;
+	}
+
+	if (!EVP_CIPHER_CTX_ctrl(aes->ctx, EVP_CTRL_GCM_GET_TAG,
+				 (int)taglen, tag)) {
+		ERR_clear_error();
+		return EPROTO;
+	}
+
+	return 0;
+#else
+	(void)aes;
+	(void)tag;
+	(void)taglen;
+
+	return ENOTSUP;
+#endif
+}
+
+
+/**
+ * Finish a GCM decryption and verify the authentication tag
+ *
+ * @param aes    AES Context
+ * @param tag    Authentication tag
+ * @param taglen Length of the authentication tag in bytes
+ *
+ * @return 0 if success, EAUTH if the tag does not match
+ */
+int aes_authenticate(struct aes *aes, const uint8_t *tag, size_t taglen)
+{
+#ifdef EVP_CIPH_GCM_MODE
+	int tmplen;
+
+	if (!aes || !tag || !taglen)
+		return EINVAL;
+
+	if (aes->mode != AES_MODE_GCM)
+		return ENOTSUP;
+
+	if (!EVP_CIPHER_CTX_ctrl(aes->ctx, EVP_CTRL_GCM_SET_TAG,
+				 (int)taglen, (void *)tag)) {
+		ERR_clear_error();
+		return EPROTO;
+	}
+
+	if (EVP_DecryptFinal_ex(aes->ctx, NULL, &tmplen) <= 0) {
+		ERR_clear_error();
+		return EAUTH;
+	}
+
+	return 0;
+#else
+	(void)aes;
+	(void)tag;
+	(void)taglen;
+
+	return ENOTSUP;
+#endif
+}
+
+
 #else /* EVP_CIPH_CTR_MODE */
 
 
@@ -181,15 +418,30 @@ int aes_encr(struct aes *aes, uint8_t *out, const uint8_t *in, size_t len)
 }
 
 
-#endif /* EVP_CIPH_CTR_MODE */
+int aes_decr(struct aes *aes, uint8_t *out, const uint8_t *in, size_t len)
+{
+	return aes_encr(aes, out, in, len);
+}
 
 
-/*
- * Common code:
- */
+int aes_get_authtag(struct aes *aes, uint8_t *tag, size_t taglen)
+{
+	(void)aes;
+	(void)tag;
+	(void)taglen;
 
+	return ENOTSUP;
+}
 
-int aes_decr(struct aes *aes, uint8_t *out, const uint8_t *in, size_t len)
+
+int aes_authenticate(struct aes *aes, const uint8_t *tag, size_t taglen)
 {
-	return aes_encr(aes, out, in, len);
+	(void)aes;
+	(void)tag;
+	(void)taglen;
+
+	return ENOTSUP;
 }
+
+
+#endif /* EVP_CIPH_CTR_MODE */
@@ -39,9 +39,8 @@ struct tcpconn {
 	struct tmr tmr;
 	struct sa srv;
 	struct tcp_conn *conn;
-	struct mbuf *mb;
+	struct tcp_framer *framer;
 	bool connected;
-	uint16_t flen;
 	struct dnsc *dnsc; /* parent */
 };
 
@@ -197,11 +196,14 @@ static int reply_recv(struct dnsc *dnsc, struct mbuf *mb)
 	struct dns_query *q = NULL;
 	uint32_t i, j, nv[3];
 	struct dnsquery dq;
+	size_t start;
 	int err = 0;
 
 	if (!dnsc || !mb)
 		return EINVAL;
 
+	/* compression offsets are relative to the start of the message */
+	start = mb->pos;
 	dq.name = NULL;
 
 	if (dns_hdr_decode(mb, &dq.hdr) || !dq.hdr.qr) {
@@ -209,7 +211,7 @@ static int reply_recv(struct dnsc *dnsc, struct mbuf *mb)
 		goto out;
 	}
 
-	err = dns_dname_decode(mb, &dq.name, 0);
+	err = dns_dname_decode(mb, &dq.name, start);
 	if (err)
 		goto out;
 
@@ -248,7 +250,7 @@ static int reply_recv(struct dnsc *dnsc, struct mbuf *mb)
 
 			struct dnsrr *rr = NULL;
 
-			err = dns_rr_decode(mb, &rr, 0);
+			err = dns_rr_decode(mb, &rr, start);
 			if (err) {
 				query_handler(q, err, NULL, NULL, NULL, NULL);
 				mem_deref(q);
@@ -291,67 +293,47 @@ static void udp_recv_handler(const struct sa *src, struct mbuf *mb, void *arg)
 }
 
 
-static void tcp_recv_handler(struct mbuf *mbrx, void *arg)
+/* DNS message with a 2 byte length prefix, RFC 1035 section 4.2.2 */
+static int tcp_frame_len_handler(size_t *lenp, const struct mbuf *mb,
+				 void *arg)
 {
-	struct tcpconn *tc = arg;
-	struct mbuf *mb = tc->mb;
-	int err = 0;
-	size_t n;
-
- next:
-	/* frame length */
-	if (!tc->flen) {
-
-		n = min(2 - mb->end, mbuf_get_left(mbrx));
-
-		err = mbuf_write_mem(mb, mbuf_buf(mbrx), n);
-		if (err)
-			goto error;
-
-		mbrx->pos += n;
-
-		if (mb->end < 2)
-			return;
+	const uint8_t *p = mbuf_buf(mb);
+	(void)arg;
 
-		mb->pos = 0;
-		tc->flen = ntohs(mbuf_read_u16(mb));
-		mb->pos = 0;
-		mb->end = 0;
-	}
+	if (mbuf_get_left(mb) < 2)
+		return ENODATA;
 
-	/* content */
-	n = min(tc->flen - mb->end, mbuf_get_left(mbrx));
+	*lenp = 2 + (p[0] << 8 | p[1]);
 
-	err = mbuf_write_mem(mb, mbuf_buf(mbrx), n);
-	if (err)
-		goto error;
+	return 0;
+}
 
-	mbrx->pos += n;
 
-	if (mb->end < tc->flen)
-		return;
+static bool tcp_frame_handler(struct mbuf *mb, void *arg)
+{
+	struct tcpconn *tc = arg;
+	int err;
 
-	mb->pos = 0;
+	mb->pos += 2;
 
 	err = reply_recv(tc->dnsc, mb);
-	if (err)
-		goto error;
+	if (err) {
+		tcpconn_close(tc, err);
+		return false;
+	}
 
-	/* reset tcp buffer */
-	tc->flen = 0;
-	mb->pos = 0;
-	mb->end = 0;
+	return true;
+}
 
-	/* more data ? */
-	if (mbuf_get_left(mbrx) > 0) {
-		DEBUG_INFO("%u bytes of tcp data left\n", mbuf_get_left(mbrx));
-		goto next;
-	}
 
-	return;
+static void tcp_recv_handler(struct mbuf *mbrx, void *arg)
+{
+	struct tcpconn *tc = arg;
+	int err;
 
- error:
-	tcpconn_close(tc, err);
+	err = tcp_framer_recv(tc->framer, mbrx);
+	if (err)
+		tcpconn_close(tc, err);
 }
 
 
@@ -469,7 +451,7 @@ static void tcpconn_destructor(void *arg)
 	hash_unlink(&tc->le);
 	tmr_cancel(&tc->tmr);
 	mem_deref(tc->conn);
-	mem_deref(tc->mb);
+	mem_deref(tc->framer);
 }
 
 
@@ -490,8 +472,9 @@ static int tcpconn_alloc(struct tcpconn **tcpp, struct dnsc *dnsc,
 	tc->srv = *srv;
 	tc->dnsc = dnsc;
 
-	tc->mb = mbuf_alloc(1500);
-	if (!tc->mb)
+	err = tcp_framer_alloc(&tc->framer, 2 + 65535, 0,
+			       tcp_frame_len_handler, tcp_frame_handler, tc);
+	if (err)
 		goto out;
 
 	err = tcp_connect(&tc->conn, srv, tcp_estab_handler,
@@ -10,9 +10,13 @@
 #include <re_hmac.h>
 
 
+/** SHA-1 Block size */
+enum { HMAC_BLOCK_SIZE = 64 };
+
+/* The inner and outer hash states are keyed once, in hmac_create() */
 struct hmac {
-	uint8_t key[SHA_DIGEST_LENGTH];
-	size_t key_len;
+	SHA_CTX ictx;  /**< Inner hash state, keyed with ipad */
+	SHA_CTX octx;  /**< Outer hash state, keyed with opad */
 };
 
 
@@ -24,9 +28,27 @@ static void destructor(void *arg)
 }
 
 
+static void pad_init(SHA_CTX *ctx, const uint8_t *key, size_t key_len,
+		     uint8_t pad)
+{
+	uint8_t buf[HMAC_BLOCK_SIZE];
+	size_t i;
+
+	for (i = 0; i < key_len; i++)
+		buf[i] = key[i] ^ pad;
+	memset(&buf[key_len], pad, sizeof(buf) - key_len);
+
+	SHA1_Init(ctx);
+	SHA1_Update(ctx, buf, sizeof(buf));
+
+	memset(buf, 0, sizeof(buf));
+}
+
+
 int hmac_create(struct hmac **hmacp, enum hmac_hash hash,
 		const uint8_t *key, size_t key_len)
 {
+	uint8_t kd[SHA_DIGEST_LENGTH];
 	struct hmac *hmac;
 
 	if (!hmacp || !key || !key_len)
@@ -35,15 +57,26 @@ int hmac_create(struct hmac **hmacp, enum hmac_hash hash,
 	if (hash != HMAC_HASH_SHA1)
 		return ENOTSUP;
 
-	if (key_len > SHA_DIGEST_LENGTH)
-		return EINVAL;
-
 	hmac = mem_zalloc(sizeof(*hmac), destructor);
 	if (!hmac)
 		return ENOMEM;
 
-	memcpy(hmac->key, key, key_len);
-	hmac->key_len = key_len;
+	/* keys longer than the block size are hashed first */
+	if (key_len > HMAC_BLOCK_SIZE) {
+		SHA_CTX ctx;
+
+		SHA1_Init(&ctx);
+		SHA1_Update(&ctx, key, key_len);
+		SHA1_Final(kd, &ctx);
+
+		key     = kd;
+		key_len = sizeof(kd);
+	}
+
+	pad_init(&hmac->ictx, key, key_len, 0x36);
+	pad_init(&hmac->octx, key, key_len, 0x5c);
+
+	memset(kd, 0, sizeof(kd));
 
 	*hmacp = hmac;
 
@@ -54,10 +87,21 @@ int hmac_create(struct hmac **hmacp, enum hmac_hash hash,
 int hmac_digest(struct hmac *hmac, uint8_t *md, size_t md_len,
 		const uint8_t *data, size_t data_len)
 {
+	uint8_t digest[SHA_DIGEST_LENGTH];
+	SHA_CTX ctx;
+
 	if (!hmac || !md || !md_len || !data || !data_len)
 		return EINVAL;
 
-	hmac_sha1(hmac->key, hmac->key_len, data, data_len, md, md_len);
+	ctx = hmac->ictx;
+	SHA1_Update(&ctx, data, data_len);
+	SHA1_Final(digest, &ctx);
+
+	ctx = hmac->octx;
+	SHA1_Update(&ctx, digest, sizeof(digest));
+	SHA1_Final(digest, &ctx);
+
+	memcpy(md, digest, md_len < sizeof(digest) ? md_len : sizeof(digest));
 
 	return 0;
 }
@@ -5,13 +5,7 @@
  */
 #include <string.h>
 #include <re_types.h>
-#ifdef USE_OPENSSL
-#include <openssl/sha.h>
-#include <openssl/hmac.h>
-#include <openssl/err.h>
-#else
 #include <re_sha.h>
-#endif
 #include <re_hmac.h>
 
 
@@ -38,12 +32,6 @@ void hmac_sha1(const uint8_t *k,  /* secret key */
 	       uint8_t *out,      /* output buffer, at least "t" bytes */
 	       size_t   t)
 {
-#ifdef USE_OPENSSL
-	(void)t;
-
-	if (!HMAC(EVP_sha1(), k, (int)lk, d, ld, out, NULL))
-		ERR_clear_error();
-#else
 	SHA_CTX ictx, octx;
 	uint8_t isha[SHA_DIGEST_LENGTH], osha[SHA_DIGEST_LENGTH];
 	uint8_t key[SHA_DIGEST_LENGTH];
@@ -95,5 +83,4 @@ void hmac_sha1(const uint8_t *k,  /* secret key */
 	/* truncate and print the results */
 	t = t > SHA_DIGEST_LENGTH ? SHA_DIGEST_LENGTH : t;
 	memcpy(out, osha, t);
-#endif
 }
@@ -4,15 +4,33 @@
  * Copyright (C) 2010 Creytiv.com
  */
 
-#include <openssl/hmac.h>
-#include <openssl/err.h>
+#include <string.h>
+#include <openssl/sha.h>
 #include <re_types.h>
 #include <re_mem.h>
 #include <re_hmac.h>
 
 
+/*
+ * The inner and outer hash states after the padded key blocks are
+ * computed once in hmac_create(). Each digest starts from a copy of
+ * these states, so the key is not processed again per message.
+ */
+
+
+/** HMAC block size in bytes, SHA-1 and SHA-256 */
+enum { HMAC_BLOCK_SIZE = 64 };
+
+/** Hash state, one per supported hash */
+union hash_ctx {
+	SHA_CTX sha1;       /**< SHA-1 state   */
+	SHA256_CTX sha256;  /**< SHA-256 state */
+};
+
 struct hmac {
-	HMAC_CTX ctx;
+	enum hmac_hash hash;
+	union hash_ctx ictx;  /**< Inner hash state, keyed with ipad */
+	union hash_ctx octx;  /**< Outer hash state, keyed with opad */
 };
 
 
@@ -20,89 +38,125 @@ static void destructor(void *arg)
 {
 	struct hmac *hmac = arg;
 
-	HMAC_CTX_cleanup(&hmac->ctx);
+	memset(hmac, 0, sizeof(*hmac));
+}
+
+
+static void hash_init(enum hmac_hash hash, union hash_ctx *ctx)
+{
+	if (hash == HMAC_HASH_SHA256)
+		SHA256_Init(&ctx->sha256);
+	else
+		SHA1_Init(&ctx->sha1);
+}
+
+
+static void hash_update(enum hmac_hash hash, union hash_ctx *ctx,
+			const uint8_t *data, size_t len)
+{
+	if (hash == HMAC_HASH_SHA256)
+		SHA256_Update(&ctx->sha256, data, len);
+	else
+		SHA1_Update(&ctx->sha1, data, len);
+}
+
+
+static void hash_final(enum hmac_hash hash, union hash_ctx *ctx,
+		       uint8_t *md)
+{
+	if (hash == HMAC_HASH_SHA256)
+		SHA256_Final(md, &ctx->sha256);
+	else
+		SHA1_Final(md, &ctx->sha1);
+}
+
+
+static size_t hash_size(enum hmac_hash hash)
+{
+	return hash == HMAC_HASH_SHA256 ? SHA256_DIGEST_LENGTH
+		: SHA_DIGEST_LENGTH;
+}
+
+
+static void pad_init(struct hmac *hmac, union hash_ctx *ctx,
+		     const uint8_t *key, size_t key_len, uint8_t pad)
+{
+	uint8_t buf[HMAC_BLOCK_SIZE];
+	size_t i;
+
+	for (i = 0; i < key_len; i++)
+		buf[i] = key[i] ^ pad;
+	memset(&buf[key_len], pad, sizeof(buf) - key_len);
+
+	hash_init(hmac->hash, ctx);
+	hash_update(hmac->hash, ctx, buf, sizeof(buf));
+
+	memset(buf, 0, sizeof(buf));
 }
 
 
 int hmac_create(struct hmac **hmacp, enum hmac_hash hash,
 		const uint8_t *key, size_t key_len)
 {
+	uint8_t kd[SHA256_DIGEST_LENGTH];
 	struct hmac *hmac;
-	const EVP_MD *evp;
-	int err = 0;
 
 	if (!hmacp || !key || !key_len)
 		return EINVAL;
 
-	switch (hash) {
-
-	case HMAC_HASH_SHA1:
-		evp = EVP_sha1();
-		break;
-
-	case HMAC_HASH_SHA256:
-		evp = EVP_sha256();
-		break;
-
-	default:
+	if (hash != HMAC_HASH_SHA1 && hash != HMAC_HASH_SHA256)
 		return ENOTSUP;
-	}
 
 	hmac = mem_zalloc(sizeof(*hmac), destructor);
 	if (!hmac)
 		return ENOMEM;
 
-	HMAC_CTX_init(&hmac->ctx);
+	hmac->hash = hash;
+
+	/* keys longer than the block size are hashed first */
+	if (key_len > HMAC_BLOCK_SIZE) {
+		union hash_ctx ctx;
 
-#if (OPENSSL_VERSION_NUMBER >= 0x00909000)
-	if (!HMAC_Init_ex(&hmac->ctx, key, (int)key_len, evp, NULL)) {
-		ERR_clear_error();
-		err = EPROTO;
+		hash_init(hash, &ctx);
+		hash_update(hash, &ctx, key, key_len);
+		hash_final(hash, &ctx, kd);
+
+		key     = kd;
+		key_len = hash_size(hash);
 	}
-#else
-	HMAC_Init_ex(&hmac->ctx, key, (int)key_len, evp, NULL);
-#endif
 
-	if (err)
-		mem_deref(hmac);
-	else
-		*hmacp = hmac;
+	pad_init(hmac, &hmac->ictx, key, key_len, 0x36);
+	pad_init(hmac, &hmac->octx, key, key_len, 0x5c);
+
+	memset(kd, 0, sizeof(kd));
 
-	return err;
+	*hmacp = hmac;
+
+	return 0;
 }
 
 
 int hmac_digest(struct hmac *hmac, uint8_t *md, size_t md_len,
 		const uint8_t *data, size_t data_len)
 {
-	unsigned int len = (unsigned int)md_len;
+	uint8_t digest[SHA256_DIGEST_LENGTH];
+	union hash_ctx ctx;
+	size_t len;
 
 	if (!hmac || !md || !md_len || !data || !data_len)
 		return EINVAL;
 
-#if (OPENSSL_VERSION_NUMBER >= 0x00909000)
-	/* the HMAC context must be reset here */
-	if (!HMAC_Init_ex(&hmac->ctx, 0, 0, 0, NULL))
-		goto error;
-
-	if (!HMAC_Update(&hmac->ctx, data, (int)data_len))
-		goto error;
-	if (!HMAC_Final(&hmac->ctx, md, &len))
-		goto error;
-
-	return 0;
+	len = hash_size(hmac->hash);
 
- error:
-	ERR_clear_error();
-	return EPROTO;
+	ctx = hmac->ictx;
+	hash_update(hmac->hash, &ctx, data, data_len);
+	hash_final(hmac->hash, &ctx, digest);
 
-#else
-	/* the HMAC context must be reset here */
-	HMAC_Init_ex(&hmac->ctx, 0, 0, 0, NULL);
+	ctx = hmac->octx;
+	hash_update(hmac->hash, &ctx, digest, len);
+	hash_final(hmac->hash, &ctx, digest);
 
-	HMAC_Update(&hmac->ctx, data, (int)data_len);
-	HMAC_Final(&hmac->ctx, md, &len);
+	memcpy(md, digest, md_len < len ? md_len : len);
 
 	return 0;
-#endif
 }
@@ -100,7 +100,7 @@ struct re {
 	bool update;                 /**< File descriptor set need updating */
 	bool polling;                /**< Is polling flag                   */
 	int sig;                     /**< Last caught signal                */
-	struct list tmrl;            /**< List of timers                    */
+	struct tmrl tmrl;            /**< List of timers                    */
 
 #ifdef HAVE_POLL
 	struct pollfd *fds;          /**< Event set for poll()              */
@@ -130,7 +130,7 @@ static struct re global_re = {
 	false,
 	false,
 	0,
-	LIST_INIT,
+	{{LIST_INIT}},
 #ifdef HAVE_POLL
 	NULL,
 #endif
@@ -1230,8 +1230,8 @@ void re_set_mutex(void *mutexp)
  *
  * @note only used by tmr module
  */
-struct list *tmrl_get(void);
-struct list *tmrl_get(void)
+struct tmrl *tmrl_get(void);
+struct tmrl *tmrl_get(void)
 {
 	return &re_get()->tmrl;
 }
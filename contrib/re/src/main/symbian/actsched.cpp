@@ -16,7 +16,7 @@ extern "C" {
 #define DEBUG_LEVEL 5
 #include <re_dbg.h>
 
-extern struct list *tmrl_get(void);
+extern struct tmrl *tmrl_get(void);
 }
 
 
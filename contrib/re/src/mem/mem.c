@@ -14,6 +14,7 @@
 #include <re_fmt.h>
 #include <re_mbuf.h>
 #include <re_mem.h>
+#include "mem.h"
 
 
 #define DEBUG_MODULE "mem"
@@ -29,6 +30,9 @@
 /** Defines a reference-counting memory object */
 struct mem {
 	uint32_t nrefs;     /**< Number of references  */
+#ifdef MEM_SLAB
+	int cls;            /**< Slab size class       */
+#endif
 	mem_destroy_h *dh;  /**< Destroy handler       */
 #if MEM_DEBUG
 	struct le le;       /**< Linked list element   */
@@ -46,7 +50,7 @@ static const uint32_t mem_magic = 0xe7fb9ac4;
 static ssize_t threshold = -1;  /**< Memory threshold, disabled by default */
 
 static struct memstat memstat = {
-	0,0,0,0,~0,0
+	0,0,0,0,~0,0,{{0,0,0,0}}
 };
 
 #ifdef HAVE_PTHREAD
@@ -117,6 +121,60 @@ static inline void mem_unlock(void)
 #endif
 
 
+static struct mem *block_alloc(size_t size)
+{
+#ifdef MEM_SLAB
+	struct mem *m;
+	int cls;
+
+	m = mem_slab_alloc(sizeof(*m) + size, &cls);
+	if (!m) {
+		m = malloc(sizeof(*m) + size);
+		cls = MEM_SLAB_NONE;
+	}
+
+	if (m)
+		m->cls = cls;
+
+	return m;
+#else
+	return malloc(sizeof(struct mem) + size);
+#endif
+}
+
+
+static struct mem *block_realloc(struct mem *m, size_t size)
+{
+#ifdef MEM_SLAB
+	const size_t total = sizeof(*m) + size;
+	struct mem *m2;
+	int cls;
+
+	if (m->cls == MEM_SLAB_NONE)
+		return realloc(m, total);
+
+	if (mem_slab_class(total) == m->cls)
+		return m;
+
+	m2 = block_alloc(size);
+	if (!m2)
+		return NULL;
+
+	/* keep the class block_alloc() chose, the header copy would
+	   overwrite it with the old one */
+	cls = m2->cls;
+	memcpy(m2, m, min(total, mem_slab_size(m->cls)));
+	m2->cls = cls;
+
+	mem_slab_free(m, m->cls);
+
+	return m2;
+#else
+	return realloc(m, sizeof(*m) + size);
+#endif
+}
+
+
 /**
  * Allocate a new reference-counted memory object
  *
@@ -138,7 +196,7 @@ void *mem_alloc_rl(size_t size, mem_destroy_h *dh, const char *f, int l)
 	mem_unlock();
 #endif
 
-	m = malloc(sizeof(*m) + size);
+	m = block_alloc(size);
 	if (!m)
 		return NULL;
 
@@ -218,7 +276,7 @@ void *mem_realloc_rl(void *data, size_t size, const char *f, int l)
 	mem_unlock();
 #endif
 
-	m2 = realloc(m, sizeof(*m2) + size);
+	m2 = block_realloc(m, size);
 
 #if MEM_DEBUG
 	mem_lock();
@@ -307,6 +365,9 @@ void *mem_ref(void *data)
 void *mem_deref(void *data)
 {
 	struct mem *m;
+#ifdef MEM_SLAB
+	int cls;
+#endif
 
 	if (!data)
 		return NULL;
@@ -331,8 +392,20 @@ void *mem_deref(void *data)
 	mem_unlock();
 #endif
 
+#ifdef MEM_SLAB
+	/* read before the debug statistics overwrite the header */
+	cls = m->cls;
+#endif
+
 	STAT_DEREF(m);
 
+#ifdef MEM_SLAB
+	if (cls != MEM_SLAB_NONE) {
+		mem_slab_free(m, cls);
+		return NULL;
+	}
+#endif
+
 	free(m);
 
 	return NULL;
@@ -483,6 +556,20 @@ int mem_status(struct re_printf *pf, void *unused)
 			  stat.size_min, stat.size_max);
 	err |= re_hprintf(pf, " Total %u blocks allocated\n", c);
 
+#ifdef MEM_SLAB
+	mem_slab_stat(&stat);
+
+	err |= re_hprintf(pf, " Slab classes:\n");
+	for (c = 0; c < MEM_SLAB_CLASSES; c++) {
+		const struct memstat_slab *st = &stat.slab[c];
+
+		err |= re_hprintf(pf, "  %5zu bytes: %zu in use, %zu free,"
+				  " %llu allocs\n",
+				  st->size, st->blocks_cur, st->blocks_free,
+				  (unsigned long long)st->allocs);
+	}
+#endif
+
 	return err;
 #else
 	(void)pf;
@@ -507,6 +594,13 @@ int mem_get_stat(struct memstat *mstat)
 	mem_lock();
 	memcpy(mstat, &memstat, sizeof(*mstat));
 	mem_unlock();
+#ifdef MEM_SLAB
+	mem_slab_stat(mstat);
+#endif
+	return 0;
+#elif defined (MEM_SLAB)
+	memset(mstat, 0, sizeof(*mstat));
+	mem_slab_stat(mstat);
 	return 0;
 #else
 	return ENOSYS;
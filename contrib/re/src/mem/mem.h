@@ -0,0 +1,17 @@
+/**
+ * @file mem.h  Internal interface to memory management
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+#ifdef MEM_SLAB
+/** Size class of memory objects not allocated from a slab */
+#define MEM_SLAB_NONE (-1)
+
+void  *mem_slab_alloc(size_t size, int *clsp);
+void   mem_slab_free(void *p, int cls);
+size_t mem_slab_size(int cls);
+int    mem_slab_class(size_t size);
+void   mem_slab_stat(struct memstat *mstat);
+#endif
@@ -5,3 +5,7 @@
 #
 
 SRCS	+= mem/mem.c
+
+ifneq ($(USE_MEM_SLAB),)
+SRCS	+= mem/slab.c
+endif
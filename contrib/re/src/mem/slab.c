@@ -0,0 +1,345 @@
+/**
+ * @file slab.c  Size-class slab allocator with per-thread caches
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <re_types.h>
+#include <re_list.h>
+#include <re_mem.h>
+#include "mem.h"
+
+
+/*
+ * Blocks have power-of-two sizes, one free list per size class.
+ * Each thread has a cache of free blocks, which is refilled from and
+ * drained to a shared depot in batches. The depot is refilled by
+ * carving chunks from malloc(); chunks are never returned.
+ */
+
+
+/** Slab values */
+enum {
+	SLAB_SHIFT_MIN = 5,                   /**< Smallest block, 32 bytes */
+	SLAB_CHUNK     = 65536,               /**< Bytes carved per refill  */
+	SLAB_CACHE_MAX = 128,                 /**< Cached blocks per class  */
+	SLAB_BATCH     = SLAB_CACHE_MAX / 2   /**< Blocks moved per refill  */
+};
+
+/** Defines a free block */
+struct slab_block {
+	struct slab_block *next;  /**< Next free block */
+};
+
+/** Defines a free list */
+struct slab_list {
+	struct slab_block *head;  /**< First free block      */
+	uint32_t count;           /**< Number of free blocks */
+};
+
+/** Defines a per-thread cache */
+struct slab_cache {
+	struct le le;                                /**< Depot cache list */
+	struct slab_list freev[MEM_SLAB_CLASSES];    /**< Free blocks      */
+	uint64_t allocs[MEM_SLAB_CLASSES];           /**< Allocations      */
+	int64_t inuse[MEM_SLAB_CLASSES];             /**< Blocks in use    */
+};
+
+/** Defines the shared depot */
+struct slab_depot {
+	struct slab_list freev[MEM_SLAB_CLASSES];    /**< Free blocks      */
+	uint64_t allocs[MEM_SLAB_CLASSES];           /**< From old caches  */
+	int64_t inuse[MEM_SLAB_CLASSES];             /**< From old caches  */
+	struct list cachel;                          /**< Thread caches    */
+};
+
+static struct slab_depot depot;
+
+
+#ifdef HAVE_PTHREAD
+
+static pthread_mutex_t depot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t  cache_once  = PTHREAD_ONCE_INIT;
+static pthread_key_t   cache_key;
+
+static inline void depot_lock(void)
+{
+	pthread_mutex_lock(&depot_mutex);
+}
+
+
+static inline void depot_unlock(void)
+{
+	pthread_mutex_unlock(&depot_mutex);
+}
+
+#else
+
+#define depot_lock()    /**< Stub */
+#define depot_unlock()  /**< Stub */
+
+static struct slab_cache *cache_single;
+
+#endif
+
+
+static void slab_list_move(struct slab_list *dst, struct slab_list *src,
+		      uint32_t n)
+{
+	while (n-- && src->head) {
+		struct slab_block *b = src->head;
+
+		src->head = b->next;
+		--src->count;
+
+		b->next = dst->head;
+		dst->head = b;
+		++dst->count;
+	}
+}
+
+
+#ifdef HAVE_PTHREAD
+static void cache_destructor(void *arg)
+{
+	struct slab_cache *c = arg;
+	int i;
+
+	depot_lock();
+
+	for (i = 0; i < MEM_SLAB_CLASSES; i++) {
+
+		slab_list_move(&depot.freev[i], &c->freev[i],
+			       c->freev[i].count);
+
+		depot.allocs[i] += c->allocs[i];
+		depot.inuse[i]  += c->inuse[i];
+	}
+
+	list_unlink(&c->le);
+
+	depot_unlock();
+
+	free(c);
+}
+
+
+static void cache_init(void)
+{
+	pthread_key_create(&cache_key, cache_destructor);
+}
+#endif
+
+
+static struct slab_cache *cache_get(void)
+{
+	struct slab_cache *c;
+
+#ifdef HAVE_PTHREAD
+	pthread_once(&cache_once, cache_init);
+
+	c = pthread_getspecific(cache_key);
+#else
+	c = cache_single;
+#endif
+	if (c)
+		return c;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return NULL;
+
+	depot_lock();
+	list_append(&depot.cachel, &c->le, c);
+	depot_unlock();
+
+#ifdef HAVE_PTHREAD
+	pthread_setspecific(cache_key, c);
+#else
+	cache_single = c;
+#endif
+
+	return c;
+}
+
+
+static int cache_refill(struct slab_cache *c, int cls)
+{
+	struct slab_list *fl = &c->freev[cls];
+	const size_t bsize = mem_slab_size(cls);
+	uint8_t *chunk;
+	size_t off;
+
+	depot_lock();
+	slab_list_move(fl, &depot.freev[cls], SLAB_BATCH);
+	depot_unlock();
+
+	if (fl->head)
+		return 0;
+
+	chunk = malloc(SLAB_CHUNK);
+	if (!chunk)
+		return ENOMEM;
+
+	for (off = 0; off + bsize <= SLAB_CHUNK; off += bsize) {
+		struct slab_block *b = (void *)(chunk + off);
+
+		b->next = fl->head;
+		fl->head = b;
+		++fl->count;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Get the size class for a block size
+ *
+ * @param size Block size in bytes
+ *
+ * @return Size class, or MEM_SLAB_NONE if too large for the slabs
+ */
+int mem_slab_class(size_t size)
+{
+	int cls = 0;
+
+	while (cls < MEM_SLAB_CLASSES && size > mem_slab_size(cls))
+		++cls;
+
+	return cls < MEM_SLAB_CLASSES ? cls : MEM_SLAB_NONE;
+}
+
+
+/**
+ * Get the block size of a size class
+ *
+ * @param cls Size class
+ *
+ * @return Block size in bytes
+ */
+size_t mem_slab_size(int cls)
+{
+	return (size_t)1 << (SLAB_SHIFT_MIN + cls);
+}
+
+
+/**
+ * Allocate a block from the slab of the current thread
+ *
+ * @param size Block size in bytes
+ * @param clsp Returned size class
+ *
+ * @return Pointer to block, or NULL if too large or out of memory
+ */
+void *mem_slab_alloc(size_t size, int *clsp)
+{
+	struct slab_cache *c;
+	struct slab_list *fl;
+	struct slab_block *b;
+	const int cls = mem_slab_class(size);
+
+	if (cls == MEM_SLAB_NONE)
+		return NULL;
+
+	c = cache_get();
+	if (!c)
+		return NULL;
+
+	fl = &c->freev[cls];
+
+	if (!fl->head && cache_refill(c, cls))
+		return NULL;
+
+	b = fl->head;
+	fl->head = b->next;
+	--fl->count;
+
+	++c->allocs[cls];
+	++c->inuse[cls];
+
+	*clsp = cls;
+
+	return b;
+}
+
+
+/**
+ * Return a block to the slab of the current thread
+ *
+ * @param p   Block to free
+ * @param cls Size class of block
+ */
+void mem_slab_free(void *p, int cls)
+{
+	struct slab_cache *c;
+	struct slab_list *fl;
+	struct slab_block *b = p;
+
+	c = cache_get();
+	if (!c) {
+		/* no cache for this thread, give it to the depot */
+		depot_lock();
+		b->next = depot.freev[cls].head;
+		depot.freev[cls].head = b;
+		++depot.freev[cls].count;
+		--depot.inuse[cls];
+		depot_unlock();
+		return;
+	}
+
+	fl = &c->freev[cls];
+
+	b->next = fl->head;
+	fl->head = b;
+	++fl->count;
+
+	--c->inuse[cls];
+
+	if (fl->count > SLAB_CACHE_MAX) {
+		depot_lock();
+		slab_list_move(&depot.freev[cls], fl, SLAB_BATCH);
+		depot_unlock();
+	}
+}
+
+
+/**
+ * Get the slab statistics. Counters of other threads are read
+ * without synchronisation, so they are only approximate.
+ *
+ * @param mstat Memory statistics to fill in
+ */
+void mem_slab_stat(struct memstat *mstat)
+{
+	struct le *le;
+	int i;
+
+	depot_lock();
+
+	for (i = 0; i < MEM_SLAB_CLASSES; i++) {
+
+		struct memstat_slab *st = &mstat->slab[i];
+		int64_t inuse = depot.inuse[i];
+
+		st->size        = mem_slab_size(i);
+		st->allocs      = depot.allocs[i];
+		st->blocks_free = depot.freev[i].count;
+
+		for (le = depot.cachel.head; le; le = le->next) {
+			const struct slab_cache *c = le->data;
+
+			st->allocs      += c->allocs[i];
+			st->blocks_free += c->freev[i].count;
+			inuse           += c->inuse[i];
+		}
+
+		st->blocks_cur = inuse > 0 ? (size_t)inuse : 0;
+	}
+
+	depot_unlock();
+}
@@ -4,11 +4,17 @@
  * Copyright (C) 2010 Creytiv.com
  */
 #include <unistd.h>
+#ifdef HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
 #include <re_types.h>
 #include <re_fmt.h>
 #include <re_mem.h>
 #include <re_main.h>
+#include <re_sa.h>
+#include <re_net.h>
 #include <re_mqueue.h>
+#include <re_atomic.h>
 #include "mqueue.h"
 
 
@@ -22,6 +28,31 @@
 #endif
 
 
+enum {
+	MQUEUE_SIZE = 1024,  /**< Ring slots, power of 2 */
+};
+
+
+/*
+ * Messages are passed in a bounded multi-producer/single-consumer ring
+ * (Vyukov). Each slot has a sequence number telling whether it is free
+ * for the producer at that position or holds a message for the
+ * consumer. Producers claim a position with a CAS on the tail and
+ * publish the slot by storing its sequence number.
+ *
+ * The doorbell (eventfd, or a pipe) is only written when the number of
+ * pending messages goes from zero to one. The consumer drains all
+ * published messages per wakeup, so a burst of N pushes costs one
+ * write and one read instead of N of each.
+ */
+
+
+struct msg {
+	uint32_t seq;
+	int id;
+	void *data;
+};
+
 /**
  * Defines a Thread-safe Message Queue
  *
@@ -30,17 +61,16 @@
  * incoming messages from other threads. The sender thread can be any thread.
  */
 struct mqueue {
-	int pfd[2];
+	struct msg ring[MQUEUE_SIZE];
+	uint32_t tail;       /**< Next position to claim, producers */
+	uint32_t head;       /**< Next position to read, consumer   */
+	int32_t pending;     /**< Published but not handled         */
+	uint32_t magic;
+	int pfd[2];          /**< Doorbell, pfd[1] is -1 for eventfd */
 	mqueue_h *h;
 	void *arg;
 };
 
-struct msg {
-	int id;
-	void *data;
-	uint32_t magic;
-};
-
 
 static void destructor(void *arg)
 {
@@ -55,32 +85,120 @@ static void destructor(void *arg)
 }
 
 
+static int doorbell_alloc(struct mqueue *mq)
+{
+	int err;
+
+#ifdef HAVE_EVENTFD
+	mq->pfd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (mq->pfd[0] >= 0)
+		return 0;
+#endif
+
+	if (pipe(mq->pfd) < 0)
+		return errno;
+
+	err = net_sockopt_blocking_set(mq->pfd[0], false);
+	if (err)
+		return err;
+
+	return 0;
+}
+
+
+static void doorbell_ring(struct mqueue *mq)
+{
+#ifdef HAVE_EVENTFD
+	if (mq->pfd[1] < 0) {
+		const uint64_t one = 1;
+
+		(void)write(mq->pfd[0], &one, sizeof(one));
+		return;
+	}
+#endif
+
+	(void)pipe_write(mq->pfd[1], "", 1);
+}
+
+
+static void doorbell_clear(struct mqueue *mq)
+{
+	uint8_t buf[16];
+
+	/* an eventfd read returns 8 bytes and resets the counter */
+	while (pipe_read(mq->pfd[0], buf, sizeof(buf)) == sizeof(buf))
+		;
+}
+
+
+/* Consumer: take the message at the head, if it has been published */
+static bool ring_pop(struct mqueue *mq, int *id, void **data)
+{
+	struct msg *msg = &mq->ring[mq->head & (MQUEUE_SIZE - 1)];
+	const uint32_t seq = re_atomic_load_acquire(&msg->seq);
+
+	if ((int32_t)(seq - (mq->head + 1)) < 0)
+		return false;
+
+	*id   = msg->id;
+	*data = msg->data;
+
+	/* hand the slot back to producers, one lap ahead */
+	re_atomic_store_release(&msg->seq, mq->head + MQUEUE_SIZE);
+	++mq->head;
+
+	return true;
+}
+
+
 static void event_handler(int flags, void *arg)
 {
 	struct mqueue *mq = arg;
-	struct msg msg;
-	ssize_t n;
 
 	if (!(flags & FD_READ))
 		return;
 
-	n = pipe_read(mq->pfd[0], &msg, sizeof(msg));
-	if (n < 0)
-		return;
+	doorbell_clear(mq);
 
-	if (n != sizeof(msg)) {
-		(void)re_fprintf(stderr, "mqueue: short read of %d bytes\n",
-				 n);
+	if (mq->magic != MAGIC) {
+		(void)re_fprintf(stderr, "mqueue: bad magic (%08x)\n",
+				 mq->magic);
 		return;
 	}
 
-	if (msg.magic != MAGIC) {
-		(void)re_fprintf(stderr, "mqueue: bad magic on read (%08x)\n",
-				 msg.magic);
-		return;
+	/* a handler may release the queue */
+	mem_ref(mq);
+
+	for (;;) {
+		int32_t n = 0, left;
+		void *data;
+		int id;
+
+		while (mem_nrefs(mq) > 1 && ring_pop(mq, &id, &data)) {
+			mq->h(id, data, mq->arg);
+			++n;
+		}
+
+		if (mem_nrefs(mq) == 1)
+			break;
+
+		/* left < 0: some producers have yet to count their
+		 * messages, which were already handled here
+		 */
+		left = re_atomic_add_fetch(&mq->pending, -n);
+		if (left <= 0)
+			break;
+
+		/* the head slot is claimed but not yet published,
+		 * come back on the next poll rather than spinning
+		 */
+		if (!n) {
+			doorbell_ring(mq);
+			break;
+		}
 	}
 
-	mq->h(msg.id, msg.data, mq->arg);
+	mem_deref(mq);
 }
 
 
@@ -96,6 +214,7 @@ static void event_handler(int flags, void *arg)
 int mqueue_alloc(struct mqueue **mqp, mqueue_h *h, void *arg)
 {
 	struct mqueue *mq;
+	uint32_t i;
 	int err = 0;
 
 	if (!mqp || !h)
@@ -105,14 +224,17 @@ int mqueue_alloc(struct mqueue **mqp, mqueue_h *h, void *arg)
 	if (!mq)
 		return ENOMEM;
 
-	mq->h   = h;
-	mq->arg = arg;
+	mq->h     = h;
+	mq->arg   = arg;
+	mq->magic = MAGIC;
+
+	for (i=0; i<MQUEUE_SIZE; i++)
+		mq->ring[i].seq = i;
 
 	mq->pfd[0] = mq->pfd[1] = -1;
-	if (pipe(mq->pfd) < 0) {
-		err = errno;
+	err = doorbell_alloc(mq);
+	if (err)
 		goto out;
-	}
 
 	err = fd_listen(mq->pfd[0], FD_READ, event_handler, mq);
 	if (err)
@@ -131,27 +253,52 @@ int mqueue_alloc(struct mqueue **mqp, mqueue_h *h, void *arg)
 /**
  * Push a new message onto the Message Queue
  *
+ * The queue holds up to 1024 messages and a push never blocks. When the
+ * queue is full the push fails with ENOBUFS, and the caller still owns
+ * the data.
+ *
  * @param mq   Message Queue
  * @param id   General purpose Identifier
  * @param data Application data
  *
- * @return 0 if success, otherwise errorcode
+ * @return 0 if success, ENOBUFS if the queue is full, otherwise errorcode
  */
 int mqueue_push(struct mqueue *mq, int id, void *data)
 {
-	struct msg msg;
-	ssize_t n;
+	uint32_t pos;
+	struct msg *msg;
 
 	if (!mq)
 		return EINVAL;
 
-	msg.id    = id;
-	msg.data  = data;
-	msg.magic = MAGIC;
+	pos = re_atomic_load_relaxed(&mq->tail);
+
+	for (;;) {
+		uint32_t seq;
+		int32_t dif;
+
+		msg = &mq->ring[pos & (MQUEUE_SIZE - 1)];
+		seq = re_atomic_load_acquire(&msg->seq);
+		dif = (int32_t)(seq - pos);
+
+		if (dif == 0) {
+			if (re_atomic_cas_weak(&mq->tail, &pos, pos + 1))
+				break;
+		}
+		else if (dif < 0) {
+			return ENOBUFS;
+		}
+		else {
+			pos = re_atomic_load_relaxed(&mq->tail);
+		}
+	}
 
-	n = pipe_write(mq->pfd[1], &msg, sizeof(msg));
-	if (n < 0)
-		return errno;
+	msg->id   = id;
+	msg->data = data;
+	re_atomic_store_release(&msg->seq, pos + 1);
+
+	if (re_atomic_add_fetch(&mq->pending, 1) == 1)
+		doorbell_ring(mq);
 
-	return (n != sizeof(msg)) ? EPIPE : 0;
+	return 0;
 }
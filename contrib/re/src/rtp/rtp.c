@@ -138,6 +138,115 @@ int rtp_hdr_decode(struct rtp_header *hdr, struct mbuf *mb)
 }
 
 
+static inline uint16_t get_u16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+
+static inline uint32_t get_u32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+		(uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+
+/**
+ * Decode the metadata of an RTP or RTCP packet, without moving the
+ * buffer position
+ *
+ * @param meta Packet metadata to decode into
+ * @param mb   Buffer with the packet at the current position
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtp_meta_decode(struct rtp_meta *meta, const struct mbuf *mb)
+{
+	struct rtp_header *hdr;
+	const uint8_t *p;
+	size_t len, hlen;
+	int i;
+
+	if (!meta || !mb)
+		return EINVAL;
+
+	p   = mbuf_buf(mb);
+	len = mbuf_get_left(mb);
+
+	/* RTCP common header and sender SSRC */
+	if (len < 8)
+		return EBADMSG;
+
+	hdr = &meta->hdr;
+
+	hdr->ver = (p[0] >> 6) & 0x03;
+	hdr->pad = (p[0] >> 5) & 0x01;
+
+	meta->start   = mb->pos;
+	meta->ext_off = 0;
+
+	/* RFC 5761 Section 4, RTCP types 192-223 */
+	if (64 <= (p[1] & 0x7f) && (p[1] & 0x7f) <= 95) {
+
+		meta->rtcp    = true;
+		meta->hdr_len = 8;
+
+		hdr->ext  = false;
+		hdr->cc   = 0;
+		hdr->m    = false;
+		hdr->pt   = p[1];
+		hdr->seq  = 0;
+		hdr->ts   = 0;
+		hdr->ssrc = get_u32(&p[4]);
+		hdr->x.type = hdr->x.len = 0;
+
+		return 0;
+	}
+
+	if (len < RTP_HEADER_SIZE)
+		return EBADMSG;
+
+	meta->rtcp = false;
+
+	hdr->ext  = (p[0] >> 4) & 0x01;
+	hdr->cc   = (p[0] >> 0) & 0x0f;
+	hdr->m    = (p[1] >> 7) & 0x01;
+	hdr->pt   = (p[1] >> 0) & 0x7f;
+	hdr->seq  = get_u16(&p[2]);
+	hdr->ts   = get_u32(&p[4]);
+	hdr->ssrc = get_u32(&p[8]);
+
+	hlen = RTP_HEADER_SIZE + hdr->cc * sizeof(uint32_t);
+	if (len < hlen)
+		return EBADMSG;
+
+	for (i=0; i<hdr->cc; i++)
+		hdr->csrc[i] = get_u32(&p[RTP_HEADER_SIZE + i*4]);
+
+	if (hdr->ext) {
+		if (len < hlen + 4)
+			return EBADMSG;
+
+		hdr->x.type = get_u16(&p[hlen]);
+		hdr->x.len  = get_u16(&p[hlen + 2]);
+
+		hlen += 4;
+		meta->ext_off = hlen;
+
+		hlen += hdr->x.len * sizeof(uint32_t);
+		if (len < hlen)
+			return EBADMSG;
+	}
+	else {
+		hdr->x.type = hdr->x.len = 0;
+	}
+
+	meta->hdr_len = hlen;
+
+	return 0;
+}
+
+
 static void destructor(void *data)
 {
 	struct rtp_sock *rs = data;
@@ -90,6 +90,12 @@ A million repetitions of "a"
 #include <re_types.h>
 #include <re_sha.h>
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_SHA_NI 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
 void SHA1_Transform(uint32_t state[5], const uint8_t buffer[64]);
 
 #define rol(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
@@ -186,6 +192,125 @@ void SHA1_Transform(uint32_t state[5], const uint8_t buffer[64])
 }
 
 
+#ifdef HAVE_SHA_NI
+
+
+/*
+ * SHA-1 using the x86 SHA extensions, selected at runtime.
+ * Each step does 4 of the 80 rounds and expands the message schedule
+ * for the following steps.
+ */
+#define NI_ROUNDS(ex, ey, m0, m1, m2, m3, f)		\
+	ex   = _mm_sha1nexte_epu32(ex, m0);		\
+	ey   = abcd;					\
+	m1   = _mm_sha1msg2_epu32(m1, m0);		\
+	abcd = _mm_sha1rnds4_epu32(abcd, ex, f);	\
+	m3   = _mm_sha1msg1_epu32(m3, m0);		\
+	m2   = _mm_xor_si128(m2, m0);
+
+
+static int sha_ni = -1;  /**< SHA extensions present, -1 if unknown */
+
+
+static bool cpu_has_sha_ni(void)
+{
+	unsigned a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSE4_1))
+		return false;
+
+	if (__get_cpuid_max(0, NULL) < 7)
+		return false;
+
+	__cpuid_count(7, 0, a, b, c, d);
+
+	return (b & (1u << 29)) != 0;
+}
+
+
+__attribute__((target("sha,sse4.1")))
+static void transform_ni(uint32_t state[5], const uint8_t buffer[64])
+{
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL,
+					    0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e0, e0_save, e1;
+	__m128i m0, m1, m2, m3;
+
+	abcd = _mm_loadu_si128((const __m128i *)(const void *)state);
+	abcd = _mm_shuffle_epi32(abcd, 0x1b);
+	e0   = _mm_set_epi32((int)state[4], 0, 0, 0);
+
+	abcd_save = abcd;
+	e0_save   = e0;
+
+	m0 = _mm_loadu_si128((const __m128i *)(const void *)buffer);
+	m1 = _mm_loadu_si128((const __m128i *)(const void *)(buffer + 16));
+	m2 = _mm_loadu_si128((const __m128i *)(const void *)(buffer + 32));
+	m3 = _mm_loadu_si128((const __m128i *)(const void *)(buffer + 48));
+	m0 = _mm_shuffle_epi8(m0, mask);
+	m1 = _mm_shuffle_epi8(m1, mask);
+	m2 = _mm_shuffle_epi8(m2, mask);
+	m3 = _mm_shuffle_epi8(m3, mask);
+
+	/* rounds 0-15, the schedule is not complete yet */
+	e0   = _mm_add_epi32(e0, m0);
+	e1   = abcd;
+	abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+	e1   = _mm_sha1nexte_epu32(e1, m1);
+	e0   = abcd;
+	abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+	m0   = _mm_sha1msg1_epu32(m0, m1);
+
+	e0   = _mm_sha1nexte_epu32(e0, m2);
+	e1   = abcd;
+	abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+	m1   = _mm_sha1msg1_epu32(m1, m2);
+	m0   = _mm_xor_si128(m0, m2);
+
+	NI_ROUNDS(e1, e0, m3, m0, m1, m2, 0);
+
+	/* rounds 16-79 */
+	NI_ROUNDS(e0, e1, m0, m1, m2, m3, 0);
+	NI_ROUNDS(e1, e0, m1, m2, m3, m0, 1);
+	NI_ROUNDS(e0, e1, m2, m3, m0, m1, 1);
+	NI_ROUNDS(e1, e0, m3, m0, m1, m2, 1);
+	NI_ROUNDS(e0, e1, m0, m1, m2, m3, 1);
+	NI_ROUNDS(e1, e0, m1, m2, m3, m0, 1);
+	NI_ROUNDS(e0, e1, m2, m3, m0, m1, 2);
+	NI_ROUNDS(e1, e0, m3, m0, m1, m2, 2);
+	NI_ROUNDS(e0, e1, m0, m1, m2, m3, 2);
+	NI_ROUNDS(e1, e0, m1, m2, m3, m0, 2);
+	NI_ROUNDS(e0, e1, m2, m3, m0, m1, 2);
+	NI_ROUNDS(e1, e0, m3, m0, m1, m2, 3);
+	NI_ROUNDS(e0, e1, m0, m1, m2, m3, 3);
+	NI_ROUNDS(e1, e0, m1, m2, m3, m0, 3);
+	NI_ROUNDS(e0, e1, m2, m3, m0, m1, 3);
+	NI_ROUNDS(e1, e0, m3, m0, m1, m2, 3);
+
+	e0   = _mm_sha1nexte_epu32(e0, e0_save);
+	abcd = _mm_add_epi32(abcd, abcd_save);
+
+	abcd = _mm_shuffle_epi32(abcd, 0x1b);
+	_mm_storeu_si128((__m128i *)(void *)state, abcd);
+	state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+
+static inline void transform(uint32_t state[5], const uint8_t buffer[64])
+{
+	if (sha_ni > 0)
+		transform_ni(state, buffer);
+	else
+		SHA1_Transform(state, buffer);
+}
+
+
+#else
+#define transform SHA1_Transform
+#endif
+
+
 /**
  * Initialize new context
  *
@@ -200,6 +325,11 @@ void SHA1_Init(SHA1_CTX* context)
 	context->state[3] = 0x10325476;
 	context->state[4] = 0xc3d2e1f0;
 	context->count[0] = context->count[1] = 0;
+
+#ifdef HAVE_SHA_NI
+	if (sha_ni < 0)
+		sha_ni = cpu_has_sha_ni();
+#endif
 }
 
 
@@ -221,9 +351,9 @@ void SHA1_Update(SHA1_CTX* context, const void *p, size_t len)
 	context->count[1] += (uint32_t)(len >> 29);
 	if ((j + len) > 63) {
 		memcpy(&context->buffer[j], data, (i = 64-j));
-		SHA1_Transform(context->state, context->buffer);
+		transform(context->state, context->buffer);
 		for ( ; i + 63 < len; i += 64) {
-			SHA1_Transform(context->state, data + i);
+			transform(context->state, data + i);
 		}
 		j = 0;
 	}
@@ -3,25 +3,97 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <re_types.h>
+#include <re_mem.h>
 #include <re_mbuf.h>
 #include <re_list.h>
+#include <re_aes.h>
 #include <re_srtp.h>
 #include "srtp.h"
 
 
+/*
+ * The window is a ring of 64-bit words, indexed by the packet index
+ * (RFC 6479). Moving the window forward only clears the words that
+ * are passed, so there is no bit shifting of the whole bitmap. With
+ * N words the window covers (N-1)*64 packets, one word is always
+ * being filled.
+ */
+
+
 enum {
-	SRTP_WINDOW_SIZE = 64
+	SRTP_WINDOW_SIZE = 64,     /**< Default window size in packets */
+	REPLAY_WORD_BITS = 64,
+	REPLAY_WORDS_MAX = 1024,   /**< Largest ring, 65472 packets    */
 };
 
 
-void srtp_replay_init(struct replay *replay)
+static uint32_t ring_words(uint32_t window)
+{
+	uint32_t words = 2;
+
+	while ((words - 1) * REPLAY_WORD_BITS < window)
+		words <<= 1;
+
+	return words;
+}
+
+
+/**
+ * Initialize replay protection
+ *
+ * @param replay Replay protection state
+ * @param window Window size in packets, 0 for the default
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int srtp_replay_init(struct replay *replay, uint32_t window)
+{
+	uint32_t words;
+
+	if (!replay)
+		return EINVAL;
+
+	if (!window)
+		window = SRTP_WINDOW_SIZE;
+
+	words = ring_words(window);
+	if (words > REPLAY_WORDS_MAX)
+		return EINVAL;
+
+	memset(replay, 0, sizeof(*replay));
+
+	if (words <= ARRAY_SIZE(replay->ring)) {
+		replay->bitmap = replay->ring;
+	}
+	else {
+		replay->bitmap = mem_zalloc(words * sizeof(uint64_t), NULL);
+		if (!replay->bitmap)
+			return ENOMEM;
+	}
+
+	replay->words  = words;
+	replay->window = (words - 1) * REPLAY_WORD_BITS;
+
+	return 0;
+}
+
+
+/**
+ * Release replay protection state
+ *
+ * @param replay Replay protection state
+ */
+void srtp_replay_close(struct replay *replay)
 {
 	if (!replay)
 		return;
 
-	replay->bitmap = 0;
-	replay->lix    = 0;
+	if (replay->bitmap != replay->ring)
+		mem_deref(replay->bitmap);
+
+	replay->bitmap = NULL;
 }
 
 
@@ -30,34 +102,42 @@ void srtp_replay_init(struct replay *replay)
  */
 bool srtp_replay_check(struct replay *replay, uint64_t ix)
 {
-	uint64_t diff;
+	uint32_t mask, w;
+	uint64_t bit;
 
-	if (!replay)
+	if (!replay || !replay->bitmap)
 		return false;
 
+	mask = replay->words - 1;
+
 	if (ix > replay->lix) {
-		diff = ix - replay->lix;
+		uint64_t cur = replay->lix / REPLAY_WORD_BITS;
+		uint64_t n = ix / REPLAY_WORD_BITS - cur;
+
+		if (n > replay->words)
+			n = replay->words;
 
-		if (diff < SRTP_WINDOW_SIZE) {   /* In window */
-			replay->bitmap <<= diff;
-			replay->bitmap |= 1;     /* set bit for this packet */
-		}
-		else
-			replay->bitmap = 1;
+		/* clear the words the window moves into */
+		while (n--)
+			replay->bitmap[++cur & mask] = 0;
 
 		replay->lix = ix;
-		return true;
 	}
-
-	diff = replay->lix - ix;
-	if (diff >= SRTP_WINDOW_SIZE)
+	else if (replay->lix - ix >= replay->window) {
+		++replay->n_old;
 		return false;
+	}
 
-	if (replay->bitmap & (1ULL << diff))
-		return false; /* already seen */
+	w   = (uint32_t)(ix / REPLAY_WORD_BITS) & mask;
+	bit = 1ULL << (ix % REPLAY_WORD_BITS);
+
+	if (replay->bitmap[w] & bit) {
+		++replay->n_replay;
+		return false;  /* already seen */
+	}
 
 	/* mark as seen */
-	replay->bitmap |= (1ULL << diff);
+	replay->bitmap[w] |= bit;
 
 	return true;
 }
@@ -28,6 +28,97 @@ static int get_rtcp_ssrc(uint32_t *ssrc, struct mbuf *mb)
 }
 
 
+/*
+ * RFC 7714 Section 9: the RTCP header and SSRC, followed by the E-bit
+ * and SRTCP-index, are Associated Data. The trailer is the
+ * authentication tag followed by the E-bit and SRTCP-index.
+ */
+static int encrypt_gcm(struct comp *rtcp, struct srtp_stream *strm,
+		       uint32_t ssrc, struct mbuf *mb, size_t start)
+{
+	const uint32_t eix = htonl(1u<<31 | strm->rtcp_index);
+	uint8_t tag[SRTP_GCM_TAG_SIZE];
+	uint8_t *p = mbuf_buf(mb);
+	union vect128 iv;
+	int err;
+
+	srtp_iv_calc_gcm(&iv, &rtcp->k_s, ssrc, strm->rtcp_index);
+
+	aes_set_iv(rtcp->aes, iv.u8);
+
+	err  = aes_encr(rtcp->aes, NULL, &mb->buf[start], mb->pos - start);
+	err |= aes_encr(rtcp->aes, NULL, (const uint8_t *)&eix, 4);
+	err |= aes_encr(rtcp->aes, p, p, mbuf_get_left(mb));
+	err |= aes_get_authtag(rtcp->aes, tag, rtcp->tag_len);
+	if (err)
+		return err;
+
+	mb->pos = mb->end;
+
+	err  = mbuf_write_mem(mb, tag, rtcp->tag_len);
+	err |= mbuf_write_u32(mb, eix);
+
+	return err;
+}
+
+
+static int decrypt_gcm(struct comp *rtcp, struct srtp_stream *strm,
+		       uint32_t ssrc, struct mbuf *mb, size_t start)
+{
+	const size_t pld_start = mb->pos;
+	size_t eix_start, tag_start;
+	union vect128 iv;
+	uint32_t v, ix;
+	bool ep;
+	int err;
+
+	if (mbuf_get_left(mb) < (4 + rtcp->tag_len))
+		return EBADMSG;
+
+	eix_start = mb->end - 4;
+	tag_start = eix_start - rtcp->tag_len;
+
+	mb->pos = eix_start;
+	v = ntohl(mbuf_read_u32(mb));
+
+	ep = (v >> 31) & 1;
+	ix = v & 0x7fffffff;
+
+	srtp_iv_calc_gcm(&iv, &rtcp->k_s, ssrc, ix);
+
+	aes_set_iv(rtcp->aes, iv.u8);
+
+	if (ep) {
+		uint8_t *p = &mb->buf[pld_start];
+
+		err  = aes_decr(rtcp->aes, NULL, &mb->buf[start],
+				pld_start - start);
+		err |= aes_decr(rtcp->aes, NULL, &mb->buf[eix_start], 4);
+		err |= aes_decr(rtcp->aes, p, p, tag_start - pld_start);
+	}
+	else {
+		err  = aes_decr(rtcp->aes, NULL, &mb->buf[start],
+				tag_start - start);
+		err |= aes_decr(rtcp->aes, NULL, &mb->buf[eix_start], 4);
+	}
+	if (err)
+		return err;
+
+	err = aes_authenticate(rtcp->aes, &mb->buf[tag_start],
+			       rtcp->tag_len);
+	if (err)
+		return err;
+
+	if (!srtp_replay_check(&strm->replay_rtcp, ix))
+		return EALREADY;
+
+	mb->pos = start;
+	mb->end = tag_start;
+
+	return 0;
+}
+
+
 int srtcp_encrypt(struct srtp *srtp, struct mbuf *mb)
 {
 	struct srtp_stream *strm;
@@ -53,6 +144,17 @@ int srtcp_encrypt(struct srtp *srtp, struct mbuf *mb)
 
 	strm->rtcp_index = (strm->rtcp_index+1) & 0x7fffffff;
 
+	if (rtcp->mode == AES_MODE_GCM) {
+
+		err = encrypt_gcm(rtcp, strm, ssrc, mb, start);
+		if (err)
+			return err;
+
+		mb->pos = start;
+
+		return 0;
+	}
+
 	if (rtcp->aes) {
 		union vect128 iv;
 		uint8_t *p = mbuf_buf(mb);
@@ -120,6 +222,9 @@ int srtcp_decrypt(struct srtp *srtp, struct mbuf *mb)
 	if (err)
 		return err;
 
+	if (rtcp->mode == AES_MODE_GCM)
+		return decrypt_gcm(rtcp, strm, ssrc, mb, start);
+
 	pld_start = mb->pos;
 
 	if (mbuf_get_left(mb) < (4 + rtcp->tag_len))
@@ -33,7 +33,7 @@ static inline int seq_diff(uint16_t x, uint16_t y)
 static int comp_init(struct comp *c, unsigned offs,
 		     const uint8_t *key, size_t key_b,
 		     const uint8_t *s, size_t s_b,
-		     size_t tag_len, bool encrypted)
+		     size_t tag_len, bool encrypted, enum aes_mode mode)
 {
 	uint8_t k_e[MAX_KEYLEN], k_a[SHA_DIGEST_LENGTH];
 	int err = 0;
@@ -41,10 +41,26 @@ static int comp_init(struct comp *c, unsigned offs,
 	if (key_b > sizeof(k_e))
 		return EINVAL;
 
-	if (tag_len > SHA_DIGEST_LENGTH)
+	if (tag_len > SHA_DIGEST_LENGTH && mode == AES_MODE_CTR)
 		return EINVAL;
 
 	c->tag_len = tag_len;
+	c->mode    = mode;
+
+	/* AEAD: the cipher authenticates, no auth key is needed */
+	if (mode == AES_MODE_GCM) {
+
+		if (!encrypted)
+			return ENOTSUP;
+
+		err |= srtp_derive(k_e, key_b, 0x00+offs, key, key_b, s, s_b);
+		err |= srtp_derive(c->k_s.u8, s_b, 0x02+offs,
+				   key, key_b, s, s_b);
+		if (err)
+			return err;
+
+		return aes_alloc(&c->aes, AES_MODE_GCM, k_e, key_b*8, NULL);
+	}
 
 	err |= srtp_derive(k_e, key_b,       0x00+offs, key, key_b, s, s_b);
 	err |= srtp_derive(k_a, sizeof(k_a), 0x01+offs, key, key_b, s, s_b);
@@ -56,6 +72,9 @@ static int comp_init(struct comp *c, unsigned offs,
 		err = aes_alloc(&c->aes, AES_MODE_CTR, k_e, key_b*8, NULL);
 		if (err)
 			return err;
+
+		/* optional, batches fall back to one CTR pass per packet */
+		(void)aes_alloc(&c->aes_ks, AES_MODE_ECB, k_e, key_b*8, NULL);
 	}
 
 	err = hmac_create(&c->hmac, HMAC_HASH_SHA1, k_a, sizeof(k_a));
@@ -72,10 +91,14 @@ static void destructor(void *arg)
 
 	mem_deref(srtp->rtp.aes);
 	mem_deref(srtp->rtcp.aes);
+	mem_deref(srtp->rtp.aes_ks);
+	mem_deref(srtp->rtcp.aes_ks);
 	mem_deref(srtp->rtp.hmac);
 	mem_deref(srtp->rtcp.hmac);
 
 	list_flush(&srtp->streaml);
+	mem_deref(srtp->streamv);
+	mem_deref(srtp->ks);
 }
 
 
@@ -84,12 +107,16 @@ int srtp_alloc(struct srtp **srtpp, enum srtp_suite suite,
 {
 	struct srtp *srtp;
 	const uint8_t *master_salt;
-	size_t cipher_bytes, auth_bytes;
+	size_t cipher_bytes, salt_bytes, auth_bytes;
+	enum aes_mode mode;
 	int err = 0;
 
 	if (!srtpp || !key)
 		return EINVAL;
 
+	salt_bytes = SRTP_SALT_SIZE;
+	mode       = AES_MODE_CTR;
+
 	switch (suite) {
 
 	case SRTP_AES_CM_128_HMAC_SHA1_80:
@@ -112,11 +139,25 @@ int srtp_alloc(struct srtp **srtpp, enum srtp_suite suite,
 		auth_bytes   =  4;
 		break;
 
+	case SRTP_AES_128_GCM:
+		cipher_bytes = 16;
+		salt_bytes   = SRTP_GCM_SALT_SIZE;
+		auth_bytes   = SRTP_GCM_TAG_SIZE;
+		mode         = AES_MODE_GCM;
+		break;
+
+	case SRTP_AES_256_GCM:
+		cipher_bytes = 32;
+		salt_bytes   = SRTP_GCM_SALT_SIZE;
+		auth_bytes   = SRTP_GCM_TAG_SIZE;
+		mode         = AES_MODE_GCM;
+		break;
+
 	default:
 		return ENOTSUP;
 	};
 
-	if ((cipher_bytes + SRTP_SALT_SIZE) != key_bytes)
+	if ((cipher_bytes + salt_bytes) != key_bytes)
 		return EINVAL;
 
 	master_salt = &key[cipher_bytes];
@@ -125,11 +166,14 @@ int srtp_alloc(struct srtp **srtpp, enum srtp_suite suite,
 	if (!srtp)
 		return ENOMEM;
 
-	err |= comp_init(&srtp->rtp,  0, key, cipher_bytes,
-			 master_salt, SRTP_SALT_SIZE, auth_bytes, true);
-	err |= comp_init(&srtp->rtcp, 3, key, cipher_bytes,
-			 master_salt, SRTP_SALT_SIZE, auth_bytes,
-			 !(flags & SRTP_UNENCRYPTED_SRTCP));
+	err = comp_init(&srtp->rtp,  0, key, cipher_bytes,
+			master_salt, salt_bytes, auth_bytes, true, mode);
+	if (err)
+		goto out;
+
+	err = comp_init(&srtp->rtcp, 3, key, cipher_bytes,
+			master_salt, salt_bytes, auth_bytes,
+			!(flags & SRTP_UNENCRYPTED_SRTCP), mode);
 	if (err)
 		goto out;
 
@@ -143,21 +187,35 @@ int srtp_alloc(struct srtp **srtpp, enum srtp_suite suite,
 }
 
 
-int srtp_encrypt(struct srtp *srtp, struct mbuf *mb)
+/*
+ * A packet is protected in three steps: begin() decodes the header and
+ * updates the stream state, the payload is then ciphered, and end()
+ * appends or strips the trailer. The batch functions run begin() for
+ * a group of packets, generate the CTR keystream of the whole group
+ * in one pass of the block cipher, and then finish each packet.
+ */
+
+
+/** Packet state between the protection steps */
+struct pkt {
+	struct mbuf *mb;            /**< Packet buffer                */
+	struct srtp_stream *strm;   /**< SRTP stream of the packet    */
+	size_t start;               /**< Start of the RTP header      */
+	uint64_t ix;                /**< SRTP packet index            */
+	uint32_t roc;               /**< ROC used for this packet     */
+	uint16_t seq;               /**< RTP sequence number          */
+};
+
+
+static int encrypt_begin(struct pkt *pkt, struct srtp *srtp,
+			 struct mbuf *mb)
 {
 	struct srtp_stream *strm;
 	struct rtp_header hdr;
-	struct comp *comp;
-	size_t start;
-	uint64_t ix;
 	int err;
 
-	if (!srtp || !mb)
-		return EINVAL;
-
-	comp = &srtp->rtp;
-
-	start = mb->pos;
+	pkt->mb    = mb;
+	pkt->start = mb->pos;
 
 	err = rtp_hdr_decode(&hdr, mb);
 	if (err)
@@ -173,19 +231,22 @@ int srtp_encrypt(struct srtp *srtp, struct mbuf *mb)
 		strm->s_l = 0;
 	}
 
-	ix = 65536ULL * strm->roc + hdr.seq;
+	pkt->strm = strm;
+	pkt->seq  = hdr.seq;
+	pkt->roc  = strm->roc;
+	pkt->ix   = 65536ULL * strm->roc + hdr.seq;
 
-	if (comp->aes) {
-		union vect128 iv;
-		uint8_t *p = mbuf_buf(mb);
+	if (hdr.seq > strm->s_l)
+		strm->s_l = hdr.seq;
 
-		srtp_iv_calc(&iv, &comp->k_s, strm->ssrc, ix);
+	return 0;
+}
 
-		aes_set_iv(comp->aes, iv.u8);
-		err = aes_encr(comp->aes, p, p, mbuf_get_left(mb));
-		if (err)
-			return err;
-	}
+
+static int encrypt_end(struct pkt *pkt, const struct comp *comp)
+{
+	struct mbuf *mb = pkt->mb;
+	int err;
 
 	if (comp->hmac) {
 		const size_t tag_start = mb->end;
@@ -193,11 +254,11 @@ int srtp_encrypt(struct srtp *srtp, struct mbuf *mb)
 
 		mb->pos = tag_start;
 
-		err = mbuf_write_u32(mb, htonl(strm->roc));
+		err = mbuf_write_u32(mb, htonl(pkt->roc));
 		if (err)
 			return err;
 
-		mb->pos = start;
+		mb->pos = pkt->start;
 
 		err = hmac_digest(comp->hmac, tag, sizeof(tag),
 				  mbuf_buf(mb), mbuf_get_left(mb));
@@ -211,23 +272,63 @@ int srtp_encrypt(struct srtp *srtp, struct mbuf *mb)
 			return err;
 	}
 
-	if (hdr.seq > strm->s_l)
-		strm->s_l = hdr.seq;
+	mb->pos = pkt->start;
 
-	mb->pos = start;
+	return 0;
+}
+
+
+static int encrypt_gcm(struct pkt *pkt, struct comp *comp)
+{
+	struct mbuf *mb = pkt->mb;
+	uint8_t *p = mbuf_buf(mb);
+	uint8_t tag[SRTP_GCM_TAG_SIZE];
+	const size_t tag_start = mb->end;
+	union vect128 iv;
+	int err;
+
+	srtp_iv_calc_gcm(&iv, &comp->k_s, pkt->strm->ssrc, pkt->ix);
+
+	aes_set_iv(comp->aes, iv.u8);
+
+	/* the RTP header is Associated Data */
+	err  = aes_encr(comp->aes, NULL, &mb->buf[pkt->start],
+			mb->pos - pkt->start);
+	err |= aes_encr(comp->aes, p, p, mbuf_get_left(mb));
+	err |= aes_get_authtag(comp->aes, tag, comp->tag_len);
+	if (err)
+		return err;
+
+	mb->pos = tag_start;
+
+	err = mbuf_write_mem(mb, tag, comp->tag_len);
+	if (err)
+		return err;
+
+	mb->pos = pkt->start;
 
 	return 0;
 }
 
 
-int srtp_decrypt(struct srtp *srtp, struct mbuf *mb)
+static int cipher_ctr(struct pkt *pkt, struct comp *comp)
+{
+	struct mbuf *mb = pkt->mb;
+	uint8_t *p = mbuf_buf(mb);
+	union vect128 iv;
+
+	srtp_iv_calc(&iv, &comp->k_s, pkt->strm->ssrc, pkt->ix);
+
+	aes_set_iv(comp->aes, iv.u8);
+
+	return aes_encr(comp->aes, p, p, mbuf_get_left(mb));
+}
+
+
+int srtp_encrypt(struct srtp *srtp, struct mbuf *mb)
 {
-	struct srtp_stream *strm;
-	struct rtp_header hdr;
 	struct comp *comp;
-	uint64_t ix;
-	size_t start;
-	int diff;
+	struct pkt pkt;
 	int err;
 
 	if (!srtp || !mb)
@@ -235,91 +336,539 @@ int srtp_decrypt(struct srtp *srtp, struct mbuf *mb)
 
 	comp = &srtp->rtp;
 
-	start = mb->pos;
+	err = encrypt_begin(&pkt, srtp, mb);
+	if (err)
+		return err;
 
-	err = rtp_hdr_decode(&hdr, mb);
+	if (comp->mode == AES_MODE_GCM)
+		return encrypt_gcm(&pkt, comp);
+
+	if (comp->aes) {
+		err = cipher_ctr(&pkt, comp);
+		if (err)
+			return err;
+	}
+
+	return encrypt_end(&pkt, comp);
+}
+
+
+static int decrypt_begin(struct pkt *pkt, struct srtp *srtp,
+			 struct mbuf *mb, const struct rtp_meta *meta)
+{
+	struct srtp_stream *strm;
+	struct rtp_header hdr_dec;
+	const struct rtp_header *hdr;
+	int err;
+
+	pkt->mb    = mb;
+	pkt->start = mb->pos;
+
+	/* the header was already decoded by the caller */
+	if (meta) {
+		if (meta->rtcp || meta->start != mb->pos ||
+		    meta->hdr_len > mbuf_get_left(mb))
+			return EINVAL;
+
+		hdr = &meta->hdr;
+		mb->pos += meta->hdr_len;
+	}
+	else {
+		err = rtp_hdr_decode(&hdr_dec, mb);
+		if (err)
+			return err;
+
+		hdr = &hdr_dec;
+	}
+
+	err = stream_get_seq(&strm, srtp, hdr->ssrc, hdr->seq);
 	if (err)
 		return err;
 
-	err = stream_get_seq(&strm, srtp, hdr.ssrc, hdr.seq);
+	/*
+	 * RFC 3711 Section 3.3.1: the ROC of the packet is estimated,
+	 * so that late packets from before a wrap keep the old ROC.
+	 * The stream state is only updated once the packet is accepted.
+	 */
+	pkt->strm = strm;
+	pkt->seq  = hdr->seq;
+	pkt->ix   = srtp_get_index(strm->roc, strm->s_l, hdr->seq);
+	pkt->roc  = (uint32_t)(pkt->ix >> 16);
+
+	return 0;
+}
+
+
+static int decrypt_gcm(struct pkt *pkt, struct comp *comp)
+{
+	struct mbuf *mb = pkt->mb;
+	uint8_t *p = mbuf_buf(mb);
+	union vect128 iv;
+	size_t tag_start;
+	int err;
+
+	if (mbuf_get_left(mb) < comp->tag_len)
+		return EBADMSG;
+
+	tag_start = mb->end - comp->tag_len;
+
+	srtp_iv_calc_gcm(&iv, &comp->k_s, pkt->strm->ssrc, pkt->ix);
+
+	aes_set_iv(comp->aes, iv.u8);
+
+	/* the RTP header is Associated Data */
+	err  = aes_decr(comp->aes, NULL, &mb->buf[pkt->start],
+			mb->pos - pkt->start);
+	err |= aes_decr(comp->aes, p, p, tag_start - mb->pos);
 	if (err)
 		return err;
 
-	diff = seq_diff(strm->s_l, hdr.seq);
-	if (diff > 32768)
-		return ETIMEDOUT;
+	err = aes_authenticate(comp->aes, &mb->buf[tag_start],
+			       comp->tag_len);
+	if (err)
+		return err;
 
-	/* Roll-Over Counter (ROC) */
-	if (diff <= -32768) {
-		strm->roc++;
-		strm->s_l = 0;
-	}
+	mb->end = tag_start;
 
-	ix = srtp_get_index(strm->roc, strm->s_l, hdr.seq);
+	if (!srtp_replay_check(&pkt->strm->replay_rtp, pkt->ix))
+		return EALREADY;
 
-	if (comp->hmac) {
-		uint8_t tag_calc[SHA_DIGEST_LENGTH];
-		uint8_t tag_pkt[SHA_DIGEST_LENGTH];
-		size_t pld_start, tag_start;
+	return 0;
+}
 
-		if (mbuf_get_left(mb) < comp->tag_len)
-			return EBADMSG;
 
-		pld_start = mb->pos;
-		tag_start = mb->end - comp->tag_len;
+static int decrypt_auth(struct pkt *pkt, const struct comp *comp)
+{
+	struct mbuf *mb = pkt->mb;
+	uint8_t tag_calc[SHA_DIGEST_LENGTH];
+	uint8_t tag_pkt[SHA_DIGEST_LENGTH];
+	size_t pld_start, tag_start;
+	int err;
 
-		mb->pos = tag_start;
+	if (mbuf_get_left(mb) < comp->tag_len)
+		return EBADMSG;
 
-		err = mbuf_read_mem(mb, tag_pkt, comp->tag_len);
-		if (err)
-			return err;
+	pld_start = mb->pos;
+	tag_start = mb->end - comp->tag_len;
 
-		mb->pos = mb->end = tag_start;
+	mb->pos = tag_start;
 
-		err = mbuf_write_u32(mb, htonl(strm->roc));
-		if (err)
-			return err;
+	err = mbuf_read_mem(mb, tag_pkt, comp->tag_len);
+	if (err)
+		return err;
 
-		mb->pos = start;
+	mb->pos = mb->end = tag_start;
 
-		err = hmac_digest(comp->hmac, tag_calc, sizeof(tag_calc),
-				  mbuf_buf(mb), mbuf_get_left(mb));
-		if (err)
-			return err;
+	err = mbuf_write_u32(mb, htonl(pkt->roc));
+	if (err)
+		return err;
 
-		mb->pos = pld_start;
-		mb->end = tag_start;
+	mb->pos = pkt->start;
+
+	err = hmac_digest(comp->hmac, tag_calc, sizeof(tag_calc),
+			  mbuf_buf(mb), mbuf_get_left(mb));
+	if (err)
+		return err;
+
+	mb->pos = pld_start;
+	mb->end = tag_start;
+
+	if (0 != memcmp(tag_calc, tag_pkt, comp->tag_len))
+		return EAUTH;
+
+	/*
+	 * 3.3.2.  Replay Protection
+	 *
+	 * Secure replay protection is only possible when
+	 * integrity protection is present.
+	 */
+	if (!srtp_replay_check(&pkt->strm->replay_rtp, pkt->ix))
+		return EALREADY;
+
+	return 0;
+}
 
-		if (0 != memcmp(tag_calc, tag_pkt, comp->tag_len))
-			return EAUTH;
 
-		/*
-		 * 3.3.2.  Replay Protection
-		 *
-		 * Secure replay protection is only possible when
-		 * integrity protection is present.
-		 */
-		if (!srtp_replay_check(&strm->replay_rtp, ix))
-			return EALREADY;
+static void decrypt_end(struct pkt *pkt)
+{
+	struct srtp_stream *strm = pkt->strm;
+
+	if (pkt->ix > 65536ULL * strm->roc + strm->s_l) {
+		strm->roc = pkt->roc;
+		strm->s_l = pkt->seq;
 	}
+}
 
-	if (comp->aes) {
 
-		union vect128 iv;
-		uint8_t *p = mbuf_buf(mb);
+int srtp_decrypt(struct srtp *srtp, struct mbuf *mb)
+{
+	return srtp_decrypt_meta(srtp, mb, NULL);
+}
 
-		srtp_iv_calc(&iv, &comp->k_s, strm->ssrc, ix);
 
-		aes_set_iv(comp->aes, iv.u8);
-		err = aes_decr(comp->aes, p, p, mbuf_get_left(mb));
+/**
+ * Decrypt an SRTP packet in place, using the RTP header metadata from
+ * rtp_meta_decode() instead of decoding the header again
+ *
+ * @param srtp SRTP Context
+ * @param mb   Packet buffer, positioned at the start of the packet
+ * @param meta Metadata of the packet, or NULL to decode the header
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int srtp_decrypt_meta(struct srtp *srtp, struct mbuf *mb,
+		      const struct rtp_meta *meta)
+{
+	struct comp *comp;
+	struct pkt pkt;
+	int err;
+
+	if (!srtp || !mb)
+		return EINVAL;
+
+	comp = &srtp->rtp;
+
+	err = decrypt_begin(&pkt, srtp, mb, meta);
+	if (err)
+		return err;
+
+	if (comp->mode == AES_MODE_GCM) {
+		err = decrypt_gcm(&pkt, comp);
 		if (err)
 			return err;
 	}
+	else {
+		if (comp->hmac) {
+			err = decrypt_auth(&pkt, comp);
+			if (err)
+				return err;
+		}
+
+		if (comp->aes) {
+			err = cipher_ctr(&pkt, comp);
+			if (err)
+				return err;
+		}
+	}
 
-	if (hdr.seq > strm->s_l)
-		strm->s_l = hdr.seq;
+	decrypt_end(&pkt);
 
-	mb->pos = start;
+	mb->pos = pkt.start;
 
 	return 0;
 }
+
+
+/** Batch state, one group of packets sharing a keystream pass */
+struct batch {
+	struct pkt pktv[SRTP_BATCH_MAX];  /**< Packets of the group      */
+	size_t idxv[SRTP_BATCH_MAX];      /**< Array index of each       */
+	size_t ksv[SRTP_BATCH_MAX];       /**< Keystream offset of each  */
+	size_t n;                         /**< Number of packets         */
+	size_t ks_len;                    /**< Keystream length in bytes */
+};
+
+
+static inline size_t ks_size(size_t len)
+{
+	return (len + AES_BLOCK_SIZE - 1) & ~(size_t)(AES_BLOCK_SIZE - 1);
+}
+
+
+static inline void set_err(int *errv, size_t i, int e, int *err)
+{
+	if (errv)
+		errv[i] = e;
+	if (e && !*err)
+		*err = e;
+}
+
+
+/*
+ * Large payloads get their own CTR pass. The cipher setup saved by the
+ * batch is small next to the payload, and the extra keystream buffer
+ * pass through the cache costs more.
+ */
+static inline bool batch_pkt(const struct mbuf *mb)
+{
+	return mbuf_get_left(mb) <= SRTP_BATCH_PKT;
+}
+
+
+static bool batch_fits(const struct batch *b, const struct mbuf *mb)
+{
+	return b->n < SRTP_BATCH_MAX &&
+		b->ks_len + ks_size(mbuf_get_left(mb)) <= SRTP_BATCH_KS;
+}
+
+
+/* One counter block per keystream block, RFC 3711 Section 4.1.1 */
+static void batch_add(struct batch *b, const struct comp *comp,
+		      uint8_t *ks, const struct pkt *pkt, size_t idx)
+{
+	const size_t len = ks_size(mbuf_get_left(pkt->mb));
+	union vect128 iv;
+	size_t i;
+
+	srtp_iv_calc(&iv, &comp->k_s, pkt->strm->ssrc, pkt->ix);
+
+	/* the block counter is stored bytewise, no partial vector write */
+	for (i = 0; i < len / AES_BLOCK_SIZE; i++) {
+		uint8_t *blk = &ks[b->ks_len + i * AES_BLOCK_SIZE];
+
+		memcpy(blk, iv.u8, 14);
+		blk[14] = (uint8_t)(i >> 8);
+		blk[15] = (uint8_t)i;
+	}
+
+	b->pktv[b->n] = *pkt;
+	b->idxv[b->n] = idx;
+	b->ksv[b->n]  = b->ks_len;
+
+	++b->n;
+	b->ks_len += len;
+}
+
+
+static void xor_keystream(uint8_t *p, const uint8_t *ks, size_t len)
+{
+	for (; len >= 8; len -= 8, p += 8, ks += 8) {
+		uint64_t a, k;
+
+		memcpy(&a, p, 8);
+		memcpy(&k, ks, 8);
+		a ^= k;
+		memcpy(p, &a, 8);
+	}
+
+	while (len--)
+		*p++ ^= *ks++;
+}
+
+
+/*
+ * Encrypt all counter blocks of the group in one call, then apply the
+ * keystream. Should that fail, each packet gets its own CTR pass.
+ */
+static void batch_cipher(struct batch *b, struct comp *comp, uint8_t *ks,
+			 int *errv, int *err)
+{
+	size_t i;
+
+	if (!aes_encr(comp->aes_ks, ks, ks, b->ks_len)) {
+
+		for (i = 0; i < b->n; i++) {
+			struct mbuf *mb = b->pktv[i].mb;
+
+			xor_keystream(mbuf_buf(mb), &ks[b->ksv[i]],
+				      mbuf_get_left(mb));
+		}
+
+		return;
+	}
+
+	for (i = 0; i < b->n; i++) {
+		int e = cipher_ctr(&b->pktv[i], comp);
+		if (e) {
+			set_err(errv, b->idxv[i], e, err);
+			b->pktv[i].mb = NULL;
+		}
+	}
+}
+
+
+static int batch_init(struct batch *b, struct srtp *srtp)
+{
+	b->n = 0;
+	b->ks_len = 0;
+
+	if (srtp->ks)
+		return 0;
+
+	srtp->ks = mem_alloc(SRTP_BATCH_KS, NULL);
+
+	return srtp->ks ? 0 : ENOMEM;
+}
+
+
+/**
+ * Encrypt a batch of SRTP packets in place. The packets are processed
+ * in order, and the keystream for a group of packets is generated in
+ * a single pass of the block cipher.
+ *
+ * @param srtp SRTP Context
+ * @param mbv  Array of packet buffers
+ * @param errv Optional array of per-packet error codes
+ * @param n    Number of packets
+ *
+ * @return 0 if all packets were encrypted, otherwise the first error
+ */
+int srtp_encrypt_batch(struct srtp *srtp, struct mbuf **mbv, int *errv,
+		       size_t n)
+{
+	struct comp *comp;
+	struct batch b;
+	size_t i = 0, j;
+	int err = 0;
+
+	if (!srtp || !mbv)
+		return EINVAL;
+
+	comp = &srtp->rtp;
+
+	/* GCM, or no keystream context */
+	if (!comp->aes_ks || batch_init(&b, srtp)) {
+
+		for (i = 0; i < n; i++)
+			set_err(errv, i, srtp_encrypt(srtp, mbv[i]), &err);
+
+		return err;
+	}
+
+	while (i < n) {
+
+		batch_init(&b, srtp);
+
+		for (; i < n; i++) {
+			struct pkt pkt;
+			int e;
+
+			if (!mbv[i]) {
+				set_err(errv, i, EINVAL, &err);
+				continue;
+			}
+
+			if (!batch_pkt(mbv[i])) {
+
+				/* in order, after the packets before it */
+				if (b.n)
+					break;
+
+				set_err(errv, i, srtp_encrypt(srtp, mbv[i]),
+					&err);
+				continue;
+			}
+
+			if (!batch_fits(&b, mbv[i]))
+				break;
+
+			e = encrypt_begin(&pkt, srtp, mbv[i]);
+			if (e) {
+				set_err(errv, i, e, &err);
+				continue;
+			}
+
+			batch_add(&b, comp, srtp->ks, &pkt, i);
+		}
+
+		if (!b.n)
+			continue;
+
+		batch_cipher(&b, comp, srtp->ks, errv, &err);
+
+		for (j = 0; j < b.n; j++) {
+
+			if (!b.pktv[j].mb)
+				continue;
+
+			set_err(errv, b.idxv[j], encrypt_end(&b.pktv[j], comp),
+				&err);
+		}
+	}
+
+	return err;
+}
+
+
+/**
+ * Decrypt a batch of SRTP packets in place. Each packet is
+ * authenticated and replay checked in order, and the keystream for a
+ * group of packets is generated in a single pass of the block cipher.
+ *
+ * @param srtp SRTP Context
+ * @param mbv  Array of packet buffers
+ * @param errv Optional array of per-packet error codes
+ * @param n    Number of packets
+ *
+ * @return 0 if all packets were decrypted, otherwise the first error
+ */
+int srtp_decrypt_batch(struct srtp *srtp, struct mbuf **mbv, int *errv,
+		       size_t n)
+{
+	struct comp *comp;
+	struct batch b;
+	size_t i = 0, j;
+	int err = 0;
+
+	if (!srtp || !mbv)
+		return EINVAL;
+
+	comp = &srtp->rtp;
+
+	/* GCM, or no keystream context */
+	if (!comp->aes_ks || batch_init(&b, srtp)) {
+
+		for (i = 0; i < n; i++)
+			set_err(errv, i, srtp_decrypt(srtp, mbv[i]), &err);
+
+		return err;
+	}
+
+	while (i < n) {
+
+		batch_init(&b, srtp);
+
+		for (; i < n; i++) {
+			struct pkt pkt;
+			int e;
+
+			if (!mbv[i]) {
+				set_err(errv, i, EINVAL, &err);
+				continue;
+			}
+
+			if (!batch_pkt(mbv[i])) {
+
+				/* in order, after the packets before it */
+				if (b.n)
+					break;
+
+				set_err(errv, i, srtp_decrypt(srtp, mbv[i]),
+					&err);
+				continue;
+			}
+
+			if (!batch_fits(&b, mbv[i]))
+				break;
+
+			e = decrypt_begin(&pkt, srtp, mbv[i], NULL);
+			if (!e)
+				e = decrypt_auth(&pkt, comp);
+			if (e) {
+				set_err(errv, i, e, &err);
+				continue;
+			}
+
+			decrypt_end(&pkt);
+
+			batch_add(&b, comp, srtp->ks, &pkt, i);
+		}
+
+		if (!b.n)
+			continue;
+
+		batch_cipher(&b, comp, srtp->ks, errv, &err);
+
+		for (j = 0; j < b.n; j++) {
+
+			if (!b.pktv[j].mb)
+				continue;
+
+			b.pktv[j].mb->pos = b.pktv[j].start;
+
+			set_err(errv, b.idxv[j], 0, &err);
+		}
+	}
+
+	return err;
+}
@@ -6,7 +6,12 @@
 
 
 enum {
-	SRTP_SALT_SIZE = 14
+	SRTP_SALT_SIZE     =    14,
+	SRTP_GCM_SALT_SIZE =    12,  /**< RFC 7714 master and session salt */
+	SRTP_GCM_TAG_SIZE  =    16,  /**< RFC 7714 authentication tag      */
+	SRTP_BATCH_MAX     =    32,  /**< Packets per keystream pass       */
+	SRTP_BATCH_KS      =  8192,  /**< Keystream bytes per pass         */
+	SRTP_BATCH_PKT     =   512,  /**< Largest payload in a pass        */
 };
 
 
@@ -20,8 +25,13 @@ union vect128 {
 
 /** Replay protection */
 struct replay {
-	uint64_t bitmap;   /**< Session state - must be 64 bits */
-	uint64_t lix;      /**< Last received index             */
+	uint64_t *bitmap;   /**< Window, ring of 64-bit words         */
+	uint64_t ring[2];   /**< Storage for the default window       */
+	uint32_t words;     /**< Number of words, power of 2          */
+	uint32_t window;    /**< Window size in packets               */
+	uint64_t lix;       /**< Last received index                  */
+	uint64_t n_replay;  /**< Packets dropped as seen before       */
+	uint64_t n_old;     /**< Packets dropped as older than window */
 };
 
 /** SRTP stream/context -- shared state between RTP/RTCP */
@@ -40,12 +50,20 @@ struct srtp_stream {
 struct srtp {
 	struct comp {
 		struct aes *aes;    /**< AES Context                       */
-		struct hmac *hmac;  /**< HMAC Context                      */
+		struct aes *aes_ks; /**< AES-ECB for batch keystream       */
+		enum aes_mode mode; /**< AES mode, CTR or GCM              */
+		struct hmac *hmac;  /**< HMAC Context, CTR mode only       */
 		union vect128 k_s;  /**< Derived salting key (14 bytes)    */
 		size_t tag_len;     /**< Authentication tag length [bytes] */
 	} rtp, rtcp;
 
-	struct list streaml;        /**< SRTP-streams (struct srtp_stream) */
+	struct list streaml;             /**< SRTP-streams                 */
+	struct srtp_stream **streamv;    /**< SSRC table, open addressing  */
+	uint32_t streamc;                /**< SSRC table size, power of 2  */
+	uint32_t max_streams;            /**< Maximum number of streams    */
+	struct srtp_stream *strm_last;   /**< Stream of the last lookup    */
+	uint32_t replay_window;          /**< RTP replay window, 0 default */
+	uint8_t *ks;                     /**< Keystream buffer for batches */
 };
 
 
@@ -59,10 +77,13 @@ int  srtp_derive(uint8_t *out, size_t out_len, uint8_t label,
 		 const uint8_t *master_salt, size_t salt_bytes);
 void srtp_iv_calc(union vect128 *iv, const union vect128 *k_s,
 		  uint32_t ssrc, uint64_t ix);
+void srtp_iv_calc_gcm(union vect128 *iv, const union vect128 *k_s,
+		      uint32_t ssrc, uint64_t ix);
 uint64_t srtp_get_index(uint32_t roc, uint16_t s_l, uint16_t seq);
 
 
 /* Replay protection */
 
-void srtp_replay_init(struct replay *replay);
+int  srtp_replay_init(struct replay *replay, uint32_t window);
+void srtp_replay_close(struct replay *replay);
 bool srtp_replay_check(struct replay *replay, uint64_t ix);
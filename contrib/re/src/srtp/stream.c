@@ -3,38 +3,111 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#include <string.h>
 #include <re_types.h>
 #include <re_mem.h>
 #include <re_mbuf.h>
 #include <re_list.h>
+#include <re_aes.h>
 #include <re_srtp.h>
 #include "srtp.h"
 
 
 /** SRTP protocol values */
 #ifndef SRTP_MAX_STREAMS
-#define SRTP_MAX_STREAMS  (8)  /**< Maximum number of SRTP streams */
+#define SRTP_MAX_STREAMS  (8)  /**< Default maximum number of SRTP streams */
 #endif
 
 
+/*
+ * The streams are indexed by SSRC in an open-addressed table with
+ * linear probing. The table is kept at most half full, and streams are
+ * only removed together with the SRTP session, so no deleted markers
+ * are needed. The stream found last is checked first, as most packets
+ * belong to the same stream as the one before.
+ */
+
+
 static void stream_destructor(void *arg)
 {
 	struct srtp_stream *strm = arg;
 
 	list_unlink(&strm->le);
+
+	srtp_replay_close(&strm->replay_rtp);
+	srtp_replay_close(&strm->replay_rtcp);
 }
 
 
-static struct srtp_stream *stream_find(struct srtp *srtp, uint32_t ssrc)
+static inline uint32_t ssrc_hash(uint32_t ssrc)
+{
+	ssrc ^= ssrc >> 16;
+	ssrc *= 0x45d9f3b;
+	ssrc ^= ssrc >> 16;
+
+	return ssrc;
+}
+
+
+static void table_insert(struct srtp_stream **streamv, uint32_t streamc,
+			 struct srtp_stream *strm)
+{
+	uint32_t i = ssrc_hash(strm->ssrc) & (streamc - 1);
+
+	while (streamv[i])
+		i = (i + 1) & (streamc - 1);
+
+	streamv[i] = strm;
+}
+
+
+static int table_alloc(struct srtp *srtp, uint32_t max_streams)
 {
+	struct srtp_stream **streamv;
+	uint32_t streamc = 4;
 	struct le *le;
 
-	for (le = srtp->streaml.head; le; le = le->next) {
+	while (streamc < 2 * max_streams)
+		streamc *= 2;
+
+	streamv = mem_zalloc(streamc * sizeof(*streamv), NULL);
+	if (!streamv)
+		return ENOMEM;
+
+	for (le = srtp->streaml.head; le; le = le->next)
+		table_insert(streamv, streamc, le->data);
+
+	mem_deref(srtp->streamv);
+
+	srtp->streamv     = streamv;
+	srtp->streamc     = streamc;
+	srtp->max_streams = max_streams;
 
-		struct srtp_stream *strm = le->data;
+	return 0;
+}
+
+
+static struct srtp_stream *stream_find(struct srtp *srtp, uint32_t ssrc)
+{
+	struct srtp_stream *strm = srtp->strm_last;
+	uint32_t i;
 
-		if (strm->ssrc == ssrc)
+	if (strm && strm->ssrc == ssrc)
+		return strm;
+
+	if (!srtp->streamv)
+		return NULL;
+
+	i = ssrc_hash(ssrc) & (srtp->streamc - 1);
+
+	while ((strm = srtp->streamv[i])) {
+
+		if (strm->ssrc == ssrc) {
+			srtp->strm_last = strm;
 			return strm;
+		}
+
+		i = (i + 1) & (srtp->streamc - 1);
 	}
 
 	return NULL;
@@ -45,8 +118,15 @@ static int stream_new(struct srtp_stream **strmp, struct srtp *srtp,
 		      uint32_t ssrc)
 {
 	struct srtp_stream *strm;
+	int err;
+
+	if (!srtp->streamv) {
+		err = table_alloc(srtp, SRTP_MAX_STREAMS);
+		if (err)
+			return err;
+	}
 
-	if (list_count(&srtp->streaml) >= SRTP_MAX_STREAMS)
+	if (list_count(&srtp->streaml) >= srtp->max_streams)
 		return ENOSR;
 
 	strm = mem_zalloc(sizeof(*strm), stream_destructor);
@@ -54,10 +134,18 @@ static int stream_new(struct srtp_stream **strmp, struct srtp *srtp,
 		return ENOMEM;
 
 	strm->ssrc = ssrc;
-	srtp_replay_init(&strm->replay_rtp);
-	srtp_replay_init(&strm->replay_rtcp);
+
+	err  = srtp_replay_init(&strm->replay_rtp, srtp->replay_window);
+	err |= srtp_replay_init(&strm->replay_rtcp, 0);
+	if (err) {
+		mem_deref(strm);
+		return err;
+	}
 
 	list_append(&srtp->streaml, &strm->le, strm);
+	table_insert(srtp->streamv, srtp->streamc, strm);
+
+	srtp->strm_last = strm;
 
 	if (strmp)
 		*strmp = strm;
@@ -66,6 +154,90 @@ static int stream_new(struct srtp_stream **strmp, struct srtp *srtp,
 }
 
 
+/**
+ * Set the maximum number of SRTP streams (SSRCs) in an SRTP session.
+ * Packets of further streams are rejected with ENOSR.
+ *
+ * @param srtp SRTP Session
+ * @param n    Maximum number of streams
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int srtp_set_max_streams(struct srtp *srtp, uint32_t n)
+{
+	if (!srtp || !n || n > 0x10000)
+		return EINVAL;
+
+	if (n < list_count(&srtp->streaml))
+		return EBUSY;
+
+	return table_alloc(srtp, n);
+}
+
+
+/**
+ * Set the size of the RTP replay protection window. The window is
+ * rounded up, and must be set before the first packet.
+ *
+ * @param srtp   SRTP Session
+ * @param window Window size in packets, 0 for the default of 64
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int srtp_set_replay_window(struct srtp *srtp, uint32_t window)
+{
+	struct replay replay;
+	int err;
+
+	if (!srtp)
+		return EINVAL;
+
+	if (!list_isempty(&srtp->streaml))
+		return EBUSY;
+
+	/* check that the window is supported */
+	err = srtp_replay_init(&replay, window);
+	if (err)
+		return err;
+
+	srtp_replay_close(&replay);
+
+	srtp->replay_window = window;
+
+	return 0;
+}
+
+
+/**
+ * Get the statistics of an SRTP session, summed over all streams
+ *
+ * @param srtp  SRTP Session
+ * @param stats Returned statistics
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int srtp_stats_get(const struct srtp *srtp, struct srtp_stats *stats)
+{
+	struct le *le;
+
+	if (!srtp || !stats)
+		return EINVAL;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (le = srtp->streaml.head; le; le = le->next) {
+		const struct srtp_stream *strm = le->data;
+
+		stats->replay += strm->replay_rtp.n_replay;
+		stats->replay += strm->replay_rtcp.n_replay;
+		stats->old    += strm->replay_rtp.n_old;
+		stats->old    += strm->replay_rtcp.n_old;
+	}
+
+	return 0;
+}
+
+
 int stream_get(struct srtp_stream **strmp, struct srtp *srtp, uint32_t ssrc)
 {
 	struct srtp_stream *strm;
@@ -5,4 +5,5 @@
 #
 
 SRCS	+= tcp/tcp.c
+SRCS	+= tcp/tcp_frame.c
 SRCS	+= tcp/tcp_high.c
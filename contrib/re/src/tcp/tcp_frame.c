@@ -0,0 +1,282 @@
+/**
+ * @file tcp_frame.c  Framing of messages in a TCP stream
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re_types.h>
+#include <re_mem.h>
+#include <re_mbuf.h>
+#include <re_tcp.h>
+
+
+/*
+ * Complete frames are handed out as views into the received buffer,
+ * without copying. Only a frame that is split between two segments is
+ * copied to a buffer of fixed capacity, which is allocated once and
+ * never grows. The frame handlers expect one linear buffer, so the
+ * buffer is not used as a wrap-around ring but is compacted instead.
+ */
+
+
+/** Defines a stream framer */
+struct tcp_framer {
+	struct mbuf *mb;            /**< Partial frames, fixed capacity  */
+	size_t size;                /**< Capacity in bytes               */
+	size_t align;               /**< Frame alignment in bytes        */
+	tcp_framer_len_h *lenh;     /**< Frame length handler            */
+	tcp_framer_frame_h *frameh; /**< Frame handler                   */
+	void *arg;                  /**< Handler argument                */
+};
+
+
+static void destructor(void *arg)
+{
+	struct tcp_framer *frm = arg;
+
+	mem_deref(frm->mb);
+}
+
+
+static inline size_t frame_padded(const struct tcp_framer *frm, size_t len)
+{
+	if (frm->align > 1)
+		len = (len + frm->align - 1) / frm->align * frm->align;
+
+	return len;
+}
+
+
+static int buf_append(struct tcp_framer *frm, struct mbuf *mb, size_t n)
+{
+	struct mbuf *buf = frm->mb;
+
+	if (!buf) {
+		buf = frm->mb = mbuf_alloc(frm->size);
+		if (!buf)
+			return ENOMEM;
+	}
+
+	if (mbuf_get_left(buf) + n > frm->size)
+		return EOVERFLOW;
+
+	/* move the pending bytes to the front */
+	if (buf->end + n > frm->size) {
+		memmove(buf->buf, mbuf_buf(buf), mbuf_get_left(buf));
+		buf->end -= buf->pos;
+		buf->pos = 0;
+	}
+
+	memcpy(buf->buf + buf->end, mbuf_buf(mb), n);
+	buf->end += n;
+	mb->pos += n;
+
+	return 0;
+}
+
+
+static int frame_length(struct tcp_framer *frm, size_t *lenp,
+			const struct mbuf *mb)
+{
+	int err;
+
+	err = frm->lenh(lenp, mb, frm->arg);
+	if (err)
+		return err;
+
+	if (!*lenp)
+		return EBADMSG;
+
+	if (frame_padded(frm, *lenp) > frm->size)
+		return EOVERFLOW;
+
+	return 0;
+}
+
+
+/* Hand out one frame as a view, and skip it including the padding */
+static bool frame_deliver(struct tcp_framer *frm, struct mbuf *mb,
+			  size_t len)
+{
+	const size_t pos = mb->pos, end = mb->end;
+	bool cont;
+
+	mb->end = pos + len;
+
+	cont = frm->frameh(mb, frm->arg);
+
+	mb->pos = pos + frame_padded(frm, len);
+	mb->end = end;
+
+	return cont;
+}
+
+
+/*
+ * Complete the first frame in the buffer from the received data. The
+ * header is copied byte by byte until its length is known, and then
+ * not more than the rest of that frame.
+ */
+static int buf_complete(struct tcp_framer *frm, struct mbuf *mb,
+			size_t *lenp)
+{
+	size_t len, have, n;
+	int err;
+
+	for (;;) {
+		err = frame_length(frm, &len, frm->mb);
+		if (err != ENODATA)
+			break;
+
+		if (!mbuf_get_left(mb))
+			return ENODATA;
+
+		err = buf_append(frm, mb, 1);
+		if (err)
+			return err;
+	}
+	if (err)
+		return err;
+
+	have = mbuf_get_left(frm->mb);
+	if (have < frame_padded(frm, len)) {
+
+		n = min(frame_padded(frm, len) - have, mbuf_get_left(mb));
+
+		err = buf_append(frm, mb, n);
+		if (err)
+			return err;
+
+		if (have + n < frame_padded(frm, len))
+			return ENODATA;
+	}
+
+	*lenp = len;
+
+	return 0;
+}
+
+
+static int framer_recv(struct tcp_framer *frm, struct mbuf *mb)
+{
+	size_t len;
+	int err;
+
+	/* a frame started, or left over, in the previous segments */
+	while (tcp_framer_pending(frm)) {
+
+		err = buf_complete(frm, mb, &len);
+		if (err == ENODATA)
+			return 0;
+		else if (err)
+			return err;
+
+		if (!frame_deliver(frm, frm->mb, len))
+			goto out;
+	}
+
+	if (frm->mb)
+		frm->mb->pos = frm->mb->end = 0;
+
+	/* complete frames in the received segment, without a copy */
+	while (mbuf_get_left(mb)) {
+
+		err = frame_length(frm, &len, mb);
+		if (err == ENODATA)
+			break;
+		else if (err)
+			return err;
+
+		if (mbuf_get_left(mb) < frame_padded(frm, len))
+			break;
+
+		if (!frame_deliver(frm, mb, len))
+			break;
+	}
+
+ out:
+	/* keep the rest for the next segment */
+	if (mbuf_get_left(mb))
+		return buf_append(frm, mb, mbuf_get_left(mb));
+
+	return 0;
+}
+
+
+/**
+ * Allocate a stream framer
+ *
+ * @param frmp   Pointer to allocated stream framer
+ * @param size   Maximum frame size in bytes, including the padding
+ * @param align  Frame alignment in bytes, or 0 for none
+ * @param lenh   Frame length handler
+ * @param frameh Frame handler
+ * @param arg    Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int tcp_framer_alloc(struct tcp_framer **frmp, size_t size, size_t align,
+		     tcp_framer_len_h *lenh, tcp_framer_frame_h *frameh,
+		     void *arg)
+{
+	struct tcp_framer *frm;
+
+	if (!frmp || !size || !lenh || !frameh)
+		return EINVAL;
+
+	frm = mem_zalloc(sizeof(*frm), destructor);
+	if (!frm)
+		return ENOMEM;
+
+	frm->size   = size;
+	frm->align  = align;
+	frm->lenh   = lenh;
+	frm->frameh = frameh;
+	frm->arg    = arg;
+
+	*frmp = frm;
+
+	return 0;
+}
+
+
+/**
+ * Feed received stream data to a stream framer. The frame handler is
+ * called for each complete frame. A frame handler that returns false
+ * stops the framing, and the rest of the data is kept in the framer
+ * until the next call.
+ *
+ * The frame handler may dereference the framer, and must then return
+ * false.
+ *
+ * @param frm Stream framer
+ * @param mb  Received data
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int tcp_framer_recv(struct tcp_framer *frm, struct mbuf *mb)
+{
+	int err;
+
+	if (!frm || !mb)
+		return EINVAL;
+
+	mem_ref(frm);
+	err = framer_recv(frm, mb);
+	mem_deref(frm);
+
+	return err;
+}
+
+
+/**
+ * Get the number of bytes kept by a stream framer
+ *
+ * @param frm Stream framer
+ *
+ * @return Number of pending bytes
+ */
+size_t tcp_framer_pending(const struct tcp_framer *frm)
+{
+	return frm && frm->mb ? mbuf_get_left(frm->mb) : 0;
+}
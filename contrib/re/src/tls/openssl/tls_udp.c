@@ -26,8 +26,9 @@
 
 
 enum {
-	MTU_DEFAULT  = 1400,
-	MTU_FALLBACK = 548,
+	MTU_DEFAULT      = 1400,
+	MTU_FALLBACK     = 548,
+	HEADROOM_DEFAULT = 4,
 };
 
 
@@ -40,6 +41,7 @@ struct dtls_sock {
 	dtls_conn_h *connh;
 	void *arg;
 	size_t mtu;
+	size_t headroom;
 };
 
 
@@ -88,17 +90,17 @@ static int bio_destroy(BIO *b)
 static int bio_write(BIO *b, const char *buf, int len)
 {
 	struct tls_conn *tc = b->ptr;
+	const size_t headroom = tc->sock->headroom;
 	struct mbuf *mb;
-	enum {SPACE = 4};
 	int err;
 
-	mb = mbuf_alloc(SPACE + len);
+	mb = mbuf_alloc(headroom + len);
 	if (!mb)
 		return -1;
 
-	mb->pos = SPACE;
+	mb->pos = headroom;
 	(void)mbuf_write_mem(mb, (void *)buf, len);
-	mb->pos = SPACE;
+	mb->pos = headroom;
 
 	err = udp_send_helper(tc->sock->us, &tc->peer, mb, tc->sock->uh);
 
@@ -725,9 +727,10 @@ int dtls_listen(struct dtls_sock **sockp, const struct sa *laddr,
 	if (err)
 		goto out;
 
-	sock->mtu   = MTU_DEFAULT;
-	sock->connh = connh;
-	sock->arg   = arg;
+	sock->mtu      = MTU_DEFAULT;
+	sock->headroom = HEADROOM_DEFAULT;
+	sock->connh    = connh;
+	sock->arg      = arg;
 
  out:
 	if (err)
@@ -767,6 +770,22 @@ void dtls_set_mtu(struct dtls_sock *sock, size_t mtu)
 }
 
 
+/**
+ * Set the headroom reserved in front of outgoing DTLS packets, so
+ * that lower layers can prepend their headers without copying
+ *
+ * @param sock     DTLS Socket
+ * @param headroom Headroom in bytes
+ */
+void dtls_set_headroom(struct dtls_sock *sock, size_t headroom)
+{
+	if (!sock)
+		return;
+
+	sock->headroom = headroom;
+}
+
+
 void dtls_recv_packet(struct dtls_sock *sock, const struct sa *src,
 		      struct mbuf *mb)
 {
@@ -37,24 +37,83 @@ enum {
 	MAX_BLOCKING = 100   /**< Maximum time spent in handler [ms] */
 };
 
-extern struct list *tmrl_get(void);
+extern struct tmrl *tmrl_get(void);
 
 
-static bool inspos_handler(struct le *le, void *arg)
+static inline unsigned level_shift(unsigned lvl)
 {
-	struct tmr *tmr = le->data;
-	const uint64_t now = *(uint64_t *)arg;
+	return TMR_WHEEL_BITS0 + lvl * TMR_WHEEL_BITSN;
+}
+
+
+/*
+ * Link an active timer into the wheel slot matching its expiry time,
+ * relative to the next jiffy that will be processed
+ */
+static void wheel_insert(struct tmrl *tmrl, struct tmr *tmr)
+{
+	uint64_t expires = tmr->jfs;
+	struct list *lst;
+	uint64_t idx;
+	unsigned lvl;
+
+	/* already expired, run it on the next poll */
+	if (expires < tmrl->jfs) {
+		lst = &tmrl->due;
+		goto out;
+	}
+
+	idx = expires - tmrl->jfs;
+
+	if (idx < TMR_WHEEL_SIZE0) {
+		lst = &tmrl->vec0[expires & (TMR_WHEEL_SIZE0 - 1)];
+		goto out;
+	}
+
+	for (lvl = 0; lvl < TMR_WHEEL_LEVELS - 1; lvl++) {
+
+		if (idx < (1ULL << level_shift(lvl + 1)))
+			break;
+	}
+
+	/* beyond the range of the wheel, park it in the last slot */
+	if (idx >= (1ULL << level_shift(TMR_WHEEL_LEVELS))) {
+		idx = (1ULL << level_shift(TMR_WHEEL_LEVELS)) - 1;
+		expires = tmrl->jfs + idx;
+	}
 
-	return tmr->jfs <= now;
+	lst = &tmrl->vecn[lvl][(expires >> level_shift(lvl))
+			       & (TMR_WHEEL_SIZEN - 1)];
+
+ out:
+	list_append(lst, &tmr->le, tmr);
 }
 
 
-static bool inspos_handler_0(struct le *le, void *arg)
+/*
+ * Move the timers of the current upper level slots one level down.
+ * Called when the lower bits of the wheel jiffies wrap to zero.
+ */
+static void wheel_cascade(struct tmrl *tmrl)
 {
-	struct tmr *tmr = le->data;
-	const uint64_t now = *(uint64_t *)arg;
+	unsigned lvl;
+
+	for (lvl = 0; lvl < TMR_WHEEL_LEVELS; lvl++) {
+
+		const uint32_t idx = (uint32_t)(tmrl->jfs >> level_shift(lvl))
+			& (TMR_WHEEL_SIZEN - 1);
+		struct list *lst = &tmrl->vecn[lvl][idx];
+		struct le *le;
+
+		while ((le = lst->head)) {
+
+			list_unlink(le);
+			wheel_insert(tmrl, le->data);
+		}
 
-	return tmr->jfs > now;
+		if (idx)
+			break;
+	}
 }
 
 
@@ -77,41 +136,141 @@ static void call_handler(tmr_h *th, void *arg)
 #endif
 
 
+/*
+ * The clock went backwards, so that the wheel is ahead of the current
+ * jiffy. Insert all timers again relative to the current jiffy.
+ */
+static void wheel_rebase(struct tmrl *tmrl, uint64_t jfs)
+{
+	struct list tmp = LIST_INIT;
+	struct le *le;
+	unsigned lvl;
+	uint32_t i;
+
+	for (i = 0; i < TMR_WHEEL_SIZE0; i++) {
+		while ((le = tmrl->vec0[i].head)) {
+			list_unlink(le);
+			list_append(&tmp, le, le->data);
+		}
+	}
+
+	for (lvl = 0; lvl < TMR_WHEEL_LEVELS; lvl++) {
+		for (i = 0; i < TMR_WHEEL_SIZEN; i++) {
+			while ((le = tmrl->vecn[lvl][i].head)) {
+				list_unlink(le);
+				list_append(&tmp, le, le->data);
+			}
+		}
+	}
+
+	tmrl->jfs = jfs;
+
+	while ((le = tmp.head)) {
+		list_unlink(le);
+		wheel_insert(tmrl, le->data);
+	}
+}
+
+
+/* Run the handler of the first timer in a list, if there is any */
+static bool run_first(struct tmrl *tmrl, struct list *lst)
+{
+	struct tmr *tmr;
+	tmr_h *th;
+	void *th_arg;
+
+	tmr = list_ledata(lst->head);
+	if (!tmr)
+		return false;
+
+	th = tmr->th;
+	th_arg = tmr->arg;
+
+	tmr->th = NULL;
+
+	list_unlink(&tmr->le);
+	--tmrl->n;
+
+	if (!th)
+		return true;
+
+#if TMR_DEBUG
+	call_handler(th, th_arg);
+#else
+	th(th_arg);
+#endif
+
+	return true;
+}
+
+
+static int status_list(struct re_printf *pf, const struct list *lst)
+{
+	struct le *le;
+	int err = 0;
+
+	for (le = lst->head; le; le = le->next) {
+		const struct tmr *tmr = le->data;
+
+		err |= re_hprintf(pf, "  %p: th=%p expire=%llums\n",
+				  tmr, tmr->th,
+				  (unsigned long long)tmr_get_expire(tmr));
+	}
+
+	return err;
+}
+
+
+
+
 /**
  * Poll all timers in the current thread
  *
+ * Timers that expire up to the current jiffy are run, including the
+ * timers that are started with no delay from a handler during the poll.
+ *
  * @param tmrl Timer list
  */
-void tmr_poll(struct list *tmrl)
+void tmr_poll(struct tmrl *tmrl)
 {
 	const uint64_t jfs = tmr_jiffies();
 
-	for (;;) {
-		struct tmr *tmr;
-		tmr_h *th;
-		void *th_arg;
+	/* nothing to run, do not walk the slots of an idle wheel */
+	if (!tmrl->n) {
+		if (tmrl->jfs <= jfs)
+			tmrl->jfs = jfs + 1;
+		return;
+	}
 
-		tmr = list_ledata(tmrl->head);
+	if (tmrl->jfs > jfs + 1)
+		wheel_rebase(tmrl, jfs);
 
-		if (!tmr || (tmr->jfs > jfs)) {
-			break;
-		}
+	while (run_first(tmrl, &tmrl->due))
+		;
 
-		th = tmr->th;
-		th_arg = tmr->arg;
+	while (tmrl->jfs <= jfs) {
 
-		tmr->th = NULL;
+		const uint64_t cur = tmrl->jfs;
+		const uint32_t idx = cur & (TMR_WHEEL_SIZE0 - 1);
 
-		list_unlink(&tmr->le);
+		if (!idx)
+			wheel_cascade(tmrl);
 
-		if (!th)
+		while (run_first(tmrl, &tmrl->vec0[idx]) ||
+		       run_first(tmrl, &tmrl->due))
+			;
+
+		/* the wheel ran empty and was re-synchronised by a handler */
+		if (tmrl->jfs != cur)
 			continue;
 
-#if TMR_DEBUG
-		call_handler(th, th_arg);
-#else
-		th(th_arg);
-#endif
+		/* skip empty slots, but stop at the next cascade */
+		do {
+			++tmrl->jfs;
+		} while (tmrl->jfs <= jfs &&
+			 (tmrl->jfs & (TMR_WHEEL_SIZE0 - 1)) &&
+			 list_isempty(&tmrl->vec0[tmrl->jfs
+						  & (TMR_WHEEL_SIZE0 - 1)]));
 	}
 }
 
@@ -151,47 +310,88 @@ uint64_t tmr_jiffies(void)
 /**
  * Get number of milliseconds until the next timer expires
  *
+ * For timers in the upper levels of the wheel the time of the next
+ * cascade is returned, which is never later than the actual expiry.
+ *
  * @param tmrl Timer-list
  *
  * @return Number of [ms], or 0 if no active timers
  */
-uint64_t tmr_next_timeout(struct list *tmrl)
+uint64_t tmr_next_timeout(struct tmrl *tmrl)
 {
 	const uint64_t jif = tmr_jiffies();
-	const struct tmr *tmr;
+	uint64_t next = UINT64_MAX;
+	unsigned lvl;
+	uint32_t k;
 
-	tmr = list_ledata(tmrl->head);
-	if (!tmr)
+	if (!tmrl->n)
 		return 0;
 
-	if (tmr->jfs <= jif)
+	if (!list_isempty(&tmrl->due))
+		return 1;
+
+	for (k = 0; k < TMR_WHEEL_SIZE0; k++) {
+
+		const uint64_t t = tmrl->jfs + k;
+
+		if (!list_isempty(&tmrl->vec0[t & (TMR_WHEEL_SIZE0 - 1)])) {
+			next = t;
+			break;
+		}
+	}
+
+	for (lvl = 0; lvl < TMR_WHEEL_LEVELS; lvl++) {
+
+		const unsigned shift = level_shift(lvl);
+		const uint64_t blk = tmrl->jfs >> shift;
+		const uint64_t mask = (1ULL << shift) - 1;
+		const uint32_t k0 = (tmrl->jfs & mask) ? 1 : 0;
+
+		for (k = k0; k < k0 + TMR_WHEEL_SIZEN; k++) {
+
+			const uint64_t t = (blk + k) << shift;
+
+			if (t >= next)
+				break;
+
+			if (!list_isempty(&tmrl->vecn[lvl][(blk + k)
+						& (TMR_WHEEL_SIZEN - 1)])) {
+				next = t;
+				break;
+			}
+		}
+	}
+
+	if (next <= jif)
 		return 1;
 	else
-		return tmr->jfs - jif;
+		return next - jif;
 }
 
 
 int tmr_status(struct re_printf *pf, void *unused)
 {
-	struct list *tmrl = tmrl_get();
-	struct le *le;
-	uint32_t n;
+	struct tmrl *tmrl = tmrl_get();
+	unsigned lvl;
+	uint32_t i, n;
 	int err;
 
 	(void)unused;
 
-	n = list_count(tmrl);
+	n = tmrl->n;
 	if (!n)
 		return 0;
 
 	err = re_hprintf(pf, "Timers (%u):\n", n);
 
-	for (le = tmrl->head; le; le = le->next) {
-		const struct tmr *tmr = le->data;
+	err |= status_list(pf, &tmrl->due);
 
-		err |= re_hprintf(pf, "  %p: th=%p expire=%llums\n",
-				  tmr, tmr->th,
-				  (unsigned long long)tmr_get_expire(tmr));
+	for (i = 0; i < TMR_WHEEL_SIZE0; i++)
+		err |= status_list(pf, &tmrl->vec0[i]);
+
+	for (lvl = 0; lvl < TMR_WHEEL_LEVELS; lvl++) {
+		for (i = 0; i < TMR_WHEEL_SIZEN; i++)
+			err |= status_list(pf, &tmrl->vecn[lvl][i]);
 	}
 
 	if (n > 100)
@@ -206,7 +406,7 @@ int tmr_status(struct re_printf *pf, void *unused)
  */
 void tmr_debug(void)
 {
-	if (!list_isempty(tmrl_get()))
+	if (tmrl_get()->n)
 		(void)re_fprintf(stderr, "%H", tmr_status, NULL);
 }
 
@@ -235,14 +435,15 @@ void tmr_init(struct tmr *tmr)
  */
 void tmr_start(struct tmr *tmr, uint64_t delay, tmr_h *th, void *arg)
 {
-	struct list *tmrl = tmrl_get();
-	struct le *le;
+	struct tmrl *tmrl = tmrl_get();
+	uint64_t jfs;
 
 	if (!tmr)
 		return;
 
 	if (tmr->th) {
 		list_unlink(&tmr->le);
+		--tmrl->n;
 	}
 
 	tmr->th  = th;
@@ -251,26 +452,18 @@ void tmr_start(struct tmr *tmr, uint64_t delay, tmr_h *th, void *arg)
 	if (!th)
 		return;
 
-	tmr->jfs = delay + tmr_jiffies();
+	jfs = tmr_jiffies();
 
-	if (delay == 0) {
-		le = list_apply(tmrl, true, inspos_handler_0, &tmr->jfs);
-		if (le) {
-			list_insert_before(tmrl, le, &tmr->le, tmr);
-		}
-		else {
-			list_append(tmrl, &tmr->le, tmr);
-		}
-	}
-	else {
-		le = list_apply(tmrl, false, inspos_handler, &tmr->jfs);
-		if (le) {
-			list_insert_after(tmrl, le, &tmr->le, tmr);
-		}
-		else {
-			list_prepend(tmrl, &tmr->le, tmr);
-		}
-	}
+	/* an idle wheel may lag behind, catch up for free */
+	if (!tmrl->n)
+		tmrl->jfs = jfs;
+	else if (tmrl->jfs > jfs + 1)
+		wheel_rebase(tmrl, jfs);
+
+	tmr->jfs = delay + jfs;
+
+	wheel_insert(tmrl, tmr);
+	++tmrl->n;
 
 #ifdef HAVE_ACTSCHED
 	/* TODO: this is a hack. when a new timer is started we must reset
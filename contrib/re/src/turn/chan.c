@@ -43,6 +43,8 @@ struct chan {
 	struct stun_ctrans *ct;
 	turnc_chan_h *ch;
 	void *arg;
+	bool bound;
+	bool autobind;
 };
 
 
@@ -95,7 +97,7 @@ static void timeout(void *arg)
 	int err;
 
 	err = chanbind_request(chan, true);
-	if (err)
+	if (err && !chan->autobind)
 		chan->turnc->th(err, 0, NULL, NULL, NULL, NULL,
 				chan->turnc->arg);
 }
@@ -113,6 +115,7 @@ static void chanbind_resp_handler(int err, uint16_t scode, const char *reason,
 
 	case 0:
 		tmr_start(&chan->tmr, CHAN_REFRESH * 1000, timeout, chan);
+		chan->bound = true;
 		if (chan->ch) {
 			chan->ch(chan->arg);
 			chan->ch  = NULL;
@@ -137,6 +140,12 @@ static void chanbind_resp_handler(int err, uint16_t scode, const char *reason,
 	}
 
  out:
+	/* not fatal, the data goes in Send indications until a retry */
+	if (chan->autobind) {
+		tmr_start(&chan->tmr, CHAN_REFRESH * 1000, timeout, chan);
+		return;
+	}
+
 	chan->turnc->th(err, scode, reason, NULL, NULL, msg, chan->turnc->arg);
 }
 
@@ -161,30 +170,38 @@ static int chanbind_request(struct chan *chan, bool reset_ls)
 }
 
 
-/**
- * Add a TURN Channel for a peer
- *
- * @param turnc TURN Client
- * @param peer  Peer IP-address
- * @param ch    Channel handler
- * @param arg   Handler argument
- *
- * @return 0 if success, otherwise errorcode
- */
-int turnc_add_chan(struct turnc *turnc, const struct sa *peer,
-		   turnc_chan_h *ch, void *arg)
+static int chan_add(struct turnc *turnc, const struct sa *peer,
+		    bool autobind, turnc_chan_h *ch, void *arg)
 {
 	struct chan *chan;
 	int err;
 
-	if (!turnc || !peer)
-		return EINVAL;
+	chan = turnc_chan_find_peer(turnc, peer);
+	if (chan) {
+		/* asked for now, report the errors */
+		if (!autobind)
+			chan->autobind = false;
 
-	if (turnc->chans->nr >= CHAN_NUMB_MAX)
-		return ERANGE;
+		if (!ch)
+			return 0;
+
+		if (chan->bound) {
+			ch(arg);
+			return 0;
+		}
+
+		/* called when the pending binding succeeds */
+		if (chan->ch && (chan->ch != ch || chan->arg != arg))
+			return EALREADY;
+
+		chan->ch  = ch;
+		chan->arg = arg;
 
-	if (turnc_chan_find_peer(turnc, peer))
 		return 0;
+	}
+
+	if (turnc->chans->nr >= CHAN_NUMB_MAX)
+		return ERANGE;
 
 	chan = mem_zalloc(sizeof(*chan), chan_destructor);
 	if (!chan)
@@ -201,6 +218,7 @@ int turnc_add_chan(struct turnc *turnc, const struct sa *peer,
 	chan->turnc = turnc;
 	chan->ch = ch;
 	chan->arg = arg;
+	chan->autobind = autobind;
 
 	err = chanbind_request(chan, true);
 	if (err)
@@ -210,6 +228,67 @@ int turnc_add_chan(struct turnc *turnc, const struct sa *peer,
 }
 
 
+/**
+ * Add a TURN Channel for a peer. If the peer already has a channel, e.g.
+ * from an automatic binding, the channel handler is called at once when
+ * the channel is bound, or else when the pending binding succeeds.
+ *
+ * @param turnc TURN Client
+ * @param peer  Peer IP-address
+ * @param ch    Channel handler
+ * @param arg   Handler argument
+ *
+ * @return 0 if success, EALREADY if the pending binding has another
+ *         handler, otherwise errorcode
+ */
+int turnc_add_chan(struct turnc *turnc, const struct sa *peer,
+		   turnc_chan_h *ch, void *arg)
+{
+	if (!turnc || !peer)
+		return EINVAL;
+
+	return chan_add(turnc, peer, false, ch, arg);
+}
+
+
+/*
+ * Bind a channel to a peer in the background, so that the data can
+ * use the 4 byte ChannelData header instead of a Send indication.
+ * A failed binding is retried at the refresh interval and is not
+ * reported to the TURN handler.
+ */
+int turnc_chan_autobind(struct turnc *turnc, const struct sa *peer)
+{
+	if (!turnc || !peer)
+		return EINVAL;
+
+	if (!turnc->allocated || !sa_isset(peer, SA_ALL))
+		return 0;
+
+	if (sa_cmp(peer, &turnc->srv, SA_ALL))
+		return 0;
+
+	return chan_add(turnc, peer, true, NULL, NULL);
+}
+
+
+/*
+ * Get the channel for sending data to a peer, or NULL if the peer
+ * has no bound channel yet. This is only a lookup, the binding is
+ * started from turnc_add_perm() on the thread of the TURN client,
+ * because data may be sent from other threads.
+ */
+struct chan *turnc_chan_send(const struct turnc *turnc,
+			     const struct sa *peer)
+{
+	struct chan *chan;
+
+	chan = turnc_chan_find_peer(turnc, peer);
+
+	return chan && chan->bound ? chan : NULL;
+}
+
+
 int turnc_chan_hash_alloc(struct channels **cp, uint32_t bsize)
 {
 	struct channels *c;
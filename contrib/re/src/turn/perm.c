@@ -154,6 +154,10 @@ int turnc_add_perm(struct turnc *turnc, const struct sa *peer,
 	if (!turnc || !peer)
 		return EINVAL;
 
+	/* a peer with a port will get data soon, bind a channel now */
+	if (sa_port(peer))
+		(void)turnc_chan_autobind(turnc, peer);
+
 	if (perm_find(turnc, peer))
 		return 0;
 
@@ -273,7 +273,7 @@ static bool udp_send_handler(int *err, struct sa *dst, struct mbuf *mb,
 	if (mb->pos < CHAN_HDR_SIZE)
 		return false;
 
-	chan = turnc_chan_find_peer(turnc, dst);
+	chan = turnc_chan_send(turnc, dst);
 	if (chan) {
 		struct chan_hdr hdr;
 
@@ -284,6 +284,8 @@ static bool udp_send_handler(int *err, struct sa *dst, struct mbuf *mb,
 		*err = turnc_chan_hdr_encode(&hdr, mb);
 		mb->pos -= CHAN_HDR_SIZE;
 
+		turnc->stats.chan_tx += mbuf_get_left(mb);
+
 		*dst = turnc->srv;
 
 		return false;
@@ -302,6 +304,8 @@ static bool udp_send_handler(int *err, struct sa *dst, struct mbuf *mb,
 			       STUN_ATTR_DATA, mb);
 	mb->pos = pos;
 
+	turnc->stats.ind_tx += mbuf_get_left(mb);
+
 	*dst = turnc->srv;
 
 	return false;
@@ -313,6 +317,7 @@ static bool udp_recv_handler(struct sa *src, struct mbuf *mb, void *arg)
 	struct stun_attr *peer, *data;
 	struct stun_unknown_attr ua;
 	struct turnc *turnc = arg;
+	const size_t len = mbuf_get_left(mb);
 	struct stun_msg *msg;
 	bool hdld = true;
 
@@ -337,6 +342,8 @@ static bool udp_recv_handler(struct sa *src, struct mbuf *mb, void *arg)
 
 		*src = *turnc_chan_peer(chan);
 
+		turnc->stats.chan_rx += CHAN_HDR_SIZE + hdr.len;
+
 		return false;
 	}
 
@@ -356,6 +363,8 @@ static bool udp_recv_handler(struct sa *src, struct mbuf *mb, void *arg)
 
 		*src = peer->v.xor_peer_addr;
 
+		turnc->stats.ind_rx += len;
+
 		mb->pos = data->v.data.pos;
 		mb->end = data->v.data.end;
 
@@ -477,7 +486,7 @@ int turnc_send(struct turnc *turnc, const struct sa *dst, struct mbuf *mb)
 	if (!turnc || !dst || !mb)
 		return EINVAL;
 
-	chan = turnc_chan_find_peer(turnc, dst);
+	chan = turnc_chan_send(turnc, dst);
 	if (chan) {
 		struct chan_hdr hdr;
 
@@ -507,6 +516,8 @@ int turnc_send(struct turnc *turnc, const struct sa *dst, struct mbuf *mb)
 		}
 
 		mb->pos = pos;
+
+		turnc->stats.chan_tx += mbuf_get_left(mb);
 	}
 	else {
 		indlen = stun_indlen(dst);
@@ -526,12 +537,16 @@ int turnc_send(struct turnc *turnc, const struct sa *dst, struct mbuf *mb)
 			return err;
 
 		mb->pos = pos;
+
+		turnc->stats.ind_tx += mbuf_get_left(mb);
 	}
 
 	switch (turnc->proto) {
 
 	case IPPROTO_UDP:
-		err = udp_send(turnc->sock, &turnc->srv, mb);
+		/* already encapsulated, skip our own send helper */
+		err = udp_send_helper(turnc->sock, &turnc->srv, mb,
+				      turnc->uh);
 		break;
 
 	case IPPROTO_TCP:
@@ -558,11 +573,14 @@ int turnc_recv(struct turnc *turnc, struct sa *src, struct mbuf *mb)
 	struct stun_attr *peer, *data;
 	struct stun_unknown_attr ua;
 	struct stun_msg *msg;
+	size_t len;
 	int err = 0;
 
 	if (!turnc || !src || !mb)
 		return EINVAL;
 
+	len = mbuf_get_left(mb);
+
 	if (stun_msg_decode(&msg, mb, &ua)) {
 
 		struct chan_hdr hdr;
@@ -580,6 +598,8 @@ int turnc_recv(struct turnc *turnc, struct sa *src, struct mbuf *mb)
 
 		*src = *turnc_chan_peer(chan);
 
+		turnc->stats.chan_rx += CHAN_HDR_SIZE + hdr.len;
+
 		return 0;
 	}
 
@@ -605,6 +625,8 @@ int turnc_recv(struct turnc *turnc, struct sa *src, struct mbuf *mb)
 
 		*src = peer->v.xor_peer_addr;
 
+		turnc->stats.ind_rx += len;
+
 		mb->pos = data->v.data.pos;
 		mb->end = data->v.data.end;
 		break;
@@ -680,3 +702,16 @@ int turnc_keygen(struct turnc *turnc, const struct stun_msg *msg)
 	return md5_printf(turnc->md5_hash, "%s:%s:%s",
 			  turnc->username, turnc->realm, turnc->password);
 }
+
+
+/**
+ * Get the data counters of a TURN Client
+ *
+ * @param turnc TURN Client
+ *
+ * @return Data counters, NULL if no client
+ */
+const struct turnc_stats *turnc_stats_get(const struct turnc *turnc)
+{
+	return turnc ? &turnc->stats : NULL;
+}
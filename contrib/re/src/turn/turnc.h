@@ -34,6 +34,7 @@ struct turnc {
 	char *realm;                   /**< Saved REALM value from server   */
 	struct hash *perms;            /**< Hash-table of permissions       */
 	struct channels *chans;        /**< TURN Channels                   */
+	struct turnc_stats stats;      /**< Data counters                   */
 	bool allocated;                /**< Allocation was done flag        */
 };
 
@@ -64,6 +65,9 @@ int turnc_chan_hash_alloc(struct channels **cp, uint32_t bsize);
 struct chan *turnc_chan_find_numb(const struct turnc *turnc, uint16_t nr);
 struct chan *turnc_chan_find_peer(const struct turnc *turnc,
 				  const struct sa *peer);
+struct chan *turnc_chan_send(const struct turnc *turnc,
+			     const struct sa *peer);
+int turnc_chan_autobind(struct turnc *turnc, const struct sa *peer);
 uint16_t turnc_chan_numb(const struct chan *chan);
 const struct sa *turnc_chan_peer(const struct chan *chan);
 int turnc_chan_hdr_encode(const struct chan_hdr *hdr, struct mbuf *mb);
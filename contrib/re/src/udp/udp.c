@@ -3,6 +3,9 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#if defined (HAVE_RECVMMSG) || defined (HAVE_SENDMMSG)
+#define _GNU_SOURCE 1
+#endif
 #include <stdlib.h>
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
@@ -22,15 +25,30 @@
 #ifdef __APPLE__
 #include "TargetConditionals.h"
 #endif
+#if defined (HAVE_RECVMMSG) || defined (HAVE_SENDMMSG)
+#include <sys/socket.h>
+#endif
+#ifdef HAVE_SENDMMSG
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include <re_types.h>
 #include <re_fmt.h>
 #include <re_mem.h>
 #include <re_mbuf.h>
 #include <re_list.h>
+#include <re_tmr.h>
 #include <re_main.h>
 #include <re_sa.h>
 #include <re_net.h>
 #include <re_udp.h>
+#ifdef HAVE_PTHREAD
+#include <re_lock.h>
+#include <re_mqueue.h>
+#endif
 
 
 #define DEBUG_MODULE "udp"
@@ -56,7 +74,58 @@
 
 
 enum {
-	UDP_RXSZ_DEFAULT = 8192
+	UDP_RXSZ_DEFAULT = 8192,
+	UDP_RXBATCH_MAX  = 64,
+	UDP_TXQ_MAX      = 64,
+	UDP_TXQ_PKTSZ    = 1536,
+	UDP_GSO_MAXSZ    = 65000
+};
+
+
+/** Defines the batched receive state of a UDP socket */
+struct udp_rxbatch {
+	struct mbuf **mbv;       /**< Recycled receive buffers     */
+	struct sa *srcv;         /**< Source addresses             */
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr *msgv;    /**< Message headers for recvmmsg */
+	struct iovec *iov;       /**< I/O vectors for recvmmsg     */
+#endif
+	unsigned n;              /**< Max datagrams per wakeup     */
+};
+
+
+/** Defines a queued outgoing datagram */
+struct udp_txpkt {
+	struct sa dst;           /**< Destination address          */
+	size_t off;              /**< Offset in queue buffer       */
+	size_t len;              /**< Length of datagram           */
+	int fd;                  /**< Socket file descriptor       */
+};
+
+/** Defines the transmit queue of a UDP socket */
+struct udp_txqueue {
+	struct tmr tmr;          /**< Flush at end of loop         */
+	struct udp_txstat stat;  /**< Transmit statistics          */
+	struct udp_txpkt *pktv;  /**< Queued datagrams             */
+	uint8_t *buf;            /**< Datagram payloads            */
+	size_t size;             /**< Size of payload buffer       */
+	size_t used;             /**< Used bytes of payload buffer */
+	unsigned n;              /**< Max queued datagrams         */
+	unsigned cnt;            /**< Number of queued datagrams   */
+	int err;                 /**< First unreported send error  */
+	bool gso;                /**< Use UDP GSO if supported     */
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr *msgv;    /**< Message headers for sendmmsg */
+	struct iovec *iov;       /**< I/O vectors for sendmmsg     */
+	unsigned *segv;          /**< Datagrams per message        */
+	uint8_t *ctrl;           /**< GSO control messages         */
+#endif
+#ifdef HAVE_PTHREAD
+	pthread_t owner;         /**< Thread running the queue     */
+	struct lock *lock;       /**< Queue shared with threads    */
+	struct mqueue *mq;       /**< Wakes up the owner thread    */
+	bool wake;               /**< Wakeup of the owner pending  */
+#endif
 };
 
 
@@ -71,6 +140,8 @@ struct udp_sock {
 	bool conn;           /**< Connected socket flag       */
 	size_t rxsz;         /**< Maximum receive chunk size  */
 	size_t rx_presz;     /**< Preallocated rx buffer size */
+	struct udp_rxbatch *rxb; /**< Batched receive, optional  */
+	struct udp_txqueue *txq; /**< Transmit queue, optional   */
 };
 
 /** Defines a UDP helper */
@@ -119,6 +190,13 @@ static void udp_destructor(void *data)
 
 	list_flush(&us->helpers);
 
+	mem_deref(us->rxb);
+
+	if (us->txq) {
+		udp_txqueue_flush(us);
+		mem_deref(us->txq);
+	}
+
 	if (-1 != us->fd) {
 		fd_close(us->fd);
 		(void)close(us->fd);
@@ -131,81 +209,64 @@ static void udp_destructor(void *data)
 }
 
 
-static void udp_read(struct udp_sock *us, int fd)
+static void udp_read_error(struct udp_sock *us, int err)
 {
-	struct mbuf *mb = mbuf_alloc(us->rxsz);
-	struct sa src;
-	struct le *le;
-	int err = 0;
-	ssize_t n;
-
-	if (!mb)
+	if (EAGAIN == err)
 		return;
 
-	src.len = sizeof(src.u);
-	n = recvfrom(fd, BUF_CAST mb->buf + us->rx_presz,
-		     mb->size - us->rx_presz, 0,
-		     &src.u.sa, &src.len);
-	if (n < 0) {
-		err = errno;
-
-		if (EAGAIN == err)
-			goto out;
-
 #ifdef EWOULDBLOCK
-		if (EWOULDBLOCK == err)
-			goto out;
+	if (EWOULDBLOCK == err)
+		return;
 #endif
 
 #if TARGET_OS_IPHONE
-		if (ENOTCONN == err) {
-
-			struct udp_sock *us_new;
-			struct sa laddr;
+	if (ENOTCONN == err) {
 
-			err = udp_local_get(us, &laddr);
-			if (err)
-				goto out;
+		struct udp_sock *us_new;
+		struct sa laddr;
 
-			if (-1 != us->fd) {
-				fd_close(us->fd);
-				(void)close(us->fd);
-				us->fd = -1;
-			}
+		err = udp_local_get(us, &laddr);
+		if (err)
+			return;
 
-			if (-1 != us->fd6) {
-				fd_close(us->fd6);
-				(void)close(us->fd6);
-				us->fd6 = -1;
-			}
+		if (-1 != us->fd) {
+			fd_close(us->fd);
+			(void)close(us->fd);
+			us->fd = -1;
+		}
 
-			err = udp_listen(&us_new, &laddr, NULL, NULL);
-			if (err)
-				goto out;
+		if (-1 != us->fd6) {
+			fd_close(us->fd6);
+			(void)close(us->fd6);
+			us->fd6 = -1;
+		}
 
-			us->fd  = us_new->fd;
-			us->fd6 = us_new->fd6;
+		err = udp_listen(&us_new, &laddr, NULL, NULL);
+		if (err)
+			return;
 
-			us_new->fd  = -1;
-			us_new->fd6 = -1;
+		us->fd  = us_new->fd;
+		us->fd6 = us_new->fd6;
 
-			mem_deref(us_new);
+		us_new->fd  = -1;
+		us_new->fd6 = -1;
 
-			udp_thread_attach(us);
+		mem_deref(us_new);
 
-			goto out;
-		}
-#endif
-		if (us->eh)
-			us->eh(err, us->arg);
+		udp_thread_attach(us);
 
-		goto out;
+		return;
 	}
+#endif
+	if (us->eh)
+		us->eh(err, us->arg);
+}
 
-	mb->pos = us->rx_presz;
-	mb->end = n + us->rx_presz;
 
-	(void)mbuf_resize(mb, mb->end);
+static void udp_recv_deliver(struct udp_sock *us, struct sa *src,
+			     struct mbuf *mb)
+{
+	struct le *le;
 
 	/* call helpers */
 	le = us->helpers.head;
@@ -215,12 +276,167 @@ static void udp_read(struct udp_sock *us, int fd)
 
 		le = le->next;
 
-		hdld = uh->recvh(&src, mb, uh->arg);
+		hdld = uh->recvh(src, mb, uh->arg);
 		if (hdld)
+			return;
+	}
+
+	us->rh(src, mb, us->arg);
+}
+
+
+static void rxbatch_destructor(void *data)
+{
+	struct udp_rxbatch *rxb = data;
+	unsigned i;
+
+	for (i = 0; i < rxb->n; i++)
+		mem_deref(rxb->mbv[i]);
+
+	mem_deref(rxb->mbv);
+	mem_deref(rxb->srcv);
+#ifdef HAVE_RECVMMSG
+	mem_deref(rxb->msgv);
+	mem_deref(rxb->iov);
+#endif
+}
+
+
+/*
+ * Get a receive buffer for slot i. The previous buffer is recycled,
+ * unless a handler is still holding a reference to it.
+ */
+static struct mbuf *rxbatch_mbuf(struct udp_rxbatch *rxb, unsigned i,
+				 size_t size)
+{
+	struct mbuf *mb = rxb->mbv[i];
+
+	if (mb && mem_nrefs(mb) == 1 && mb->size >= size) {
+		mbuf_rewind(mb);
+		return mb;
+	}
+
+	mem_deref(mb);
+	rxb->mbv[i] = mbuf_alloc(size);
+
+	return rxb->mbv[i];
+}
+
+
+static void udp_read_batch(struct udp_sock *us, int fd)
+{
+	struct udp_rxbatch *rxb = mem_ref(us->rxb);
+	unsigned i, cnt;
+	int n, err = 0;
+
+	mem_ref(us);
+
+	for (cnt = 0; cnt < rxb->n; cnt++) {
+
+		if (!rxbatch_mbuf(rxb, cnt, us->rxsz))
+			break;
+	}
+
+	if (!cnt)
+		goto out;
+
+#ifdef HAVE_RECVMMSG
+	for (i = 0; i < cnt; i++) {
+		struct mbuf *mb = rxb->mbv[i];
+		struct msghdr *hdr = &rxb->msgv[i].msg_hdr;
+
+		rxb->iov[i].iov_base = mb->buf + us->rx_presz;
+		rxb->iov[i].iov_len  = mb->size - us->rx_presz;
+
+		memset(hdr, 0, sizeof(*hdr));
+		hdr->msg_name    = &rxb->srcv[i].u.sa;
+		hdr->msg_namelen = sizeof(rxb->srcv[i].u);
+		hdr->msg_iov     = &rxb->iov[i];
+		hdr->msg_iovlen  = 1;
+	}
+
+	n = recvmmsg(fd, rxb->msgv, cnt, 0, NULL);
+	if (n < 0) {
+		udp_read_error(us, errno);
+		goto out;
+	}
+
+	for (i = 0; i < (unsigned)n; i++) {
+		struct mbuf *mb = rxb->mbv[i];
+
+		rxb->srcv[i].len = rxb->msgv[i].msg_hdr.msg_namelen;
+
+		mb->pos = us->rx_presz;
+		mb->end = rxb->msgv[i].msg_len + us->rx_presz;
+	}
+#else
+	for (n = 0; n < (int)cnt; n++) {
+		struct mbuf *mb = rxb->mbv[n];
+		struct sa *src = &rxb->srcv[n];
+		ssize_t len;
+
+		src->len = sizeof(src->u);
+		len = recvfrom(fd, BUF_CAST mb->buf + us->rx_presz,
+			       mb->size - us->rx_presz, 0,
+			       &src->u.sa, &src->len);
+		if (len < 0) {
+			err = errno;
+			break;
+		}
+
+		mb->pos = us->rx_presz;
+		mb->end = len + us->rx_presz;
+	}
+#endif
+
+	for (i = 0; i < (unsigned)n; i++) {
+
+		/* the socket was closed by one of the handlers */
+		if (mem_nrefs(us) == 1)
 			goto out;
+
+		udp_recv_deliver(us, &rxb->srcv[i], rxb->mbv[i]);
+	}
+
+	if (err && mem_nrefs(us) > 1)
+		udp_read_error(us, err);
+
+ out:
+	mem_deref(us);
+	mem_deref(rxb);
+}
+
+
+static void udp_read(struct udp_sock *us, int fd)
+{
+	struct mbuf *mb;
+	struct sa src;
+	ssize_t n;
+
+	if (us->rxb) {
+		udp_read_batch(us, fd);
+		return;
+	}
+
+	mb = mbuf_alloc(us->rxsz);
+	if (!mb)
+		return;
+
+	src.len = sizeof(src.u);
+	n = recvfrom(fd, BUF_CAST mb->buf + us->rx_presz,
+		     mb->size - us->rx_presz, 0,
+		     &src.u.sa, &src.len);
+	if (n < 0) {
+		udp_read_error(us, errno);
+		goto out;
 	}
 
-	us->rh(&src, mb, us->arg);
+	mb->pos = us->rx_presz;
+	mb->end = n + us->rx_presz;
+
+	(void)mbuf_resize(mb, mb->end);
+
+	udp_recv_deliver(us, &src, mb);
 
  out:
 	mem_deref(mb);
@@ -426,6 +642,339 @@ int udp_connect(struct udp_sock *us, const struct sa *peer)
 }
 
 
+static bool txq_is_owner(const struct udp_txqueue *txq)
+{
+#ifdef HAVE_PTHREAD
+	return 0 != pthread_equal(txq->owner, pthread_self());
+#else
+	(void)txq;
+	return true;
+#endif
+}
+
+
+static inline void txq_lock(struct udp_txqueue *txq)
+{
+#ifdef HAVE_PTHREAD
+	lock_write_get(txq->lock);
+#else
+	(void)txq;
+#endif
+}
+
+
+static inline void txq_unlock(struct udp_txqueue *txq)
+{
+#ifdef HAVE_PTHREAD
+	lock_rel(txq->lock);
+#else
+	(void)txq;
+#endif
+}
+
+
+static void txq_flush(struct udp_sock *us);
+
+
+/*
+ * Flush the queue on the owner thread. Send errors of queued datagrams
+ * go to the error handler.
+ */
+static void txq_flush_report(struct udp_sock *us)
+{
+	struct udp_txqueue *txq = us->txq;
+	int err;
+
+	txq_lock(txq);
+
+	txq_flush(us);
+
+	err = txq->err;
+	txq->err = 0;
+#ifdef HAVE_PTHREAD
+	txq->wake = false;
+#endif
+
+	txq_unlock(txq);
+
+	if (err && us->eh)
+		us->eh(err, us->arg);
+}
+
+
+static void txq_flush_handler(void *arg)
+{
+	txq_flush_report(arg);
+}
+
+
+#ifdef HAVE_PTHREAD
+/* Datagrams queued by other threads */
+static void txq_mqueue_handler(int id, void *data, void *arg)
+{
+	(void)id;
+	(void)data;
+
+	txq_flush_report(arg);
+}
+#endif
+
+
+static void txq_error(struct udp_txqueue *txq, int err, unsigned n)
+{
+	txq->stat.n_err += n;
+
+	if (!txq->err)
+		txq->err = err;
+}
+
+
+/*
+ * Copy a datagram into the transmit queue of the socket. The owner
+ * thread flushes the queue at the end of the main loop iteration.
+ * Other threads wake up the owner thread once for the datagrams they
+ * queue until it flushes, so that a burst is sent in one go. A thread
+ * that finds the queue full flushes it itself.
+ */
+static int txq_push(struct udp_sock *us, int fd, const struct sa *dst,
+		    struct mbuf *mb)
+{
+	struct udp_txqueue *txq = us->txq;
+	const size_t len = mbuf_get_left(mb);
+	const bool owner = txq_is_owner(txq);
+	struct udp_txpkt *pkt;
+	bool wake = false;
+
+	txq_lock(txq);
+
+	if (len > UDP_TXQ_PKTSZ) {
+
+		/* keep the order of queued datagrams */
+		++txq->stat.n_direct;
+		txq_flush(us);
+
+		txq_unlock(txq);
+
+		return EMSGSIZE;
+	}
+
+	if (txq->cnt >= txq->n || txq->used + len > txq->size)
+		txq_flush(us);
+
+	pkt = &txq->pktv[txq->cnt++];
+
+	sa_cpy(&pkt->dst, dst);
+	pkt->off = txq->used;
+	pkt->len = len;
+	pkt->fd  = fd;
+
+	memcpy(txq->buf + txq->used, mbuf_buf(mb), len);
+	txq->used += len;
+
+#ifdef HAVE_PTHREAD
+	if (!owner) {
+		++txq->stat.n_handoff;
+		wake = !txq->wake;
+		txq->wake = true;
+	}
+#endif
+
+	txq_unlock(txq);
+
+	if (owner) {
+		if (!tmr_isrunning(&txq->tmr))
+			tmr_start(&txq->tmr, 0, txq_flush_handler, us);
+	}
+#ifdef HAVE_PTHREAD
+	else if (wake && mqueue_push(txq->mq, 0, NULL)) {
+
+		/* the next datagram tries again */
+		txq_lock(txq);
+		txq->wake = false;
+		txq_unlock(txq);
+	}
+#else
+	(void)wake;
+#endif
+
+	return 0;
+}
+
+
+static void txq_send_single(struct udp_sock *us, const struct udp_txpkt *pkt)
+{
+	struct udp_txqueue *txq = us->txq;
+	const uint8_t *buf = txq->buf + pkt->off;
+	ssize_t n;
+
+	if (us->conn)
+		n = send(pkt->fd, BUF_CAST buf, pkt->len, 0);
+	else
+		n = sendto(pkt->fd, BUF_CAST buf, pkt->len, 0,
+			   &pkt->dst.u.sa, pkt->dst.len);
+
+	++txq->stat.n_syscall;
+
+	if (n < 0)
+		txq_error(txq, errno, 1);
+	else
+		++txq->stat.n_pkt;
+}
+
+
+#ifdef HAVE_SENDMMSG
+/* The errors of a GSO message that the kernel or device cannot send */
+static bool gso_unsupported(int err)
+{
+	return err == EIO || err == EINVAL || err == ENOPROTOOPT;
+}
+
+
+/*
+ * Number of datagrams from index i that can go out as one GSO
+ * message: same socket and destination, equal size except the last.
+ */
+static unsigned txq_gso_run(const struct udp_txqueue *txq, unsigned i)
+{
+#ifdef UDP_SEGMENT
+	const struct udp_txpkt *first = &txq->pktv[i];
+	size_t total = first->len;
+	unsigned k;
+
+	if (!txq->gso)
+		return 1;
+
+	for (k = i + 1; k < txq->cnt && k - i < UDP_TXQ_MAX; k++) {
+
+		const struct udp_txpkt *pkt = &txq->pktv[k];
+
+		if (txq->pktv[k-1].len != first->len)
+			break;
+
+		if (pkt->fd != first->fd || pkt->len > first->len)
+			break;
+
+		if (!sa_cmp(&pkt->dst, &first->dst, SA_ALL))
+			break;
+
+		if (total + pkt->len > UDP_GSO_MAXSZ)
+			break;
+
+		total += pkt->len;
+	}
+
+	return k - i;
+#else
+	(void)txq;
+	(void)i;
+	return 1;
+#endif
+}
+
+
+static void txq_flush_mmsg(struct udp_sock *us, unsigned first,
+			   unsigned end)
+{
+	struct udp_txqueue *txq = us->txq;
+	const int fd = txq->pktv[first].fd;
+	unsigned i = first, nmsg = 0, off = 0;
+
+	while (i < end) {
+
+		const struct udp_txpkt *pkt = &txq->pktv[i];
+		struct msghdr *hdr = &txq->msgv[nmsg].msg_hdr;
+		const unsigned segs = txq_gso_run(txq, i);
+		size_t len = 0;
+		unsigned k;
+
+		for (k = i; k < i + segs; k++)
+			len += txq->pktv[k].len;
+
+		txq->iov[nmsg].iov_base = txq->buf + pkt->off;
+		txq->iov[nmsg].iov_len  = len;
+
+		memset(hdr, 0, sizeof(*hdr));
+		hdr->msg_iov    = &txq->iov[nmsg];
+		hdr->msg_iovlen = 1;
+
+		if (!us->conn) {
+			hdr->msg_name    = (void *)&pkt->dst.u.sa;
+			hdr->msg_namelen = pkt->dst.len;
+		}
+
+#ifdef UDP_SEGMENT
+		if (segs > 1) {
+			uint8_t *ctrl = txq->ctrl
+				+ nmsg * CMSG_SPACE(sizeof(uint16_t));
+			struct cmsghdr *cm = (struct cmsghdr *)(void *)ctrl;
+
+			memset(ctrl, 0, CMSG_SPACE(sizeof(uint16_t)));
+			hdr->msg_control    = ctrl;
+			hdr->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+
+			cm->cmsg_level = SOL_UDP;
+			cm->cmsg_type  = UDP_SEGMENT;
+			cm->cmsg_len   = CMSG_LEN(sizeof(uint16_t));
+			*(uint16_t *)(void *)CMSG_DATA(cm) =
+				(uint16_t)pkt->len;
+		}
+#endif
+
+		txq->segv[nmsg++] = segs;
+		i += segs;
+	}
+
+	i = first;
+
+	while (off < nmsg) {
+
+		int n = sendmmsg(fd, &txq->msgv[off], nmsg - off, 0);
+		const int err = n < 0 ? errno : EIO;
+		unsigned segs;
+
+		++txq->stat.n_syscall;
+
+		if (n > 0) {
+			while (n--) {
+				const unsigned nseg = txq->segv[off++];
+
+				txq->stat.n_pkt += nseg;
+				if (nseg > 1)
+					txq->stat.n_gso += nseg;
+
+				i += nseg;
+			}
+			continue;
+		}
+
+		if (err == EINTR)
+			continue;
+
+		segs = txq->segv[off];
+
+		/* GSO not supported, send the datagrams one by one */
+		if (segs > 1 && gso_unsupported(err)) {
+
+			unsigned k;
+
+			DEBUG_INFO("sendmmsg: disable GSO (%m)\n", err);
+			txq->gso = false;
+
+			for (k = i; k < i + segs; k++)
+				txq_send_single(us, &txq->pktv[k]);
+		}
+		else {
+			/* e.g. EAGAIN or ENOBUFS, drop the message */
+			txq_error(txq, err, segs);
+		}
+
+		i += segs;
+		++off;
+	}
+}
+#endif
+
+
 static int udp_send_internal(struct udp_sock *us, const struct sa *dst,
 			     struct mbuf *mb, struct le *le)
 {
@@ -453,6 +1002,9 @@ static int udp_send_internal(struct udp_sock *us, const struct sa *dst,
 			return err;
 	}
 
+	if (us->txq && 0 == txq_push(us, fd, dst, mb))
+		return 0;
+
 	/* Connected socket? */
 	if (us->conn) {
 		if (send(fd, BUF_CAST mb->buf + mb->pos, mb->end - mb->pos,
@@ -628,6 +1180,230 @@ void udp_rxbuf_presz_set(struct udp_sock *us, size_t rx_presz)
 }
 
 
+/**
+ * Set the number of datagrams to receive per wakeup on a UDP Socket.
+ * The datagrams are received into a pool of recycled buffers, using
+ * recvmmsg() where available, and passed to the helpers and the
+ * receive handler one by one.
+ *
+ * @param us UDP Socket
+ * @param n  Maximum number of datagrams per wakeup, 0 or 1 to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udp_rxbatch_set(struct udp_sock *us, unsigned n)
+{
+	struct udp_rxbatch *rxb;
+	int err = 0;
+
+	if (!us || n > UDP_RXBATCH_MAX)
+		return EINVAL;
+
+	us->rxb = mem_deref(us->rxb);
+
+	if (n <= 1)
+		return 0;
+
+	rxb = mem_zalloc(sizeof(*rxb), rxbatch_destructor);
+	if (!rxb)
+		return ENOMEM;
+
+	rxb->n = n;
+
+	rxb->mbv  = mem_zalloc(n * sizeof(*rxb->mbv), NULL);
+	rxb->srcv = mem_zalloc(n * sizeof(*rxb->srcv), NULL);
+	if (!rxb->mbv || !rxb->srcv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+#ifdef HAVE_RECVMMSG
+	rxb->msgv = mem_zalloc(n * sizeof(*rxb->msgv), NULL);
+	rxb->iov  = mem_zalloc(n * sizeof(*rxb->iov), NULL);
+	if (!rxb->msgv || !rxb->iov) {
+		err = ENOMEM;
+		goto out;
+	}
+#endif
+
+ out:
+	if (err)
+		mem_deref(rxb);
+	else
+		us->rxb = rxb;
+
+	return err;
+}
+
+
+static void txqueue_destructor(void *data)
+{
+	struct udp_txqueue *txq = data;
+
+	tmr_cancel(&txq->tmr);
+#ifdef HAVE_PTHREAD
+	mem_deref(txq->mq);
+	mem_deref(txq->lock);
+#endif
+	mem_deref(txq->pktv);
+	mem_deref(txq->buf);
+#ifdef HAVE_SENDMMSG
+	mem_deref(txq->msgv);
+	mem_deref(txq->iov);
+	mem_deref(txq->segv);
+	mem_deref(txq->ctrl);
+#endif
+}
+
+
+/**
+ * Enable a transmit queue on a UDP Socket. Datagrams are queued and
+ * flushed at the end of the current main loop iteration of the calling
+ * thread, using sendmmsg() and UDP GSO where available. Datagrams sent
+ * from other threads are queued as well, and the calling thread is
+ * woken up to flush them.
+ *
+ * udp_send() returns 0 for a queued datagram. If it cannot be sent
+ * later, the error is reported to the error handler of the socket.
+ *
+ * @param us UDP Socket
+ * @param n  Maximum number of queued datagrams, 0 to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udp_txqueue_set(struct udp_sock *us, unsigned n)
+{
+	struct udp_txqueue *txq;
+	int err = 0;
+
+	if (!us || n > UDP_TXQ_MAX)
+		return EINVAL;
+
+	if (us->txq) {
+		udp_txqueue_flush(us);
+		us->txq = mem_deref(us->txq);
+	}
+
+	if (!n)
+		return 0;
+
+	txq = mem_zalloc(sizeof(*txq), txqueue_destructor);
+	if (!txq)
+		return ENOMEM;
+
+	txq->n    = n;
+	txq->size = n * UDP_TXQ_PKTSZ;
+	txq->gso  = true;
+#ifdef HAVE_PTHREAD
+	txq->owner = pthread_self();
+
+	err  = lock_alloc(&txq->lock);
+	err |= mqueue_alloc(&txq->mq, txq_mqueue_handler, us);
+	if (err)
+		goto out;
+#endif
+
+	txq->pktv = mem_zalloc(n * sizeof(*txq->pktv), NULL);
+	txq->buf  = mem_alloc(txq->size, NULL);
+	if (!txq->pktv || !txq->buf) {
+		err = ENOMEM;
+		goto out;
+	}
+
+#ifdef HAVE_SENDMMSG
+	txq->msgv = mem_zalloc(n * sizeof(*txq->msgv), NULL);
+	txq->iov  = mem_zalloc(n * sizeof(*txq->iov), NULL);
+	txq->segv = mem_zalloc(n * sizeof(*txq->segv), NULL);
+	txq->ctrl = mem_zalloc(n * CMSG_SPACE(sizeof(uint16_t)), NULL);
+	if (!txq->msgv || !txq->iov || !txq->segv || !txq->ctrl) {
+		err = ENOMEM;
+		goto out;
+	}
+#endif
+
+ out:
+	if (err)
+		mem_deref(txq);
+	else
+		us->txq = txq;
+
+	return err;
+}
+
+
+static void txq_flush(struct udp_sock *us)
+{
+	struct udp_txqueue *txq = us->txq;
+	unsigned i = 0;
+
+	while (i < txq->cnt) {
+
+		const int fd = txq->pktv[i].fd;
+		unsigned end = i + 1;
+
+		while (end < txq->cnt && txq->pktv[end].fd == fd)
+			++end;
+
+#ifdef HAVE_SENDMMSG
+		txq_flush_mmsg(us, i, end);
+#else
+		for (; i < end; i++)
+			txq_send_single(us, &txq->pktv[i]);
+#endif
+		i = end;
+	}
+
+	txq->cnt  = 0;
+	txq->used = 0;
+}
+
+
+/**
+ * Send all datagrams in the transmit queue of a UDP Socket
+ *
+ * @param us UDP Socket
+ *
+ * @return 0 if success, otherwise the first send error
+ */
+int udp_txqueue_flush(struct udp_sock *us)
+{
+	int err;
+
+	if (!us || !us->txq)
+		return EINVAL;
+
+	txq_lock(us->txq);
+
+	txq_flush(us);
+
+	err = us->txq->err;
+	us->txq->err = 0;
+
+	txq_unlock(us->txq);
+
+	if (txq_is_owner(us->txq))
+		tmr_cancel(&us->txq->tmr);
+
+	return err;
+}
+
+
+/**
+ * Get the transmit queue statistics of a UDP Socket
+ *
+ * @param us UDP Socket
+ *
+ * @return Transmit statistics, NULL if no transmit queue
+ */
+const struct udp_txstat *udp_txqueue_stat(const struct udp_sock *us)
+{
+	if (!us || !us->txq)
+		return NULL;
+
+	return &us->txq->stat;
+}
+
+
 /**
  * Set receive handler on a UDP Socket
  *
@@ -16,7 +16,8 @@
 struct shim {
 	struct tcp_conn *tc;
 	struct tcp_helper *th;
-	struct mbuf *mb;
+	struct tcp_framer *framer;
+	struct mbuf *mb;           /* frame for the next recv-handler */
 	shim_frame_h *frameh;
 	void *arg;
 
@@ -52,92 +53,71 @@ static bool shim_send_handler(int *err, struct mbuf *mb, void *arg)
 }
 
 
-static bool shim_recv_handler(int *errp, struct mbuf *mbx, bool *estab,
-			      void *arg)
+static int shim_frame_len_handler(size_t *lenp, const struct mbuf *mb,
+				  void *arg)
 {
-	struct shim *shim = arg;
-	int err = 0;
-	(void)estab;
-
-	/* handle re-assembly */
-	if (!shim->mb) {
-		shim->mb = mbuf_alloc(1024);
-		if (!shim->mb) {
-			*errp = ENOMEM;
-			return true;
-		}
-	}
-
-	if (shim->mb) {
-		size_t pos;
-
-		pos = shim->mb->pos;
-
-		shim->mb->pos = shim->mb->end;
+	const uint8_t *p = mbuf_buf(mb);
+	(void)arg;
 
-		err = mbuf_write_mem(shim->mb, mbuf_buf(mbx),
-				     mbuf_get_left(mbx));
-		if (err)
-			goto out;
-
-		shim->mb->pos = pos;
-	}
-
-	/* extract all SHIM-frames in the TCP-stream */
-	for (;;) {
+	if (mbuf_get_left(mb) < SHIM_HDR_SIZE)
+		return ENODATA;
 
-		size_t start, len, pos, end;
-		bool hdld;
+	*lenp = SHIM_HDR_SIZE + (p[0] << 8 | p[1]);
 
-		start = shim->mb->pos;
+	return 0;
+}
 
-		if (mbuf_get_left(shim->mb) < (SHIM_HDR_SIZE))
-			break;
 
-		len = ntohs(mbuf_read_u16(shim->mb));
+static bool shim_frame_handler(struct mbuf *mb, void *arg)
+{
+	struct shim *shim = arg;
+	int err;
 
-		if (mbuf_get_left(shim->mb) < len)
-			goto rewind;
+	mb->pos += SHIM_HDR_SIZE;
 
-		pos = shim->mb->pos;
-		end = shim->mb->end;
+	++shim->n_rx;
 
-		shim->mb->end = pos + len;
+	if (shim->frameh(mb, shim->arg))
+		return true;
 
-		++shim->n_rx;
+	/* pass the frame to the next recv-handler, the framer keeps
+	   the rest of the segment until the next one arrives */
+	shim->mb = mem_deref(shim->mb);
 
-		hdld = shim->frameh(shim->mb, shim->arg);
-		if (!hdld) {
-			/* XXX: handle multiple frames per segment */
+	shim->mb = mbuf_alloc(mbuf_get_left(mb));
+	if (!shim->mb)
+		return false;
 
-			shim->mb->pos = pos;
-			shim->mb->end = pos + len;
+	err = mbuf_write_mem(shim->mb, mbuf_buf(mb), mbuf_get_left(mb));
+	if (err)
+		shim->mb = mem_deref(shim->mb);
 
-			mbx->pos = mbx->end = 2;
-			err = mbuf_write_mem(mbx, mbuf_buf(shim->mb), len);
-			if (err)
-				goto out;
-			mbx->pos = 2;
+	return false;
+}
 
-			shim->mb->pos = pos + len;
-			shim->mb->end = end;
 
-			return false;  /* continue recv-handlers */
-		}
+static bool shim_recv_handler(int *errp, struct mbuf *mbx, bool *estab,
+			      void *arg)
+{
+	struct shim *shim = arg;
+	int err;
+	(void)estab;
 
-		shim->mb->pos = pos + len;
-		shim->mb->end = end;
+	/* extract all SHIM-frames in the TCP-stream */
+	err = tcp_framer_recv(shim->framer, mbx);
+	if (err)
+		goto out;
 
-		if (shim->mb->pos >= shim->mb->end) {
-			shim->mb = mem_deref(shim->mb);
-			break;
-		}
+	if (shim->mb) {
 
-		continue;
+		mbx->pos = mbx->end = 2;
+		err = mbuf_write_mem(mbx, shim->mb->buf, shim->mb->end);
+		shim->mb = mem_deref(shim->mb);
+		if (err)
+			goto out;
+		mbx->pos = 2;
 
-	rewind:
-		shim->mb->pos = start;
-		break;
+		return false;  /* continue recv-handlers */
 	}
 
  out:
@@ -154,6 +134,7 @@ static void destructor(void *arg)
 
 	mem_deref(shim->th);
 	mem_deref(shim->tc);
+	mem_deref(shim->framer);
 	mem_deref(shim->mb);
 }
 
@@ -172,6 +153,13 @@ int shim_insert(struct shim **shimp, struct tcp_conn *tc, int layer,
 		return ENOMEM;
 
 	shim->tc = mem_ref(tc);
+
+	err = tcp_framer_alloc(&shim->framer, SHIM_HDR_SIZE + 65535, 0,
+			       shim_frame_len_handler, shim_frame_handler,
+			       shim);
+	if (err)
+		goto out;
+
 	err = tcp_register_helper(&shim->th, tc, layer, NULL,
 				  shim_send_handler,
 				  shim_recv_handler, shim);
@@ -29,6 +29,7 @@ struct aucodec_param {
 	uint8_t  pt;
 	uint32_t srate;
 	uint8_t  ch;
+	uint8_t  extmap_aulevel;  /* RFC 6464 extension id, 0 if none */
 };
 
 struct media_ctx;
@@ -88,6 +89,8 @@ typedef int  (audec_rtcp_h)(struct audec_state *ads,
 typedef int  (audec_start_h)(struct audec_state *ads);
 typedef void (audec_stop_h)(struct audec_state *ads);
 typedef int  (audec_get_stats)(struct audec_state *ads, struct aucodec_stats *stats);
+typedef void (audec_level_h)(struct audec_state *ads,
+			     uint8_t level, bool vad);
 
 struct aucodec {
 	struct le le;
@@ -110,6 +113,7 @@ struct aucodec {
 	audec_start_h *dec_start;
 	audec_stop_h *dec_stop;
 	audec_get_stats *get_stats;
+	audec_level_h *dec_levelh;  /* smoothed RFC 6464 level, next packet */
 
 	sdp_fmtp_enc_h *fmtp_ench;
 	sdp_fmtp_cmp_h *fmtp_cmph;
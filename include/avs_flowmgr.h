@@ -31,6 +31,7 @@ int  flowmgr_is_ready(struct flowmgr *fm, bool *is_ready);
 void flowmgr_enable_dualstack(bool enable);
 void flowmgr_enable_loopback(bool enable);
 void flowmgr_enable_privacy(bool enable);
+void flowmgr_enable_turn_sharing(bool enable);
 void flowmgr_bind_interface(const char *ifname);
 
 struct mqueue *flowmgr_mqueue(void);
@@ -148,6 +149,14 @@ typedef void (flowmgr_media_estab_h)(const char *convid, bool estab,
 typedef void (flowmgr_conf_pos_h)(const char *convid,
 				  struct list *partl, void *arg);
 
+/**
+ * Callback used to inform user about the loudest speaker in a call,
+ * from the RFC 6464 audio levels. The userid is NULL when nobody is
+ * speaking.
+ */
+typedef void (flowmgr_active_speaker_h)(const char *convid,
+					const char *userid, void *arg);
+
 
 /**
  * Callback used to inform user that received audio is interrupted
@@ -236,6 +245,9 @@ void flowmgr_set_media_estab_handler(struct flowmgr *fm,
 void flowmgr_set_conf_pos_handler(struct flowmgr *fm,
 				  flowmgr_conf_pos_h *conf_posh,
 				  void *arg);
+void flowmgr_set_active_speaker_handler(struct flowmgr *fm,
+				flowmgr_active_speaker_h *speakerh,
+				void *arg);
 
 void flowmgr_set_username_handler(struct flowmgr *fm,
 				  flowmgr_username_h *usernameh, void *arg);
@@ -434,11 +446,15 @@ void flowmgr_enable_rcv_ns(bool enable);
 
 void flowmgr_set_bitrate(int rate_bps);
 void flowmgr_set_packet_size(int packet_size_ms);
+void flowmgr_enable_shared_encoder(bool enable);
+void flowmgr_set_max_speakers(unsigned n);
 
 typedef void (flowmgr_vm_play_status_h)(bool is_playing, unsigned int cur_time_ms, unsigned int file_length_ms, void *arg);
 
 int flowmgr_vm_start_record(struct flowmgr *fm, const char fileNameUTF8[1024]);
 int flowmgr_vm_stop_record(struct flowmgr *fm);
+typedef void (flowmgr_vm_record_status_h)(bool is_recording, unsigned int cur_time_ms, unsigned int backlog_ms, unsigned int n_dropped, void *arg);
+int flowmgr_vm_set_record_status_handler(struct flowmgr *fm, flowmgr_vm_record_status_h *handler, void *arg);
 int flowmgr_vm_get_length(struct flowmgr *fm, const char fileNameUTF8[1024], int* length_ms);
 int flowmgr_vm_start_play(struct flowmgr *fm, const char fileNameUTF8[1024], int  start_time_ms, flowmgr_vm_play_status_h *handler, void *arg);
 int flowmgr_vm_stop_play(struct flowmgr *fm);
@@ -457,6 +473,27 @@ int flowmgr_append_convlog(struct flowmgr *fm, const char *convid,
 void flowmgr_enable_metrics(struct flowmgr *fm, bool metrics);
 void flowmgr_enable_logging(struct flowmgr *fm, bool logging);
 
+/* Pool of pre-gathered mediaflows */
+struct flowmgr_ttfr {
+	uint32_t n;           /* calls with RTP                  */
+	uint64_t sum_ms;      /* sum of time to first RTP        */
+	uint64_t max_ms;      /* longest time to first RTP       */
+};
+
+struct flowmgr_pool_stats {
+	uint32_t size;        /* configured pool size            */
+	uint32_t ready;       /* pooled and gathered mediaflows  */
+	uint32_t n_hit;       /* mediaflows taken from the pool  */
+	uint32_t n_miss;      /* mediaflows allocated on demand  */
+
+	struct flowmgr_ttfr ttfr_pooled;  /* all flows pooled    */
+	struct flowmgr_ttfr ttfr_cold;    /* other calls         */
+};
+
+int flowmgr_set_pool_size(struct flowmgr *fm, uint32_t size);
+int flowmgr_pool_stats_get(const struct flowmgr *fm,
+			   struct flowmgr_pool_stats *stats);
+
 int flowmgr_send_metrics(struct flowmgr *fm, const char *convid,
 			 const char *path);
 
@@ -489,6 +526,9 @@ void marshal_flowmgr_set_log_handlers(struct flowmgr *fm,
 void marshal_flowmgr_set_conf_pos_handler(struct flowmgr *fm,
 					  flowmgr_conf_pos_h *conf_posh,
 					  void *arg);
+void marshal_flowmgr_set_active_speaker_handler(struct flowmgr *fm,
+				flowmgr_active_speaker_h *speakerh,
+				void *arg);
 int  marshal_flowmgr_resp(struct flowmgr *fm, int status, const char *reason,
 			  const char *ctype, const char *content, size_t clen,
 			  struct rr_resp *rr);
@@ -515,6 +555,7 @@ int  marshal_flowmgr_append_convlog(struct flowmgr *fm, const char *convid,
 				    const char *msg);
 void marshal_flowmgr_enable_metrics(struct flowmgr *fm, bool metrics);
 void marshal_flowmgr_enable_logging(struct flowmgr *fm, bool logging);
+int  marshal_flowmgr_set_pool_size(struct flowmgr *fm, uint32_t size);
 void marshal_flowmgr_set_sessid(struct flowmgr *fm, const char *convid,
 				const char *sessid);
 int  marshal_flowmgr_interruption(struct flowmgr *fm, const char *convid,
@@ -530,6 +571,7 @@ void marshal_flowmgr_refresh_access_token(struct flowmgr *fm,
 
 int marshal_flowmgr_vm_start_record(struct flowmgr *fm, const char fileNameUTF8[1024]);
 int marshal_flowmgr_vm_stop_record(struct flowmgr *fm);
+int marshal_flowmgr_vm_set_record_status_handler(struct flowmgr *fm, flowmgr_vm_record_status_h *handler, void *arg);
 int marshal_flowmgr_vm_start_play(struct flowmgr *fm, const char fileNameUTF8[1024], int  start_time_ms, flowmgr_vm_play_status_h *handler, void *arg);
 int marshal_flowmgr_vm_stop_play(struct flowmgr *fm);
 
@@ -550,6 +592,35 @@ int marshal_flowmgr_is_sending_video(struct flowmgr *fm,
 void marshal_flowmgr_set_video_send_state(struct flowmgr *fm, const char *convid, enum flowmgr_video_send_state state);
 
 
+/**
+ * Defines a completion handler for async marshalled calls.
+ * This function is called from the re thread once the call
+ * has been handled, err is the result of the call.
+ */
+typedef void (flowmgr_marshal_h)(int err, void *arg);
+
+/* Async marshalled functions, doneh may be NULL (fire-and-forget) */
+int marshal_flowmgr_release_flows_async(struct flowmgr *fm,
+					const char *convid,
+					flowmgr_marshal_h *doneh, void *arg);
+int marshal_flowmgr_set_active_async(struct flowmgr *fm, const char *convid,
+				     bool active,
+				     flowmgr_marshal_h *doneh, void *arg);
+int marshal_flowmgr_user_add_async(struct flowmgr *fm, const char *convid,
+				   const char *userid, const char *name,
+				   flowmgr_marshal_h *doneh, void *arg);
+int marshal_flowmgr_network_changed_async(struct flowmgr *fm,
+					  flowmgr_marshal_h *doneh, void *arg);
+int marshal_flowmgr_set_mute_async(struct flowmgr *fm, bool mute,
+				   flowmgr_marshal_h *doneh, void *arg);
+int marshal_flowmgr_enable_metrics_async(struct flowmgr *fm, bool metrics,
+					 flowmgr_marshal_h *doneh, void *arg);
+int marshal_flowmgr_set_video_send_state_async(struct flowmgr *fm,
+				const char *convid,
+				enum flowmgr_video_send_state state,
+				flowmgr_marshal_h *doneh, void *arg);
+
+
 /* Wrap flow manager calls into these macros if you want to call them
  * from outside the re thread.
  */
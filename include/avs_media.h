@@ -22,6 +22,7 @@
  */
 
 struct mediaflow;
+struct udpmux;
 struct zapi_candidate;
 struct aucodec_stats;
 struct rtp_stats;
@@ -79,6 +80,9 @@ struct mediaflow_stats {
 
 	unsigned dtls_pkt_sent;
 	unsigned dtls_pkt_recv;
+
+	unsigned srtp_replay_drops;  /* SRTP/SRTCP packets seen before */
+	unsigned srtp_window_drops;  /* older than the replay window   */
 };
 
 
@@ -101,6 +105,9 @@ typedef void (mediaflow_rtp_state_h)(bool started, bool video_started,
 
 typedef void (mediaflow_gather_h)(void *arg);
 
+/* level in -dBov (0 is loudest, 127 is silence) */
+typedef void (mediaflow_level_h)(uint8_t level, bool speaking, void *arg);
+
 int mediaflow_alloc(struct mediaflow **mfp, struct tls *dtls,
 		    const struct list *aucodecl,
 		    const struct sa *laddr,
@@ -126,6 +133,10 @@ void mediaflow_set_rtp_handler(struct mediaflow *mf,
 int mediaflow_add_video(struct mediaflow *mf, struct list *vidcodecl);
 void mediaflow_set_gather_handler(struct mediaflow *mf,
 				  mediaflow_gather_h *gatherh);
+void mediaflow_set_handlers(struct mediaflow *mf,
+			    mediaflow_estab_h *estabh,
+			    mediaflow_close_h *closeh,
+			    void *arg);
 
 int mediaflow_start_ice(struct mediaflow *mf);
 
@@ -178,6 +189,11 @@ int mediaflow_debug(struct re_printf *pf, const struct mediaflow *mf);
 
 void mediaflow_set_rtpstate_handler(struct mediaflow *mf,
 				      mediaflow_rtp_state_h *rtpstateh);
+void mediaflow_set_level_handler(struct mediaflow *mf,
+				 mediaflow_level_h *levelh);
+int  mediaflow_audio_level(const struct mediaflow *mf, uint8_t *levelp,
+			   bool *speakingp);
+bool mediaflow_has_audio_level(const struct mediaflow *mf);
 const char *mediaflow_peer_software(const struct mediaflow *mf);
 
 void mediaflow_rtp_start_send(struct mediaflow *mf);
@@ -221,7 +237,34 @@ const struct mediaflow_stats *mediaflow_stats_get(const struct mediaflow *mf);
 void mediaflow_set_local_eoc(struct mediaflow *mf);
 bool mediaflow_have_eoc(const struct mediaflow *mf);
 void mediaflow_enable_privacy(struct mediaflow *mf, bool enabled);
+void mediaflow_enable_turn_sharing(struct mediaflow *mf, bool enabled);
 
 const char *mediaflow_lcand_name(const struct mediaflow *mf);
 const char *mediaflow_rcand_name(const struct mediaflow *mf);
 bool mediaflow_dtls_peer_isset(const struct mediaflow *mf);
+void mediaflow_set_udpmux(struct udpmux *mux);
+
+
+/*
+ * Shared UDP port
+ */
+
+struct udpmux_ep;
+struct ice_lcand;
+
+struct udpmux_stats {
+	uint64_t n_rx;
+	uint64_t n_drop;
+};
+
+int  udpmux_alloc(struct udpmux **muxp, uint16_t port);
+int  udpmux_stats_get(const struct udpmux *mux, const struct sa *laddr,
+		      struct udpmux_stats *stats);
+int  udpmux_ep_alloc(struct udpmux_ep **epp, struct udpmux *mux,
+		     const struct sa *laddr, const char *lufrag,
+		     udp_recv_h *recvh, void *arg);
+struct udp_sock *udpmux_ep_sock(const struct udpmux_ep *ep);
+struct udp_helper *udpmux_ep_helper(const struct udpmux_ep *ep);
+void udpmux_ep_set_lcand(struct udpmux_ep *ep, struct ice_lcand *lcand);
+int  udpmux_ep_add_raddr(struct udpmux_ep *ep, const struct sa *raddr);
+int  udpmux_ep_select(struct udpmux_ep *ep, const struct sa *raddr);
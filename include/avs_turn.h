@@ -22,6 +22,7 @@
  */
 
 struct turn_conn;
+struct turn_share;
 
 typedef void (turnconn_estab_h)(struct turn_conn *conn,
 				const struct sa *relay_addr,
@@ -40,7 +41,7 @@ struct turn_conn {
 	struct sa turn_srv;
 	struct tls_conn *tlsc;
 	struct tls *tls;
-	struct mbuf *mb;
+	struct tcp_framer *framer;  /* STUN/ChannelData over TCP */
 	struct udp_helper *uh_app;  /* for outgoing UDP->TCP redirect */
 	struct udp_sock *us_app;    // todo: remove?
 	struct udp_sock *us_turn;
@@ -50,6 +51,10 @@ struct turn_conn {
 	int proto;
 	bool secure;
 	bool turn_allocated;
+	bool failed;                /* allocation failed or was lost */
+	struct turn_share *share;   /* shared allocation (optional) */
+	struct le le_share;         /* member of the shared users */
+	struct list peerl;          /* peers of a shared user */
 	int layer_stun;
 	int layer_turn;
 	turnconn_estab_h *estabh;
@@ -70,12 +75,26 @@ int turnconn_alloc(struct turn_conn **connp, struct list *connl,
 		   turnconn_estab_h *estabh, turnconn_data_h *datah,
 		   turnconn_error_h *errorh, void *arg
 		   );
+int turnconn_alloc_shared(struct turn_conn **connp, struct list *connl,
+			  const struct sa *turn_srv, int proto, bool secure,
+			  const char *username, const char *password,
+			  int layer_stun, int layer_turn,
+			  turnconn_estab_h *estabh, turnconn_data_h *datah,
+			  turnconn_error_h *errorh, void *arg);
 int turnconn_add_permission(struct turn_conn *conn, const struct sa *peer);
+int turnconn_add_channel(struct turn_conn *conn, const struct sa *peer);
+int turnconn_send(struct turn_conn *conn, const struct sa *dst,
+		  struct mbuf *mb);
 struct turn_conn *turnconn_find_allocated(const struct list *turnconnl,
 					  int proto);
 const char *turnconn_proto_name(const struct turn_conn *conn);
 int turnconn_debug(struct re_printf *pf, const struct turn_conn *conn);
 
+uint32_t turnconn_srv_score(const struct sa *srv, int proto, bool secure);
+int  turnconn_srvstat_debug(struct re_printf *pf, void *unused);
+void turnconn_srvstat_flush(void);
+uint32_t turnconn_shared_count(void);
+
 
 /*
  * STUN uri
@@ -127,6 +127,8 @@ int voe_enable_rcv_ns(bool enable);
     
 int voe_set_bitrate(int rate_bps);
 int voe_set_packet_size(int packet_size_ms);
+int voe_enable_shared_encoder(bool enable);
+int voe_set_max_speakers(unsigned n);
 
 void voe_register_adm(void* adm);
 void voe_deregister_adm();
@@ -136,9 +138,15 @@ int voe_debug(struct re_printf *pf, void *unused);
 void voe_update_conf_parts(const struct audec_state *adsv[], size_t adsc);
 
 typedef void (vm_play_status_h)(bool is_playing, unsigned int cur_time_ms, unsigned int file_length_ms, void *arg);
+typedef void (vm_record_status_h)(bool is_recording,
+				  unsigned int cur_time_ms,
+				  unsigned int backlog_ms,
+				  unsigned int n_dropped,
+				  void *arg);
     
 int voe_vm_start_record(const char fileNameUTF8[1024]);
 int voe_vm_stop_record();
+int voe_vm_set_record_status_handler(vm_record_status_h *handler, void *arg);
 int voe_vm_get_length(const char fileNameUTF8[1024],
                       int* length_ms);
 int voe_vm_start_play(const char fileNameUTF8[1024],
@@ -274,7 +274,7 @@ $(CONTRIB_LIBRE_TARGET): $(TOOLCHAIN_MASTER) $(CONTRIB_OPENSSL_TARGET) \
 		SYSROOT="$(SYSROOT)" \
 		SYSROOT_ALT="$(BUILD_TARGET)" \
 		PREFIX= USE_OPENSSL=yes USE_OPENSSL_DTLS=1 \
-		USE_OPENSSL_SRTP=1 USE_ZLIB=yes \
+		USE_OPENSSL_SRTP=1 USE_ZLIB=yes USE_MEM_SLAB=$(USE_MEM_SLAB) \
 		DESTDIR=$(BUILD_TARGET) \
 		$(CONTRIB_LIBRE_FAMILY_OPTIONS_$(AVS_FAMILY)) \
 		$(CONTRIB_LIBRE_OS_OPTIONS_$(AVS_OS))
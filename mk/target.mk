@@ -60,6 +60,9 @@
 #     				This will avoid rebuilding everything when
 #     				you are hacking away on the build system.
 #
+#     USE_MEM_SLAB		build libre with the slab allocator for
+#     				memory objects.
+#
 #     USE_X11			include code for X11.
 #
 # From all this information, this file defines various variables that are
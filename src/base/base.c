@@ -22,6 +22,7 @@
 #include "avs_uuid.h"
 #include "avs_zapi.h"
 #include "avs_media.h"
+#include "avs_turn.h"
 #include "avs_flowmgr.h"
 
 
@@ -116,6 +117,9 @@ void avs_close(void)
 	base.inited = false;
 
 	base.token = mem_deref(base.token);
+
+	/* the TURN server statistics are also kept without a flowmgr */
+	turnconn_srvstat_flush();
 }
 
 
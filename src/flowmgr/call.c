@@ -346,6 +346,9 @@ void call_remove_conf_part(struct call *call, struct flow *flow)
 
 	flow->cp = mem_deref(flow->cp);
 
+	memset(&flow->aulevel, 0, sizeof(flow->aulevel));
+	call_speaker_update(call);
+
 	conf_pos_sort(&call->conf_parts);
 
 	flowmgr_update_conf_parts(&call->conf_parts);
@@ -357,6 +360,48 @@ void call_remove_conf_part(struct call *call, struct flow *flow)
 }
 
 
+/*
+ * Select the loudest speaking participant from the audio levels, and
+ * report it when it changes. The current speaker is kept on a tie.
+ */
+void call_speaker_update(struct call *call)
+{
+	struct flow *speaker = NULL;
+	struct le *le;
+
+	if (!call)
+		return;
+
+	LIST_FOREACH(&call->conf_parts, le) {
+		struct conf_part *cp = le->data;
+		struct flow *flow = cp->data;
+
+		if (!flow || !flow->aulevel.valid || !flow->aulevel.speaking)
+			continue;
+
+		if (!speaker || flow->aulevel.level < speaker->aulevel.level)
+			speaker = flow;
+		else if (flow == call->speaker &&
+			 flow->aulevel.level == speaker->aulevel.level)
+			speaker = flow;
+	}
+
+	if (speaker == call->speaker)
+		return;
+
+	call->speaker = speaker;
+
+	info("flowmgr: call(%p): active speaker: %s\n",
+	     call, speaker ? speaker->remoteid : "none");
+
+	if (call->fm && call->fm->speaker.h) {
+		call->fm->speaker.h(call->convid,
+				    speaker ? speaker->remoteid : NULL,
+				    call->fm->speaker.arg);
+	}
+}
+
+
 int call_add_flow(struct call *call, struct userflow *uf, struct flow *flow)
 {
 	int err;
@@ -874,6 +919,34 @@ int call_deestablish_media(struct call *call)
 }
 
 
+static bool cold_userflow_handler(char *key, void *val, void *arg)
+{
+	struct userflow *uf = val;
+
+	(void)key;
+	(void)arg;
+
+	return !uf->pooled;
+}
+
+
+/* Time to first RTP, with and without pooled mediaflows */
+static void ttfr_update(struct call *call, uint64_t t)
+{
+	struct flowmgr_ttfr *ttfr;
+
+	call->pooled = dict_count(call->users) > 0 &&
+		!dict_apply(call->users, cold_userflow_handler, NULL);
+
+	ttfr = call->pooled ? &call->fm->pool.stats.ttfr_pooled
+		: &call->fm->pool.stats.ttfr_cold;
+
+	++ttfr->n;
+	ttfr->sum_ms += t;
+	ttfr->max_ms = max(ttfr->max_ms, t);
+}
+
+
 void call_rtp_started(struct call *call, bool started)
 {
 	struct flowmgr *fm;
@@ -896,9 +969,12 @@ void call_rtp_started(struct call *call, bool started)
 		call->rtp_start_ts = tmr_jiffies();
 
 		t = call->rtp_start_ts - call->start_ts;
+
+		ttfr_update(call, t);
+
 		info("flowmgr(%p): call(%p): rtp_started "
-		     "total setup time is %llu ms\n",
-		     fm, call, t);
+		     "total setup time is %llu ms (pooled=%d)\n",
+		     fm, call, t, call->pooled);
 	}
 }
 
@@ -954,6 +1030,8 @@ bool call_stats_prepare(struct call *call, struct json_object *jobj)
 
 		json_object_object_add(jobj, "setup_time",
 				       json_object_new_int((int32_t)t));
+		json_object_object_add(jobj, "pooled",
+				       json_object_new_boolean(call->pooled));
 
 #if 0 /* Disable session-id for privacy */
 		{
@@ -95,6 +95,10 @@ static void call_config_resp_handler(int status, struct rr_resp *rr,
 			  tmr_handler, fm);
 	}
 
+	/* re-gather the pooled mediaflows with the new ICE servers */
+	if (!err)
+		mfpool_flush(fm->pool.mfp);
+
 	if (!err && fm->config.configh)
 		fm->config.configh(&fm->config.cfg, fm->config.arg);
 }
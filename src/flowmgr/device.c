@@ -189,6 +189,18 @@ void flowmgr_set_packet_size(int packet_size_ms)
 }
 
 
+void flowmgr_enable_shared_encoder(bool enable)
+{
+	voe_enable_shared_encoder(enable);
+}
+
+
+void flowmgr_set_max_speakers(unsigned n)
+{
+	voe_set_max_speakers(n);
+}
+
+
 void flowmgr_silencing(bool silenced)
 {
 	if (!flowmgr_is_using_voe())
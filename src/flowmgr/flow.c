@@ -777,6 +777,16 @@ struct call *flow_call(struct flow *flow)
 }
 
 
+/* Audio level in -dBov as a volume from 0.0 to 1.0 */
+static double aulevel_volume(const struct flow *flow)
+{
+	if (!flow->aulevel.valid)
+		return 0.0;
+
+	return (127.0 - flow->aulevel.level) / 127.0;
+}
+
+
 void flow_vol_handler(struct flow *flow, bool using_voe)
 {
 	struct auenc_state *aes;
@@ -800,12 +810,18 @@ void flow_vol_handler(struct flow *flow, bool using_voe)
 
 	if (using_voe) {
 		err = voe_invol(aes, &invol);
-		err |= voe_outvol(ads, &outvol);
+
+		/* the output volume comes with the audio levels */
+		if (mediaflow_has_audio_level(mf))
+			outvol = aulevel_volume(flow);
+		else
+			err |= voe_outvol(ads, &outvol);
 		if (err) {
 			error("flowmgr: flow_vol_handler: volumes: (%m)\n",
 			      err);
 			return;
 		}
+		flow->invol = (float)invol;
 		if (flow->volh) {
 			flow->volh(flow, (float)invol, (float)outvol);
 		}
@@ -813,6 +829,24 @@ void flow_vol_handler(struct flow *flow, bool using_voe)
 }
 
 
+/* The remote audio level changed, see mediaflow_level_h */
+void flow_audio_level(struct flow *flow, uint8_t level, bool speaking)
+{
+	if (!flow)
+		return;
+
+	flow->aulevel.level = level;
+	flow->aulevel.speaking = speaking;
+	flow->aulevel.valid = true;
+
+	if (flow->volh)
+		flow->volh(flow, flow->invol, aulevel_volume(flow));
+
+	if (flow->cp)
+		call_speaker_update(flow->call);
+}
+
+
 static void cand_destructor(void *arg)
 {
 	struct cand *cand = arg;
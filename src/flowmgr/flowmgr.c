@@ -60,6 +60,7 @@ static struct {
 	bool using_voe;
 	bool loopback;
 	bool privacy;
+	bool turn_shared;
 	char ifname[256];
 
 	struct list flowmgrl;
@@ -273,7 +274,18 @@ static int msystem_init(const char *msysname,
 
 	tls_set_verify_client(msys.dtls);
 
-	err = tls_set_srtp(msys.dtls, "SRTP_AES128_CM_SHA1_80");
+	/* Prefer AES-GCM if the peer offers it, as it encrypts and
+	 * authenticates in one pass. Older OpenSSL versions do not
+	 * know the AEAD profiles.
+	 */
+	err = tls_set_srtp(msys.dtls,
+			   "SRTP_AEAD_AES_128_GCM:"
+			   "SRTP_AEAD_AES_256_GCM:"
+			   "SRTP_AES128_CM_SHA1_80");
+	if (err) {
+		info("flowmgr: AES-GCM SRTP profiles not supported\n");
+		err = tls_set_srtp(msys.dtls, "SRTP_AES128_CM_SHA1_80");
+	}
 	if (err) {
 		warning("flowmgr: failed to enable SRTP profile (%m)\n",
 			err);
@@ -358,6 +370,12 @@ bool msystem_get_privacy(void)
 }
 
 
+bool msystem_get_turn_shared(void)
+{
+	return msys.turn_shared;
+}
+
+
 const char *msystem_get_interface(void)
 {
 	return msys.ifname;
@@ -502,6 +520,14 @@ void flowmgr_enable_privacy(bool enable)
 }
 
 
+void flowmgr_enable_turn_sharing(bool enable)
+{
+	info("flowmgr: shared TURN allocations %sabled\n",
+	     enable ? "En" : "Dis");
+	msys.turn_shared = enable;
+}
+
+
 void flowmgr_bind_interface(const char *ifname)
 {
 	if (!ifname)
@@ -531,6 +557,7 @@ void flowmgr_close(void)
 	flowmgr_wakeup();
 	marshal_close();
 	msystem_free();
+	turnconn_srvstat_flush();
 }
 
 
@@ -549,6 +576,12 @@ void flowmgr_network_changed(struct flowmgr *fm)
 
 	if (!fm)
 		return;
+
+	/* the pooled mediaflows have the old interfaces */
+	mfpool_flush(fm->pool.mfp);
+
+	/* the server latencies were measured on the old network */
+	turnconn_srvstat_flush();
        
 	/* Go through all the calls, and restart flows on them */
 	dict_apply(fm->calls, call_restart_handler, fm);
@@ -1290,6 +1323,8 @@ static void fm_destructor(void *arg)
 
 	flowmgr_config_stop(fm);
 
+	fm->pool.mfp = mem_deref(fm->pool.mfp);
+
 	close_requests(fm);
 
 	if (fm->calls)
@@ -1413,6 +1448,18 @@ void flowmgr_set_conf_pos_handler(struct flowmgr *fm,
 }
 
 
+void flowmgr_set_active_speaker_handler(struct flowmgr *fm,
+				flowmgr_active_speaker_h *speakerh,
+				void *arg)
+{
+	if (!fm)
+		return;
+
+	fm->speaker.h = speakerh;
+	fm->speaker.arg = arg;
+}
+
+
 void flowmgr_set_video_handlers(struct flowmgr *fm, 
 				flowmgr_video_state_change_h *state_change_h,
 				flowmgr_render_frame_h *render_frame_h,
@@ -1493,6 +1540,53 @@ void flowmgr_enable_metrics(struct flowmgr *fm, bool metrics)
 }
 
 
+/**
+ * Keep a number of mediaflows allocated and gathered ahead of the
+ * calls. The pool is filled in the background.
+ *
+ * @param fm   Flow manager
+ * @param size Number of pooled mediaflows, 0 to disable the pool
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int flowmgr_set_pool_size(struct flowmgr *fm, uint32_t size)
+{
+	int err;
+
+	if (!fm)
+		return EINVAL;
+
+	if (!size) {
+		fm->pool.mfp = mem_deref(fm->pool.mfp);
+		return 0;
+	}
+
+	if (!fm->pool.mfp) {
+		err = mfpool_alloc(&fm->pool.mfp, fm);
+		if (err)
+			return err;
+	}
+
+	mfpool_set_size(fm->pool.mfp, size);
+
+	return 0;
+}
+
+
+int flowmgr_pool_stats_get(const struct flowmgr *fm,
+			   struct flowmgr_pool_stats *stats)
+{
+	if (!fm || !stats)
+		return EINVAL;
+
+	*stats = fm->pool.stats;
+	stats->size  = mfpool_size(fm->pool.mfp);
+	stats->ready = mfpool_ready(fm->pool.mfp);
+
+	return 0;
+}
+
+
 void flowmgr_enable_logging(struct flowmgr *fm, bool logging)
 {
 	if (!fm)
@@ -1847,6 +1941,7 @@ int flowmgr_debug(struct re_printf *pf, const struct flowmgr *fm)
 }
 
 
+/* ENOBUFS is fine here: a full queue wakes the re thread anyway */
 int flowmgr_wakeup(void)
 {
 	if (!msys.mq)
@@ -91,7 +91,7 @@ struct userflow {
 		bool async_offer;
 	} sdp;
 
-	unsigned num_if;
+	bool pooled;  /* mediaflow was taken from the pool */
 };
 
 
@@ -113,8 +113,10 @@ struct call {
 	uint64_t start_ts;
 	uint64_t rtp_start_ts;
 	bool rtp_started;
+	bool pooled;  /* all mediaflows were taken from the pool */
 	bool is_mestab;
 	bool active;
+	struct flow *speaker;  /* loudest speaking flow, or NULL */
 
 	struct le post_le;
 };
@@ -146,6 +148,14 @@ struct flow {
 	struct mflow_stats stats;
 
 	mflow_volume_h *volh;          // XXX: remove this
+	float invol;                   /* last polled input volume */
+
+	/* RFC 6464 audio level of the remote user */
+	struct {
+		uint8_t level;         /* -dBov, 127 is silence */
+		bool speaking;
+		bool valid;
+	} aulevel;
 
 	struct {
 		flowmgr_video_state_change_h *state_change_h;
@@ -197,6 +207,12 @@ struct flowmgr {
 	flowmgr_conf_pos_h *conf_posh;
 	void *conf_pos_arg;
 
+	/* Active speaker handler */
+	struct {
+		flowmgr_active_speaker_h *h;
+		void *arg;
+	} speaker;
+
 	/* log handlers */
 	struct {
 		flowmgr_log_append_h *appendh;
@@ -244,6 +260,11 @@ struct flowmgr {
 		struct rest_cli *cli;
 		struct login_token token;
 	} rest;
+
+	struct {
+		struct mfpool *mfp;
+		struct flowmgr_pool_stats stats;
+	} pool;
 };
 
 
@@ -331,6 +352,7 @@ void call_restart(struct call *call);
 bool call_restart_handler(char *key, void *val, void *arg);
 int  call_add_conf_part(struct call *call, struct flow *flow);
 void call_remove_conf_part(struct call *call, struct flow *flow);
+void call_speaker_update(struct call *call);
 void call_mestab(struct call *call, bool mestab);
 
 
@@ -373,6 +395,7 @@ bool flow_stats_handler(char *key, void *val, void *arg);
 bool flow_best_handler(char *key, void *val, void *arg);
 bool flow_restart_handler(char *key, void *val, void *arg);
 void flow_vol_handler(struct flow *flow, bool using_voe);
+void flow_audio_level(struct flow *flow, uint8_t level, bool speaking);
 bool flow_lookup_part_handler(char *key, void *val, void *arg);
 void flow_ice_resp(int status, struct rr_resp *rr,
 		   struct json_object *jobj, void *arg);
@@ -399,6 +422,17 @@ int  flow_cand_handler(struct flow *flow, struct json_object *jobj);
 
 void flow_local_sdp_req(struct flow *flow, const char *type, const char *sdp);
 
+/* Mediaflow pool */
+struct mfpool;
+
+int  mfpool_alloc(struct mfpool **poolp, struct flowmgr *fm);
+void mfpool_set_size(struct mfpool *pool, uint32_t size);
+void mfpool_flush(struct mfpool *pool);
+int  mfpool_checkout(struct mfpool *pool, struct mediaflow **mfp);
+uint32_t mfpool_size(const struct mfpool *pool);
+uint32_t mfpool_ready(const struct mfpool *pool);
+
+
 /* rr */
 int  rr_alloc(struct rr_resp **rrp, struct flowmgr *fm, struct call *call,
 	      rr_resp_h *resph, void *arg);
@@ -415,6 +449,7 @@ struct list *msystem_vidcodecl(void);
 struct list *msystem_flows(void);
 bool msystem_get_loopback(void);
 bool msystem_get_privacy(void);
+bool msystem_get_turn_shared(void);
 const char *msystem_get_interface(void);
 
 int  marshal_init(void);
@@ -431,6 +466,9 @@ void userflow_set_flow(struct userflow *uf, struct flow *flow);
 int  userflow_generate_offer(struct userflow *uf);
 bool userflow_check_sdp_handler(char *key, void *val, void *arg);
 int  userflow_alloc_mediaflow(struct userflow *uf);
+int  userflow_mediaflow_alloc(struct mediaflow **mfp, struct flowmgr *fm,
+			      mediaflow_estab_h *estabh,
+			      mediaflow_close_h *closeh, void *arg);
 void userflow_release_mediaflow(struct userflow *uf);
 
 struct mediaflow *userflow_mediaflow(struct userflow *uf);
@@ -17,6 +17,7 @@
 */
 #include <stdlib.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include <re/re.h>
 #include <avs.h>
@@ -31,6 +32,22 @@ struct {
 };
 
 
+/*
+ * Each calling thread has one waiter, created on first use and kept
+ * until the thread exits. The re thread signals the condition once a
+ * call is handled, so a blocking call returns as soon as it is done.
+ * Keeping the waiter for the life of the thread avoids creating and
+ * destroying sync objects per call, which is expensive on Darwin.
+ */
+struct marshal_waiter {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+static pthread_once_t waiter_once = PTHREAD_ONCE_INIT;
+static pthread_key_t waiter_key;
+
+
 enum marshal_id {
 	MARSHAL_ALLOC,
 	MARSHAL_START,
@@ -38,6 +55,7 @@ enum marshal_id {
 	MARSHAL_MEDIA_HANDLERS,
 	MARSHAL_MEDIA_ESTAB_HANDLER,
 	MARSHAL_CONF_POS_HANDLER,
+	MARSHAL_ACTIVE_SPEAKER_HANDLER,
 	MARSHAL_LOG_HANDLERS,
 	MARSHAL_RESP,
 	MARSHAL_EVENT,
@@ -63,16 +81,21 @@ enum marshal_id {
 	MARSHAL_VM_STOP_RECORD,
 	MARSHAL_VM_START_PLAY,
 	MARSHAL_VM_STOP_PLAY,
+	MARSHAL_VM_RECORD_STATUS_HANDLER,
 	MARSHAL_CAN_SEND_VIDEO,
 	MARSHAL_IS_SENDING_VIDEO,
 	MARSHAL_SET_VIDEO_SEND_STATE,
 	MARSHAL_SET_VIDEO_HANDLERS,
 	MARSHAL_SET_AUDIO_STATE_HANDLER,
+	MARSHAL_SET_POOL_SIZE,
 };
 
 struct marshal_elem {
 	int id;
 	struct flowmgr *fm;
+	struct marshal_waiter *waiter;  /**< NULL for async calls     */
+	flowmgr_marshal_h *doneh;       /**< Async completion handler */
+	void *arg;
 	bool handled;
 	int ret;
 };
@@ -108,6 +131,13 @@ struct marshal_conf_pos_handler_elem {
 	void *arg;
 };
 
+struct marshal_active_speaker_handler_elem {
+	struct marshal_elem a;
+
+	flowmgr_active_speaker_h *speakerh;
+	void *arg;
+};
+
 struct marshal_log_handlers_elem {
 	struct marshal_elem a;
 
@@ -189,6 +219,7 @@ struct marshal_mute_elem {
 	struct marshal_elem a;
 	
 	bool *mute;
+	bool val;
 };
 
 
@@ -205,6 +236,12 @@ struct marshal_enable_elem {
 	bool enable;
 };
 
+struct marshal_pool_size_elem {
+	struct marshal_elem a;
+
+	uint32_t size;
+};
+
 struct marshal_sessid_elem {
 	struct marshal_elem a;
 	
@@ -264,6 +301,12 @@ struct marshal_vm_stop_play_elem {
     struct marshal_elem a;
 };
 
+struct marshal_vm_record_status_elem {
+    struct marshal_elem a;
+    flowmgr_vm_record_status_h *handler;
+    void *arg;
+};
+
 struct marshal_video_capture_list_elem {
 	struct marshal_elem a;
 
@@ -307,6 +350,29 @@ struct marshal_audio_state_handler_elem {
 	void *arg;
 };
 
+/* Called on the re thread when a call has been handled */
+static void marshal_complete(struct marshal_elem *me)
+{
+	struct marshal_waiter *w = me->waiter;
+
+	if (!w) {
+		if (me->doneh)
+			me->doneh(me->ret, me->arg);
+
+		mem_deref(me);
+		return;
+	}
+
+	/* the caller owns me, and may return as soon as the
+	 * mutex is released, so me is not touched after that
+	 */
+	pthread_mutex_lock(&w->mutex);
+	me->handled = true;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+}
+
+
 static void mqueue_handler(int id, void *data, void *arg)
 {
 	struct marshal_elem *me = data;
@@ -355,6 +421,14 @@ static void mqueue_handler(int id, void *data, void *arg)
 					     cpe->arg);
 		break;
 	}
+
+	case MARSHAL_ACTIVE_SPEAKER_HANDLER: {
+		struct marshal_active_speaker_handler_elem *ase = data;
+
+		flowmgr_set_active_speaker_handler(me->fm, ase->speakerh,
+						   ase->arg);
+		break;
+	}
 		
 	case MARSHAL_LOG_HANDLERS: {
 		struct marshal_log_handlers_elem *mle = data;
@@ -500,6 +574,13 @@ static void mqueue_handler(int id, void *data, void *arg)
 		break;
 	}
 
+	case MARSHAL_SET_POOL_SIZE: {
+		struct marshal_pool_size_elem *mpe = data;
+
+		me->ret = flowmgr_set_pool_size(me->fm, mpe->size);
+		break;
+	}
+
 	case MARSHAL_SET_SESSID: {
 		struct marshal_sessid_elem *mse = data;
 
@@ -543,6 +624,15 @@ static void mqueue_handler(int id, void *data, void *arg)
 		break;
 	}
 
+	case MARSHAL_VM_RECORD_STATUS_HANDLER: {
+		struct marshal_vm_record_status_elem *mie = data;
+
+		me->ret = flowmgr_vm_set_record_status_handler(me->fm,
+							       mie->handler,
+							       mie->arg);
+		break;
+	}
+
 	case MARSHAL_SET_VIDEO_SEND_STATE: {
 		struct marshal_video_state_elem *mse = data;
 
@@ -587,18 +677,65 @@ static void mqueue_handler(int id, void *data, void *arg)
             
 	}
 
-	me->handled = true;
+	marshal_complete(me);
+}
+
+
+static void waiter_destructor(void *arg)
+{
+	struct marshal_waiter *w = arg;
+
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->mutex);
+}
+
+
+static void waiter_release(void *arg)
+{
+	mem_deref(arg);
+}
+
+
+static void waiter_key_init(void)
+{
+	pthread_key_create(&waiter_key, waiter_release);
+}
+
+
+static struct marshal_waiter *waiter_get(void)
+{
+	struct marshal_waiter *w;
+
+	pthread_once(&waiter_once, waiter_key_init);
+
+	w = pthread_getspecific(waiter_key);
+	if (w)
+		return w;
+
+	w = mem_zalloc(sizeof(*w), waiter_destructor);
+	if (!w)
+		return NULL;
+
+	pthread_mutex_init(&w->mutex, NULL);
+	pthread_cond_init(&w->cond, NULL);
+
+	if (pthread_setspecific(waiter_key, w)) {
+		mem_deref(w);
+		return NULL;
+	}
+
+	return w;
 }
 
 
 static void marshal_wait(struct marshal_elem *me)
 {
-	/* Using a semaphore would be more efficient,
-	 * but the Darwin implementation of it is really
-	 * not suitable for short-lived semaphores
-	 */
-	while(!me->handled)
-		usleep(40000);
+	struct marshal_waiter *w = me->waiter;
+
+	pthread_mutex_lock(&w->mutex);
+	while (!me->handled)
+		pthread_cond_wait(&w->cond, &w->mutex);
+	pthread_mutex_unlock(&w->mutex);
 }
 
 
@@ -624,18 +761,80 @@ void marshal_close(void)
 static void marshal_send(void *arg)
 {
 	struct marshal_elem *me = arg;
+	int err;
 
 	if (!marshal.mq) {
 		warning("flowmgr: marshal_send: no mq\n");
+		me->ret = ENOENT;
 		return;
 	}
 
+	me->waiter = waiter_get();
+	if (!me->waiter) {
+		me->ret = ENOMEM;
+		return;
+	}
+
+	me->doneh = NULL;
+	me->arg = NULL;
 	me->handled = false;
-	mqueue_push(marshal.mq, me->id, me);
+	me->ret = 0;
+
+	err = mqueue_push(marshal.mq, me->id, me);
+	if (err) {
+		warning("flowmgr: marshal_send: push failed (%m)\n", err);
+		me->ret = err;
+		return;
+	}
+
 	marshal_wait(me);
 }
 
 
+/*
+ * Async calls are allocated and owned by the queue. The element is
+ * freed on the re thread once handled, after doneh has been called.
+ */
+static void *marshal_async_alloc(size_t size, mem_destroy_h *dh, int id,
+				 struct flowmgr *fm,
+				 flowmgr_marshal_h *doneh, void *arg)
+{
+	struct marshal_elem *me;
+
+	me = mem_zalloc(size, dh);
+	if (!me)
+		return NULL;
+
+	me->id = id;
+	me->fm = fm;
+	me->doneh = doneh;
+	me->arg = arg;
+
+	return me;
+}
+
+
+static int marshal_post(void *arg)
+{
+	struct marshal_elem *me = arg;
+	int err;
+
+	if (!marshal.mq) {
+		warning("flowmgr: marshal_post: no mq\n");
+		err = ENOENT;
+		goto out;
+	}
+
+	err = mqueue_push(marshal.mq, me->id, me);
+
+ out:
+	if (err)
+		mem_deref(me);
+
+	return err;
+}
+
+
 int marshal_flowmgr_alloc(struct flowmgr **fmp, flowmgr_req_h *reqh,
 			  flowmgr_err_h *errh, void *arg)
 {
@@ -721,6 +920,22 @@ void marshal_flowmgr_set_conf_pos_handler(struct flowmgr *fm,
 }
 
 
+void marshal_flowmgr_set_active_speaker_handler(struct flowmgr *fm,
+				flowmgr_active_speaker_h *speakerh,
+				void *arg)
+{
+	struct marshal_active_speaker_handler_elem me;
+
+	me.a.id = MARSHAL_ACTIVE_SPEAKER_HANDLER;
+	me.a.fm = fm;
+
+	me.speakerh = speakerh;
+	me.arg = arg;
+
+	marshal_send(&me);
+}
+
+
 void marshal_flowmgr_set_log_handlers(struct flowmgr *fm,
 				      flowmgr_log_append_h *appendh,
 				      flowmgr_log_upload_h *uploadh,
@@ -1022,6 +1237,21 @@ void marshal_flowmgr_enable_logging(struct flowmgr *fm, bool logging)
 }
 
 
+int marshal_flowmgr_set_pool_size(struct flowmgr *fm, uint32_t size)
+{
+	struct marshal_pool_size_elem me;
+
+	me.a.id = MARSHAL_SET_POOL_SIZE;
+	me.a.fm = fm;
+
+	me.size = size;
+
+	marshal_send(&me);
+
+	return me.a.ret;
+}
+
+
 void marshal_flowmgr_set_sessid(struct flowmgr *fm, const char *convid,
 				const char *sessid)
 {
@@ -1079,6 +1309,20 @@ int marshal_flowmgr_vm_stop_record(struct flowmgr *fm)
     return me.a.ret;
 }
 
+int marshal_flowmgr_vm_set_record_status_handler(struct flowmgr *fm, flowmgr_vm_record_status_h *handler, void *arg)
+{
+    struct marshal_vm_record_status_elem me;
+    
+    me.a.id = MARSHAL_VM_RECORD_STATUS_HANDLER;
+    me.a.fm = fm;
+    me.handler = handler;
+    me.arg = arg;
+    
+    marshal_send(&me);
+    
+    return me.a.ret;
+}
+
 int marshal_flowmgr_vm_start_play(struct flowmgr *fm, const char fileNameUTF8[1024], int start_time_ms, flowmgr_vm_play_status_h *handler, void *arg)
 
 {
@@ -1196,3 +1440,194 @@ void marshal_flowmgr_set_audio_state_handler(struct flowmgr *fm,
     
 	marshal_send(&me);
 }
+
+
+/*
+ * Async variants. These return as soon as the call is queued. The
+ * completion handler is optional and is called from the re thread
+ * with the result, strings are copied so the caller can free them.
+ */
+
+static void release_destructor(void *arg)
+{
+	struct marshal_release_elem *me = arg;
+
+	mem_deref((char *)me->convid);
+}
+
+
+static void setactive_destructor(void *arg)
+{
+	struct marshal_setactive_elem *me = arg;
+
+	mem_deref((char *)me->convid);
+}
+
+
+static void useradd_destructor(void *arg)
+{
+	struct marshal_useradd_elem *me = arg;
+
+	mem_deref((char *)me->convid);
+	mem_deref((char *)me->userid);
+	mem_deref((char *)me->name);
+}
+
+
+static void video_state_destructor(void *arg)
+{
+	struct marshal_video_state_elem *me = arg;
+
+	mem_deref((char *)me->convid);
+}
+
+
+int marshal_flowmgr_release_flows_async(struct flowmgr *fm,
+					const char *convid,
+					flowmgr_marshal_h *doneh, void *arg)
+{
+	struct marshal_release_elem *me;
+	char *cid = NULL;
+	int err;
+
+	me = marshal_async_alloc(sizeof(*me), release_destructor,
+				 MARSHAL_RELEASE, fm, doneh, arg);
+	if (!me)
+		return ENOMEM;
+
+	err = str_dup(&cid, convid);
+	me->convid = cid;
+	if (err) {
+		mem_deref(me);
+		return err;
+	}
+
+	return marshal_post(me);
+}
+
+
+int marshal_flowmgr_set_active_async(struct flowmgr *fm, const char *convid,
+				     bool active,
+				     flowmgr_marshal_h *doneh, void *arg)
+{
+	struct marshal_setactive_elem *me;
+	char *cid = NULL;
+	int err;
+
+	me = marshal_async_alloc(sizeof(*me), setactive_destructor,
+				 MARSHAL_SET_ACTIVE, fm, doneh, arg);
+	if (!me)
+		return ENOMEM;
+
+	err = str_dup(&cid, convid);
+	me->convid = cid;
+	me->active = active;
+	if (err) {
+		mem_deref(me);
+		return err;
+	}
+
+	return marshal_post(me);
+}
+
+
+int marshal_flowmgr_user_add_async(struct flowmgr *fm, const char *convid,
+				   const char *userid, const char *name,
+				   flowmgr_marshal_h *doneh, void *arg)
+{
+	struct marshal_useradd_elem *me;
+	char *cid = NULL, *uid = NULL, *nm = NULL;
+	int err;
+
+	me = marshal_async_alloc(sizeof(*me), useradd_destructor,
+				 MARSHAL_USER_ADD, fm, doneh, arg);
+	if (!me)
+		return ENOMEM;
+
+	err  = str_dup(&cid, convid);
+	err |= str_dup(&uid, userid);
+	if (name)
+		err |= str_dup(&nm, name);
+	me->convid = cid;
+	me->userid = uid;
+	me->name = nm;
+	if (err) {
+		mem_deref(me);
+		return ENOMEM;
+	}
+
+	return marshal_post(me);
+}
+
+
+int marshal_flowmgr_network_changed_async(struct flowmgr *fm,
+					  flowmgr_marshal_h *doneh, void *arg)
+{
+	struct marshal_elem *me;
+
+	me = marshal_async_alloc(sizeof(*me), NULL,
+				 MARSHAL_NETWORK, fm, doneh, arg);
+	if (!me)
+		return ENOMEM;
+
+	return marshal_post(me);
+}
+
+
+int marshal_flowmgr_set_mute_async(struct flowmgr *fm, bool mute,
+				   flowmgr_marshal_h *doneh, void *arg)
+{
+	struct marshal_mute_elem *me;
+
+	me = marshal_async_alloc(sizeof(*me), NULL,
+				 MARSHAL_SET_MUTE, fm, doneh, arg);
+	if (!me)
+		return ENOMEM;
+
+	me->val = mute;
+	me->mute = &me->val;
+
+	return marshal_post(me);
+}
+
+
+int marshal_flowmgr_enable_metrics_async(struct flowmgr *fm, bool metrics,
+					 flowmgr_marshal_h *doneh, void *arg)
+{
+	struct marshal_enable_elem *me;
+
+	me = marshal_async_alloc(sizeof(*me), NULL,
+				 MARSHAL_ENABLE_METRICS, fm, doneh, arg);
+	if (!me)
+		return ENOMEM;
+
+	me->enable = metrics;
+
+	return marshal_post(me);
+}
+
+
+int marshal_flowmgr_set_video_send_state_async(struct flowmgr *fm,
+				const char *convid,
+				enum flowmgr_video_send_state state,
+				flowmgr_marshal_h *doneh, void *arg)
+{
+	struct marshal_video_state_elem *me;
+	char *cid = NULL;
+	int err;
+
+	me = marshal_async_alloc(sizeof(*me), video_state_destructor,
+				 MARSHAL_SET_VIDEO_SEND_STATE, fm, doneh, arg);
+	if (!me)
+		return ENOMEM;
+
+	err = str_dup(&cid, convid);
+	me->convid = cid;
+	me->state = state;
+	if (err) {
+		mem_deref(me);
+		return err;
+	}
+
+	return marshal_post(me);
+}
@@ -0,0 +1,307 @@
+/*
+* Wire
+* Copyright (C) 2016 Wire Swiss GmbH
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <re/re.h>
+
+#include "avs.h"
+
+#include "flowmgr.h"
+
+
+/*
+ * Mediaflow pool
+ *
+ * A number of mediaflows are allocated ahead of the calls, with the
+ * sockets bound and the STUN/TURN candidates gathered. A new userflow
+ * takes one from the pool, and the pool is refilled in the background,
+ * one mediaflow at a time. The TURN client keeps the allocations of
+ * pooled mediaflows refreshed. Old entries are replaced, so that the
+ * server reflexive candidates are not stale.
+ */
+
+
+enum {
+	POOL_FILL_DELAY  =    100,   /* ms between new mediaflows   */
+	POOL_RETRY_DELAY =  10000,   /* ms after a failed allocation */
+	POOL_CHECK_INTV  =  30000,   /* ms between age checks        */
+	POOL_MAX_AGE     = 300000,   /* ms before an entry is replaced */
+};
+
+struct mfpool {
+	struct list entryl;   /* struct pool_entry, oldest first */
+	struct flowmgr *fm;   /* pointer to owner */
+	struct tmr tmr;
+	uint32_t size;
+};
+
+struct pool_entry {
+	struct le le;
+	struct mfpool *pool;  /* pointer to parent */
+	struct mediaflow *mf;
+	uint64_t ts;
+};
+
+
+static void fill_handler(void *arg);
+
+
+static void schedule_fill(struct mfpool *pool, uint64_t delay)
+{
+	if (pool->size)
+		tmr_start(&pool->tmr, delay, fill_handler, pool);
+	else
+		tmr_cancel(&pool->tmr);
+}
+
+
+static void entry_destructor(void *arg)
+{
+	struct pool_entry *pe = arg;
+
+	list_unlink(&pe->le);
+	mem_deref(pe->mf);
+}
+
+
+static void entry_gather_handler(void *arg)
+{
+	struct pool_entry *pe = arg;
+
+	info("flowmgr: mfpool: mediaflow %p gathered in %llu ms\n",
+	     pe->mf, (unsigned long long)(tmr_jiffies() - pe->ts));
+}
+
+
+static void entry_close_handler(int err, void *arg)
+{
+	struct pool_entry *pe = arg;
+	struct mfpool *pool = pe->pool;
+
+	warning("flowmgr: mfpool: pooled mediaflow %p closed (%m)\n",
+		pe->mf, err);
+
+	mem_deref(pe);
+
+	schedule_fill(pool, POOL_RETRY_DELAY);
+}
+
+
+static int entry_alloc(struct mfpool *pool)
+{
+	struct pool_entry *pe;
+	int err;
+
+	pe = mem_zalloc(sizeof(*pe), entry_destructor);
+	if (!pe)
+		return ENOMEM;
+
+	pe->pool = pool;
+	pe->ts = tmr_jiffies();
+
+	err = userflow_mediaflow_alloc(&pe->mf, pool->fm, NULL,
+				       entry_close_handler, pe);
+	if (err)
+		goto out;
+
+	mediaflow_set_gather_handler(pe->mf, entry_gather_handler);
+
+	list_append(&pool->entryl, &pe->le, pe);
+
+	info("flowmgr: mfpool: added mediaflow %p (%u/%u)\n",
+	     pe->mf, list_count(&pool->entryl), pool->size);
+
+ out:
+	if (err)
+		mem_deref(pe);
+
+	return err;
+}
+
+
+static bool entry_is_old(const struct pool_entry *pe, uint64_t now)
+{
+	return pe && now - pe->ts >= POOL_MAX_AGE;
+}
+
+
+/*
+ * Add one mediaflow per tick. When the pool is full, the oldest entry
+ * is replaced if it is too old: the new mediaflow is added before the
+ * old one is dropped, so the pool does not shrink while it gathers.
+ */
+static void fill_handler(void *arg)
+{
+	struct mfpool *pool = arg;
+	const uint64_t now = tmr_jiffies();
+	struct pool_entry *old;
+	int err;
+
+	/* trim after the size was reduced */
+	while (list_count(&pool->entryl) > pool->size)
+		mem_deref(list_ledata(list_tail(&pool->entryl)));
+
+	/* the oldest entries are first */
+	old = list_ledata(list_head(&pool->entryl));
+
+	if (list_count(&pool->entryl) < pool->size || entry_is_old(old, now)) {
+
+		err = entry_alloc(pool);
+		if (err) {
+			warning("flowmgr: mfpool: mediaflow alloc failed"
+				" (%m)\n", err);
+			schedule_fill(pool, POOL_RETRY_DELAY);
+			return;
+		}
+
+		if (list_count(&pool->entryl) > pool->size) {
+			info("flowmgr: mfpool: replaced old mediaflow %p\n",
+			     old->mf);
+			mem_deref(old);
+		}
+	}
+
+	old = list_ledata(list_head(&pool->entryl));
+
+	if (list_count(&pool->entryl) < pool->size || entry_is_old(old, now))
+		schedule_fill(pool, POOL_FILL_DELAY);
+	else
+		schedule_fill(pool, POOL_CHECK_INTV);
+}
+
+
+static void destructor(void *arg)
+{
+	struct mfpool *pool = arg;
+
+	tmr_cancel(&pool->tmr);
+	list_flush(&pool->entryl);
+}
+
+
+int mfpool_alloc(struct mfpool **poolp, struct flowmgr *fm)
+{
+	struct mfpool *pool;
+
+	if (!poolp || !fm)
+		return EINVAL;
+
+	pool = mem_zalloc(sizeof(*pool), destructor);
+	if (!pool)
+		return ENOMEM;
+
+	list_init(&pool->entryl);
+	tmr_init(&pool->tmr);
+	pool->fm = fm;
+
+	*poolp = pool;
+
+	return 0;
+}
+
+
+void mfpool_set_size(struct mfpool *pool, uint32_t size)
+{
+	if (!pool)
+		return;
+
+	info("flowmgr: mfpool: size %u -> %u\n", pool->size, size);
+
+	pool->size = size;
+
+	schedule_fill(pool, 0);
+}
+
+
+/* Replace all entries, e.g. after a network or config change */
+void mfpool_flush(struct mfpool *pool)
+{
+	if (!pool)
+		return;
+
+	info("flowmgr: mfpool: flush %u mediaflows\n",
+	     list_count(&pool->entryl));
+
+	list_flush(&pool->entryl);
+
+	schedule_fill(pool, POOL_FILL_DELAY);
+}
+
+
+/*
+ * Take a mediaflow from the pool, the oldest gathered one if there
+ * is any. The caller owns the mediaflow and must set its handlers.
+ */
+int mfpool_checkout(struct mfpool *pool, struct mediaflow **mfp)
+{
+	struct pool_entry *pe = NULL;
+	struct le *le;
+
+	if (!pool || !mfp)
+		return EINVAL;
+
+	LIST_FOREACH(&pool->entryl, le) {
+		struct pool_entry *cur = le->data;
+
+		if (mediaflow_is_gathered(cur->mf)) {
+			pe = cur;
+			break;
+		}
+	}
+
+	/* still gathering, but the sockets are bound */
+	if (!pe)
+		pe = list_ledata(list_head(&pool->entryl));
+	if (!pe)
+		return ENOENT;
+
+	mediaflow_set_gather_handler(pe->mf, NULL);
+	mediaflow_set_handlers(pe->mf, NULL, NULL, NULL);
+
+	*mfp = pe->mf;
+	pe->mf = NULL;
+	mem_deref(pe);
+
+	schedule_fill(pool, POOL_FILL_DELAY);
+
+	return 0;
+}
+
+
+uint32_t mfpool_size(const struct mfpool *pool)
+{
+	return pool ? pool->size : 0;
+}
+
+
+uint32_t mfpool_ready(const struct mfpool *pool)
+{
+	struct le *le;
+	uint32_t n = 0;
+
+	if (!pool)
+		return 0;
+
+	LIST_FOREACH(&pool->entryl, le) {
+		struct pool_entry *pe = le->data;
+
+		if (mediaflow_is_gathered(pe->mf))
+			++n;
+	}
+
+	return n;
+}
@@ -10,6 +10,7 @@ AVS_SRCS += \
 	flowmgr/flow.c \
 	flowmgr/flowmgr.c \
 	flowmgr/marshal.c \
+	flowmgr/mfpool.c \
 	flowmgr/rr.c \
 	flowmgr/userflow.c \
 	flowmgr/voice_message.c
@@ -62,6 +62,17 @@ static void rtp_start_handler(bool started, bool video_started, void *arg)
 }
 
 
+static void level_handler(uint8_t level, bool speaking, void *arg)
+{
+	struct userflow *uf = arg;
+
+	if (!uf || !uf->flow)
+		return;
+
+	flow_audio_level(uf->flow, level, speaking);
+}
+
+
 static void mediaflow_close_handler(int err, void *arg)
 {
 	struct userflow *uf = arg;
@@ -169,10 +180,16 @@ static void mediaflow_localcand_handler(const struct zapi_candidate *candv,
 #endif
 
 
+struct if_ctx {
+	struct mediaflow *mf;
+	unsigned num_if;
+};
+
+
 static bool interface_handler(const char *ifname, const struct sa *sa,
 			      void *arg)
 {
-	struct userflow *uf = arg;
+	struct if_ctx *ctx = arg;
 	const char *bindif = msystem_get_interface();
 	int err;
 
@@ -186,16 +203,16 @@ static bool interface_handler(const char *ifname, const struct sa *sa,
 	}
 
 	info("flowmgr: adding local host interface to mf=%p: %s:%j\n",
-	     uf->mediaflow, ifname, sa);
+	     ctx->mf, ifname, sa);
 
-	err = mediaflow_add_local_host_candidate(uf->mediaflow, ifname, sa);
+	err = mediaflow_add_local_host_candidate(ctx->mf, ifname, sa);
 	if (err) {
 		warning("flowmgr: userflow: failed to add local host candidate"
 			" %s:%j (%m)\n", ifname, sa, err);
 		return false;
 	}
 
-	++uf->num_if;
+	++ctx->num_if;
 
 	return false;
 }
@@ -271,14 +288,14 @@ static void mediaflow_gather_handler(void *arg)
 }
 
 
-static int userflow_add_iceserver(struct userflow *uf,
-				  const char *uristr,
-				  const char *username, const char *password)
+static int add_iceserver(struct mediaflow *mf,
+			 const char *uristr,
+			 const char *username, const char *password)
 {
 	struct stun_uri stun_uri;
 	int err;
 
-	if (!uf || !uristr)
+	if (!mf || !uristr)
 		return EINVAL;
 
 	err = stun_uri_decode(&stun_uri, uristr);
@@ -291,7 +308,7 @@ static int userflow_add_iceserver(struct userflow *uf,
 	switch (stun_uri.scheme) {
 
 	case STUN_SCHEME_STUN:
-		err = mediaflow_gather_stun(uf->mediaflow, &stun_uri.addr);
+		err = mediaflow_gather_stun(mf, &stun_uri.addr);
 		if (err)
 			return err;
 		break;
@@ -306,7 +323,7 @@ static int userflow_add_iceserver(struct userflow *uf,
 		switch (stun_uri.proto) {
 
 		case IPPROTO_UDP:
-			err = mediaflow_gather_turn(uf->mediaflow,
+			err = mediaflow_gather_turn(mf,
 						    &stun_uri.addr,
 						    username, password);
 			if (err)
@@ -314,7 +331,7 @@ static int userflow_add_iceserver(struct userflow *uf,
 			break;
 
 		case IPPROTO_TCP:
-			err = mediaflow_gather_turn_tcp(uf->mediaflow,
+			err = mediaflow_gather_turn_tcp(mf,
 							&stun_uri.addr,
 							username, password,
 							stun_uri.secure);
@@ -340,25 +357,62 @@ static int userflow_add_iceserver(struct userflow *uf,
 }
 
 
-int userflow_update_config(struct userflow *uf)
+/* STUN servers first, then the TURN servers that did best recently */
+static uint32_t iceserver_score(const struct zapi_ice_server *srv)
+{
+	struct stun_uri uri;
+
+	if (stun_uri_decode(&uri, srv->url))
+		return UINT32_MAX;
+
+	if (uri.scheme == STUN_SCHEME_STUN)
+		return 0;
+
+	return turnconn_srv_score(&uri.addr, uri.proto, uri.secure);
+}
+
+
+static void add_iceservers(struct mediaflow *mf, struct flowmgr *fm)
 {
 	struct call_config *call_config;
-	int err = 0;
-	
+	int err;
+
 	/* optional iceservers */
-	call_config = uf->call ? &uf->call->fm->config.cfg : NULL;
+	call_config = fm ? &fm->config.cfg : NULL;
 	if (call_config && call_config->iceserverc) {
 
+		struct zapi_ice_server *srvv[ARRAY_SIZE(
+						call_config->iceserverv)];
+		uint32_t scorev[ARRAY_SIZE(call_config->iceserverv)];
 		struct zapi_ice_server *srv;
-		size_t i;
+		size_t i, j, n;
 
-		for (i=0; i<call_config->iceserverc; i++) {
+		n = min(call_config->iceserverc, ARRAY_SIZE(srvv));
+
+		/* stable insertion sort, the list is short */
+		for (i=0; i<n; i++) {
 
 			srv = &call_config->iceserverv[i];
+			scorev[i] = iceserver_score(srv);
+			srvv[i] = srv;
+
+			for (j=i; j>0 && scorev[j-1] > scorev[j]; j--) {
+				uint32_t score = scorev[j];
+
+				scorev[j] = scorev[j-1];
+				scorev[j-1] = score;
+				srvv[j] = srvv[j-1];
+				srvv[j-1] = srv;
+			}
+		}
 
-			err = userflow_add_iceserver(uf, srv->url,
-						     srv->username,
-						     srv->credential);
+		for (i=0; i<n; i++) {
+
+			srv = srvv[i];
+
+			err = add_iceserver(mf, srv->url,
+					    srv->username,
+					    srv->credential);
 			if (err) {
 				warning("flowmgr: failed to add iceserver"
 					" (%m)\n", err);
@@ -370,20 +424,34 @@ int userflow_update_config(struct userflow *uf)
 	else {
 		info("flowmgr: userflow_alloc_mediaflow: no iceservers\n");
 	}
+}
+
+
+int userflow_update_config(struct userflow *uf)
+{
+	add_iceservers(uf->mediaflow, uf->call ? uf->call->fm : NULL);
 
 	return 0;
 }
 
 
-int userflow_alloc_mediaflow(struct userflow *uf)
+/*
+ * Allocate a mediaflow with the local candidates and ICE servers
+ * of the flowmgr. Used for calls and for the mediaflow pool.
+ */
+int userflow_mediaflow_alloc(struct mediaflow **mfp, struct flowmgr *fm,
+			     mediaflow_estab_h *estabh,
+			     mediaflow_close_h *closeh, void *arg)
 {
 	enum mediaflow_nat nat = MEDIAFLOW_TRICKLEICE_DUALSTACK;
-	struct flowmgr *fm;
-	struct sa laddr;	
+	struct mediaflow *mf = NULL;
+	struct if_ctx ctx;
+	struct sa laddr;
 	int err;
 
-	debug("userflow_alloc_mediaflow: uf=%p\n", uf);
-	
+	if (!mfp)
+		return EINVAL;
+
 	/*
 	 * NOTE: v4 has presedence over v6 for now
 	 */
@@ -403,54 +471,51 @@ int userflow_alloc_mediaflow(struct userflow *uf)
 		goto out;
 	}
 
-	err = mediaflow_alloc(&uf->mediaflow,
+	err = mediaflow_alloc(&mf,
 			      msystem_dtls(),
 			      msystem_aucodecl(),
 			      &laddr, nat, CRYPTO_DTLS_SRTP, true,
 			      NULL,
-			      mediaflow_estab_handler, 
-			      mediaflow_close_handler, uf);
+			      estabh,
+			      closeh, arg);
 	if (err) {
 		warning("flowmgr: failed to alloc mediaflow (%m)\n", err);
 		goto out;
 	}
 
-	fm = call_flowmgr(uf->call);
 	if (fm && fm->config.cfg.early_dtls) {
 
 		info("flowmgr: enable early-DTLS\n");
-		mediaflow_set_earlydtls(uf->mediaflow,
-					fm->config.cfg.early_dtls);
+		mediaflow_set_earlydtls(mf, fm->config.cfg.early_dtls);
 	}
 
 #if 1
 	if (msystem_get_privacy()) {
 		info("flowmgr: enable mediaflow privacy\n");
-		mediaflow_enable_privacy(uf->mediaflow, true);
+		mediaflow_enable_privacy(mf, true);
 	}
 #endif
 
-	mediaflow_set_gather_handler(uf->mediaflow,
-				     mediaflow_gather_handler);
-
-	mediaflow_set_rtpstate_handler(uf->mediaflow, rtp_start_handler);
+	if (msystem_get_turn_shared())
+		mediaflow_enable_turn_sharing(mf, true);
 
 	info("flowmgr: adding video\n");
 
 	// TODO: add a run-time option for video-call or not ?
-	err = mediaflow_add_video(uf->mediaflow, msystem_vidcodecl());
+	err = mediaflow_add_video(mf, msystem_vidcodecl());
 	if (err) {
 		warning("flowmgr: mediaflow add video failed (%m)\n", err);
 		goto out;
 	}
 
 	/* populate all network interfaces */
-	uf->num_if = 0;
-	net_if_apply(interface_handler, uf);
+	ctx.mf = mf;
+	ctx.num_if = 0;
+	net_if_apply(interface_handler, &ctx);
 
-	info("flowmgr: num interfaces added: %u\n", uf->num_if);
+	info("flowmgr: num interfaces added: %u\n", ctx.num_if);
 
-	if (uf->num_if == 0) {
+	if (ctx.num_if == 0) {
 
 		if (msystem_get_loopback()) {
 
@@ -458,7 +523,7 @@ int userflow_alloc_mediaflow(struct userflow *uf)
 
 			sa_set_str(&lo, "127.0.0.1", 0);
 
-			err = mediaflow_add_local_host_candidate(uf->mediaflow,
+			err = mediaflow_add_local_host_candidate(mf,
 								 "lo0", &lo);
 			if (err) {
 				warning("flowmgr: userflow: failed "
@@ -471,20 +536,66 @@ int userflow_alloc_mediaflow(struct userflow *uf)
 		}
 	}
 
-	err = userflow_update_config(uf);
-	if (err) {
-		warning("userflow(%p): failed to update config\n", uf);
-		goto out;
-	}
+	add_iceservers(mf, fm);
 
  out:
 	if (err)
-		uf->mediaflow = mem_deref(uf->mediaflow);
+		mem_deref(mf);
+	else
+		*mfp = mf;
 
 	return err;
 }
 
 
+int userflow_alloc_mediaflow(struct userflow *uf)
+{
+	struct flowmgr *fm;
+	int err;
+
+	debug("userflow_alloc_mediaflow: uf=%p\n", uf);
+
+	fm = call_flowmgr(uf->call);
+
+	/* a pre-gathered mediaflow saves the gathering round-trips */
+	err = mfpool_checkout(fm ? fm->pool.mfp : NULL, &uf->mediaflow);
+	if (!err) {
+		info("flowmgr: userflow(%p): mediaflow %p from pool"
+		     " (gathered=%d)\n", uf, uf->mediaflow,
+		     mediaflow_is_gathered(uf->mediaflow));
+
+		mediaflow_set_handlers(uf->mediaflow,
+				       mediaflow_estab_handler,
+				       mediaflow_close_handler, uf);
+		uf->pooled = true;
+	}
+	else {
+		err = userflow_mediaflow_alloc(&uf->mediaflow, fm,
+					       mediaflow_estab_handler,
+					       mediaflow_close_handler, uf);
+		if (err)
+			return err;
+
+		uf->pooled = false;
+	}
+
+	if (fm) {
+		if (uf->pooled)
+			++fm->pool.stats.n_hit;
+		else
+			++fm->pool.stats.n_miss;
+	}
+
+	mediaflow_set_gather_handler(uf->mediaflow,
+				     mediaflow_gather_handler);
+
+	mediaflow_set_rtpstate_handler(uf->mediaflow, rtp_start_handler);
+	mediaflow_set_level_handler(uf->mediaflow, level_handler);
+
+	return 0;
+}
+
+
 static void destructor(void *arg)
 {
 	struct userflow *uf = arg;
@@ -51,6 +51,17 @@ int flowmgr_vm_stop_record(struct flowmgr *fm)
 }
 
 
+int flowmgr_vm_set_record_status_handler(struct flowmgr *fm,
+				flowmgr_vm_record_status_h *handler,
+				void *arg)
+{
+	(void)fm;
+
+	return voe_vm_set_record_status_handler(
+				(vm_record_status_h *)handler, arg);
+}
+
+
 int flowmgr_vm_get_length(struct flowmgr *fm,
 			  const char fileNameUTF8[1024],
 			  int* length_ms)
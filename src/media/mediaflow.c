@@ -50,6 +50,14 @@
 enum {
 	RTP_TIMEOUT_MS = 20000,
 	DTLS_MTU       = 1480,
+	UDP_RXBATCH    = 16,    /* datagrams per socket wakeup */
+	UDP_TXQUEUE    = 32,    /* datagrams per loop iteration */
+	SEND_HEADROOM  = 48,    /* TURN Send indication to IPv6 peer */
+	SEND_TAILROOM  = 32,    /* SRTP/SRTCP index and auth tag */
+	REPLAY_WINDOW_VIDEO = 1024, /* SRTP packets, video and RTX bursts */
+	SRTP_STREAMS_SPARE = 8,     /* SSRCs not in the SDP */
+	GATHER_GRACE   = 500,   /* ms for other relays after the first */
+	GATHER_TIMEOUT = 5000,  /* ms before gathering is cut off */
 };
 
 enum {
@@ -57,6 +65,17 @@ enum {
 	VIDEO_BANDWIDTH = 800,  /* kilobits/second */
 };
 
+/* RFC 6464 Client-to-Mixer Audio Level, in -dBov (127 is silence) */
+#define AULEVEL_URI "urn:ietf:params:rtp-hdrext:ssrc-audio-level"
+
+enum {
+	AULEVEL_ID_DEFAULT = 1,
+	AULEVEL_SPEAKING   = 50,   /* at or below is speaking          */
+	AULEVEL_SILENT     = 60,   /* above is not speaking any more   */
+	AULEVEL_DECAY      = 1,    /* dB per packet when getting quiet */
+	AULEVEL_BUCKET     = 8,    /* dB per reported level step       */
+};
+
 
 enum sdp_state {
 	SDP_IDLE = 0,
@@ -78,6 +97,7 @@ struct interface {
 	struct sa addr;
 	char ifname[64];
 	bool is_default;
+	struct udpmux_ep *ep;           /* shared host port (optional) */
 };
 
 
@@ -150,6 +170,10 @@ struct mediaflow {
 	bool ice_remote_eoc;
 	bool stun_server;
 	bool stun_ok;
+	bool stun_failed;
+	struct tmr tmr_gather;   /* grace time after the first relay */
+	bool gather_cutoff;
+	bool gathered;           /* gather handler was called */
 
 	/* crypto: */
 	enum media_crypto cryptos_local;
@@ -179,11 +203,32 @@ struct mediaflow {
 	struct auenc_state *aes;
 	struct audec_state *ads;
 	pthread_mutex_t mutex_enc;  /* protect the encoder state */
+	struct mbuf *mb_tx;         /* send buffer, protected by mutex_enc */
+
+	/* Established path, written with mutex_enc held on the re-thread */
+	struct {
+		struct udp_sock *us;     /* socket to send on              */
+		struct udp_helper *uh;   /* send below this helper, or NULL */
+		struct sa raddr;         /* selected remote address        */
+		struct srtp *srtp_tx;
+		struct srtp *srtp_rx;
+		int8_t ptv[128];         /* payload type to media_type, -1 */
+		bool valid;
+	} fp;
+
 	uint32_t srate;
 	uint8_t audio_ch;
 	bool started;
 	bool hold;
 
+	/* RFC 6464 audio level of the remote sender */
+	struct {
+		uint8_t id;          /* negotiated extension id, or 0 */
+		uint8_t level;       /* smoothed level in -dBov       */
+		bool speaking;
+		bool valid;
+	} aulevel;
+
 	/* Video */
 	struct {
 		struct sdp_media *sdpm;
@@ -206,6 +251,7 @@ struct mediaflow {
 	mediaflow_close_h *closeh;
 	mediaflow_rtp_state_h *rtpstateh;
 	mediaflow_gather_h *gatherh;
+	mediaflow_level_h *levelh;
 	void *arg;
 
 	struct {
@@ -227,6 +273,8 @@ struct mediaflow {
 	bool got_rtp;
 
 	struct list interfacel;
+	struct udpmux *udpmux;
+	bool turn_shared;        /* join the shared TURN allocations */
 
 	struct mediaflow_stats mf_stats;
 	bool privacy_mode;
@@ -250,6 +298,10 @@ struct mediaflow {
 #endif
 
 
+/* shared host port for new mediaflows, set by the application */
+static struct udpmux *udpmux_default;
+
+
 /* 0.0.0.0 port 0 */
 static const struct sa dummy_dtls_peer = {
 
@@ -268,16 +320,20 @@ static const struct sa dummy_dtls_peer = {
 
 /* prototypes */
 static int print_cand(struct re_printf *pf, const struct ice_cand_attr *cand);
-static void turnc_perm_handler(void *arg);
 static void add_turn_permission_ds(struct mediaflow *mf,
-				   struct turnc *turnc,
+				   struct turn_conn *conn,
 				   const struct ice_cand_attr *rcand);
 static void add_permission_to_remotes(struct mediaflow *mf);
 static void add_permission_to_remotes_ds(struct mediaflow *mf,
-					 struct turnc *turnc);
+					 struct turn_conn *conn);
 static void external_rtp_recv(struct mediaflow *mf,
-			      const struct sa *src, struct mbuf *mb);
+			      const struct sa *src, struct mbuf *mb,
+			      const struct rtp_meta *meta);
+static void fastpath_invalidate(struct mediaflow *mf);
+static struct interface *interface_find_sock(const struct mediaflow *mf,
+					     const void *sock);
 static bool are_all_turnconn_allocated(const struct mediaflow *mf);
+static void gather_check(struct mediaflow *mf);
 
 
 static void mf_log(const struct mediaflow *mf, enum log_level level,
@@ -498,6 +554,8 @@ static void ice_error(struct mediaflow *mf, int err)
 {
 	warning("mediaflow: error in ICE-transport (%m)\n", err);
 
+	fastpath_invalidate(mf);
+
 	mf->ice_ready = false;
 	mf->err = err;
 
@@ -522,6 +580,8 @@ static void crypto_error(struct mediaflow *mf, int err)
 {
 	warning("mediaflow: error in DTLS (%m)\n", err);
 
+	fastpath_invalidate(mf);
+
 	mf->crypto_ready = false;
 	mf->err = err;
 	mf->tls_conn = mem_deref(mf->tls_conn);
@@ -752,10 +812,10 @@ static int voenc_rtp_handler(const uint8_t *pkt, size_t len, void *arg)
 	if (!mf)
 		return EINVAL;
 
-	if (!mf->sent_rtp) {
+	/* on a full queue, try again with the next packet */
+	if (!mf->sent_rtp && !mqueue_push(mf->mq, MQ_RTP_START, NULL)) {
 		info("mediaflow: first RTP packet sent\n");
 		mf->sent_rtp = true;
-		mqueue_push(mf->mq, MQ_RTP_START, NULL);
 	}
 
 	err = mediaflow_send_raw_rtp(mf, pkt, len);
@@ -811,6 +871,7 @@ static int start_codecs(struct mediaflow *mf)
 	prm.pt = fmt->pt;
 	prm.srate = mf->srate ? mf->srate : ac->srate;
 	prm.ch = mf->audio_ch ? mf->audio_ch : ac->ch;
+	prm.extmap_aulevel = mf->aulevel.id;
 
 	if (ac->enc_alloc && !mf->aes) {
 		err = ac->enc_alloc(&mf->aes, &mf->mctx, ac, NULL,
@@ -1038,6 +1099,7 @@ static void timeout_rtp(void *arg)
 
 			mf->terminated = true;
 			mf->ice_ready = false;
+			fastpath_invalidate(mf);
 
 			if (mf->closeh)
 				mf->closeh(ETIMEDOUT, mf->arg);
@@ -1046,9 +1108,166 @@ static void timeout_rtp(void *arg)
 }
 
 
+/*
+ * The established path
+ *
+ * Once ICE and crypto are ready the socket, remote address, SRTP
+ * contexts and payload types do not change until the next ICE or
+ * DTLS event. They are resolved here once, so that sending and
+ * receiving RTP does not go through the NAT-mode switch, the UDP
+ * helper chain and the SDP format lists for every packet.
+ *
+ * NOTE: must be called with mutex_enc held
+ */
+static void fastpath_reset(struct mediaflow *mf)
+{
+	mf->fp.valid = false;
+	mf->fp.us = mem_deref(mf->fp.us);
+	mf->fp.uh = NULL;
+	mf->fp.srtp_tx = mem_deref(mf->fp.srtp_tx);
+	mf->fp.srtp_rx = mem_deref(mf->fp.srtp_rx);
+}
+
+
+static void fastpath_invalidate(struct mediaflow *mf)
+{
+	pthread_mutex_lock(&mf->mutex_enc);
+	fastpath_reset(mf);
+	pthread_mutex_unlock(&mf->mutex_enc);
+}
+
+
+static void fastpath_ptv_add(struct mediaflow *mf,
+			     const struct sdp_media *sdpm,
+			     enum media_type type)
+{
+	const struct list *lfmtl = sdp_media_format_lst(sdpm, true);
+	struct le *le;
+
+	LIST_FOREACH(lfmtl, le) {
+
+		const struct sdp_format *fmt = le->data;
+
+		if (fmt->pt < 0 || fmt->pt >= (int)sizeof(mf->fp.ptv))
+			continue;
+
+		/* the first match wins, as in sdp_media_lformat() */
+		if (mf->fp.ptv[fmt->pt] < 0)
+			mf->fp.ptv[fmt->pt] = type;
+	}
+}
+
+
+/* Re-build the established path, or drop it if not ready any more */
+static void fastpath_update(struct mediaflow *mf)
+{
+	struct udp_sock *us;
+	struct udp_helper *uh = NULL;
+	struct interface *ifc;
+
+	pthread_mutex_lock(&mf->mutex_enc);
+
+	fastpath_reset(mf);
+
+	if (mf->terminated || !mediaflow_is_ready(mf))
+		goto out;
+
+	if (mf->nat == MEDIAFLOW_TRICKLEICE_DUALSTACK) {
+
+		if (!mf->sel_lcand)
+			goto out;
+
+		us = trice_lcand_sock(mf->trice, mf->sel_lcand);
+
+		/* on a shared port, skip the helpers of the other flows */
+		ifc = interface_find_sock(mf, us);
+		if (ifc)
+			uh = udpmux_ep_helper(ifc->ep);
+	}
+	else {
+		us = rtp_sock(mf->rtp);
+		uh = mf->uh_srtp;
+	}
+
+	if (!us)
+		goto out;
+
+	mf->fp.us = mem_ref(us);
+	mf->fp.uh = uh;
+	mf->fp.raddr = mf->rcand.addr;
+	mf->fp.srtp_tx = mem_ref(mf->srtp_tx);
+	mf->fp.srtp_rx = mem_ref(mf->srtp_rx);
+
+	memset(mf->fp.ptv, -1, sizeof(mf->fp.ptv));
+	fastpath_ptv_add(mf, mf->sdpm, MEDIA_AUDIO);
+	fastpath_ptv_add(mf, mf->video.sdpm, MEDIA_VIDEO);
+
+	mf->fp.valid = true;
+
+ out:
+	pthread_mutex_unlock(&mf->mutex_enc);
+}
+
+
+/*
+ * Encrypt and send an RTP/RTCP packet on the established path
+ *
+ * NOTE: must be called with mutex_enc held, and fp.valid set
+ */
+static int fastpath_send(struct mediaflow *mf, struct mbuf *mb)
+{
+	int err = 0;
+
+	if (mf->fp.srtp_tx && packet_is_rtp_or_rtcp(mb)) {
+
+		if (packet_is_rtcp_packet(mb)) {
+
+			/* drop short RTCP packets */
+			if (mbuf_get_left(mb) <= 8)
+				return 0;
+
+			err = srtcp_encrypt(mf->fp.srtp_tx, mb);
+		}
+		else {
+			err = srtp_encrypt(mf->fp.srtp_tx, mb);
+		}
+
+		if (err) {
+			warning("mediaflow: fastpath: encrypt"
+				" [%zu bytes] failed (%m)\n",
+				mbuf_get_left(mb), err);
+			return err;
+		}
+	}
+
+	/* the SRTP helper is above, only TURN and STUN remain below */
+	if (mf->fp.uh)
+		return udp_send_helper(mf->fp.us, &mf->fp.raddr, mb,
+				       mf->fp.uh);
+	else
+		return udp_send(mf->fp.us, &mf->fp.raddr, mb);
+}
+
+
+/*
+ * Send an RTP/RTCP packet from tx_mbuf()
+ *
+ * NOTE: must be called with mutex_enc held
+ */
+static int send_media_packet(struct mediaflow *mf, struct mbuf *mb)
+{
+	if (mf->fp.valid)
+		return fastpath_send(mf, mb);
+
+	return udp_send(rtp_sock(mf->rtp), &mf->rcand.addr, mb);
+}
+
+
 /* this function is only called once */
 static void mediaflow_established_handler(struct mediaflow *mf)
 {
+	fastpath_update(mf);
+
 	if (mf->terminated)
 		return;
 	if (!mediaflow_is_ready(mf))
@@ -1119,12 +1338,49 @@ bool mediaflow_early_dtls_supported(const struct mediaflow *mf)
 }
 
 
+/*
+ * Get a send buffer with room for the largest TURN header in front of
+ * the packet and the SRTP trailer behind it, so that the UDP helpers
+ * can encrypt and wrap the packet in place.
+ *
+ * NOTE: must be called with mutex_enc held
+ */
+static struct mbuf *tx_mbuf(struct mediaflow *mf, size_t len)
+{
+	const size_t size = SEND_HEADROOM + len + SEND_TAILROOM;
+
+	/* still referenced by a lower layer, cannot be re-used */
+	if (mf->mb_tx && mem_nrefs(mf->mb_tx) > 1)
+		mf->mb_tx = mem_deref(mf->mb_tx);
+
+	if (!mf->mb_tx) {
+		mf->mb_tx = mbuf_alloc(size);
+		if (!mf->mb_tx)
+			return NULL;
+	}
+	else if (mf->mb_tx->size < size) {
+		if (mbuf_resize(mf->mb_tx, size))
+			return NULL;
+	}
+
+	mf->mb_tx->pos = SEND_HEADROOM;
+	mf->mb_tx->end = SEND_HEADROOM;
+
+	return mem_ref(mf->mb_tx);
+}
+
+
+/*
+ * Packets from the DTLS socket already have SEND_HEADROOM in front,
+ * and are sent in place. Others are copied to a new buffer.
+ */
 static int send_packet(struct mediaflow *mf, size_t headroom,
 		       const struct sa *raddr, struct mbuf *mb_pkt,
 		       enum packet pkt)
 {
-	struct mbuf *mb = NULL;
-	size_t len = mbuf_get_left(mb_pkt);
+	struct mbuf *mb, *mb_copy = NULL;
+	const size_t len = mbuf_get_left(mb_pkt);
+	const size_t pos = mb_pkt->pos, end = mb_pkt->end;
 	int err = 0;
 
 	if (!mf)
@@ -1136,16 +1392,18 @@ static int send_packet(struct mediaflow *mf, size_t headroom,
 	     mbuf_get_left(mb_pkt),
 	     sock_prefix(headroom), raddr);
 
-	mb = mbuf_alloc(headroom + len);
-	if (!mb)
-		return ENOMEM;
-
-	mb->pos = headroom;
-	mbuf_write_mem(mb, mbuf_buf(mb_pkt), len);
-	mb->pos = headroom;
+	if (mb_pkt->pos >= SEND_HEADROOM) {
+		mb = mb_pkt;
+	}
+	else {
+		mb = mb_copy = mbuf_alloc(SEND_HEADROOM + len);
+		if (!mb)
+			return ENOMEM;
 
-	/* now invalid */
-	mb_pkt = NULL;
+		mb->pos = SEND_HEADROOM;
+		mbuf_write_mem(mb, mbuf_buf(mb_pkt), len);
+		mb->pos = SEND_HEADROOM;
+	}
 
 	switch (mf->nat) {
 
@@ -1214,7 +1472,10 @@ static int send_packet(struct mediaflow *mf, size_t headroom,
 	}
 
  out:
-	mem_deref(mb);
+	mem_deref(mb_copy);
+
+	mb_pkt->pos = pos;
+	mb_pkt->end = end;
 
 	return err;
 }
@@ -1246,20 +1507,28 @@ static bool send_dtls_handler(int *err, struct sa *dst_unused,
 	if (mf->early_dtls_local) {
 
 		struct turn_conn *conn;
-		size_t headroom = 36;
 
 		conn = turnconn_find_allocated(&mf->turnconnl, IPPROTO_UDP);
 		if (conn) {
 
 			const struct sa *raddr = sdp_media_raddr(mf->sdpm);
-			struct mbuf *mb = 0;
+			struct mbuf *mb, *mb_copy = NULL;
 
-			mb = mbuf_alloc(headroom + len);
-			mb->pos = headroom;
-			mbuf_write_mem(mb, mbuf_buf(mb_pkt), len);
-			mb->pos = headroom;
+			/* sent in place if the DTLS socket left headroom */
+			if (mb_pkt->pos >= SEND_HEADROOM) {
+				mb = mb_pkt;
+			}
+			else {
+				mb = mb_copy = mbuf_alloc(SEND_HEADROOM + len);
+				if (!mb) {
+					*err = ENOMEM;
+					goto out;
+				}
 
-			mb_pkt = NULL;
+				mb->pos = SEND_HEADROOM;
+				mbuf_write_mem(mb, mbuf_buf(mb_pkt), len);
+				mb->pos = SEND_HEADROOM;
+			}
 
 			/* NOTE: do not check for "early_dtls" here as the
 			 *       receiving of the SDP can be slow ..
@@ -1269,14 +1538,14 @@ static bool send_dtls_handler(int *err, struct sa *dst_unused,
 			     " send %zu:%zu bytes to %J\n",
 			     mb->pos, mbuf_get_left(mb), raddr);
 
-			*err = turnc_send(conn->turnc, raddr, mb);
+			*err = turnconn_send(conn, raddr, mb);
 			if (*err) {
 				warning("mediaflow: turnc_send failed"
 					" (%zu bytes to %J) (%m)\n",
 					mbuf_get_left(mb), raddr, *err);
 			}
 
-			mem_deref(mb);
+			mem_deref(mb_copy);
 
 			goto out;  /* handled */
 		}
@@ -1416,11 +1685,119 @@ static bool verify_fingerprint(struct mediaflow *mf,
 }
 
 
+/* master key and salt length of a DTLS-SRTP suite */
+static size_t get_master_keylen(enum srtp_suite suite)
+{
+	switch (suite) {
+
+	case SRTP_AES_CM_128_HMAC_SHA1_32: return 16+14;
+	case SRTP_AES_CM_128_HMAC_SHA1_80: return 16+14;
+	case SRTP_AES_256_CM_HMAC_SHA1_32: return 32+14;
+	case SRTP_AES_256_CM_HMAC_SHA1_80: return 32+14;
+	case SRTP_AES_128_GCM:             return 16+12;
+	case SRTP_AES_256_GCM:             return 32+12;
+	default: return 0;
+	}
+}
+
+
+/*
+ * Video bursts and RTX retransmissions arrive well behind the newest
+ * packet, so they need a wider SRTP replay window. The window must be
+ * set before the first packet, and video may start after DTLS is
+ * established, so the receive context always gets the wide window.
+ */
+static void set_replay_window(struct mediaflow *mf)
+{
+	int err;
+
+	err = srtp_set_replay_window(mf->srtp_rx, REPLAY_WINDOW_VIDEO);
+	if (err) {
+		warning("mediaflow: could not set SRTP replay window"
+			" (%m)\n", err);
+	}
+}
+
+
+struct ssrc_set {
+	uint32_t v[32];
+	size_t c;
+};
+
+
+static bool ssrc_set_handler(const char *name, const char *value, void *arg)
+{
+	struct ssrc_set *set = arg;
+	struct pl pl;
+	(void)name;
+
+	if (set->c >= ARRAY_SIZE(set->v))
+		return true;
+
+	if (re_regex(value, strlen(value), "[0-9]+", &pl))
+		return false;
+
+	update_ssrc_array(set->v, &set->c, pl_u32(&pl));
+
+	return false;
+}
+
+
+/*
+ * Audio, video and RTX share one SRTP context per direction. The
+ * stream limit is raised to the number of SSRCs in the SDP, with
+ * room for SSRCs that are not signalled, e.g. after an SSRC change.
+ */
+static void set_max_streams(struct mediaflow *mf)
+{
+	struct ssrc_set rset;
+	uint32_t lssrcc = 0;
+	size_t i;
+	int err = 0;
+
+	memset(&rset, 0, sizeof(rset));
+	sdp_media_rattr_apply(mf->sdpm, "ssrc", ssrc_set_handler, &rset);
+	sdp_media_rattr_apply(mf->video.sdpm, "ssrc", ssrc_set_handler,
+			      &rset);
+
+	for (i = 0; i < MEDIA_NUM; i++) {
+		if (mf->lssrcv[i])
+			++lssrcc;
+	}
+
+	if (mf->srtp_tx) {
+		err |= srtp_set_max_streams(mf->srtp_tx,
+					    lssrcc + SRTP_STREAMS_SPARE);
+	}
+	if (mf->srtp_rx) {
+		err |= srtp_set_max_streams(mf->srtp_rx,
+					    (uint32_t)rset.c +
+					    SRTP_STREAMS_SPARE);
+	}
+	if (err) {
+		warning("mediaflow: could not set SRTP max streams"
+			" (%m)\n", err);
+	}
+}
+
+
+static void update_replay_stats(struct mediaflow *mf)
+{
+	struct srtp_stats stats;
+
+	if (srtp_stats_get(mf->srtp_rx, &stats))
+		return;
+
+	mf->mf_stats.srtp_replay_drops = (unsigned)stats.replay;
+	mf->mf_stats.srtp_window_drops = (unsigned)stats.old;
+}
+
 static void dtls_estab_handler(void *arg)
 {
 	struct mediaflow *mf = arg;
 	enum srtp_suite suite;
-	uint8_t cli_key[30], srv_key[30];
+	uint8_t cli_key[46], srv_key[46];
+	size_t keylen;
 	int err;
 
 	if (mf->mf_stats.dtls_estab < 0 && mf->ts_dtls)
@@ -1452,10 +1829,15 @@ static void dtls_estab_handler(void *arg)
 
 	info("mediaflow: DTLS established (%s)\n", srtp_suite_name(suite));
 
+	keylen = get_master_keylen(suite);
+
+	/* re-built with the new keys by mediaflow_established_handler */
+	fastpath_invalidate(mf);
+
 	mf->srtp_tx = mem_deref(mf->srtp_tx);
 	err = srtp_alloc(&mf->srtp_tx, suite,
 			 mf->setup_local == SETUP_ACTIVE ? cli_key : srv_key,
-			 sizeof(cli_key), 0);
+			 keylen, 0);
 	if (err) {
 		warning("mediaflow: failed to allocate SRTP for TX (%m)\n",
 			err);
@@ -1464,13 +1846,16 @@ static void dtls_estab_handler(void *arg)
 
 	err = srtp_alloc(&mf->srtp_rx, suite,
 			 mf->setup_local == SETUP_ACTIVE ? srv_key : cli_key,
-			 sizeof(srv_key), 0);
+			 keylen, 0);
 	if (err) {
 		warning("mediaflow: failed to allocate SRTP for RX (%m)\n",
 			err);
 		goto error;
 	}
 
+	set_replay_window(mf);
+	set_max_streams(mf);
+
 	mf->crypto_ready = true;
 
 	mediaflow_established_handler(mf);
@@ -1754,6 +2139,9 @@ static int handle_sdes_srtp_rx(struct mediaflow *mf)
                return err;
        }
 
+       set_replay_window(mf);
+       set_max_streams(mf);
+
        return err;
 }
 
@@ -1772,72 +2160,180 @@ static void handle_dtls_packet(struct mediaflow *mf, const struct sa *src,
 }
 
 
-static bool udp_helper_recv_handler_srtp(struct sa *src, struct mbuf *mb,
-					 void *arg)
+/*
+ * Decrypt and dispatch a received RTP/RTCP packet. The header is
+ * decoded once here, and the metadata is used by SRTP, the statistics
+ * and the codec dispatch.
+ *
+ * Returns true if the packet was handled, false to pass it on to the
+ * internal RTP-stack.
+ */
+static bool media_recv(struct mediaflow *mf, const struct sa *src,
+		       struct mbuf *mb)
 {
-	struct mediaflow *mf = arg;
-	size_t len = mbuf_get_left(mb);
-	const enum packet pkt = packet_classify_packet_type(mb);
+	const size_t len = mbuf_get_left(mb);
+	struct rtp_meta meta;
+	struct srtp *srtp;
 	int err;
 
-	if (pkt == PACKET_DTLS) {
-		handle_dtls_packet(mf, src, mb);
+	err = rtp_meta_decode(&meta, mb);
+	if (err) {
+		warning("mediaflow: recv: bad RTP/RTCP header"
+			" [%zu bytes from %J] (%m)\n", len, src, err);
 		return true;
 	}
 
-	if (packet_is_rtp_or_rtcp(mb)) {
+	srtp = mf->fp.valid ? mf->fp.srtp_rx : mf->srtp_rx;
 
+	if (!srtp) {
 		/* the SRTP is not ready yet .. */
-		if (!mf->srtp_rx) {
+		if (!mf->fp.valid)
 			mf->stat.n_srtp_dropped++;
-			goto next;
-		}
-
-		if (packet_is_rtcp_packet(mb)) {
+	}
+	else {
+		if (meta.rtcp)
+			err = srtcp_decrypt(srtp, mb);
+		else
+			err = srtp_decrypt_meta(srtp, mb, &meta);
 
-			err = srtcp_decrypt(mf->srtp_rx, mb);
-			if (err) {
-				mf->stat.n_srtp_error++;
-				warning("mediaflow: srtcp_decrypt failed"
-					" [%zu bytes] (%m)\n", len, err);
-				return true;
+		if (err) {
+			mf->stat.n_srtp_error++;
+			if (err == EALREADY) {
+				update_replay_stats(mf);
 			}
-		}
-		else {
-			err = srtp_decrypt(mf->srtp_rx, mb);
-			if (err) {
-				mf->stat.n_srtp_error++;
-				if (err != EALREADY) {
-					warning("mediaflow: srtp_decrypt"
-						" failed"
-						" [%zu bytes from %J] (%m)\n",
-						len, src, err);
-				}
-				return true;
+			else {
+				warning("mediaflow: %s decrypt failed"
+					" [%zu bytes from %J] (%m)\n",
+					meta.rtcp ? "srtcp" : "srtp",
+					len, src, err);
 			}
+			return true;
 		}
+	}
 
+	/* If external RTP is enabled, forward RTP/RTCP packets
+	 * to the relevant au/vid-codec.
+	 *
+	 * otherwise just pass it up to internal RTP-stack
+	 */
+	if (mf->external_rtp) {
+		external_rtp_recv(mf, src, mb, &meta);
+		return true; /* handled */
 	}
 
- next:
-	if (packet_is_rtp_or_rtcp(mb)) {
+	update_rx_stats(mf, mbuf_get_left(mb));
 
-		/* If external RTP is enabled, forward RTP/RTCP packets
-		 * to the relevant au/vid-codec.
-		 *
-		 * otherwise just pass it up to internal RTP-stack
-		 */
-		if (mf->external_rtp) {
-			external_rtp_recv(mf, src, mb);
-			return true; /* handled */
+	return false;  /* continue processing */
+}
+
+
+static bool udp_helper_recv_handler_srtp(struct sa *src, struct mbuf *mb,
+					 void *arg)
+{
+	struct mediaflow *mf = arg;
+
+	if (packet_is_rtp_or_rtcp(mb))
+		return media_recv(mf, src, mb);
+
+	if (packet_is_dtls_packet(mb)) {
+		handle_dtls_packet(mf, src, mb);
+		return true;
+	}
+
+	return false;
+}
+
+
+static bool extmap_handler(const char *name, const char *value, void *arg)
+{
+	struct mediaflow *mf = arg;
+	struct sdp_extmap extmap;
+	(void)name;
+
+	if (sdp_extmap_decode(&extmap, value))
+		return false;
+
+	if (pl_strcasecmp(&extmap.name, AULEVEL_URI))
+		return false;
+
+	/* one-byte header elements only */
+	if (extmap.id < 1 || extmap.id > 14)
+		return false;
+
+	mf->aulevel.id = extmap.id;
+
+	return true;
+}
+
+
+/*
+ * Find the audio level in the one-byte header extension of RFC 5285.
+ * The level follows a louder level at once and decays slowly, and the
+ * smoothed level goes to the decoder and the level handler.
+ */
+static void aulevel_recv(struct mediaflow *mf, const struct aucodec *ac,
+			 const struct mbuf *mb, const struct rtp_meta *meta)
+{
+	const uint8_t *p = mb->buf + meta->start + meta->ext_off;
+	const size_t len = meta->hdr.x.len * sizeof(uint32_t);
+	uint8_t level = 0, prev;
+	bool speaking, vad, found = false;
+	size_t i = 0;
+
+	if (meta->hdr.x.type != 0xbede)
+		return;
+
+	while (i < len) {
+		const uint8_t id = p[i] >> 4;
+		const size_t elen = (p[i] & 0x0f) + 1;
+
+		if (p[i] == 0x00) {  /* padding */
+			++i;
+			continue;
 		}
-		else {
-			update_rx_stats(mf, mbuf_get_left(mb));
-			return false;  /* continue processing */
+		if (id == 15 || i + 1 + elen > len)
+			break;
+
+		if (id == mf->aulevel.id) {
+			level = p[i + 1];
+			found = true;
+			break;
 		}
+
+		i += 1 + elen;
 	}
 
-	return false;
+	if (!found)
+		return;
+
+	vad = (level & 0x80) != 0;
+	level &= 0x7f;
+	prev = mf->aulevel.level;
+
+	if (!mf->aulevel.valid || level <= prev)
+		mf->aulevel.level = level;
+	else
+		mf->aulevel.level = min(prev + AULEVEL_DECAY, level);
+
+	/* the decoder selects the speakers by the smoothed level */
+	if (ac && ac->dec_levelh)
+		ac->dec_levelh(mf->ads, mf->aulevel.level, vad);
+
+	if (mf->aulevel.speaking)
+		speaking = mf->aulevel.level <= AULEVEL_SILENT;
+	else
+		speaking = mf->aulevel.level <= AULEVEL_SPEAKING;
+
+	if (mf->aulevel.valid &&
+	    speaking == mf->aulevel.speaking &&
+	    mf->aulevel.level / AULEVEL_BUCKET == prev / AULEVEL_BUCKET)
+		return;
+
+	mf->aulevel.valid = true;
+	mf->aulevel.speaking = speaking;
+
+	if (mf->levelh)
+		mf->levelh(mf->aulevel.level, speaking, mf->arg);
 }
 
 
@@ -1847,14 +2343,14 @@ static bool udp_helper_recv_handler_srtp(struct sa *src, struct mbuf *mb,
  * -- send to decoder if supported by it
  */
 static void external_rtp_recv(struct mediaflow *mf,
-			      const struct sa *src, struct mbuf *mb)
+			      const struct sa *src, struct mbuf *mb,
+			      const struct rtp_meta *meta)
 {
 	const struct aucodec *ac;
 	const struct vidcodec *vc;
-	struct rtp_header hdr;
-	const struct sdp_format *fmt;
+	const uint8_t pt = meta->hdr.pt;
 	size_t start = mb->pos;
-	int err;
+	int type = -1;
 
 	if (!mf->started) {
 		return;
@@ -1863,7 +2359,7 @@ static void external_rtp_recv(struct mediaflow *mf,
 	ac = audec_get(mf->ads);
 	vc = viddec_get(mf->video.vds);
 
-	if (!packet_is_rtcp_packet(mb)) {
+	if (!meta->rtcp) {
 		update_rx_stats(mf, mbuf_get_left(mb));
 	}
 	else {
@@ -1889,15 +2385,17 @@ static void external_rtp_recv(struct mediaflow *mf,
 		check_rtpstart(mf);
 	}
 
-	err = rtp_hdr_decode(&hdr, mb);
-	mb->pos = start;
-	if (err) {
-		warning("mediaflow: rtp header decode (%m)\n", err);
-		goto out;
-	}
+	if (mf->fp.valid)
+		type = mf->fp.ptv[pt];
+	else if (sdp_media_lformat(mf->sdpm, pt))
+		type = MEDIA_AUDIO;
+	else if (sdp_media_lformat(mf->video.sdpm, pt))
+		type = MEDIA_VIDEO;
+
+	if (type == MEDIA_AUDIO) {
 
-	fmt = sdp_media_lformat(mf->sdpm, hdr.pt);
-	if (fmt) {
+		if (mf->aulevel.id && meta->ext_off)
+			aulevel_recv(mf, ac, mb, meta);
 
 		/* now, pass on the raw RTP/RTCP packet to the decoder */
 
@@ -1905,15 +2403,14 @@ static void external_rtp_recv(struct mediaflow *mf,
 			ac->dec_rtph(mf->ads,
 				     mbuf_buf(mb), mbuf_get_left(mb));
 
-			rtp_stats_update(&mf->audio_stats_rcv,
-					 mbuf_buf(mb), mbuf_get_left(mb));
+			rtp_stats_update_meta(&mf->audio_stats_rcv,
+					      meta, mbuf_get_left(mb));
 		}
 
 		goto out;
 	}
 
-	fmt = sdp_media_lformat(mf->video.sdpm, hdr.pt);
-	if (fmt) {
+	if (type == MEDIA_VIDEO) {
 		if (!mf->video.has_rtp) {
 			mf->video.has_rtp = true;
 			check_rtpstart(mf);
@@ -1922,15 +2419,15 @@ static void external_rtp_recv(struct mediaflow *mf,
 			vc->dec_rtph(mf->video.vds,
 				     mbuf_buf(mb), mbuf_get_left(mb));
 
-			rtp_stats_update(&mf->video_stats_rcv,
-					 mbuf_buf(mb),mbuf_get_left(mb));
+			rtp_stats_update_meta(&mf->video_stats_rcv,
+					      meta, mbuf_get_left(mb));
 		}
 
 		goto out;
 	}
 
 	info("mediaflow: recv: no SDP format found"
-	     " for payload type %d\n", hdr.pt);
+	     " for payload type %d\n", pt);
 
  out:
 	return;  /* stop packet here */
@@ -2046,6 +2543,9 @@ int mediaflow_summary(struct re_printf *pf, const struct mediaflow *mf)
 				  mf->mf_stats.dtls_pkt_sent,
 				  mf->mf_stats.dtls_pkt_recv);
 	}
+	err |= re_hprintf(pf, "SRTP replay drops:   %u (outside window %u)\n",
+			  mf->mf_stats.srtp_replay_drops,
+			  mf->mf_stats.srtp_window_drops);
 	err |= re_hprintf(pf, "\n");
 
 	err |= re_hprintf(pf, "RTP packets lost:    %zu\n",
@@ -2080,6 +2580,25 @@ int mediaflow_summary(struct re_printf *pf, const struct mediaflow *mf)
 	err |= re_hprintf(pf, "SRTP errors:     %zu\n",
 			  mf->stat.n_srtp_error);
 
+	if (mf->sel_lcand && mf->sel_lcand->attr.proto == IPPROTO_UDP) {
+		const struct udp_txstat *txs;
+
+		txs = udp_txqueue_stat(trice_lcand_sock(mf->trice,
+							mf->sel_lcand));
+		if (txs && txs->n_syscall) {
+			err |= re_hprintf(pf, "UDP tx queue:    %llu packets"
+					  " in %llu syscalls (%.1f/syscall,"
+					  " gso=%llu, other threads=%llu,"
+					  " errors=%llu)\n",
+					  (unsigned long long)txs->n_pkt,
+					  (unsigned long long)txs->n_syscall,
+					  (double)txs->n_pkt / txs->n_syscall,
+					  (unsigned long long)txs->n_gso,
+					  (unsigned long long)txs->n_handoff,
+					  (unsigned long long)txs->n_err);
+		}
+	}
+
 	err |= re_hprintf(pf, "\nvideo_media: %d\n", mf->video.has_media);
 
 	if (mf->nat == MEDIAFLOW_TRICKLEICE_DUALSTACK ||
@@ -2245,6 +2764,7 @@ static void destructor(void *arg)
 
 	tmr_cancel(&mf->tmr_rtp);
 	tmr_cancel(&mf->tmr_nat);
+	tmr_cancel(&mf->tmr_gather);
 
 	/* XXX: voe is calling to mediaflow_xxx here */
 	/* deref the encoders/decodrs first, as they may be multithreaded,
@@ -2257,6 +2777,8 @@ static void destructor(void *arg)
 	mf->video.ves = mem_deref(mf->video.ves);
 	mf->video.vds = mem_deref(mf->video.vds);
 
+	fastpath_reset(mf);
+
 	mem_deref(mf->tls_conn);
 
 	list_flush(&mf->interfacel);
@@ -2268,6 +2790,7 @@ static void destructor(void *arg)
 	mf->trice_stun = mem_deref(mf->trice_stun);
 	mem_deref(mf->us_turn);
 	list_flush(&mf->turnconnl);
+	mem_deref(mf->udpmux);
 
 	//mem_deref(mf->tls_conn);
 	mem_deref(mf->dtls_sock);
@@ -2279,6 +2802,7 @@ static void destructor(void *arg)
 
 	mem_deref(mf->srtp_tx);
 	mem_deref(mf->srtp_rx);
+	mem_deref(mf->mb_tx);
 	mem_deref(mf->dtls);
 	mem_deref(mf->ct_gather);
 
@@ -2435,6 +2959,9 @@ int mediaflow_alloc(struct mediaflow **mfp,
 	mf->rcand.type = (enum ice_cand_type)-1;
 	mf->ice_tiebrk = rand_u64();
 
+	if (nat == MEDIAFLOW_TRICKLEICE_DUALSTACK)
+		mf->udpmux = mem_ref(udpmux_default);
+
 	err = pthread_mutex_init(&mf->mutex_enc, NULL);
 	if (err)
 		goto out;
@@ -2482,6 +3009,8 @@ int mediaflow_alloc(struct mediaflow **mfp,
 		goto out;
 
 	sdp_media_set_lattr(mf->sdpm, false, "mid", "audio");
+	sdp_media_set_lattr(mf->sdpm, false, "extmap", "%u %s",
+			    AULEVEL_ID_DEFAULT, AULEVEL_URI);
 
 	rand_str(mf->cname, sizeof(mf->cname));
 	rand_str(mf->msid, sizeof(mf->msid));
@@ -2570,6 +3099,9 @@ int mediaflow_alloc(struct mediaflow **mfp,
 		if (err)
 			goto out;
 
+		udp_rxbatch_set(mf->us_turn, UDP_RXBATCH);
+		udp_txqueue_set(mf->us_turn, UDP_TXQUEUE);
+
 		err = udp_local_get(mf->us_turn, &laddr_turn);
 		if (err)
 			goto out;
@@ -2686,6 +3218,7 @@ int mediaflow_alloc(struct mediaflow **mfp,
 			goto out;
 
 		dtls_set_mtu(mf->dtls_sock, DTLS_MTU);
+		dtls_set_headroom(mf->dtls_sock, SEND_HEADROOM);
 
 		err = sdp_media_set_lattr(mf->sdpm, true,
 					  "fingerprint", "sha-256 %H",
@@ -2942,6 +3475,9 @@ int mediaflow_add_video(struct mediaflow *mf, struct list *vidcodecl)
 		}
 	}
 
+	/* new video payload types for an established flow */
+	fastpath_update(mf);
+
  out:
 	return err;
 }
@@ -3113,19 +3649,17 @@ static void demux_packet(struct mediaflow *mf, const struct sa *src,
 			 struct mbuf *mb)
 {
 	enum packet pkt;
-	bool hdld;
+
+	if (packet_is_rtp_or_rtcp(mb)) {
+		if (!media_recv(mf, src, mb))
+			rtp_recv_packet(mf->rtp, src, mb);
+		return;
+	}
 
 	pkt = packet_classify_packet_type(mb);
 
 	switch (pkt) {
 
-	case PACKET_RTP:
-	case PACKET_RTCP:
-		hdld = udp_helper_recv_handler_srtp((struct sa *)src, mb, mf);
-		if (!hdld)
-			rtp_recv_packet(mf->rtp, src, mb);
-		break;
-
 	case PACKET_DTLS:
 		handle_dtls_packet(mf, src, mb);
 		break;
@@ -3157,6 +3691,7 @@ static void interface_destructor(void *data)
 
 	list_unlink(&ifc->le);
 	/*mem_deref(ifc->lcand);*/
+	mem_deref(ifc->ep);
 }
 
 
@@ -3190,26 +3725,61 @@ int mediaflow_add_local_host_candidate(struct mediaflow *mf,
 		if (!ifc)
 			return ENOMEM;
 
-		if (!mf->privacy_mode) {
+		if (!mf->privacy_mode) {
+
+			if (mf->udpmux) {
+				err = udpmux_ep_alloc(&ifc->ep, mf->udpmux,
+						      addr, mf->ice_ufrag,
+						      trice_udp_recv_handler,
+						      mf);
+				if (err) {
+					warning("mediaflow: add_local_host[%j]"
+						" udpmux failed (%m)\n",
+						addr, err);
+					mem_deref(ifc);
+					return err;
+				}
+			}
+
 			err = trice_lcand_add(&lcand, mf->trice,
 					      ICE_COMPID_RTP,
 					      IPPROTO_UDP, prio, addr, NULL,
 					      ICE_CAND_TYPE_HOST, NULL,
 					      0,     /* tcptype */
-					      NULL,  /* sock */
+					      udpmux_ep_sock(ifc->ep),
 					      0);
 			if (err) {
 				warning("mediaflow: add_local_host[%j]"
 					" failed (%m)\n",
 					addr, err);
+				mem_deref(ifc);
 				return err;
 			}
 
-			/* hijack the UDP-socket of the local candidate
-			 *
-			 * NOTE: this must be done for all local candidates
-			 */
-			udp_handler_set(lcand->us, trice_udp_recv_handler, mf);
+			if (ifc->ep) {
+				struct le *le;
+
+				udpmux_ep_set_lcand(ifc->ep, lcand);
+
+				LIST_FOREACH(trice_rcandl(mf->trice), le) {
+					struct ice_rcand *rcand = le->data;
+
+					(void)udpmux_ep_add_raddr(ifc->ep,
+							    &rcand->attr.addr);
+				}
+			}
+			else {
+				/* hijack the UDP-socket of the local
+				 * candidate
+				 *
+				 * NOTE: this must be done for all local
+				 *       candidates
+				 */
+				udp_handler_set(lcand->us,
+						trice_udp_recv_handler, mf);
+				udp_rxbatch_set(lcand->us, UDP_RXBATCH);
+				udp_txqueue_set(lcand->us, UDP_TXQUEUE);
+			}
 
 			err = sdp_media_set_lattr(mf->sdpm, false,
 						  "candidate",
@@ -3428,6 +3998,17 @@ static int post_sdp_decode(struct mediaflow *mf)
 		sdp_media_set_lattr(mf->sdpm, true, "mid", mid);
 	}
 
+	/* both directions use the extension id of the offerer */
+	mf->aulevel.id = 0;
+	sdp_media_rattr_apply(mf->sdpm, "extmap", extmap_handler, mf);
+	if (mf->aulevel.id) {
+		sdp_media_set_lattr(mf->sdpm, true, "extmap", "%u %s",
+				    mf->aulevel.id, AULEVEL_URI);
+	}
+	else {
+		sdp_media_del_lattr(mf->sdpm, "extmap");
+	}
+
 	if (!sdp_media_rattr(mf->sdpm, "rtcp-mux")) {
 		warning("mediaflow: no 'rtcp-mux' attribute in SDP"
 			" -- rejecting\n");
@@ -3523,6 +4104,8 @@ static int post_sdp_decode(struct mediaflow *mf)
 			goto out;
 	}
 
+	fastpath_update(mf);
+
  out:
 	return err;
 }
@@ -3579,6 +4162,8 @@ int mediaflow_handle_offer(struct mediaflow *mf, const char *sdp)
 	if (err)
 		goto out;
 
+	set_max_streams(mf);
+
 
 	start_codecs(mf);
 
@@ -3648,6 +4233,8 @@ int mediaflow_handle_answer(struct mediaflow *mf, const char *sdp)
 	if (err)
 		goto out;
 
+	set_max_streams(mf);
+
 	start_codecs(mf);
 
 	if (sdp_media_rformat(mf->video.sdpm, NULL)) {
@@ -3763,8 +4350,7 @@ int mediaflow_send_audio(struct mediaflow *mf,
 int mediaflow_send_rtp(struct mediaflow *mf, const struct rtp_header *hdr,
 		       const uint8_t *pld, size_t pldlen)
 {
-	struct mbuf *mb;
-	size_t headroom = 0;
+	struct mbuf *mb = NULL;
 	int err = 0;
 
 	if (!mf || !pld || !pldlen || !hdr)
@@ -3772,35 +4358,39 @@ int mediaflow_send_rtp(struct mediaflow *mf, const struct rtp_header *hdr,
 
 	MAGIC_CHECK(mf);
 
+	pthread_mutex_lock(&mf->mutex_enc);
+
 	/* check if media-stream is ready for sending */
-	if (!mediaflow_is_ready(mf)) {
+	if (!mf->fp.valid && !mediaflow_is_ready(mf)) {
 		warning("mediaflow: send_rtp: not ready\n");
-		return EINTR;
+		err = EINTR;
+		goto out;
 	}
 
-	headroom = get_headroom(mf);
-
-	mb = mbuf_alloc(headroom + 256);
-	if (!mb)
-		return ENOMEM;
+	mb = tx_mbuf(mf, RTP_HEADER_SIZE + pldlen);
+	if (!mb) {
+		err = ENOMEM;
+		goto out;
+	}
 
-	mb->pos = headroom;
 	err  = rtp_hdr_encode(mb, hdr);
 	err |= mbuf_write_mem(mb, pld, pldlen);
 	if (err)
 		goto out;
 
-	mb->pos = headroom;
+	mb->pos = SEND_HEADROOM;
 
 	update_tx_stats(mf, pldlen); /* This INCLUDES the rtp header! */
 
-	err = udp_send(rtp_sock(mf->rtp), &mf->rcand.addr, mb);
+	err = send_media_packet(mf, mb);
 	if (err)
 		goto out;
 
  out:
 	mem_deref(mb);
 
+	pthread_mutex_unlock(&mf->mutex_enc);
+
 	return err;
 }
 
@@ -3809,8 +4399,7 @@ int mediaflow_send_rtp(struct mediaflow *mf, const struct rtp_header *hdr,
 int mediaflow_send_raw_rtp(struct mediaflow *mf, const uint8_t *buf,
 			   size_t len)
 {
-	struct mbuf *mb;
-	size_t headroom;
+	struct mbuf *mb = NULL;
 	int err;
 
 	if (!mf || !buf)
@@ -3818,34 +4407,32 @@ int mediaflow_send_raw_rtp(struct mediaflow *mf, const uint8_t *buf,
 
 	MAGIC_CHECK(mf);
 
+	pthread_mutex_lock(&mf->mutex_enc);
+
 	/* check if media-stream is ready for sending */
-	if (!mediaflow_is_ready(mf)) {
+	if (!mf->fp.valid && !mediaflow_is_ready(mf)) {
 		warning("mediaflow: send_raw_rtp(%zu bytes): not ready"
 			" [ice=%d, crypto=%d]\n",
 			len, mf->ice_ready, mf->crypto_ready);
-		return EINTR;
+		err = EINTR;
+		goto out;
 	}
 
-	pthread_mutex_lock(&mf->mutex_enc);
-
-	headroom = get_headroom(mf);
-
-	mb = mbuf_alloc(headroom + len);
+	mb = tx_mbuf(mf, len);
 	if (!mb) {
 		err = ENOMEM;
 		goto out;
 	}
 
-	mb->pos = headroom;
 	err = mbuf_write_mem(mb, buf, len);
 	if (err)
 		goto out;
-	mb->pos = headroom;
+	mb->pos = SEND_HEADROOM;
 
 	if (len >= RTP_HEADER_SIZE)
 		update_tx_stats(mf, len - RTP_HEADER_SIZE);
 
-	err = udp_send(rtp_sock(mf->rtp), &mf->rcand.addr, mb);
+	err = send_media_packet(mf, mb);
 	if (err)
 		goto out;
 
@@ -3874,8 +4461,7 @@ void mediaflow_rtp_start_send(struct mediaflow *mf)
 int mediaflow_send_raw_rtcp(struct mediaflow *mf,
 			    const uint8_t *buf, size_t len)
 {
-	struct mbuf *mb;
-	size_t headroom;
+	struct mbuf *mb = NULL;
 	int err;
 
 	if (!mf || !buf || !len)
@@ -3883,31 +4469,29 @@ int mediaflow_send_raw_rtcp(struct mediaflow *mf,
 
 	MAGIC_CHECK(mf);
 
+	pthread_mutex_lock(&mf->mutex_enc);
+
 	/* check if media-stream is ready for sending */
-	if (!mediaflow_is_ready(mf)) {
+	if (!mf->fp.valid && !mediaflow_is_ready(mf)) {
 		warning("mediaflow: send_raw_rtcp(%zu bytes): not ready"
 			" [ice=%d, crypto=%d]\n",
 			len, mf->ice_ready, mf->crypto_ready);
-		return EINTR;
+		err = EINTR;
+		goto out;
 	}
 
-	pthread_mutex_lock(&mf->mutex_enc);
-
-	headroom = get_headroom(mf);
-
-	mb = mbuf_alloc(headroom + 256);
+	mb = tx_mbuf(mf, len);
 	if (!mb) {
 		err = ENOMEM;
 		goto out;
 	}
 
-	mb->pos = headroom;
 	err = mbuf_write_mem(mb, buf, len);
 	if (err)
 		goto out;
-	mb->pos = headroom;
+	mb->pos = SEND_HEADROOM;
 
-	err = udp_send(rtp_sock(mf->rtp), &mf->rcand.addr, mb);
+	err = send_media_packet(mf, mb);
 	if (err)
 		goto out;
 
@@ -3957,6 +4541,36 @@ static bool sa_ipv4_is_private(const struct sa *sa)
 }
 
 
+/* let the shared host ports know the address of a remote candidate */
+static void interfaces_add_raddr(struct mediaflow *mf, const struct sa *raddr)
+{
+	struct le *le;
+
+	LIST_FOREACH(&mf->interfacel, le) {
+		struct interface *ifc = le->data;
+
+		if (ifc->ep)
+			(void)udpmux_ep_add_raddr(ifc->ep, raddr);
+	}
+}
+
+
+static struct interface *interface_find_sock(const struct mediaflow *mf,
+					     const void *sock)
+{
+	struct le *le;
+
+	LIST_FOREACH(&mf->interfacel, le) {
+		struct interface *ifc = le->data;
+
+		if (ifc->lcand && ifc->lcand->us == sock)
+			return ifc;
+	}
+
+	return NULL;
+}
+
+
 static bool rcandidate_ds_handler(const char *name, const char *val, void *arg)
 {
 	struct mediaflow *mf = arg;
@@ -3976,21 +4590,15 @@ static bool rcandidate_ds_handler(const char *name, const char *val, void *arg)
 			" [%J] (%m)\n",
 			&rcand.addr, err);
 	}
+	else {
+		interfaces_add_raddr(mf, &rcand.addr);
+	}
 
  out:
 	return false;
 }
 
 
-static void turnc_chan_handler(void *arg)
-{
-	struct mediaflow *mf = arg;
-	(void)mf;
-
-	info("mediaflow: TURN channel added.\n");
-}
-
-
 static void trice_estab_handler(struct ice_candpair *pair,
 				const struct stun_msg *msg, void *arg)
 {
@@ -4013,6 +4621,7 @@ static void trice_estab_handler(struct ice_candpair *pair,
 	if (!mf->ice_ready) {
 		struct stun_attr *attr;
 		struct turn_conn *conn;
+		struct interface *ifc;
 
 		mem_deref(mf->sel_lcand);
 		mf->sel_lcand = mem_ref(pair->lcand);
@@ -4028,10 +4637,23 @@ static void trice_estab_handler(struct ice_candpair *pair,
 		     print_cand, pair->rcand,
 		     mf->peer_software);
 
+		ifc = interface_find_sock(mf, sock);
+		if (ifc && ifc->ep) {
+			/* media from the peer to us on the shared port */
+			err = udpmux_ep_select(ifc->ep,
+					       &pair->rcand->attr.addr);
+			if (err) {
+				warning("mediaflow: udpmux select failed"
+					" (%m)\n", err);
+			}
+		}
+		else {
 #if 1
-		// TODO: extra for PRFLX
-		udp_handler_set(pair->lcand->us, trice_udp_recv_handler, mf);
+			// TODO: extra for PRFLX
+			udp_handler_set(pair->lcand->us,
+					trice_udp_recv_handler, mf);
 #endif
+		}
 
 		conn = turnconn_find_allocated(&mf->turnconnl,
 					       IPPROTO_UDP);
@@ -4039,9 +4661,8 @@ static void trice_estab_handler(struct ice_candpair *pair,
 			info("mediaflow: adding TURN channel to %J\n",
 			     &pair->rcand->attr.addr);
 
-			err = turnc_add_chan(conn->turnc,
-					     &pair->rcand->attr.addr,
-					     turnc_chan_handler, mf);
+			err = turnconn_add_channel(conn,
+						   &pair->rcand->attr.addr);
 			if (err) {
 				warning("mediaflow: could not add TURN"
 					" channel (%m)\n", err);
@@ -4144,7 +4765,7 @@ int mediaflow_start_ice(struct mediaflow *mf)
 			struct turn_conn *conn = le->data;
 
 			if (conn->turnc && conn->turn_allocated) {
-				add_permission_to_remotes_ds(mf, conn->turnc);
+				add_permission_to_remotes_ds(mf, conn);
 			}
 		}
 
@@ -4219,13 +4840,16 @@ int mediaflow_add_rcand(struct mediaflow *mf, const char *sdp,
 				" [%J] (%m)\n",
 				&rcand.addr, err);
 		}
+		else {
+			interfaces_add_raddr(mf, &rcand.addr);
+		}
 
 		/* add permission for ALL TURN-Clients */
 		for (le = mf->turnconnl.head; le; le = le->next) {
 			struct turn_conn *tc = le->data;
 
 			if (tc->turnc && tc->turn_allocated)
-				add_turn_permission_ds(mf, tc->turnc, &rcand);
+				add_turn_permission_ds(mf, tc, &rcand);
 		}
 
 		/* NOTE: checklist must be re-started for every new
@@ -4573,7 +5197,9 @@ static void submit_local_candidate(struct mediaflow *mf,
 		attr.prio = calc_prio(type, sa_af(addr),
 				      turn_proto, turn_secure);
 
-		if (turn_proto == IPPROTO_UDP)
+		/* a shared relay gets its own socket, like TCP */
+		if (turn_proto == IPPROTO_UDP &&
+		    !(type == ICE_CAND_TYPE_RELAY && mf->turn_shared))
 			sock = mf->us_turn;  /* NOTE this */
 		else
 			sock = NULL;
@@ -4627,6 +5253,116 @@ static void submit_local_candidate(struct mediaflow *mf,
 }
 
 
+/*
+ * TURN servers are gathered in parallel. Gathering is complete when
+ * each address family has one relay, or has no server left that may
+ * still answer. After the first relay the others get GATHER_GRACE,
+ * and no server can hold up the offer longer than GATHER_TIMEOUT.
+ * Relays allocated after the cutoff keep trickling.
+ */
+static bool is_af_gathered(const struct mediaflow *mf, int af)
+{
+	bool pending = false;
+	struct le *le;
+
+	LIST_FOREACH(&mf->turnconnl, le) {
+		const struct turn_conn *conn = le->data;
+
+		if (sa_af(&conn->turn_srv) != af)
+			continue;
+
+		if (conn->turn_allocated)
+			return true;
+
+		if (!conn->failed)
+			pending = true;
+	}
+
+	return !pending;
+}
+
+
+static bool is_turn_gathered(const struct mediaflow *mf)
+{
+	return is_af_gathered(mf, AF_INET) && is_af_gathered(mf, AF_INET6);
+}
+
+
+static bool is_gather_failed(const struct mediaflow *mf)
+{
+	struct le *le;
+
+	if (mf->stun_ok || (mf->stun_server && !mf->stun_failed))
+		return false;
+
+	LIST_FOREACH(&mf->turnconnl, le) {
+		const struct turn_conn *conn = le->data;
+
+		if (conn->turn_allocated || !conn->failed)
+			return false;
+	}
+
+	return mf->stun_failed || !list_isempty(&mf->turnconnl);
+}
+
+
+static void gather_check(struct mediaflow *mf)
+{
+	if (!mediaflow_is_gathered(mf))
+		return;
+
+	if (!mf->gathered) {
+		info("mediaflow: gathering complete (cutoff=%d)\n",
+		     mf->gather_cutoff);
+		mf->gathered = true;
+	}
+
+	if (mf->gatherh)
+		mf->gatherh(mf->arg);
+}
+
+
+static void gather_timeout(void *arg)
+{
+	struct mediaflow *mf = arg;
+
+	mf->gather_cutoff = true;
+
+	if (!mf->gathered)
+		gather_check(mf);
+}
+
+
+static void gather_cutoff_start(struct mediaflow *mf, uint64_t delay)
+{
+	if (mf->gather_cutoff)
+		return;
+
+	if (tmr_isrunning(&mf->tmr_gather) &&
+	    tmr_get_expire(&mf->tmr_gather) <= delay)
+		return;
+
+	tmr_start(&mf->tmr_gather, delay, gather_timeout, mf);
+}
+
+
+/* one failed server is not fatal while others may still succeed */
+static void gather_error(struct mediaflow *mf, int err)
+{
+	/* NOTE: only flag an error if ICE is not established yet */
+	if (mf->ice_ready)
+		return;
+
+	if (is_gather_failed(mf)) {
+		ice_error(mf, err);
+		return;
+	}
+
+	if (!mf->gathered)
+		gather_check(mf);
+}
+
+
 static void gather_stun_resp_handler(int err, uint16_t scode,
 				     const char *reason,
 				     const struct stun_msg *msg, void *arg)
@@ -4665,15 +5401,14 @@ static void gather_stun_resp_handler(int err, uint16_t scode,
 	mf->ice_local_eoc = true;
 	sdp_media_set_lattr(mf->sdpm, true, "end-of-candidates", NULL);
 
-	if (mf->gatherh)
-		mf->gatherh(mf->arg);
+	gather_check(mf);
 
 	return;
 
  error:
-	/* NOTE: only flag an error if ICE is not established yet */
-	if (!mf->ice_ready)
-		ice_error(mf, err ? err : EPROTO);
+	mf->stun_failed = true;
+
+	gather_error(mf, err ? err : EPROTO);
 }
 
 
@@ -4719,22 +5454,14 @@ int mediaflow_gather_stun(struct mediaflow *mf, const struct sa *stun_srv)
 	}
 
 	mf->stun_server = true;
+	gather_cutoff_start(mf, GATHER_TIMEOUT);
 
 	return 0;
 }
 
 
-static void turnc_perm_handler(void *arg)
-{
-	struct mediaflow *mf = arg;
-	(void)mf;
-
-	info("mediaflow: TURN permission added OK\n");
-}
-
-
 static void add_turn_permission_ds(struct mediaflow *mf,
-				   struct turnc *turnc,
+				   struct turn_conn *conn,
 				   const struct ice_cand_attr *rcand)
 {
 	bool add;
@@ -4755,10 +5482,9 @@ static void add_turn_permission_ds(struct mediaflow *mf,
 		info("mediaflow: DS: adding TURN permission"
 		     " to remote address %s.%j <turnc=%p>\n",
 		     ice_cand_type2name(rcand->type),
-		     &rcand->addr, turnc);
+		     &rcand->addr, conn->turnc);
 
-		err = turnc_add_perm(turnc, &rcand->addr,
-				     turnc_perm_handler, mf);
+		err = turnconn_add_permission(conn, &rcand->addr);
 		if (err) {
 			warning("mediaflow: failed to"
 				" add permission (%m)\n",
@@ -4791,7 +5517,7 @@ static void add_permission_to_remotes(struct mediaflow *mf)
 
 			struct ice_rcand *rcand = le->data;
 
-			add_turn_permission_ds(mf, conn->turnc, &rcand->attr);
+			add_turn_permission_ds(mf, conn, &rcand->attr);
 		}
 		break;
 
@@ -4802,7 +5528,7 @@ static void add_permission_to_remotes(struct mediaflow *mf)
 
 
 static void add_permission_to_remotes_ds(struct mediaflow *mf,
-					 struct turnc *turnc)
+					 struct turn_conn *conn)
 {
 	struct le *le;
 
@@ -4815,7 +5541,7 @@ static void add_permission_to_remotes_ds(struct mediaflow *mf,
 
 		struct ice_rcand *rcand = le->data;
 
-		add_turn_permission_ds(mf, turnc, &rcand->attr);
+		add_turn_permission_ds(mf, conn, &rcand->attr);
 	}
 }
 
@@ -4847,15 +5573,15 @@ static int sa_translate_nat64(struct sa *sa6, const struct sa *sa4)
 }
 
 
-/* all outgoing UDP-packets must be sent via
- * the TCP-connection to the TURN server
+/* all outgoing UDP-packets must be sent via the TCP-connection,
+ * or the shared allocation, to the TURN server
  */
 static bool turntcp_send_handler(int *err, struct sa *dst,
 				 struct mbuf *mb, void *arg)
 {
 	struct turn_conn *tc = arg;
 
-	*err = turnc_send(tc->turnc, dst, mb);
+	*err = turnconn_send(tc, dst, mb);
 	if (*err) {
 		re_printf("mediaflow: turnc_send failed (%zu bytes to %J)\n",
 			mbuf_get_left(mb), dst);
@@ -4899,8 +5625,7 @@ static void turnconn_estab_handler(struct turn_conn *conn,
 		info("mediaflow: turn: add permission to relay %j\n",
 		     relay_addr);
 
-		err = turnc_add_perm(conn->turnc, relay_addr,
-				     turnc_perm_handler, mf);
+		err = turnconn_add_permission(conn, relay_addr);
 		if (err) {
 			warning("mediaflow: failed to"
 				" add permission (%m)\n",
@@ -4911,7 +5636,8 @@ static void turnconn_estab_handler(struct turn_conn *conn,
 
 	/* NOTE: important to ship the SRFLX before RELAY cand. */
 
-	if (conn->proto == IPPROTO_UDP) {
+	/* NOTE: the socket of a shared allocation is not ours */
+	if (conn->proto == IPPROTO_UDP && !conn->share) {
 		submit_local_candidate(mf, ICE_CAND_TYPE_SRFLX,
 				       mapped_addr, &mf->laddr_default, false,
 				       conn->proto, conn->secure, NULL);
@@ -4921,7 +5647,7 @@ static void turnconn_estab_handler(struct turn_conn *conn,
 			       relay_addr, mapped_addr, true,
 			       conn->proto, conn->secure, &sock);
 
-	if (conn->proto == IPPROTO_TCP) {
+	if (conn->proto == IPPROTO_TCP || conn->share) {
 		/* NOTE: this is needed to snap up outgoing UDP-packets */
 		conn->us_app = mem_ref(sock);
 		err = udp_register_helper(&conn->uh_app, sock, LAYER_TURN,
@@ -4936,11 +5662,13 @@ static void turnconn_estab_handler(struct turn_conn *conn,
 	mf->ice_local_eoc = true;
 	sdp_media_set_lattr(mf->sdpm, true, "end-of-candidates", NULL);
 
-	add_permission_to_remotes_ds(mf, conn->turnc);
+	add_permission_to_remotes_ds(mf, conn);
 	add_permission_to_remotes(mf);
 
-	if (mf->gatherh)
-		mf->gatherh(mf->arg);
+	/* the other servers get a short grace time (happy eyeballs) */
+	gather_cutoff_start(mf, GATHER_GRACE);
+
+	gather_check(mf);
 
 	if (mediaflow_early_dtls_supported(mf))
 		start_early_dtls(mf);
@@ -4954,6 +5682,27 @@ static void turnconn_estab_handler(struct turn_conn *conn,
 }
 
 
+/* the relay candidate that sends via this TURN connection */
+static struct ice_lcand *relay_lcand_find(const struct mediaflow *mf,
+					  const struct turn_conn *conn,
+					  int af)
+{
+	struct le *le;
+
+	if (conn->us_app) {
+		LIST_FOREACH(trice_lcandl(mf->trice), le) {
+			struct ice_lcand *lcand = le->data;
+
+			if (lcand->attr.type == ICE_CAND_TYPE_RELAY &&
+			    lcand->us == conn->us_app)
+				return lcand;
+		}
+	}
+
+	return trice_lcand_find2(mf->trice, ICE_CAND_TYPE_RELAY, af);
+}
+
+
 /* incoming packets over TURN - demultiplex to the right module */
 static void turnconn_data_handler(struct turn_conn *conn, const struct sa *src,
 				  struct mbuf *mb, void *arg)
@@ -4968,10 +5717,7 @@ static void turnconn_data_handler(struct turn_conn *conn, const struct sa *src,
 
 		debug("mediaflow: incoming STUN-packet via TURN\n");
 
-		// TODO: this supports only one TURN-client for now
-		//       add support for multiple clients
-		lcand = trice_lcand_find2(mf->trice,
-					  ICE_CAND_TYPE_RELAY, sa_af(src));
+		lcand = relay_lcand_find(mf, conn, sa_af(src));
 		if (lcand) {
 
 			/* forward packet to ICE */
@@ -4992,9 +5738,7 @@ static void turnconn_error_handler(int err, void *arg)
 {
 	struct mediaflow *mf = arg;
 
-	/* NOTE: only flag an error if ICE is not established yet */
-	if (!mf->ice_ready)
-		ice_error(mf, err ? err : EPROTO);
+	gather_error(mf, err ? err : EPROTO);
 }
 
 
@@ -5056,23 +5800,36 @@ int mediaflow_gather_turn(struct mediaflow *mf, const struct sa *turn_srv,
 		return EINVAL;
 	}
 
-	debug("mediaflow: gather_turn: username='%s' srv=%J\n",
-	      username, turn_srv);
+	debug("mediaflow: gather_turn: username='%s' srv=%J%s\n",
+	      username, turn_srv, mf->turn_shared ? " (shared)" : "");
 
-	err = turnconn_alloc(NULL, &mf->turnconnl,
-			     turn_srv, IPPROTO_UDP, false,
-			     username, password,
-			     sock,
-			     LAYER_STUN, LAYER_TURN,
-			     turnconn_estab_handler,
-			     turnconn_data_handler,
-			     turnconn_error_handler, mf
-			     );
+	if (mf->turn_shared && mf->nat == MEDIAFLOW_TRICKLEICE_DUALSTACK) {
+		err = turnconn_alloc_shared(NULL, &mf->turnconnl,
+					    turn_srv, IPPROTO_UDP, false,
+					    username, password,
+					    LAYER_STUN, LAYER_TURN,
+					    turnconn_estab_handler,
+					    turnconn_data_handler,
+					    turnconn_error_handler, mf);
+	}
+	else {
+		err = turnconn_alloc(NULL, &mf->turnconnl,
+				     turn_srv, IPPROTO_UDP, false,
+				     username, password,
+				     sock,
+				     LAYER_STUN, LAYER_TURN,
+				     turnconn_estab_handler,
+				     turnconn_data_handler,
+				     turnconn_error_handler, mf
+				     );
+	}
 	if (err) {
 		warning("mediaflow: turnc_alloc failed (%m)\n", err);
 		return err;
 	}
 
+	gather_cutoff_start(mf, GATHER_TIMEOUT);
+
 	return 0;
 }
 
@@ -5095,18 +5852,31 @@ int mediaflow_gather_turn_tcp(struct mediaflow *mf, const struct sa *turn_srv,
 		return EINVAL;
 	}
 
-	err = turnconn_alloc(&tc, &mf->turnconnl,
-			     turn_srv, IPPROTO_TCP, secure,
-			     username, password,
-			     NULL,
-			     LAYER_STUN, LAYER_TURN,
-			     turnconn_estab_handler,
-			     turnconn_data_handler,
-			     turnconn_error_handler, mf
-			     );
+	if (mf->turn_shared) {
+		err = turnconn_alloc_shared(&tc, &mf->turnconnl,
+					    turn_srv, IPPROTO_TCP, secure,
+					    username, password,
+					    LAYER_STUN, LAYER_TURN,
+					    turnconn_estab_handler,
+					    turnconn_data_handler,
+					    turnconn_error_handler, mf);
+	}
+	else {
+		err = turnconn_alloc(&tc, &mf->turnconnl,
+				     turn_srv, IPPROTO_TCP, secure,
+				     username, password,
+				     NULL,
+				     LAYER_STUN, LAYER_TURN,
+				     turnconn_estab_handler,
+				     turnconn_data_handler,
+				     turnconn_error_handler, mf
+				     );
+	}
 	if (err)
 		return err;
 
+	gather_cutoff_start(mf, GATHER_TIMEOUT);
+
 	return err;
 }
 
@@ -5220,6 +5990,45 @@ void mediaflow_set_rtpstate_handler(struct mediaflow *mf,
 }
 
 
+void mediaflow_set_level_handler(struct mediaflow *mf,
+				 mediaflow_level_h *levelh)
+{
+	if (!mf)
+		return;
+
+	mf->levelh = levelh;
+}
+
+
+/*
+ * Get the smoothed audio level of the remote sender, in -dBov
+ * (0 is loudest, 127 is silence). Returns ENOENT if the audio level
+ * extension was not negotiated or no level was received yet.
+ */
+int mediaflow_audio_level(const struct mediaflow *mf, uint8_t *levelp,
+			  bool *speakingp)
+{
+	if (!mf)
+		return EINVAL;
+
+	if (!mf->aulevel.id || !mf->aulevel.valid)
+		return ENOENT;
+
+	if (levelp)
+		*levelp = mf->aulevel.level;
+	if (speakingp)
+		*speakingp = mf->aulevel.speaking;
+
+	return 0;
+}
+
+
+bool mediaflow_has_audio_level(const struct mediaflow *mf)
+{
+	return mf ? mf->aulevel.id != 0 : false;
+}
+
+
 const char *mediaflow_peer_software(const struct mediaflow *mf)
 {
 	return mf ? mf->peer_software : NULL;
@@ -5270,6 +6079,30 @@ void mediaflow_set_gather_handler(struct mediaflow *mf,
 }
 
 
+/**
+ * Change the owner of a mediaflow, e.g. when it is taken from a
+ * pool of pre-gathered mediaflows. The new argument is used for
+ * all handlers.
+ *
+ * @param mf     Mediaflow
+ * @param estabh Established handler
+ * @param closeh Close handler
+ * @param arg    Handler argument
+ */
+void mediaflow_set_handlers(struct mediaflow *mf,
+			    mediaflow_estab_h *estabh,
+			    mediaflow_close_h *closeh,
+			    void *arg)
+{
+	if (!mf)
+		return;
+
+	mf->estabh = estabh;
+	mf->closeh = closeh;
+	mf->arg    = arg;
+}
+
+
 bool mediaflow_got_sdp(const struct mediaflow *mf)
 {
 	return mf ? mf->got_sdp : false;
@@ -5327,8 +6160,12 @@ bool mediaflow_is_gathered(const struct mediaflow *mf)
 	      list_count(&mf->turnconnl),
 	      mf->stun_server, mf->stun_ok);
 
-	if (!list_isempty(&mf->turnconnl))
-		return is_one_turnconn_allocated(mf);
+	if (is_one_turnconn_allocated(mf))
+		return mf->gather_cutoff || is_turn_gathered(mf);
+
+	/* no relay yet, wait for the servers that may still answer */
+	if (!mf->gather_cutoff && !is_turn_gathered(mf))
+		return false;
 
 	if (mf->stun_server)
 		return mf->stun_ok;
@@ -5470,6 +6307,27 @@ void mediaflow_enable_privacy(struct mediaflow *mf, bool enabled)
 }
 
 
+/**
+ * Share the TURN allocations with the other mediaflows of the
+ * process, one per TURN server. Must be set before gathering.
+ *
+ * @param mf      Mediaflow
+ * @param enabled True to use the shared allocations
+ */
+void mediaflow_enable_turn_sharing(struct mediaflow *mf, bool enabled)
+{
+	if (!mf)
+		return;
+
+	if (!list_isempty(&mf->turnconnl)) {
+		warning("mediaflow: turn sharing: already gathering\n");
+		return;
+	}
+
+	mf->turn_shared = enabled;
+}
+
+
 const char *mediaflow_lcand_name(const struct mediaflow *mf)
 {
 	if (!mf)
@@ -5489,3 +6347,16 @@ const char *mediaflow_rcand_name(const struct mediaflow *mf)
 
 	return ice_cand_type2name(mf->rcand.type);
 }
+
+
+/**
+ * Set the shared UDP port for the host candidates of new
+ * trickle ICE mediaflows. Existing mediaflows are not changed.
+ *
+ * @param mux UDP mux, or NULL for one port per mediaflow
+ */
+void mediaflow_set_udpmux(struct udpmux *mux)
+{
+	mem_deref(udpmux_default);
+	udpmux_default = mem_ref(mux);
+}
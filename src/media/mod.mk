@@ -8,4 +8,5 @@ AVS_SRCS += \
 	media/icelite.c \
 	media/mediaflow.c \
 	media/packet.c \
-	media/rtp_stats.c
+	media/rtp_stats.c \
+	media/udpmux.c
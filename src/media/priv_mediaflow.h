@@ -26,6 +26,7 @@ enum {
 	LAYER_ICE  = -10,
 	LAYER_TURN = -20,       /* must be below ICE */
 	LAYER_STUN = -30,       /* must be below TURN */
+	LAYER_MUX  = -100,      /* shared port demux, below all */
 };
 
 
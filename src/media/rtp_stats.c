@@ -16,6 +16,7 @@
 * along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <re.h>
 #include "rtp_stats.h"
 #include <stdio.h>
 #include <string.h>
@@ -83,24 +84,20 @@ void rtp_stats_init(struct rtp_stats* rs, int pt, int dropout_thres_ms)
 }
 
 
-void rtp_stats_update(struct rtp_stats* rs, const uint8_t *pkt, size_t len)
+static void stats_update(struct rtp_stats* rs, uint16_t seq_nr, bool marker,
+			 size_t len)
 {
-	// lock ??
-	if ((get_pt(pkt, len) & 0x7f) != rs->pt) {
-		return;
-	}
-
 	if (rs->packet_cnt == 0) {
 		ztime_get(&rs->start_time);
 		if (rs->n == 0){
 			memcpy(&rs->prev_time, &rs->start_time,
 			       sizeof(struct ztime));
 		}
-		rs->start_seq_nr = get_seqnr(pkt, len);
+		rs->start_seq_nr = seq_nr;
 	}
 	rs->byte_cnt += len;
 	rs->packet_cnt++;
-	if ( get_pt(pkt, len) == (rs->pt + (1 << 7)) ) {
+	if (marker) {
 		rs->frame_cnt++;
 	}
 
@@ -115,7 +112,7 @@ void rtp_stats_update(struct rtp_stats* rs, const uint8_t *pkt, size_t len)
 	if (diff_ms > INTERVAL_MS) {
 		float bit_rate = (float)((8*rs->byte_cnt)/diff_ms);
 		float frame_rate = (float)((rs->frame_cnt*1000)/diff_ms);
-		int expected_packets = get_seqnr(pkt, len) - rs->start_seq_nr;
+		int expected_packets = seq_nr - rs->start_seq_nr;
 		if (expected_packets < 0) {
 			expected_packets += 0xffff;
 		}
@@ -146,3 +143,27 @@ void rtp_stats_update(struct rtp_stats* rs, const uint8_t *pkt, size_t len)
 	}
 	//unlock
 }
+
+
+void rtp_stats_update(struct rtp_stats* rs, const uint8_t *pkt, size_t len)
+{
+	// lock ??
+	if ((get_pt(pkt, len) & 0x7f) != rs->pt) {
+		return;
+	}
+
+	stats_update(rs, get_seqnr(pkt, len),
+		     get_pt(pkt, len) == (rs->pt + (1 << 7)), len);
+}
+
+
+/* Same as rtp_stats_update(), with the header from rtp_meta_decode() */
+void rtp_stats_update_meta(struct rtp_stats* rs,
+			   const struct rtp_meta *meta, size_t len)
+{
+	if (meta->rtcp || meta->hdr.pt != rs->pt) {
+		return;
+	}
+
+	stats_update(rs, meta->hdr.seq, meta->hdr.m, len);
+}
@@ -51,4 +51,8 @@ struct rtp_stats {
 
 void rtp_stats_init(struct rtp_stats* rs, int pt, int dropout_thres_ms);
 
-void rtp_stats_update(struct rtp_stats* rs, const uint8_t *pkt, size_t len);
\ No newline at end of file
+void rtp_stats_update(struct rtp_stats* rs, const uint8_t *pkt, size_t len);
+
+struct rtp_meta;
+void rtp_stats_update_meta(struct rtp_stats* rs,
+			   const struct rtp_meta *meta, size_t len);
\ No newline at end of file
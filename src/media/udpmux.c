@@ -0,0 +1,697 @@
+/*
+* Wire
+* Copyright (C) 2016 Wire Swiss GmbH
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <re.h>
+#include <rew.h>
+#include "avs_log.h"
+#include "avs_media.h"
+#include "priv_mediaflow.h"
+
+
+/*
+ * Shared UDP port
+ *
+ * One UDP socket per local address is shared by the host candidates
+ * of many mediaflows. Each mediaflow has an endpoint on the socket,
+ * and incoming packets are passed to the owning endpoint:
+ *
+ *   STUN requests    -- by the local ufrag in the USERNAME attribute
+ *   other STUN       -- to all endpoints that know the source address
+ *   RTP/RTCP/DTLS    -- by the selected remote address (after
+ *                       nomination), or a remote candidate address
+ *                       if only one endpoint has it
+ *
+ * The demux is a UDP helper below all other layers, and it is the only
+ * helper on the socket: the ICE stack gets its packets from the demux.
+ *
+ * An endpoint knows the addresses of the remote candidates, and learns
+ * a peer-reflexive address once the ICE stack has accepted a request
+ * from it, that is after checking the MESSAGE-INTEGRITY.
+ */
+
+
+enum {
+	HASH_SIZE = 256,
+	UDP_RXBATCH = 16,
+	UDP_TXQUEUE = 32,
+	STUN_HDR_SIZE = 20,
+	STUN_MAGIC = 0x2112a442,
+	EP_MAX_ADDR = 32,
+};
+
+
+struct udpmux {
+	struct list sockl;
+	uint16_t port;
+};
+
+/* One shared socket per local address */
+struct mux_sock {
+	struct le le;
+	struct sa laddr;
+	struct udp_sock *us;
+	struct udp_helper *uh;
+	struct hash *ufragh;        /* struct udpmux_ep, by local ufrag */
+	struct hash *addrh;         /* struct mux_addr, by remote addr  */
+	struct udpmux_stats stats;
+};
+
+struct udpmux_ep {
+	struct le he;
+	struct mux_sock *ms;
+	char *lufrag;
+	struct ice_lcand *lcand;
+	struct list addrl;          /* struct mux_addr */
+	udp_recv_h *recvh;
+	void *arg;
+};
+
+/* A remote address known by an endpoint */
+struct mux_addr {
+	struct le he;
+	struct le le;
+	struct sa addr;
+	struct udpmux_ep *ep;
+	bool selected;
+};
+
+
+static bool is_stun(const struct mbuf *mb)
+{
+	const uint8_t *p = mbuf_buf(mb);
+
+	if (mbuf_get_left(mb) < STUN_HDR_SIZE)
+		return false;
+
+	/* RFC 5389 Section 6, top two bits zero and the magic cookie */
+	if (p[0] & 0xc0)
+		return false;
+
+	return ((uint32_t)p[4] << 24 | (uint32_t)p[5] << 16 |
+		(uint32_t)p[6] << 8 | (uint32_t)p[7]) == STUN_MAGIC;
+}
+
+
+/*
+ * Find the local ufrag of a STUN request, without decoding the message.
+ * The USERNAME is "<receiver ufrag>:<sender ufrag>" (RFC 5245 7.1.2.3)
+ */
+static bool stun_request_lufrag(struct pl *ufrag, const struct mbuf *mb)
+{
+	const uint8_t *p = mbuf_buf(mb);
+	size_t len = mbuf_get_left(mb);
+	size_t pos = STUN_HDR_SIZE;
+	uint16_t type;
+
+	type = p[0] << 8 | p[1];
+	if (type & 0x0110)
+		return false;  /* not a request */
+
+	if (len > STUN_HDR_SIZE + (size_t)(p[2] << 8 | p[3]))
+		len = STUN_HDR_SIZE + (p[2] << 8 | p[3]);
+
+	while (pos + 4 <= len) {
+
+		const uint16_t atype = p[pos] << 8 | p[pos+1];
+		const uint16_t alen  = p[pos+2] << 8 | p[pos+3];
+		const char *v = (const char *)&p[pos + 4];
+		size_t i;
+
+		if (pos + 4 + alen > len)
+			break;
+
+		if (atype == STUN_ATTR_USERNAME) {
+
+			for (i = 0; i < alen && v[i] != ':'; i++)
+				;
+
+			ufrag->p = v;
+			ufrag->l = i;
+
+			return i > 0;
+		}
+
+		pos += 4 + ((alen + 3) & ~3);
+	}
+
+	return false;
+}
+
+
+static struct udpmux_ep *ep_find_ufrag(const struct mux_sock *ms,
+				       const struct pl *ufrag)
+{
+	struct le *le;
+
+	LIST_FOREACH(hash_list(ms->ufragh, hash_joaat_pl(ufrag)), le) {
+
+		struct udpmux_ep *ep = le->data;
+
+		if (0 == pl_strcmp(ufrag, ep->lufrag))
+			return ep;
+	}
+
+	return NULL;
+}
+
+
+/*
+ * The selected address of an endpoint wins. A candidate address is
+ * only used if no other endpoint has the same one.
+ */
+static struct udpmux_ep *ep_find_addr(const struct mux_sock *ms,
+				      const struct sa *src)
+{
+	struct udpmux_ep *ep = NULL;
+	struct le *le;
+
+	LIST_FOREACH(hash_list(ms->addrh, sa_hash(src, SA_ALL)), le) {
+
+		struct mux_addr *ma = le->data;
+
+		if (!sa_cmp(&ma->addr, src, SA_ALL))
+			continue;
+
+		if (ma->selected)
+			return ma->ep;
+
+		if (ep && ep != ma->ep)
+			ep = (struct udpmux_ep *)-1;
+		else if (!ep)
+			ep = ma->ep;
+	}
+
+	return ep == (struct udpmux_ep *)-1 ? NULL : ep;
+}
+
+
+static void ep_deliver(struct udpmux_ep *ep, const struct sa *src,
+		       struct mbuf *mb, bool stun)
+{
+	struct ice_lcand *lcand = ep->lcand;
+	const size_t pos = mb->pos;
+
+	/* the ICE stack takes the STUN packets of its candidate */
+	if (stun && lcand && lcand->recvh) {
+
+		++lcand->stats.n_rx;
+
+		if (lcand->recvh(lcand, IPPROTO_UDP, lcand->us,
+				 src, mb, lcand->arg))
+			return;
+
+		mb->pos = pos;
+	}
+
+	if (ep->recvh)
+		ep->recvh(src, mb, ep->arg);
+}
+
+
+static struct mux_addr *addr_find(const struct udpmux_ep *ep,
+				  const struct sa *addr)
+{
+	struct le *le;
+
+	LIST_FOREACH(&ep->addrl, le) {
+
+		struct mux_addr *ma = le->data;
+
+		if (sa_cmp(&ma->addr, addr, SA_ALL))
+			return ma;
+	}
+
+	return NULL;
+}
+
+
+static void addr_destructor(void *arg)
+{
+	struct mux_addr *ma = arg;
+
+	hash_unlink(&ma->he);
+	list_unlink(&ma->le);
+}
+
+
+static int addr_add(struct mux_addr **map, struct udpmux_ep *ep,
+		    const struct sa *addr)
+{
+	struct mux_addr *ma;
+
+	ma = addr_find(ep, addr);
+	if (ma)
+		goto out;
+
+	/* forget the oldest address that is not selected */
+	if (list_count(&ep->addrl) >= EP_MAX_ADDR) {
+		struct le *le;
+
+		LIST_FOREACH(&ep->addrl, le) {
+			struct mux_addr *ma0 = le->data;
+
+			if (!ma0->selected) {
+				mem_deref(ma0);
+				break;
+			}
+		}
+	}
+
+	ma = mem_zalloc(sizeof(*ma), addr_destructor);
+	if (!ma)
+		return ENOMEM;
+
+	ma->addr = *addr;
+	ma->ep   = ep;
+
+	hash_append(ep->ms->addrh, sa_hash(addr, SA_ALL), &ma->he, ma);
+	list_append(&ep->addrl, &ma->le, ma);
+
+ out:
+	if (map)
+		*map = ma;
+
+	return 0;
+}
+
+
+/* e.g. a peer-reflexive candidate, if the ICE stack accepted it */
+static void ep_learn_addr(struct udpmux_ep *ep, const struct sa *src)
+{
+	const struct ice_lcand *lcand = ep->lcand;
+
+	if (!lcand || addr_find(ep, src))
+		return;
+
+	if (!trice_rcand_find(lcand->icem, lcand->attr.compid,
+			      IPPROTO_UDP, src))
+		return;
+
+	(void)addr_add(NULL, ep, src);
+}
+
+
+static bool mux_recv_handler(struct sa *src, struct mbuf *mb, void *arg)
+{
+	struct mux_sock *ms = arg;
+	struct udpmux_ep *ep;
+	struct pl ufrag;
+
+	++ms->stats.n_rx;
+
+	if (!is_stun(mb)) {
+
+		ep = ep_find_addr(ms, src);
+		if (ep)
+			ep_deliver(ep, src, mb, false);
+		else
+			++ms->stats.n_drop;
+
+		return true;
+	}
+
+	if (stun_request_lufrag(&ufrag, mb)) {
+
+		ep = ep_find_ufrag(ms, &ufrag);
+		if (ep) {
+			ep_deliver(ep, src, mb, true);
+			ep_learn_addr(ep, src);
+		}
+		else {
+			++ms->stats.n_drop;
+		}
+	}
+	else {
+		const size_t pos = mb->pos;
+		struct le *le;
+		bool found = false;
+
+		/* responses are matched by transaction in the ICE stack */
+		le = list_head(hash_list(ms->addrh, sa_hash(src, SA_ALL)));
+		while (le) {
+			struct mux_addr *ma = le->data;
+
+			le = le->next;
+
+			if (!sa_cmp(&ma->addr, src, SA_ALL))
+				continue;
+
+			mb->pos = pos;
+			ep_deliver(ma->ep, src, mb, true);
+			found = true;
+		}
+
+		if (!found)
+			++ms->stats.n_drop;
+	}
+
+	return true;
+}
+
+
+/* not used, all packets are taken by the helper */
+static void mux_udp_recv(const struct sa *src, struct mbuf *mb, void *arg)
+{
+	(void)src;
+	(void)mb;
+	(void)arg;
+}
+
+
+static bool mux_send_handler(int *err, struct sa *dst, struct mbuf *mb,
+			     void *arg)
+{
+	(void)err;
+	(void)dst;
+	(void)mb;
+	(void)arg;
+
+	return false;
+}
+
+
+static void sock_destructor(void *arg)
+{
+	struct mux_sock *ms = arg;
+
+	list_unlink(&ms->le);
+
+	mem_deref(ms->uh);
+	mem_deref(ms->us);
+	mem_deref(ms->ufragh);
+	mem_deref(ms->addrh);
+}
+
+
+static struct mux_sock *sock_find(const struct udpmux *mux,
+				  const struct sa *laddr)
+{
+	struct le *le;
+
+	LIST_FOREACH(&mux->sockl, le) {
+
+		struct mux_sock *ms = le->data;
+
+		if (sa_cmp(&ms->laddr, laddr, SA_ADDR))
+			return ms;
+	}
+
+	return NULL;
+}
+
+
+static int sock_alloc(struct mux_sock **msp, struct udpmux *mux,
+		      const struct sa *laddr)
+{
+	struct mux_sock *ms;
+	struct sa addr = *laddr;
+	int err;
+
+	ms = mem_zalloc(sizeof(*ms), sock_destructor);
+	if (!ms)
+		return ENOMEM;
+
+	ms->laddr = *laddr;
+
+	err  = hash_alloc(&ms->ufragh, HASH_SIZE);
+	err |= hash_alloc(&ms->addrh, HASH_SIZE);
+	if (err)
+		goto out;
+
+	sa_set_port(&addr, mux->port);
+
+	err = udp_listen(&ms->us, &addr, mux_udp_recv, ms);
+	if (err) {
+		warning("udpmux: listen on %J failed (%m)\n", &addr, err);
+		goto out;
+	}
+
+	err = udp_register_helper(&ms->uh, ms->us, LAYER_MUX,
+				  mux_send_handler, mux_recv_handler, ms);
+	if (err)
+		goto out;
+
+	udp_rxbatch_set(ms->us, UDP_RXBATCH);
+	udp_txqueue_set(ms->us, UDP_TXQUEUE);
+
+	list_append(&mux->sockl, &ms->le, ms);
+
+	info("udpmux: shared socket on %J\n", &addr);
+
+ out:
+	if (err)
+		mem_deref(ms);
+	else
+		*msp = ms;
+
+	return err;
+}
+
+
+static void mux_destructor(void *arg)
+{
+	struct udpmux *mux = arg;
+
+	/* endpoints keep their socket until they are released */
+	list_flush(&mux->sockl);
+}
+
+
+/**
+ * Allocate a shared UDP port for the host candidates of mediaflows
+ *
+ * @param muxp Pointer to allocated UDP mux
+ * @param port Local port for all addresses, 0 for a random port
+ *             per address
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udpmux_alloc(struct udpmux **muxp, uint16_t port)
+{
+	struct udpmux *mux;
+
+	if (!muxp)
+		return EINVAL;
+
+	mux = mem_zalloc(sizeof(*mux), mux_destructor);
+	if (!mux)
+		return ENOMEM;
+
+	list_init(&mux->sockl);
+	mux->port = port;
+
+	*muxp = mux;
+
+	return 0;
+}
+
+
+/**
+ * Get the statistics of the shared socket of a local address
+ *
+ * @param mux   UDP mux
+ * @param laddr Local address, only the address portion is used
+ * @param stats Returned statistics
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udpmux_stats_get(const struct udpmux *mux, const struct sa *laddr,
+		     struct udpmux_stats *stats)
+{
+	const struct mux_sock *ms;
+
+	if (!mux || !laddr || !stats)
+		return EINVAL;
+
+	ms = sock_find(mux, laddr);
+	if (!ms)
+		return ENOENT;
+
+	*stats = ms->stats;
+
+	return 0;
+}
+
+
+static void ep_destructor(void *arg)
+{
+	struct udpmux_ep *ep = arg;
+
+	hash_unlink(&ep->he);
+	list_flush(&ep->addrl);
+
+	mem_deref(ep->lufrag);
+	mem_deref(ep->ms);
+}
+
+
+/**
+ * Add an endpoint on the shared socket of a local address. The
+ * socket is created on first use.
+ *
+ * @param epp    Pointer to allocated endpoint
+ * @param mux    UDP mux
+ * @param laddr  Local address, only the address portion is used
+ * @param lufrag Local ICE ufrag of the endpoint
+ * @param recvh  Receive handler for packets not taken by ICE
+ * @param arg    Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udpmux_ep_alloc(struct udpmux_ep **epp, struct udpmux *mux,
+		    const struct sa *laddr, const char *lufrag,
+		    udp_recv_h *recvh, void *arg)
+{
+	struct udpmux_ep *ep;
+	struct mux_sock *ms;
+	int err;
+
+	if (!epp || !mux || !laddr || !str_isset(lufrag))
+		return EINVAL;
+
+	/* the socket list of the mux holds one reference */
+	ms = sock_find(mux, laddr);
+	if (!ms) {
+		err = sock_alloc(&ms, mux, laddr);
+		if (err)
+			return err;
+	}
+
+	ep = mem_zalloc(sizeof(*ep), ep_destructor);
+	if (!ep)
+		return ENOMEM;
+
+	ep->ms = mem_ref(ms);
+	list_init(&ep->addrl);
+	ep->recvh = recvh;
+	ep->arg   = arg;
+
+	err = str_dup(&ep->lufrag, lufrag);
+	if (err)
+		goto out;
+
+	hash_append(ms->ufragh, hash_joaat_str(lufrag), &ep->he, ep);
+
+ out:
+	if (err)
+		mem_deref(ep);
+	else
+		*epp = ep;
+
+	return err;
+}
+
+
+/**
+ * Get the shared socket of an endpoint
+ *
+ * @param ep Endpoint
+ *
+ * @return UDP socket
+ */
+struct udp_sock *udpmux_ep_sock(const struct udpmux_ep *ep)
+{
+	return ep ? ep->ms->us : NULL;
+}
+
+
+/**
+ * Get the demux helper of an endpoint. Sending below this helper
+ * skips all other helpers on the shared socket.
+ *
+ * @param ep Endpoint
+ *
+ * @return UDP helper
+ */
+struct udp_helper *udpmux_ep_helper(const struct udpmux_ep *ep)
+{
+	return ep ? ep->ms->uh : NULL;
+}
+
+
+/**
+ * Set the local ICE candidate of an endpoint, which gets the STUN
+ * packets. The UDP helper of the candidate is removed, since the
+ * demux passes the packets to the candidate.
+ *
+ * @param ep    Endpoint
+ * @param lcand Local candidate on the shared socket
+ */
+void udpmux_ep_set_lcand(struct udpmux_ep *ep, struct ice_lcand *lcand)
+{
+	if (!ep)
+		return;
+
+	if (lcand)
+		lcand->uh = mem_deref(lcand->uh);
+
+	ep->lcand = lcand;
+}
+
+
+/**
+ * Add a remote candidate address of an endpoint
+ *
+ * @param ep    Endpoint
+ * @param raddr Remote address
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udpmux_ep_add_raddr(struct udpmux_ep *ep, const struct sa *raddr)
+{
+	if (!ep || !raddr)
+		return EINVAL;
+
+	return addr_add(NULL, ep, raddr);
+}
+
+
+/**
+ * Select the remote address of an endpoint after ICE nomination.
+ * Packets from this address go to the endpoint, also if other
+ * endpoints have it as a candidate address.
+ *
+ * @param ep    Endpoint
+ * @param raddr Selected remote address
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int udpmux_ep_select(struct udpmux_ep *ep, const struct sa *raddr)
+{
+	struct mux_addr *ma;
+	struct le *le;
+	int err;
+
+	if (!ep || !raddr)
+		return EINVAL;
+
+	err = addr_add(&ma, ep, raddr);
+	if (err)
+		return err;
+
+	LIST_FOREACH(&ep->addrl, le) {
+		struct mux_addr *ma0 = le->data;
+
+		ma0->selected = false;
+	}
+
+	ma->selected = true;
+
+	return 0;
+}
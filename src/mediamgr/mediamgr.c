@@ -137,7 +137,9 @@ static void mm_destructor(void *arg)
 	struct mediamgr *mm = arg;
 
 	if (mm->started) {
-		mqueue_push(mm->mq, MM_MARSHAL_EXIT, NULL);
+		/* the thread must get it, wait for room in the queue */
+		while (mqueue_push(mm->mq, MM_MARSHAL_EXIT, NULL) == ENOBUFS)
+			sys_msleep(1);
 
 		/* waits untill re_cancel() is called on mediamgr_thread */
 		pthread_join(mm->thread, NULL);
@@ -473,6 +475,8 @@ static int mediamgr_post_media_command(struct mediamgr *mm,
 				       const char* media_name)
 {
 	struct mm_message *elem;
+	int err;
+
 	elem = mem_zalloc(sizeof(struct mm_message), NULL);
 	if (!elem) {
 		return -1;
@@ -480,7 +484,11 @@ static int mediamgr_post_media_command(struct mediamgr *mm,
 	strncpy(elem->media_elem.media_name, media_name,
 		sizeof(elem->media_elem.media_name) - 1);
 
-	return mqueue_push(mm->mq, cmd, elem);
+	err = mqueue_push(mm->mq, cmd, elem);
+	if (err)
+		mem_deref(elem);
+
+	return err;
 }
 
 
@@ -522,6 +530,7 @@ void mediamgr_set_call_state(struct mediamgr *mm, enum mediamgr_state state)
 	elem->state_elem.state = state;
 	if (mqueue_push(mm->mq, MM_MARSHAL_CALL_STATE, elem) != 0) {
 		error("mediamgr_set_call_state failed \n");
+		mem_deref(elem);
 	}
 }
 
@@ -551,6 +560,7 @@ void mediamgr_enable_speaker(struct mediamgr *mm, bool enable)
 	elem->bool_elem.val = enable;
 	if (mqueue_push(mm->mq, MM_MARSHAL_ENABLE_SPEAKER, elem) != 0) {
 		error("mediamgr_enable_speaker failed \n");
+		mem_deref(elem);
 	}
 }
 
@@ -566,6 +576,7 @@ void mediamgr_headset_connected(struct mediamgr *mm, bool connected)
 	elem->bool_elem.val = connected;
 	if (mqueue_push(mm->mq, MM_MARSHAL_HEADSET_CONNECTED, elem) != 0) {
 		error("mediamgr_headset_connected failed \n");
+		mem_deref(elem);
 	}
 }
 
@@ -581,6 +592,7 @@ void mediamgr_bt_device_connected(struct mediamgr *mm, bool connected)
 	elem->bool_elem.val = connected;
 	if (mqueue_push(mm->mq, MM_MARSHAL_BT_DEVICE_CONNECTED, elem) != 0) {
 		error("mediamgr_bt_device_connected failed \n");
+		mem_deref(elem);
 	}
 }
 
@@ -610,6 +622,7 @@ void mediamgr_register_media(struct mediamgr *mm,
 	elem->register_media_elem.is_call_media = is_call_media;
 	if (mqueue_push(mm->mq, MM_MARSHAL_REGISTER_MEDIA, elem) != 0) {
 		error("mediamgr_register_media failed \n");
+		mem_deref(elem);
 	}
 }
 
@@ -628,6 +641,7 @@ void mediamgr_unregister_media(struct mediamgr *mm, const char *media_name)
 	elem->register_media_elem.media_object = NULL;
 	if (mqueue_push(mm->mq, MM_MARSHAL_DEREGISTER_MEDIA, elem) != 0) {
 		error("mediamgr_unregister_media failed \n");
+		mem_deref(elem);
 	}
 }
 
@@ -662,6 +676,7 @@ void mediamgr_set_sound_mode(struct mediamgr *mm,
 	elem->set_intensity_elem.intensity = intensity;
 	if (mqueue_push(mm->mq, MM_MARSHAL_SET_INTENSITY, elem) != 0) {
 		error("mediamgr_set_sound_mode failed \n");
+		mem_deref(elem);
 	}
 }
 
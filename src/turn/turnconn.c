@@ -25,9 +25,136 @@
 
 enum {
 	TURNPING_INTERVAL = 15,  /* seconds, must be less than 29 */
+	SRV_SCORE_UNKNOWN = 1000,  /* ms, for servers never used */
+	SRV_FAIL_PENALTY  = 5000,  /* ms, per consecutive failure */
+	TCP_FRAME_MAX     = STUN_HEADER_SIZE + 65536,  /* padded */
 };
 
 
+/*
+ * Allocation latency per TURN server and transport, kept for the
+ * lifetime of the process. The score is used to order the servers
+ * of the next call, so the fastest server is preferred.
+ */
+struct srvstat {
+	struct le le;
+	struct sa srv;
+	int proto;
+	bool secure;
+	uint32_t rtt;        /* smoothed allocation time in [ms] */
+	uint32_t n_ok;
+	uint32_t n_fail;
+	uint32_t n_fail_seq; /* consecutive failures */
+};
+
+static struct list srvstatl;
+
+
+static struct srvstat *srvstat_find(const struct sa *srv, int proto,
+				    bool secure)
+{
+	struct le *le;
+
+	LIST_FOREACH(&srvstatl, le) {
+		struct srvstat *st = le->data;
+
+		if (st->proto == proto && st->secure == secure &&
+		    sa_cmp(&st->srv, srv, SA_ALL))
+			return st;
+	}
+
+	return NULL;
+}
+
+
+static void srvstat_update(const struct turn_conn *tc, bool ok)
+{
+	struct srvstat *st;
+	uint32_t rtt;
+
+	st = srvstat_find(&tc->turn_srv, tc->proto, tc->secure);
+	if (!st) {
+		st = mem_zalloc(sizeof(*st), NULL);
+		if (!st)
+			return;
+
+		st->srv    = tc->turn_srv;
+		st->proto  = tc->proto;
+		st->secure = tc->secure;
+
+		list_append(&srvstatl, &st->le, st);
+	}
+
+	if (!ok) {
+		++st->n_fail;
+		++st->n_fail_seq;
+		return;
+	}
+
+	rtt = (uint32_t)(tc->ts_turn_resp - tc->ts_turn_req);
+
+	/* RFC 6298 style smoothing, alpha 1/8 */
+	if (st->n_ok)
+		st->rtt = (7 * st->rtt + rtt) / 8;
+	else
+		st->rtt = rtt;
+
+	++st->n_ok;
+	st->n_fail_seq = 0;
+}
+
+
+/**
+ * Get the expected allocation time of a TURN server, lower is better
+ *
+ * @param srv    TURN server address
+ * @param proto  Transport protocol
+ * @param secure True for TLS
+ *
+ * @return Score in [ms]
+ */
+uint32_t turnconn_srv_score(const struct sa *srv, int proto, bool secure)
+{
+	const struct srvstat *st = srvstat_find(srv, proto, secure);
+	uint32_t score;
+
+	if (!st)
+		return SRV_SCORE_UNKNOWN;
+
+	score = st->n_ok ? st->rtt : SRV_SCORE_UNKNOWN;
+
+	return score + st->n_fail_seq * SRV_FAIL_PENALTY;
+}
+
+
+int turnconn_srvstat_debug(struct re_printf *pf, void *unused)
+{
+	struct le *le;
+	int err = 0;
+	(void)unused;
+
+	err |= re_hprintf(pf, "TURN servers (%u):\n",
+			  list_count(&srvstatl));
+
+	LIST_FOREACH(&srvstatl, le) {
+		const struct srvstat *st = le->data;
+
+		err |= re_hprintf(pf, "  %s%s %J  rtt=%ums ok=%u fail=%u\n",
+				  net_proto2name(st->proto),
+				  st->secure ? "/TLS" : "",
+				  &st->srv, st->rtt, st->n_ok, st->n_fail);
+	}
+
+	return err;
+}
+
+
+void turnconn_srvstat_flush(void)
+{
+	list_flush(&srvstatl);
+}
+
+
 /* NOTE: incoming data is bridged from TURN/TCP --> UDP-socket */
 static void turntcp_recv_data(struct turn_conn *tc,
 			      const struct sa *src, struct mbuf *mb)
@@ -88,8 +215,13 @@ static void turnc_handler(int err, uint16_t scode, const char *reason,
 		goto error;
 	}
 
+	if (!tc->turn_allocated) {
+		tc->ts_turn_resp = tmr_jiffies();
+		srvstat_update(tc, true);
+	}
+
 	tc->turn_allocated = true;
-	tc->ts_turn_resp = tmr_jiffies();
+	tc->failed = false;
 
 	attr = stun_msg_attr(msg, STUN_ATTR_SOFTWARE);
 
@@ -131,6 +263,10 @@ static void turnc_handler(int err, uint16_t scode, const char *reason,
 	return;
 
  error:
+	if (!tc->turn_allocated)
+		srvstat_update(tc, false);
+
+	tc->failed = true;
 	tc->errorh(err ? err : EPROTO, tc->arg);
 }
 
@@ -145,94 +281,74 @@ static void tcp_estab(void *arg)
 		     tls_cipher_name(tl->tlsc));
 	}
 
-	tl->mb = (struct mbuf *)mem_deref(tl->mb);
-
 	err = turnc_alloc(&tl->turnc, NULL, IPPROTO_TCP, tl->tc, tl->layer_turn,
 			  &tl->turn_srv, tl->username, tl->password,
 			  TURN_DEFAULT_LIFETIME, turnc_handler, tl);
 	if (err) {
 		warning("turnconn: turnc_alloc failed (%m)\n", err);
-	}
-}
-
-
-static void tcp_recv(struct mbuf *mb, void *arg)
-{
-	struct turn_conn *tl = arg;
-	int err = 0;
 
-	if (tl->mb) {
-		size_t pos;
+		srvstat_update(tl, false);
+		tl->failed = true;
 
-		pos = tl->mb->pos;
-
-		tl->mb->pos = tl->mb->end;
-
-		err = mbuf_write_mem(tl->mb, mbuf_buf(mb),
-				     mbuf_get_left(mb));
-		if (err)
-			goto out;
-
-		tl->mb->pos = pos;
+		if (tl->errorh)
+			tl->errorh(err, tl->arg);
 	}
-	else {
-		tl->mb = mem_ref(mb);
-	}
-
-	for (;;) {
+}
 
-		size_t len, pos, end;
-		struct sa src;
-		uint16_t typ;
 
-		if (mbuf_get_left(tl->mb) < 4)
-			break;
+/* STUN message or ChannelData, RFC 5766 section 11.5 */
+static int tcp_frame_len_handler(size_t *lenp, const struct mbuf *mb,
+				 void *arg)
+{
+	const uint8_t *p = mbuf_buf(mb);
+	uint16_t typ, len;
+	(void)arg;
 
-		typ = ntohs(mbuf_read_u16(tl->mb));
-		len = ntohs(mbuf_read_u16(tl->mb));
+	if (mbuf_get_left(mb) < 4)
+		return ENODATA;
 
-		if (typ < 0x4000)
-			len += STUN_HEADER_SIZE;
-		else if (typ < 0x8000)
-			len += 4;
-		else {
-			err = EBADMSG;
-			goto out;
-		}
+	typ = p[0] << 8 | p[1];
+	len = p[2] << 8 | p[3];
 
-		tl->mb->pos -= 4;
+	if (typ < 0x4000)
+		*lenp = STUN_HEADER_SIZE + len;
+	else if (typ < 0x8000)
+		*lenp = 4 + len;
+	else
+		return EBADMSG;
 
-		if (mbuf_get_left(tl->mb) < len)
-			break;
+	return 0;
+}
 
-		pos = tl->mb->pos;
-		end = tl->mb->end;
 
-		tl->mb->end = pos + len;
+static bool tcp_frame_handler(struct mbuf *mb, void *arg)
+{
+	struct turn_conn *tl = arg;
+	struct sa src;
+	int err;
 
-		err = turnc_recv(tl->turnc, &src, tl->mb);
-		if (err)
-			goto out;
+	err = turnc_recv(tl->turnc, &src, mb);
+	if (err) {
+		warning("turnconn: turn tcp_recv error (%m)\n", err);
+		mem_deref(tl);
+		return false;
+	}
 
-		if (mbuf_get_left(tl->mb))
-			turntcp_recv_data(tl, &src, tl->mb);
+	if (mbuf_get_left(mb))
+		turntcp_recv_data(tl, &src, mb);
 
-		/* 4 byte alignment */
-		while (len & 0x03)
-			++len;
+	return true;
+}
 
-		tl->mb->pos = pos + len;
-		tl->mb->end = end;
 
-		if (tl->mb->pos >= tl->mb->end) {
-			tl->mb = mem_deref(tl->mb);
-			break;
-		}
-	}
+static void tcp_recv(struct mbuf *mb, void *arg)
+{
+	struct turn_conn *tl = arg;
+	int err;
 
- out:
+	err = tcp_framer_recv(tl->framer, mb);
 	if (err) {
-		warning("turnconn: turn tcp_recv error (%m)\n");
+		warning("turnconn: turn tcp_recv error (%m)\n", err);
 		mem_deref(tl);
 	}
 }
@@ -244,6 +360,10 @@ static void tcp_close(int err, void *arg)
 
 	info("turnconn: turn connection closed (%m)\n", err);
 
+	if (!tl->turn_allocated)
+		srvstat_update(tl, false);
+
+	tl->failed = true;
 	tl->turn_allocated = false;
 	tl->turnc = mem_deref(tl->turnc);
 
@@ -257,6 +377,8 @@ static void turnconn_destructor(void *data)
 	struct turn_conn *tc = data;
 
 	list_unlink(&tc->le);
+	list_unlink(&tc->le_share);
+	list_flush(&tc->peerl);
 
 	mem_deref(tc->uh_app);   /* note: deref before us_app */
 	mem_deref(tc->us_app);
@@ -266,9 +388,10 @@ static void turnconn_destructor(void *data)
 	mem_deref(tc->tlsc);
 	mem_deref(tc->tc);
 	mem_deref(tc->tls);
-	mem_deref(tc->mb);
+	mem_deref(tc->framer);
 	mem_deref(tc->username);
 	mem_deref(tc->password);
+	mem_deref(tc->share);    /* note: deref after turnc */
 }
 
 
@@ -325,6 +448,12 @@ int turnconn_alloc(struct turn_conn **connp, struct list *connl,
 		break;
 
 	case IPPROTO_TCP:
+		err = tcp_framer_alloc(&tc->framer, TCP_FRAME_MAX, 4,
+				       tcp_frame_len_handler,
+				       tcp_frame_handler, tc);
+		if (err)
+			goto out;
+
 		err = tcp_connect(&tc->tc, turn_srv, tcp_estab,
 				  tcp_recv, tcp_close, tc);
 		if (err) {
@@ -371,6 +500,415 @@ int turnconn_alloc(struct turn_conn **connp, struct list *connl,
 }
 
 
+/*
+ * Shared TURN allocations
+ *
+ * The mediaflows of a group call all use the same TURN servers. A
+ * shared user does not get its own allocation, but joins the one of
+ * the same server, transport and credentials. Each user adds its own
+ * permissions and channels, and the incoming data is given to the
+ * user that knows the peer address. The peers are registered with the
+ * permissions, on the main thread, and not when sending, which may
+ * happen on other threads.
+ */
+
+struct turn_share {
+	struct le le;             /* member of sharel */
+	struct list userl;        /* struct turn_conn, the users */
+	struct hash *peerh;       /* struct turn_peer, by IP-address */
+	struct turn_conn *conn;   /* the one allocation */
+	struct udp_sock *us;      /* UDP only */
+	struct tmr tmr;           /* estab for users that joined late */
+	struct sa relay;
+	struct sa mapped;
+	uint32_t n_drop;
+};
+
+struct turn_peer {
+	struct le he;             /* member of turn_share.peerh */
+	struct le le;             /* member of turn_conn.peerl */
+	struct sa addr;
+	struct turn_conn *tc;     /* pointer to owner */
+};
+
+static struct list sharel;
+
+
+static void peer_destructor(void *data)
+{
+	struct turn_peer *tp = data;
+
+	hash_unlink(&tp->he);
+	list_unlink(&tp->le);
+}
+
+
+static int peer_add(struct turn_conn *tc, const struct sa *addr)
+{
+	struct turn_share *share = tc->share;
+	struct turn_peer *tp;
+	struct le *le;
+
+	LIST_FOREACH(hash_list(share->peerh, sa_hash(addr, SA_ADDR)), le) {
+		tp = le->data;
+
+		if (tp->tc == tc && sa_cmp(&tp->addr, addr, SA_ALL))
+			return 0;
+	}
+
+	tp = mem_zalloc(sizeof(*tp), peer_destructor);
+	if (!tp)
+		return ENOMEM;
+
+	tp->addr = *addr;
+	tp->tc = tc;
+
+	hash_append(share->peerh, sa_hash(addr, SA_ADDR), &tp->he, tp);
+	list_append(&tc->peerl, &tp->le, tp);
+
+	return 0;
+}
+
+
+/*
+ * Find the user of a peer. The full address wins, then the IP-address
+ * if only one user has it. A single user gets everything.
+ */
+static struct turn_conn *share_lookup(const struct turn_share *share,
+				      const struct sa *src)
+{
+	struct turn_conn *tc = NULL;
+	bool ambiguous = false;
+	struct le *le;
+
+	LIST_FOREACH(hash_list(share->peerh, sa_hash(src, SA_ADDR)), le) {
+		const struct turn_peer *tp = le->data;
+
+		if (!sa_cmp(&tp->addr, src, SA_ADDR))
+			continue;
+
+		if (sa_port(&tp->addr) == sa_port(src))
+			return tp->tc;
+
+		if (tc && tc != tp->tc)
+			ambiguous = true;
+
+		tc = tp->tc;
+	}
+
+	if (ambiguous)
+		return NULL;
+
+	if (!tc && list_count(&share->userl) == 1)
+		tc = list_ledata(list_head(&share->userl));
+
+	return tc;
+}
+
+
+static void share_recv(struct turn_share *share, const struct sa *src,
+		       struct mbuf *mb)
+{
+	struct turn_conn *tc;
+
+	tc = share_lookup(share, src);
+	if (!tc || !tc->turn_allocated) {
+		++share->n_drop;
+		return;
+	}
+
+	if (tc->datah)
+		tc->datah(tc, src, mb, tc->arg);
+}
+
+
+static void share_udp_recv(const struct sa *src, struct mbuf *mb, void *arg)
+{
+	share_recv(arg, src, mb);
+}
+
+
+static void share_data_handler(struct turn_conn *conn, const struct sa *src,
+			       struct mbuf *mb, void *arg)
+{
+	(void)conn;
+
+	share_recv(arg, src, mb);
+}
+
+
+static void user_estab(struct turn_conn *tc, const struct stun_msg *msg)
+{
+	struct turn_share *share = tc->share;
+
+	mem_deref(tc->turnc);
+	tc->turnc = mem_ref(share->conn->turnc);
+	tc->ts_turn_resp = tmr_jiffies();
+	tc->turn_allocated = true;
+	tc->failed = false;
+
+	tc->estabh(tc, &share->relay, &share->mapped, msg, tc->arg);
+}
+
+
+static void share_estab_handler(struct turn_conn *conn,
+				const struct sa *relay_addr,
+				const struct sa *mapped_addr,
+				const struct stun_msg *msg, void *arg)
+{
+	struct turn_share *share = arg;
+	struct le *le;
+	(void)conn;
+
+	share->relay  = *relay_addr;
+	share->mapped = *mapped_addr;
+
+	/* a handler may close its user, or all of them */
+	mem_ref(share);
+
+	le = share->userl.head;
+	while (le) {
+		struct turn_conn *tc = le->data;
+
+		le = le->next;
+
+		if (!tc->turn_allocated)
+			user_estab(tc, msg);
+	}
+
+	mem_deref(share);
+}
+
+
+static void share_error_handler(int err, void *arg)
+{
+	struct turn_share *share = arg;
+	struct le *le;
+
+	warning("turnconn: shared TURN-%s allocation to %J failed"
+		" with %u users (%m)\n",
+		turnconn_proto_name(share->conn), &share->conn->turn_srv,
+		list_count(&share->userl), err);
+
+	/* new users get a new allocation */
+	list_unlink(&share->le);
+
+	mem_ref(share);
+
+	le = share->userl.head;
+	while (le) {
+		struct turn_conn *tc = le->data;
+
+		le = le->next;
+
+		tc->turn_allocated = share->conn->turn_allocated;
+		tc->failed = true;
+		if (!tc->turn_allocated)
+			tc->turnc = mem_deref(tc->turnc);
+
+		if (tc->errorh)
+			tc->errorh(err, tc->arg);
+	}
+
+	mem_deref(share);
+}
+
+
+static void share_tmr_handler(void *arg)
+{
+	struct turn_share *share = arg;
+
+	share_estab_handler(share->conn, &share->relay, &share->mapped,
+			    NULL, share);
+}
+
+
+static void share_destructor(void *data)
+{
+	struct turn_share *share = data;
+
+	tmr_cancel(&share->tmr);
+	list_unlink(&share->le);
+
+	mem_deref(share->conn);
+	mem_deref(share->us);    /* note: deref after conn */
+	mem_deref(share->peerh);
+}
+
+
+static struct turn_share *share_find(const struct sa *turn_srv, int proto,
+				     bool secure, const char *username)
+{
+	struct le *le;
+
+	LIST_FOREACH(&sharel, le) {
+		struct turn_share *share = le->data;
+		const struct turn_conn *conn = share->conn;
+
+		if (conn->proto == proto && conn->secure == secure &&
+		    sa_cmp(&conn->turn_srv, turn_srv, SA_ALL) &&
+		    0 == str_cmp(conn->username, username))
+			return share;
+	}
+
+	return NULL;
+}
+
+
+static int share_alloc(struct turn_share **sharep,
+		       const struct sa *turn_srv, int proto, bool secure,
+		       const char *username, const char *password,
+		       int layer_stun, int layer_turn)
+{
+	struct turn_share *share;
+	struct sa laddr;
+	int err;
+
+	share = mem_zalloc(sizeof(*share), share_destructor);
+	if (!share)
+		return ENOMEM;
+
+	list_init(&share->userl);
+	tmr_init(&share->tmr);
+
+	err = hash_alloc(&share->peerh, 64);
+	if (err)
+		goto out;
+
+	if (proto == IPPROTO_UDP) {
+
+		sa_init(&laddr, sa_af(turn_srv));
+
+		err = udp_listen(&share->us, &laddr, share_udp_recv, share);
+		if (err)
+			goto out;
+	}
+
+	err = turnconn_alloc(&share->conn, NULL,
+			     turn_srv, proto, secure,
+			     username, password,
+			     share->us,
+			     layer_stun, layer_turn,
+			     share_estab_handler,
+			     share_data_handler,
+			     share_error_handler, share);
+	if (err)
+		goto out;
+
+	list_append(&sharel, &share->le, share);
+
+	info("turnconn: new shared TURN-%s allocation to %J\n",
+	     turnconn_proto_name(share->conn), turn_srv);
+
+ out:
+	if (err)
+		mem_deref(share);
+	else
+		*sharep = share;
+
+	return err;
+}
+
+
+/**
+ * Join the shared allocation to a TURN server, or create it
+ *
+ * The handlers have the same meaning as for turnconn_alloc(), the
+ * estab handler is called when the shared allocation is ready. The
+ * relayed data is given to the data handler, also for UDP.
+ *
+ * @param connp      Pointer to allocated TURN connection
+ * @param connl      List of TURN connections (optional)
+ * @param turn_srv   TURN server address
+ * @param proto      Transport protocol
+ * @param secure     True for TLS
+ * @param username   TURN username
+ * @param password   TURN password
+ * @param layer_stun UDP layer for the STUN keepalive
+ * @param layer_turn UDP layer for the TURN client
+ * @param estabh     Established handler
+ * @param datah      Data handler
+ * @param errorh     Error handler
+ * @param arg        Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int turnconn_alloc_shared(struct turn_conn **connp, struct list *connl,
+			  const struct sa *turn_srv, int proto, bool secure,
+			  const char *username, const char *password,
+			  int layer_stun, int layer_turn,
+			  turnconn_estab_h *estabh, turnconn_data_h *datah,
+			  turnconn_error_h *errorh, void *arg)
+{
+	struct turn_share *share;
+	struct turn_conn *tc;
+	int err = 0;
+
+	if (!turn_srv || !proto || !estabh)
+		return EINVAL;
+
+	tc = mem_zalloc(sizeof(*tc), turnconn_destructor);
+	if (!tc)
+		return ENOMEM;
+
+	share = share_find(turn_srv, proto, secure, username);
+	if (share) {
+		tc->share = mem_ref(share);
+	}
+	else {
+		err = share_alloc(&tc->share, turn_srv, proto, secure,
+				  username, password,
+				  layer_stun, layer_turn);
+		if (err)
+			goto out;
+
+		share = tc->share;
+	}
+
+	tc->turn_srv = *turn_srv;
+	tc->proto = proto;
+	tc->secure = secure;
+	tc->layer_stun = layer_stun;
+	tc->layer_turn = layer_turn;
+	tc->estabh = estabh;
+	tc->datah = datah;
+	tc->errorh = errorh;
+	tc->arg = arg;
+	tc->ts_turn_req = tmr_jiffies();
+
+	err |= str_dup(&tc->username, username);
+	err |= str_dup(&tc->password, password);
+	if (err)
+		goto out;
+
+	list_append(&share->userl, &tc->le_share, tc);
+
+	/* already allocated, no need to wait for the server */
+	if (share->conn->turn_allocated)
+		tmr_start(&share->tmr, 0, share_tmr_handler, share);
+
+	debug("turnconn: shared alloc: srv=%J users=%u\n",
+	      turn_srv, list_count(&share->userl));
+
+	list_append(connl, &tc->le, tc);
+
+ out:
+	if (err)
+		mem_deref(tc);
+	else if (connp)
+		*connp = tc;
+
+	return err;
+}
+
+
+/* Number of shared allocations, for debugging */
+uint32_t turnconn_shared_count(void)
+{
+	return list_count(&sharel);
+}
+
+
 static void turnc_perm_handler(void *arg)
 {
 	(void)arg;
@@ -381,6 +919,8 @@ static void turnc_perm_handler(void *arg)
 
 int turnconn_add_permission(struct turn_conn *conn, const struct sa *peer)
 {
+	int err;
+
 	if (!conn || !peer)
 		return EINVAL;
 
@@ -392,10 +932,66 @@ int turnconn_add_permission(struct turn_conn *conn, const struct sa *peer)
 		return EINTR;
 	}
 
+	if (conn->share) {
+		err = peer_add(conn, peer);
+		if (err)
+			return err;
+	}
+
 	return turnc_add_perm(conn->turnc, peer, turnc_perm_handler, NULL);
 }
 
 
+static void turnc_chan_handler(void *arg)
+{
+	(void)arg;
+
+	info("turnconn: TURN channel added OK\n");
+}
+
+
+int turnconn_add_channel(struct turn_conn *conn, const struct sa *peer)
+{
+	int err;
+
+	if (!conn || !peer)
+		return EINVAL;
+
+	if (!conn->turn_allocated)
+		return EINTR;
+
+	if (conn->share) {
+		err = peer_add(conn, peer);
+		if (err)
+			return err;
+	}
+
+	return turnc_add_chan(conn->turnc, peer, turnc_chan_handler, NULL);
+}
+
+
+/**
+ * Send data to a peer via the TURN server
+ *
+ * @param conn TURN connection
+ * @param dst  Peer address
+ * @param mb   Data to send, with headroom for the TURN header
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int turnconn_send(struct turn_conn *conn, const struct sa *dst,
+		  struct mbuf *mb)
+{
+	if (!conn || !dst || !mb)
+		return EINVAL;
+
+	if (!conn->turnc)
+		return ENOTCONN;
+
+	return turnc_send(conn->turnc, dst, mb);
+}
+
+
 struct turn_conn *turnconn_find_allocated(const struct list *turnconnl,
 					  int proto)
 {
@@ -426,6 +1022,7 @@ const char *turnconn_proto_name(const struct turn_conn *conn)
 
 int turnconn_debug(struct re_printf *pf, const struct turn_conn *conn)
 {
+	const struct turnc_stats *st;
 	int err = 0;
 
 	if (!conn)
@@ -437,5 +1034,22 @@ int turnconn_debug(struct re_printf *pf, const struct turn_conn *conn)
 			  turnconn_proto_name(conn), &conn->turn_srv,
 			  conn->turnc,
 			  conn->ts_turn_resp - conn->ts_turn_req);
+
+	st = turnc_stats_get(conn->turnc);
+	if (st) {
+		err |= re_hprintf(pf, "      bytes tx/rx: indication=%llu/%llu"
+				  " channel=%llu/%llu\n",
+				  st->ind_tx, st->ind_rx,
+				  st->chan_tx, st->chan_rx);
+	}
+
+	if (conn->share) {
+		err |= re_hprintf(pf, "      shared: users=%u peers=%u"
+				  " drop=%u\n",
+				  list_count(&conn->share->userl),
+				  list_count(&conn->peerl),
+				  conn->share->n_drop);
+	}
+
 	return err;
 }
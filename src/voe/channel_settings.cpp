@@ -69,3 +69,37 @@ struct channel_data *find_channel_data(struct list *active_chs, int ch)
     
     return NULL;
 }
+
+
+/* The statistics history ring is written and read on the re thread */
+void channel_stats_push(struct channel_data *cd,
+                        const struct channel_stats *st)
+{
+    if (!cd || !st)
+        return;
+
+    memcpy(&cd->ch_stats[cd->stats_cnt % NUM_STATS], st, sizeof(*st));
+    ++cd->stats_cnt;
+}
+
+
+/* Copy up to n of the latest samples, oldest first */
+int channel_stats_snapshot(const struct channel_data *cd,
+                           struct channel_stats *v, int n)
+{
+    uint32_t i;
+    int k = 0;
+
+    if (!cd || !v || n <= 0)
+        return 0;
+
+    if (n > NUM_STATS)
+        n = NUM_STATS;
+    if ((uint32_t)n > cd->stats_cnt)
+        n = (int)cd->stats_cnt;
+
+    for (i = cd->stats_cnt - n; i < cd->stats_cnt; ++i)
+        memcpy(&v[k++], &cd->ch_stats[i % NUM_STATS], sizeof(v[0]));
+
+    return k;
+}
@@ -96,6 +96,7 @@ int voe_dec_alloc(struct audec_state **adsp,
 	}
 
 	list_append(&gvoe.decl, &ads->le, ads);
+	ads->aulevel.speaker = true;
 
 	ads->ac = ac;
 	ads->recvh = recvh;
@@ -126,7 +127,9 @@ int voe_dec_start(struct audec_state *ads)
 	webrtc::CodecInst c;
     
 	gvoe.base->StartReceive(ads->ve->ch);
-	gvoe.base->StartPlayout(ads->ve->ch);
+	if (ads->aulevel.speaker)
+		gvoe.base->StartPlayout(ads->ve->ch);
+	ads->started = true;
 
 	gvoe.codec->GetSendCodec(ads->ve->ch, c);
 
@@ -145,6 +148,108 @@ int voe_dec_start(struct audec_state *ads)
 	return 0;
 }
 
+/*
+ * The level of the next RTP packet, from the RFC 6464 header extension.
+ * Mediaflow smooths the level, so that the selected speakers do not
+ * change between words.
+ */
+void voe_dec_level(struct audec_state *ads, uint8_t level, bool vad)
+{
+	(void)vad;
+
+	if (!ads)
+		return;
+
+	ads->aulevel.level = level;
+	ads->aulevel.valid = true;
+	ads->aulevel.ts = tmr_jiffies();
+}
+
+
+/*
+ * The place of a decoder in the speaker ranking: decoders without levels
+ * come first, then the loudest level, and decoders whose levels stopped
+ * come last.
+ */
+static unsigned speaker_rank_key(const struct audec_state *ads,
+				 uint64_t now)
+{
+	if (!ads->aulevel.valid)
+		return 0;
+
+	if (now - ads->aulevel.ts > AULEVEL_TIMEOUT)
+		return 0x100;
+
+	return 1 + ads->aulevel.level;
+}
+
+
+/*
+ * A decoder that is not selected leaves the mix, so that the mixer does
+ * not pull it and NetEq neither decodes nor conceals its packets. The
+ * channel still receives every packet for the RTP statistics and RTCP.
+ */
+static void set_speaker(struct audec_state *ads, bool speaker)
+{
+	if (speaker == ads->aulevel.speaker)
+		return;
+
+	ads->aulevel.speaker = speaker;
+
+	if (!ads->started || !gvoe.base)
+		return;
+
+	if (speaker)
+		gvoe.base->StartPlayout(ads->ve->ch);
+	else
+		gvoe.base->StopPlayout(ads->ve->ch);
+}
+
+
+/*
+ * Select the max_speakers loudest decoders. Decoders without levels are
+ * always selected, an equal level goes to the older decoder. Called
+ * every AULEVEL_SELECT_INTERVAL from the RTP path, so that a packet only
+ * checks the flag of its own decoder.
+ */
+void voe_dec_select_speakers(void)
+{
+	const uint64_t now = tmr_jiffies();
+	struct le *le, *le2;
+
+	gvoe.speakers_ts = now;
+
+	LIST_FOREACH(&gvoe.decl, le) {
+		struct audec_state *ads = (struct audec_state *)le->data;
+		const unsigned key = speaker_rank_key(ads, now);
+		unsigned n = 0;
+
+		if (!gvoe.max_speakers || !key) {
+			set_speaker(ads, true);
+			continue;
+		}
+
+		for (le2 = gvoe.decl.head; le2 != le; le2 = le2->next) {
+			const struct audec_state *other =
+				(const struct audec_state *)le2->data;
+
+			if (speaker_rank_key(other, now) <= key)
+				++n;
+		}
+
+		for (le2 = le->next; le2; le2 = le2->next) {
+			const struct audec_state *other =
+				(const struct audec_state *)le2->data;
+
+			if (speaker_rank_key(other, now) < key)
+				++n;
+		}
+
+		set_speaker(ads, n < gvoe.max_speakers);
+	}
+}
+
+
 void voe_dec_stop(struct audec_state *ads)
 {
 	if (!ads)
@@ -152,6 +257,8 @@ void voe_dec_stop(struct audec_state *ads)
 
 	info("voe: stopping decoder\n");
 
+	ads->started = false;
+
 	if (!gvoe.base)
 		return;
 
@@ -217,3 +217,26 @@ int voe_set_packet_size(int packet_size_ms)
 	voe_set_channel_load(&gvoe);
 	return 0;
 }
+
+
+int voe_enable_shared_encoder(bool enable)
+{
+	info("voe: shared encoder %s\n", enable ? "enabled" : "disabled");
+
+	gvoe.shenc.enabled = enable;
+
+	voe_enc_shared_update();
+	voe_multi_party_packet_rate_control(&gvoe);
+
+	return 0;
+}
+
+
+int voe_set_max_speakers(unsigned n)
+{
+	info("voe: max speakers %u\n", n);
+
+	gvoe.max_speakers = n;
+
+	return 0;
+}
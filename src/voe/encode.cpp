@@ -16,6 +16,7 @@
 * along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 #include <re.h>
+#include <re_atomic.h>
 
 #include "webrtc/common_types.h"
 #include "webrtc/common.h"
@@ -44,6 +45,29 @@ extern "C" {
 #include "voe.h"
 
 
+enum {
+	RTP_HDR_SIZE = 12,
+	RTP_MAX_SIZE = 1500,
+	RTCP_HDR_SIZE = 4,
+	RTCP_SR_SIZE = 28,     /* header, sender SSRC and sender info */
+	RTCP_RB_SIZE = 24,     /* report block */
+	RTCP_PT_SR = 200,
+	RTCP_PT_RR = 201,
+	FANOUT_MAX = 32,       /* peers per fanned out packet */
+};
+
+
+/* A rewritten header, sent outside of the shenc lock */
+struct fanout_target {
+	auenc_rtp_h *rtph;
+	auenc_rtcp_h *rtcph;
+	void *arg;
+	bool own;              /* RTCP: the encoding channel's own peer */
+	uint8_t hdr[RTCP_SR_SIZE];
+	uint8_t ext_id;        /* RTP: audio level id and length, or 0 */
+};
+
+
 static void aes_destructor(void *arg)
 {
 	struct auenc_state *aes = (struct auenc_state *)arg;
@@ -53,7 +77,13 @@ static void aes_destructor(void *arg)
 
 	voe_enc_stop(aes);
 
+	lock_write_get(gvoe.shenc.lock);
 	list_unlink(&aes->le);
+	lock_rel(gvoe.shenc.lock);
+
+	/* wait for a fan-out that may still be sending to us */
+	lock_write_get(gvoe.shenc.send_lock);
+	lock_rel(gvoe.shenc.send_lock);
 
 	mem_deref(aes->ve);
 }
@@ -94,7 +124,15 @@ int voe_enc_alloc(struct auenc_state **aesp,
 		*mctxp = (struct media_ctx *)aes->ve;
 	}
 
+	aes->ssrc = prm->local_ssrc;
+	aes->extmap_aulevel = prm->extmap_aulevel;
+	aes->fanout.src_ch = -1;
+	aes->fanout.seq = rand_u16();
+	aes->fanout.ts_last = rand_u32();
+
+	lock_write_get(gvoe.shenc.lock);
 	list_append(&gvoe.encl, &aes->le, aes);
+	lock_rel(gvoe.shenc.lock);
 
 	aes->ve->aes = aes;
 	aes->ac = ac;
@@ -106,6 +144,11 @@ int voe_enc_alloc(struct auenc_state **aesp,
 
 	if(gvoe.rtp_rtcp){
 		gvoe.rtp_rtcp->SetLocalSSRC(aes->ve->ch, prm->local_ssrc);
+
+		if (prm->extmap_aulevel) {
+			gvoe.rtp_rtcp->SetSendAudioLevelIndicationStatus(
+				aes->ve->ch, true, prm->extmap_aulevel);
+		}
 	}
         
  out:
@@ -129,9 +172,7 @@ int voe_enc_start(struct auenc_state *aes)
 
 	aes->started = true;
 
-	if (gvoe.base){
-		gvoe.base->StartSend(aes->ve->ch);
-	}
+	voe_enc_shared_update();
 
 	return 0;
 }
@@ -150,4 +191,464 @@ void voe_enc_stop(struct auenc_state *aes)
 
 		gvoe.base->StopSend(aes->ve->ch);
 	}
+
+	voe_enc_shared_update();
+}
+
+
+/*
+ * Shared encoder
+ *
+ * In a group call the same microphone signal is sent to every peer.
+ * With the shared encoder only the channel of the first started
+ * encoder is sending, and each of its RTP packets is fanned out to all
+ * started encoders. The SSRC, sequence number, timestamp and payload
+ * type are rewritten per encoder, and the RTP handler of each
+ * mediaflow applies its own SRTP context. The audio level extension
+ * gets the id that the peer negotiated, and is replaced by padding for
+ * a peer without one.
+ *
+ * The sender report of the encoding channel is rewritten the same way
+ * for every peer, and the report blocks that the peers send about
+ * their stream are handed to the encoding channel, so that the rate
+ * control of the shared encoder sees the loss and RTT of all peers.
+ *
+ * The headers are rewritten under shenc.lock, but the handlers are
+ * called without it: they take the encoder mutex of the mediaflow,
+ * which is held while starting an encoder. Instead, send_lock is held
+ * for reading while sending, and an encoder waits for it in its
+ * destructor.
+ */
+
+
+static inline uint32_t rd32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+
+static inline void wr32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v & 0xff;
+}
+
+
+/* Length of the RTP header with CSRCs and extension, or 0 if invalid */
+static size_t rtp_hdr_len(const uint8_t *pkt, size_t len)
+{
+	size_t hlen = RTP_HDR_SIZE + 4 * (pkt[0] & 0x0f);
+
+	if (pkt[0] & 0x10) {
+		if (len < hlen + 4)
+			return 0;
+
+		hlen += 4 + 4 * (pkt[hlen + 2] << 8 | pkt[hlen + 3]);
+	}
+
+	return hlen <= len ? hlen : 0;
+}
+
+
+/* Length of the RTCP packet at the start of pkt, or 0 if invalid */
+static size_t rtcp_pkt_len(const uint8_t *pkt, size_t len)
+{
+	size_t plen;
+
+	if (len < RTCP_HDR_SIZE)
+		return 0;
+
+	plen = RTCP_HDR_SIZE + 4 * (pkt[2] << 8 | pkt[3]);
+
+	return plen <= len ? plen : 0;
+}
+
+
+/*
+ * Find the element with the given id in the one-byte header extension
+ * of RFC 8285. Returns its offset in the packet, or 0, and sets the
+ * ids of all elements in the extension.
+ */
+static size_t rtp_ext_find(const uint8_t *pkt, size_t hlen, uint8_t id,
+			   uint16_t *idmap)
+{
+	size_t pos = RTP_HDR_SIZE + 4 * (pkt[0] & 0x0f), found = 0;
+
+	*idmap = 0;
+
+	if (!(pkt[0] & 0x10) || !id)
+		return 0;
+
+	if (pkt[pos] != 0xbe || pkt[pos + 1] != 0xde)
+		return 0;
+
+	for (pos += 4; pos < hlen;) {
+		const uint8_t eid = pkt[pos] >> 4;
+
+		if (pkt[pos] == 0) {
+			++pos;  /* padding */
+			continue;
+		}
+
+		if (eid == 15)
+			break;
+
+		*idmap |= 1 << eid;
+		if (eid == id)
+			found = pos;
+
+		pos += 2 + (pkt[pos] & 0x0f);
+	}
+
+	return pos <= hlen ? found : 0;
+}
+
+
+static void fanout_sent(unsigned n)
+{
+	re_atomic_add64(&gvoe.shenc.n_sent, n);
+}
+
+
+/* Select the encoding channel, and start or stop sending accordingly */
+void voe_enc_shared_update(void)
+{
+	struct auenc_state *enc = NULL;
+	struct le *le;
+	int ch = -1;
+
+	LIST_FOREACH(&gvoe.encl, le) {
+		struct auenc_state *aes = (struct auenc_state *)le->data;
+
+		if (aes->started) {
+			enc = aes;
+			break;
+		}
+	}
+
+	if (gvoe.shenc.enabled && enc)
+		ch = enc->ve->ch;
+
+	if (ch != gvoe.shenc.ch) {
+		info("voe: shared encoder on channel %d (was %d)\n",
+		     ch, gvoe.shenc.ch);
+	}
+
+	lock_write_get(gvoe.shenc.lock);
+	gvoe.shenc.ch = ch;
+	gvoe.shenc.extmap_aulevel = enc ? enc->extmap_aulevel : 0;
+	lock_rel(gvoe.shenc.lock);
+
+	if (!gvoe.base)
+		return;
+
+	/* StartSend and StopSend do nothing if already in that state */
+	LIST_FOREACH(&gvoe.encl, le) {
+		struct auenc_state *aes = (struct auenc_state *)le->data;
+
+		if (!aes->started)
+			continue;
+
+		if (gvoe.shenc.enabled && aes != enc)
+			gvoe.base->StopSend(aes->ve->ch);
+		else
+			gvoe.base->StartSend(aes->ve->ch);
+	}
+}
+
+
+/* Called from the VoiceEngine thread with each packet of channel ch */
+int voe_enc_fanout(int ch, const uint8_t *pkt, size_t len)
+{
+	struct fanout_target tv[FANOUT_MAX];
+	uint8_t buf[RTP_MAX_SIZE];
+	unsigned i, n = 0, n_sent = 0;
+	uint32_t ts, octets;
+	size_t hlen, ext_off;
+	uint16_t idmap;
+	struct le *le;
+	int err = 0;
+
+	if (!pkt || len < RTP_HDR_SIZE || len > sizeof(buf))
+		return EINVAL;
+
+	hlen = rtp_hdr_len(pkt, len);
+	if (!hlen)
+		return EBADMSG;
+
+	ts = rd32(&pkt[4]);
+	octets = (uint32_t)(len - hlen);
+
+	lock_write_get(gvoe.shenc.lock);
+
+	/* a late packet from the previous encoding channel */
+	if (ch != gvoe.shenc.ch) {
+		lock_rel(gvoe.shenc.lock);
+		return 0;
+	}
+
+	/* the ids of the other extension elements */
+	ext_off = rtp_ext_find(pkt, hlen, gvoe.shenc.extmap_aulevel, &idmap);
+	idmap &= ~(1 << gvoe.shenc.extmap_aulevel);
+
+	++gvoe.shenc.n_enc;
+
+	LIST_FOREACH(&gvoe.encl, le) {
+		struct auenc_state *aes = (struct auenc_state *)le->data;
+		struct fanout_target *t = &tv[n];
+		uint32_t ts_out;
+
+		if (!aes->started || !aes->rtph)
+			continue;
+
+		if (n >= FANOUT_MAX) {
+			warning("voe: fan-out: more than %u peers\n",
+				FANOUT_MAX);
+			break;
+		}
+
+		memcpy(t->hdr, pkt, RTP_HDR_SIZE);
+
+		/* new source, continue one frame after the last packet */
+		if (aes->fanout.src_ch != ch) {
+			const uint32_t frame = aes->ve->srate
+				* gvoe.packet_size_ms / 1000;
+
+			aes->fanout.ts_off = aes->fanout.ts_last + frame - ts;
+			aes->fanout.src_ch = ch;
+
+			t->hdr[1] |= 0x80;  /* marker */
+		}
+
+		ts_out = ts + aes->fanout.ts_off;
+		aes->fanout.ts_last = ts_out;
+
+		t->hdr[1] = (t->hdr[1] & 0x80) | (aes->ve->pt & 0x7f);
+		t->hdr[2] = aes->fanout.seq >> 8;
+		t->hdr[3] = aes->fanout.seq & 0xff;
+		wr32(&t->hdr[4], ts_out);
+		wr32(&t->hdr[8], aes->ssrc);
+
+		/* the peer's id, unless another element has it */
+		t->ext_id = 0;
+		if (ext_off && aes->extmap_aulevel &&
+		    !(idmap & (1 << aes->extmap_aulevel))) {
+			t->ext_id = aes->extmap_aulevel << 4
+				| (pkt[ext_off] & 0x0f);
+		}
+
+		++aes->fanout.seq;
+		++aes->fanout.n_pkt;
+		aes->fanout.n_octet += octets;
+
+		t->rtph = aes->rtph;
+		t->arg = aes->arg;
+		++n;
+	}
+
+	lock_read_get(gvoe.shenc.send_lock);
+	lock_rel(gvoe.shenc.lock);
+
+	for (i = 0; i < n; i++) {
+		int e;
+
+		memcpy(buf, pkt, len);
+		memcpy(buf, tv[i].hdr, RTP_HDR_SIZE);
+
+		if (ext_off && tv[i].ext_id)
+			buf[ext_off] = tv[i].ext_id;
+		else if (ext_off)
+			memset(&buf[ext_off], 0, 2 + (pkt[ext_off] & 0x0f));
+
+		e = tv[i].rtph(buf, len, tv[i].arg);
+		if (e) {
+			warning("voe: fan-out to %p failed (%m)\n",
+				tv[i].arg, e);
+			err = e;
+			continue;
+		}
+
+		++n_sent;
+	}
+
+	lock_rel(gvoe.shenc.send_lock);
+
+	fanout_sent(n_sent);
+
+	return err;
+}
+
+
+/*
+ * Called from the VoiceEngine thread with each RTCP packet of channel
+ * ch. Returns ENOENT if the packet is not from the shared encoder, and
+ * should be sent as usual.
+ *
+ * The sender report is rewritten per peer with its SSRC, timestamp
+ * offset and counts. The peer of the encoding channel gets the whole
+ * compound packet, the other peers get the sender report only, as
+ * their own channels send the receiver reports.
+ */
+int voe_enc_fanout_rtcp(int ch, const uint8_t *pkt, size_t len)
+{
+	struct fanout_target tv[FANOUT_MAX];
+	uint8_t buf[RTP_MAX_SIZE];
+	unsigned i, n = 0;
+	struct le *le;
+	uint32_t ts;
+	int err = 0;
+
+	if (!pkt || len > sizeof(buf))
+		return EINVAL;
+
+	if (len < RTCP_SR_SIZE || pkt[1] != RTCP_PT_SR ||
+	    rtcp_pkt_len(pkt, len) < RTCP_SR_SIZE)
+		return ENOENT;
+
+	ts = rd32(&pkt[16]);
+
+	lock_write_get(gvoe.shenc.lock);
+
+	if (ch != gvoe.shenc.ch) {
+		lock_rel(gvoe.shenc.lock);
+		return ENOENT;
+	}
+
+	LIST_FOREACH(&gvoe.encl, le) {
+		struct auenc_state *aes = (struct auenc_state *)le->data;
+		struct fanout_target *t = &tv[n];
+
+		/* no timestamp offset before the first packet */
+		if (!aes->started || !aes->rtcph || aes->fanout.src_ch != ch)
+			continue;
+
+		if (n >= FANOUT_MAX)
+			break;
+
+		memcpy(t->hdr, pkt, RTCP_SR_SIZE);
+
+		wr32(&t->hdr[4], aes->ssrc);
+		wr32(&t->hdr[16], ts + aes->fanout.ts_off);
+		wr32(&t->hdr[20], aes->fanout.n_pkt);
+		wr32(&t->hdr[24], aes->fanout.n_octet);
+
+		t->own = aes->ve->ch == ch;
+		if (!t->own) {
+			t->hdr[0] &= 0xe0;  /* no report blocks */
+			t->hdr[2] = 0;
+			t->hdr[3] = RTCP_SR_SIZE / 4 - 1;
+		}
+
+		t->rtcph = aes->rtcph;
+		t->arg = aes->arg;
+		++n;
+	}
+
+	lock_read_get(gvoe.shenc.send_lock);
+	lock_rel(gvoe.shenc.lock);
+
+	for (i = 0; i < n; i++) {
+		size_t blen = RTCP_SR_SIZE;
+		int e;
+
+		if (tv[i].own) {
+			memcpy(buf, pkt, len);
+			blen = len;
+		}
+		memcpy(buf, tv[i].hdr, RTCP_SR_SIZE);
+
+		e = tv[i].rtcph(buf, blen, tv[i].arg);
+		if (e) {
+			warning("voe: rtcp fan-out to %p failed (%m)\n",
+				tv[i].arg, e);
+			err = e;
+		}
+	}
+
+	lock_rel(gvoe.shenc.send_lock);
+
+	return err;
+}
+
+
+/*
+ * Called from the re thread with each RTCP packet received on channel
+ * ch. The report blocks about our stream to a peer of another channel
+ * are passed to the encoding channel as a receiver report about its
+ * own SSRC. The NTP time of the sender reports is the same for all
+ * peers, so the encoding channel computes the RTT of the peer.
+ */
+void voe_enc_shared_rtcp_recv(int ch, const uint8_t *pkt, size_t len)
+{
+	const struct auenc_state *peer = NULL, *enc = NULL;
+	uint8_t rr[RTCP_HDR_SIZE + 4 + 31 * RTCP_RB_SIZE];
+	size_t off = 0, rlen = RTCP_HDR_SIZE + 4;
+	unsigned nrb = 0;
+	struct le *le;
+
+	/* encl and shenc.ch are only changed on the re thread */
+	if (!gvoe.nw || !pkt || gvoe.shenc.ch < 0 || ch == gvoe.shenc.ch)
+		return;
+
+	LIST_FOREACH(&gvoe.encl, le) {
+		const struct auenc_state *aes =
+			(const struct auenc_state *)le->data;
+
+		if (aes->ve->ch == ch)
+			peer = aes;
+		else if (aes->ve->ch == gvoe.shenc.ch)
+			enc = aes;
+	}
+
+	if (!peer || !enc)
+		return;
+
+	while (off < len) {
+		const uint8_t *p = &pkt[off];
+		size_t plen = rtcp_pkt_len(p, len - off);
+		size_t rb;
+		unsigned rc, j;
+
+		if (!plen)
+			break;
+
+		off += plen;
+
+		if (p[1] == RTCP_PT_SR)
+			rb = RTCP_SR_SIZE;
+		else if (p[1] == RTCP_PT_RR)
+			rb = RTCP_HDR_SIZE + 4;
+		else
+			continue;
+
+		if (nrb == 0)
+			memcpy(&rr[4], &p[4], 4);  /* reporter SSRC */
+
+		rc = p[0] & 0x1f;
+		for (j = 0; j < rc && nrb < 31; j++, rb += RTCP_RB_SIZE) {
+
+			if (rb + RTCP_RB_SIZE > plen)
+				break;
+
+			if (rd32(&p[rb]) != peer->ssrc)
+				continue;
+
+			memcpy(&rr[rlen], &p[rb], RTCP_RB_SIZE);
+			wr32(&rr[rlen], enc->ssrc);
+			rlen += RTCP_RB_SIZE;
+			++nrb;
+		}
+	}
+
+	if (!nrb)
+		return;
+
+	rr[0] = 0x80 | nrb;
+	rr[1] = RTCP_PT_RR;
+	rr[2] = 0;
+	rr[3] = rlen / 4 - 1;
+
+	gvoe.nw->ReceivedRTCPPacket(gvoe.shenc.ch, rr, rlen);
 }
@@ -70,6 +70,12 @@ public:
 			goto out;
 		}
 		
+		/* one encoder for all peers */
+		if (gvoe.shenc.enabled) {
+			err = voe_enc_fanout(ve->ch, packet, length);
+			goto out;
+		}
+
 		aes = ve->aes;
 		if (aes->rtph) {
 			err = aes->rtph(packet, length, aes->arg);
@@ -99,6 +105,14 @@ public:
 			goto out;
 		}
 
+		/* sender reports of the shared encoder, per peer */
+		if (gvoe.shenc.enabled) {
+			err = voe_enc_fanout_rtcp(ve->ch, packet, length);
+			if (err != ENOENT)
+				goto out;
+			err = 0;
+		}
+
 		aes = ve->aes;
 
 		if (!aes->started)
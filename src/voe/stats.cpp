@@ -102,65 +102,63 @@ void voe_stats_init(struct voe_stats *vst)
 void voe_stats_calc(int ch, struct voe_stats *vst)
 {
     uint16_t tmpu16;
+    struct channel_stats ch_stats[NUM_STATS];
     struct channel_data *cd = find_channel_data(&gvoe.channel_data_list, ch);
     if (cd) {
-        int cnt = cd->stats_cnt;
-        if(cnt > NUM_STATS){
-            cnt = NUM_STATS;
-        }
+        int cnt = channel_stats_snapshot(cd, ch_stats, NUM_STATS);
         for(int i = 0; i < cnt; i++){
             vst->num_measurements++;
                 
-            vst->avg_currentBufferSize += cd->ch_stats[i].neteq_nw_stats.currentBufferSize;
-            vst->max_currentBufferSize = std::max(cd->ch_stats[i].neteq_nw_stats.currentBufferSize, vst->max_currentBufferSize);
-            vst->min_currentBufferSize = std::min(cd->ch_stats[i].neteq_nw_stats.currentBufferSize, vst->min_currentBufferSize);
+            vst->avg_currentBufferSize += ch_stats[i].neteq_nw_stats.currentBufferSize;
+            vst->max_currentBufferSize = std::max(ch_stats[i].neteq_nw_stats.currentBufferSize, vst->max_currentBufferSize);
+            vst->min_currentBufferSize = std::min(ch_stats[i].neteq_nw_stats.currentBufferSize, vst->min_currentBufferSize);
                 
-            vst->avg_PacketLossRate += cd->ch_stats[i].neteq_nw_stats.currentPacketLossRate;
-            vst->max_PacketLossRate = std::max(cd->ch_stats[i].neteq_nw_stats.currentPacketLossRate, vst->max_PacketLossRate);
-            vst->min_PacketLossRate = std::min(cd->ch_stats[i].neteq_nw_stats.currentPacketLossRate, vst->min_PacketLossRate);
+            vst->avg_PacketLossRate += ch_stats[i].neteq_nw_stats.currentPacketLossRate;
+            vst->max_PacketLossRate = std::max(ch_stats[i].neteq_nw_stats.currentPacketLossRate, vst->max_PacketLossRate);
+            vst->min_PacketLossRate = std::min(ch_stats[i].neteq_nw_stats.currentPacketLossRate, vst->min_PacketLossRate);
                 
-            vst->avg_ExpandRate += cd->ch_stats[i].neteq_nw_stats.currentExpandRate;
-            vst->max_ExpandRate = std::max(cd->ch_stats[i].neteq_nw_stats.currentExpandRate, vst->max_ExpandRate);
-            vst->min_ExpandRate = std::min(cd->ch_stats[i].neteq_nw_stats.currentExpandRate, vst->min_ExpandRate);
+            vst->avg_ExpandRate += ch_stats[i].neteq_nw_stats.currentExpandRate;
+            vst->max_ExpandRate = std::max(ch_stats[i].neteq_nw_stats.currentExpandRate, vst->max_ExpandRate);
+            vst->min_ExpandRate = std::min(ch_stats[i].neteq_nw_stats.currentExpandRate, vst->min_ExpandRate);
                 
-            vst->avg_AccelerateRate += cd->ch_stats[i].neteq_nw_stats.currentAccelerateRate;
-            vst->max_AccelerateRate = std::max(cd->ch_stats[i].neteq_nw_stats.currentAccelerateRate, vst->max_AccelerateRate);
-            vst->min_AccelerateRate = std::min(cd->ch_stats[i].neteq_nw_stats.currentAccelerateRate, vst->min_AccelerateRate);
+            vst->avg_AccelerateRate += ch_stats[i].neteq_nw_stats.currentAccelerateRate;
+            vst->max_AccelerateRate = std::max(ch_stats[i].neteq_nw_stats.currentAccelerateRate, vst->max_AccelerateRate);
+            vst->min_AccelerateRate = std::min(ch_stats[i].neteq_nw_stats.currentAccelerateRate, vst->min_AccelerateRate);
                 
-            vst->avg_PreemptiveRate += cd->ch_stats[i].neteq_nw_stats.currentPreemptiveRate;
-            vst->max_PreemptiveRate = std::max(cd->ch_stats[i].neteq_nw_stats.currentPreemptiveRate, vst->max_PreemptiveRate);
-            vst->min_PreemptiveRate = std::min(cd->ch_stats[i].neteq_nw_stats.currentPreemptiveRate, vst->min_PreemptiveRate);
+            vst->avg_PreemptiveRate += ch_stats[i].neteq_nw_stats.currentPreemptiveRate;
+            vst->max_PreemptiveRate = std::max(ch_stats[i].neteq_nw_stats.currentPreemptiveRate, vst->max_PreemptiveRate);
+            vst->min_PreemptiveRate = std::min(ch_stats[i].neteq_nw_stats.currentPreemptiveRate, vst->min_PreemptiveRate);
                 
-            vst->avg_SecondaryDecodedRate += cd->ch_stats[i].neteq_nw_stats.currentSecondaryDecodedRate;
-            vst->max_SecondaryDecodedRate = std::max(cd->ch_stats[i].neteq_nw_stats.currentSecondaryDecodedRate, vst->max_SecondaryDecodedRate);
-            vst->min_SecondaryDecodedRate = std::min(cd->ch_stats[i].neteq_nw_stats.currentSecondaryDecodedRate, vst->min_SecondaryDecodedRate);
+            vst->avg_SecondaryDecodedRate += ch_stats[i].neteq_nw_stats.currentSecondaryDecodedRate;
+            vst->max_SecondaryDecodedRate = std::max(ch_stats[i].neteq_nw_stats.currentSecondaryDecodedRate, vst->max_SecondaryDecodedRate);
+            vst->min_SecondaryDecodedRate = std::min(ch_stats[i].neteq_nw_stats.currentSecondaryDecodedRate, vst->min_SecondaryDecodedRate);
                 
-            vst->avg_RTT += cd->ch_stats[i].Rtt_ms;
-            vst->max_RTT = std::max((int32_t)cd->ch_stats[i].Rtt_ms, vst->max_RTT);
-            vst->min_RTT = std::min((int32_t)cd->ch_stats[i].Rtt_ms, vst->min_RTT);
+            vst->avg_RTT += ch_stats[i].Rtt_ms;
+            vst->max_RTT = std::max((int32_t)ch_stats[i].Rtt_ms, vst->max_RTT);
+            vst->min_RTT = std::min((int32_t)ch_stats[i].Rtt_ms, vst->min_RTT);
                 
-            vst->avg_Jitter += cd->ch_stats[i].jitter_smpls;
-            vst->max_Jitter = std::max((uint32_t)cd->ch_stats[i].jitter_smpls, vst->max_Jitter);
-            vst->min_Jitter = std::min((uint32_t)cd->ch_stats[i].jitter_smpls, vst->min_Jitter);
+            vst->avg_Jitter += ch_stats[i].jitter_smpls;
+            vst->max_Jitter = std::max((uint32_t)ch_stats[i].jitter_smpls, vst->max_Jitter);
+            vst->min_Jitter = std::min((uint32_t)ch_stats[i].jitter_smpls, vst->min_Jitter);
                 
-            tmpu16 = (cd->ch_stats[i].uplink_loss_q8 * 100) >> 8; /* q8 fraction to pct */
+            tmpu16 = (ch_stats[i].uplink_loss_q8 * 100) >> 8; /* q8 fraction to pct */
             vst->avg_UplinkPacketLossRate += tmpu16;
             vst->max_UplinkPacketLossRate = std::max(tmpu16, vst->max_UplinkPacketLossRate);
             vst->min_UplinkPacketLossRate = std::min(tmpu16, vst->min_UplinkPacketLossRate);
                 
-            vst->avg_UplinkJitter += cd->ch_stats[i].uplink_jitter_smpls;
-            vst->max_UplinkJitter = std::max((uint32_t)cd->ch_stats[i].uplink_jitter_smpls, vst->max_UplinkJitter);
-            vst->min_UplinkJitter = std::min((uint32_t)cd->ch_stats[i].uplink_jitter_smpls, vst->min_UplinkJitter);
+            vst->avg_UplinkJitter += ch_stats[i].uplink_jitter_smpls;
+            vst->max_UplinkJitter = std::max((uint32_t)ch_stats[i].uplink_jitter_smpls, vst->max_UplinkJitter);
+            vst->min_UplinkJitter = std::min((uint32_t)ch_stats[i].uplink_jitter_smpls, vst->min_UplinkJitter);
                 
-            vst->avg_InVol += cd->ch_stats[i].in_vol;
-            vst->max_InVol = std::max((uint16_t)cd->ch_stats[i].in_vol, vst->max_InVol);
-            vst->min_InVol = std::min((uint16_t)cd->ch_stats[i].in_vol, vst->min_InVol);
+            vst->avg_InVol += ch_stats[i].in_vol;
+            vst->max_InVol = std::max((uint16_t)ch_stats[i].in_vol, vst->max_InVol);
+            vst->min_InVol = std::min((uint16_t)ch_stats[i].in_vol, vst->min_InVol);
                 
-            vst->avg_OutVol += cd->ch_stats[i].out_vol;
-            vst->max_OutVol = std::max((uint16_t)cd->ch_stats[i].out_vol, vst->max_OutVol);
-            vst->min_OutVol = std::min((uint16_t)cd->ch_stats[i].out_vol, vst->min_OutVol);
+            vst->avg_OutVol += ch_stats[i].out_vol;
+            vst->max_OutVol = std::max((uint16_t)ch_stats[i].out_vol, vst->max_OutVol);
+            vst->min_OutVol = std::min((uint16_t)ch_stats[i].out_vol, vst->min_OutVol);
                 
-            if(cd->ch_stats[i].neteq_nw_stats.jitterPeaksFound){
+            if(ch_stats[i].neteq_nw_stats.jitterPeaksFound){
                 vst->avg_jitterPeaksFound += 1.0f;
             }
         }
@@ -193,29 +191,29 @@ void voe_stats_calc(int ch, struct voe_stats *vst)
             vst->std_OutVol = 0.0f;
             vst->std_UplinkJitter = 0.0f;
             for(int i = 0; i < vst->num_measurements; i++){
-                tmp = (float)(vst->avg_currentBufferSize - cd->ch_stats[i].neteq_nw_stats.currentBufferSize);
+                tmp = (float)(vst->avg_currentBufferSize - ch_stats[i].neteq_nw_stats.currentBufferSize);
                 vst->std_currentBufferSize += (tmp*tmp);
-                tmp = (float)(vst->avg_PacketLossRate - cd->ch_stats[i].neteq_nw_stats.currentPacketLossRate);
+                tmp = (float)(vst->avg_PacketLossRate - ch_stats[i].neteq_nw_stats.currentPacketLossRate);
                 vst->std_PacketLossRate += (tmp*tmp);
-                tmp = (float)(vst->avg_ExpandRate - cd->ch_stats[i].neteq_nw_stats.currentExpandRate);
+                tmp = (float)(vst->avg_ExpandRate - ch_stats[i].neteq_nw_stats.currentExpandRate);
                 vst->std_ExpandRate += (tmp*tmp);
-                tmp = (float)(vst->avg_AccelerateRate - cd->ch_stats[i].neteq_nw_stats.currentAccelerateRate);
+                tmp = (float)(vst->avg_AccelerateRate - ch_stats[i].neteq_nw_stats.currentAccelerateRate);
                 vst->std_AccelerateRate += (tmp*tmp);
-                tmp = (float)(vst->avg_PreemptiveRate - cd->ch_stats[i].neteq_nw_stats.currentPreemptiveRate);
+                tmp = (float)(vst->avg_PreemptiveRate - ch_stats[i].neteq_nw_stats.currentPreemptiveRate);
                 vst->std_PreemptiveRate += (tmp*tmp);
-                tmp = (float)(vst->avg_SecondaryDecodedRate - cd->ch_stats[i].neteq_nw_stats.currentSecondaryDecodedRate);
+                tmp = (float)(vst->avg_SecondaryDecodedRate - ch_stats[i].neteq_nw_stats.currentSecondaryDecodedRate);
                 vst->std_SecondaryDecodedRate += (tmp*tmp);
-                tmp = (float)(vst->avg_RTT - cd->ch_stats[i].Rtt_ms);
+                tmp = (float)(vst->avg_RTT - ch_stats[i].Rtt_ms);
                 vst->std_RTT += (tmp*tmp);
-                tmp = ((float)vst->avg_Jitter - (float)cd->ch_stats[i].jitter_smpls);
+                tmp = ((float)vst->avg_Jitter - (float)ch_stats[i].jitter_smpls);
                 vst->std_Jitter += (tmp*tmp);
-                tmp = ((float)vst->avg_UplinkPacketLossRate - (float)cd->ch_stats[i].uplink_loss_q8);
+                tmp = ((float)vst->avg_UplinkPacketLossRate - (float)ch_stats[i].uplink_loss_q8);
                 vst->std_UplinkPacketLossRate += (tmp*tmp);
-                tmp = ((float)vst->avg_UplinkJitter - (float)cd->ch_stats[i].uplink_jitter_smpls);
+                tmp = ((float)vst->avg_UplinkJitter - (float)ch_stats[i].uplink_jitter_smpls);
                 vst->std_UplinkJitter += (tmp*tmp);
-                tmp = ((float)vst->avg_InVol - (float)cd->ch_stats[i].in_vol);
+                tmp = ((float)vst->avg_InVol - (float)ch_stats[i].in_vol);
                 vst->std_InVol += (tmp*tmp);
-                tmp = ((float)vst->avg_OutVol - (float)cd->ch_stats[i].out_vol);
+                tmp = ((float)vst->avg_OutVol - (float)ch_stats[i].out_vol);
                 vst->std_OutVol += (tmp*tmp);
             }
             vst->std_currentBufferSize = sqrt(vst->std_currentBufferSize/vst->num_measurements);
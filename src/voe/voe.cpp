@@ -16,6 +16,7 @@
 * along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 #include <re.h>
+#include <re_atomic.h>
 #include "webrtc/common_types.h"
 #include "webrtc/common.h"
 #include "webrtc/system_wrappers/include/trace.h"
@@ -187,7 +188,10 @@ void MyObserver::CallbackOnError(int channel, int err_code)
 		if (med) {
 			med->ch = channel;
 			med->err = err_code;
-			mqueue_push(gvoe.mq, VOE_MQ_ERR, med);
+			if (mqueue_push(gvoe.mq, VOE_MQ_ERR, med)) {
+				warning("voe: error event dropped\n");
+				mem_deref(med);
+			}
 		}
 	}
 }
@@ -195,57 +199,6 @@ void MyObserver::CallbackOnError(int channel, int err_code)
 
 static MyObserver my_observer;
 
-static void tmr_neteq_stats_handler(void *arg)
-{
-    struct channel_stats chstat;
-    struct voe *voe = (struct voe *)arg;
-    
-    if(list_count(&voe->channel_data_list) > 0 && voe->nch > 0 && !voe->isSilenced){
-#if NETEQ_LOGGING
-        info("------ %d active channels ------- \n", list_count(&voe->channel_data_list));
-#endif
-        struct le *le;
-        for(le = voe->channel_data_list.head; le; le = le->next){
-            struct channel_data *cd = (struct channel_data *)le->data;
-            
-            chstat.in_vol = 20 * log10(voe->in_vol_smth + 1.0f);
-            chstat.out_vol = 20 * log10(cd->out_vol_smth + 1.0f);
-            
-            int ch_id = cd->channel_number;
-            voe->neteq_stats->GetNetworkStatistics(ch_id, chstat.neteq_nw_stats);
-            
-            webrtc::CallStatistics stats;
-            voe->rtp_rtcp->GetRTCPStatistics(ch_id, stats);
-            chstat.Rtt_ms = stats.rttMs;
-            chstat.jitter_smpls = stats.jitterSamples;
-            
-            unsigned int NTPHigh = 0, NTPLow = 0, timestamp = 0, playoutTimestamp = 0, jitter = 0;
-            unsigned short fractionLostUp_Q8 = 0; // Uplink packet loss as reported by remote side
-            voe->rtp_rtcp->GetRemoteRTCPData( ch_id, NTPHigh, NTPLow, timestamp, playoutTimestamp, &jitter, &fractionLostUp_Q8);
-            
-            chstat.uplink_loss_q8 = fractionLostUp_Q8;
-            chstat.uplink_jitter_smpls = jitter;
-            
-            memcpy(&cd->ch_stats[cd->stats_idx], &chstat, sizeof(chstat));
-            cd->stats_idx++;
-            if(cd->stats_idx >= NUM_STATS){
-               cd->stats_idx = 0;
-            }
-            cd->stats_cnt++;
-#if NETEQ_LOGGING
-            float pl_rate = ((float)chstat.neteq_nw_stats.currentPacketLossRate)/163.84f; // convert Q14 -> float and fraction to percent
-            float fec_rate = ((float)chstat.neteq_nw_stats.currentSecondaryDecodedRate)/163.84f; // convert Q14 -> float and fraction to percent
-            float exp_rate = ((float)chstat.neteq_nw_stats.currentExpandRate)/163.84f;
-            float acc_rate = ((float)chstat.neteq_nw_stats.currentAccelerateRate)/163.84f;
-            float dec_rate = ((float)chstat.neteq_nw_stats.currentPreemptiveRate)/163.84f;
-            info("ch# %d BufferSize = %d ms PacketLossRate = %.2f ExpandRate = %.2f fec_rate = %.2f AccelerateRate = %.2f DecelerateRate = %.2f \n", ch_id, chstat.neteq_nw_stats.currentBufferSize, pl_rate, exp_rate, fec_rate, acc_rate, dec_rate);
-#endif
-        }
-    }
-    tmr_start(&voe->tmr_neteq_stats, NW_STATS_DELTA*MILLISECONDS_PER_SECOND, tmr_neteq_stats_handler, voe);
-}
-
-
 static const char *AGCmode2Str(webrtc::AgcModes AGCmode)
 {
     switch (AGCmode) {
@@ -512,6 +465,8 @@ static void tmr_rtp_timeout_handler(void *arg)
 static int rtp_handler(struct audec_state *ads,
 		       const uint8_t *pkt, size_t len)
 {
+	uint64_t now;
+
 	if (!ads || !pkt || !len)
 		return EINVAL;
 
@@ -524,6 +479,14 @@ static int rtp_handler(struct audec_state *ads,
 		set_interrupted(ads->ve->ch, false);
 		tmr_cancel(&ads->tmr_rtp_timeout);
 		tmr_start(&ads->tmr_rtp_timeout, 2*MILLISECONDS_PER_SECOND,tmr_rtp_timeout_handler, ads);
+
+		now = tmr_jiffies();
+		if (now - gvoe.speakers_ts >= AULEVEL_SELECT_INTERVAL)
+			voe_dec_select_speakers();
+
+		/* flows that are not selected are not mixed nor decoded */
+		if (!ads->aulevel.speaker)
+			++ads->aulevel.n_skip;
         
 		gvoe.nw->ReceivedRTPPacket(ads->ve->ch, pkt, len);
 
@@ -537,6 +500,91 @@ static int rtp_handler(struct audec_state *ads,
 	return 0;
 }
 
+/*
+ * The statistics are still polled from the VoiceEngine on the re thread.
+ * A sample is taken when an RTCP report arrives for the channel, at most
+ * every NW_STATS_DELTA seconds, and a timer samples the channels that
+ * had no report for that long. The readers copy the history ring and do
+ * not call into the VoiceEngine.
+ */
+static void channel_stats_sample(struct channel_data *cd,
+				 const webrtc::CallStatistics &stats,
+				 unsigned int jitter,
+				 unsigned short fractionLostUp_Q8)
+{
+	struct channel_stats chstat;
+	uint64_t now = tmr_jiffies();
+
+	if (gvoe.isSilenced)
+		return;
+
+	if (cd->stats_ts &&
+	    now - cd->stats_ts < NW_STATS_DELTA*MILLISECONDS_PER_SECOND)
+		return;
+
+	cd->stats_ts = now;
+
+	memset(&chstat, 0, sizeof(chstat));
+	chstat.in_vol = 20 * log10(gvoe.in_vol_smth + 1.0f);
+	chstat.out_vol = 20 * log10(cd->out_vol_smth + 1.0f);
+
+	gvoe.neteq_stats->GetNetworkStatistics(cd->channel_number,
+					       chstat.neteq_nw_stats);
+
+	chstat.Rtt_ms = stats.rttMs;
+	chstat.jitter_smpls = stats.jitterSamples;
+	chstat.uplink_loss_q8 = fractionLostUp_Q8;
+	chstat.uplink_jitter_smpls = jitter;
+
+	channel_stats_push(cd, &chstat);
+
+#if NETEQ_LOGGING
+	float pl_rate = ((float)chstat.neteq_nw_stats.currentPacketLossRate)/163.84f; // convert Q14 -> float and fraction to percent
+	float fec_rate = ((float)chstat.neteq_nw_stats.currentSecondaryDecodedRate)/163.84f; // convert Q14 -> float and fraction to percent
+	float exp_rate = ((float)chstat.neteq_nw_stats.currentExpandRate)/163.84f;
+	float acc_rate = ((float)chstat.neteq_nw_stats.currentAccelerateRate)/163.84f;
+	float dec_rate = ((float)chstat.neteq_nw_stats.currentPreemptiveRate)/163.84f;
+	info("ch# %d BufferSize = %d ms PacketLossRate = %.2f ExpandRate = %.2f fec_rate = %.2f AccelerateRate = %.2f DecelerateRate = %.2f \n", cd->channel_number, chstat.neteq_nw_stats.currentBufferSize, pl_rate, exp_rate, fec_rate, acc_rate, dec_rate);
+#endif
+}
+
+
+/* Sample the channels without RTCP, e.g. a peer that sends no reports */
+static void tmr_neteq_stats_handler(void *arg)
+{
+	struct voe *voe = (struct voe *)arg;
+	const uint64_t now = tmr_jiffies();
+	struct le *le;
+
+	tmr_start(&voe->tmr_neteq_stats,
+		  NW_STATS_DELTA*MILLISECONDS_PER_SECOND,
+		  tmr_neteq_stats_handler, voe);
+
+	if (voe->nch == 0 || !voe->neteq_stats || !voe->rtp_rtcp)
+		return;
+
+	LIST_FOREACH(&voe->channel_data_list, le) {
+		struct channel_data *cd = (struct channel_data *)le->data;
+		webrtc::CallStatistics stats;
+		unsigned int NTPHigh = 0, NTPLow = 0, timestamp = 0;
+		unsigned int playoutTimestamp = 0, jitter = 0;
+		unsigned short fractionLostUp_Q8 = 0;
+
+		if (cd->stats_ts &&
+		    now - cd->stats_ts < NW_STATS_DELTA*MILLISECONDS_PER_SECOND)
+			continue;
+
+		memset(&stats, 0, sizeof(stats));
+		voe->rtp_rtcp->GetRTCPStatistics(cd->channel_number, stats);
+		voe->rtp_rtcp->GetRemoteRTCPData(cd->channel_number,
+						 NTPHigh, NTPLow, timestamp,
+						 playoutTimestamp, &jitter,
+						 &fractionLostUp_Q8);
+
+		channel_stats_sample(cd, stats, jitter, fractionLostUp_Q8);
+	}
+}
+
 #define SWITCH_TO_SHORTER_PACKETS_RTT_MS  500
 #define SWITCH_TO_LONGER_PACKETS_RTT_MS   800
 
@@ -553,6 +601,10 @@ static int rtcp_handler(struct audec_state *ads,
     
 	if (gvoe.nw)
 		gvoe.nw->ReceivedRTCPPacket(ads->ve->ch, pkt, len);
+
+	/* reports about our stream belong to the encoding channel */
+	if (gvoe.shenc.enabled)
+		voe_enc_shared_rtcp_recv(ads->ve->ch, pkt, len);
     
 	if (!gvoe.rtp_rtcp)
 		return 0;
@@ -572,6 +624,10 @@ static int rtcp_handler(struct audec_state *ads,
 			if( cd->channel_number == ads->ve->ch ) {
 				cd->last_rtcp_rtt = stats.rttMs;
 				cd->last_rtcp_ploss = fractionLostUp_Q8;
+				if (gvoe.neteq_stats) {
+					channel_stats_sample(cd, stats, jitter,
+							     fractionLostUp_Q8);
+				}
 			}
 			rtt_ms = std::max(rtt_ms, cd->last_rtcp_rtt);
 			frac_lost_Q8 = std::max(frac_lost_Q8, cd->last_rtcp_ploss);
@@ -614,6 +670,7 @@ static struct aucodec voe_aucodecv[NUM_CODECS] = {
 		.dec_start = voe_dec_start,
 		.dec_stop  = voe_dec_stop,
 		.get_stats = voe_get_stats,
+		.dec_levelh = voe_dec_level,
 	}
 };
 
@@ -694,8 +751,11 @@ void voe_close(void)
 	webrtc::Trace::ReturnTrace();
 
 	tmr_cancel(&gvoe.tmr_neteq_stats);
-    
+
 	gvoe.mq = (struct mqueue *)mem_deref(gvoe.mq);
+	gvoe.shenc.lock = (struct lock *)mem_deref(gvoe.shenc.lock);
+	gvoe.shenc.send_lock =
+		(struct lock *)mem_deref(gvoe.shenc.send_lock);
     
 	list_flush(&gvoe.channel_data_list);
 
@@ -826,6 +886,16 @@ int voe_init(struct list *aucodecl)
 		     ac->name, ac->srate, c);
 	}
 
+	err = lock_alloc(&gvoe.shenc.lock);
+	if (err)
+		goto out;
+
+	err = lock_alloc(&gvoe.shenc.send_lock);
+	if (err)
+		goto out;
+
+	gvoe.shenc.ch = -1;
+
 	gvoe.nch = 0;
 	list_init(&gvoe.channel_data_list);
 	gvoe.packet_size_ms = 20;
@@ -858,7 +928,8 @@ int voe_init(struct list *aucodecl)
     
     gvoe.playout_device = "uninitialized";
     
-    tmr_start(&gvoe.tmr_neteq_stats, MILLISECONDS_PER_SECOND, tmr_neteq_stats_handler, &gvoe);
+    tmr_start(&gvoe.tmr_neteq_stats, NW_STATS_DELTA*MILLISECONDS_PER_SECOND,
+              tmr_neteq_stats_handler, &gvoe);
     
     voe_vm_init(&gvoe.vm);
     
@@ -1154,9 +1225,24 @@ int voe_debug(struct re_printf *pf, void *unused)
     for (le = gvoe.channel_data_list.head; le; le = le->next) {
         struct channel_data *cd = (struct channel_data *)le->data;
         
+        struct channel_stats st;
         int ch = cd->channel_number;
         
-        err |= re_hprintf(pf, " ...channel=%d\n", ch);
+        err |= re_hprintf(pf, " ...channel=%d samples=%u", ch,
+                          cd->stats_cnt);
+        if (channel_stats_snapshot(cd, &st, 1)) {
+            webrtc::NetworkStatistics *nw = &st.neteq_nw_stats;
+
+            err |= re_hprintf(pf, " buffer=%ums expand=%u"
+                              " accelerate=%u rtt=%lldms"
+                              " loss_u=%u/256",
+                              nw->currentBufferSize,
+                              nw->currentExpandRate,
+                              nw->currentAccelerateRate,
+                              (long long)st.Rtt_ms,
+                              st.uplink_loss_q8);
+        }
+        err |= re_hprintf(pf, "\n");
     }
 	err |= re_hprintf(pf, "\n");
 
@@ -1169,12 +1255,24 @@ int voe_debug(struct re_printf *pf, void *unused)
 	}
 	err |= re_hprintf(pf, "\n");
 
-	err |= re_hprintf(pf, " decoders (%u):\n", list_count(&gvoe.decl));
+	err |= re_hprintf(pf, " shared encoder:  %s channel=%d"
+			  " encoded=%llu sent=%llu\n",
+			  gvoe.shenc.enabled ? "on" : "off", gvoe.shenc.ch,
+			  gvoe.shenc.n_enc,
+			  re_atomic_load64(&gvoe.shenc.n_sent));
+	err |= re_hprintf(pf, "\n");
+
+	err |= re_hprintf(pf, " decoders (%u, max speakers %u):\n",
+			  list_count(&gvoe.decl), gvoe.max_speakers);
 	for (le = gvoe.decl.head; le; le = le->next) {
 		struct audec_state *ads = (struct audec_state *)le->data;
 
-		err |= re_hprintf(pf, " ...%s channel=%d\n",
-				  ads->ac->name, ads->ve->ch);
+		err |= re_hprintf(pf, " ...%s channel=%d level=%d"
+				  "%s skipped=%llu\n",
+				  ads->ac->name, ads->ve->ch,
+				  ads->aulevel.valid ? -ads->aulevel.level : 0,
+				  ads->aulevel.speaker ? "" : " (not mixed)",
+				  ads->aulevel.n_skip);
 	}
 	err |= re_hprintf(pf, "\n");
 
@@ -1217,8 +1315,10 @@ void voe_multi_party_packet_rate_control(struct voe *voe)
     
 	webrtc::CodecInst c;
     
-	/* Change Packet size based on amount of flows in use */
-	int active_flows = list_count(&voe->channel_data_list);
+	/* Change Packet size based on amount of flows in use,
+	   there is only one encoder when it is shared */
+	int active_flows = voe->shenc.enabled ? 1 :
+		list_count(&voe->channel_data_list);
 	int min_packet_size_ms = 20;
 
 	if ( active_flows >= ACTIVE_FLOWS_FOR_60MS_PACKETS ) {
@@ -69,6 +69,17 @@ struct auenc_state {
 	auenc_packet_h *pkth;
 	auenc_err_h *errh;
 	void *arg;
+
+	uint32_t ssrc;
+	uint8_t extmap_aulevel;    /* audio level extension id, or 0 */
+	struct {
+		int src_ch;        /* channel of the last packet, or -1 */
+		uint16_t seq;
+		uint32_t ts_off;
+		uint32_t ts_last;
+		uint32_t n_pkt;    /* sender report packet count */
+		uint32_t n_octet;  /* sender report octet count */
+	} fanout;                  /* RTP header rewriting, shared encoder */
 };
 
 int voe_enc_alloc(struct auenc_state **aesp,
@@ -83,9 +94,18 @@ int voe_enc_alloc(struct auenc_state **aesp,
 
 int  voe_enc_start(struct auenc_state *aes);
 void voe_enc_stop(struct auenc_state *aes);
+void voe_enc_shared_update(void);
+int  voe_enc_fanout(int ch, const uint8_t *pkt, size_t len);
+int  voe_enc_fanout_rtcp(int ch, const uint8_t *pkt, size_t len);
+void voe_enc_shared_rtcp_recv(int ch, const uint8_t *pkt, size_t len);
 
 /* decoder */
 
+enum {
+	AULEVEL_TIMEOUT = 1000,  /* ms before a level is ignored */
+	AULEVEL_SELECT_INTERVAL = 100,  /* ms between speaker selections */
+};
+
 struct audec_state {
 	const struct aucodec *ac;  /* inheritance */
 
@@ -96,6 +116,15 @@ struct audec_state {
 	audec_err_h *errh;
     
 	struct tmr tmr_rtp_timeout;
+
+	struct {
+		uint8_t level;     /* RFC 6464 level in -dBov, smoothed */
+		bool valid;
+		uint64_t ts;       /* time of the last level */
+		bool speaker;      /* selected, the channel is mixed */
+		uint64_t n_skip;   /* packets received while not mixed */
+	} aulevel;
+	bool started;
     
 	void *arg;
 };
@@ -112,18 +141,26 @@ int  voe_dec_alloc(struct audec_state **adsp,
 int  voe_dec_start(struct audec_state *ads);
 int  voe_get_stats(struct audec_state *ads, struct aucodec_stats *new_stats);
 void voe_dec_stop(struct audec_state *ads);
+void voe_dec_level(struct audec_state *ads, uint8_t level, bool vad);
+void voe_dec_select_speakers(void);
 void voe_calculate_stats(int ch);
 void voe_set_channel_load(struct voe *voe);
 
 
 /* Voice Messaging */
 class VmTransport;
+struct vm_recorder;
+struct vm_player;
 
 struct vm_state {
     int ch;
     VmTransport *transport;
     FILE *fp;
-    pthread_mutex_t mutex;
+    struct vm_recorder *rec;        /* writer thread, when recording */
+    struct vm_player *player;       /* mapped file, when playing */
+    struct tmr tmr_vm_record;
+    vm_record_status_h *record_statush;
+    void *record_statush_arg;
     struct tmr tmr_vm_player;
     struct timeval next_event;
     webrtc::CodecInst c;
@@ -216,14 +253,20 @@ struct channel_data {
 	int  last_rtcp_rtt;
 	int  last_rtcp_ploss;
 	bool interrupted;
-	struct channel_stats ch_stats[NUM_STATS];
-	int stats_idx;
-	int stats_cnt;
 	float out_vol_smth;
+
+	/* Statistics history ring */
+	struct channel_stats ch_stats[NUM_STATS];
+	uint32_t stats_cnt;             /* samples written */
+	uint64_t stats_ts;              /* time of the last sample */
 };
 
 int channel_data_add(struct list *ch_list, int ch, webrtc::CodecInst &c);
 struct channel_data *find_channel_data(struct list *active_chs, int ch);
+void channel_stats_push(struct channel_data *cd,
+			const struct channel_stats *st);
+int  channel_stats_snapshot(const struct channel_data *cd,
+			    struct channel_stats *v, int n);
 
 /* global data */
 struct voe {
@@ -252,6 +295,19 @@ struct voe {
 	struct list encl;  /* struct auenc_state */
 	struct list decl;  /* struct audec_state */
 
+	struct {
+		bool enabled;
+		int ch;             /* encoding channel, or -1 */
+		uint8_t extmap_aulevel; /* audio level id of the channel */
+		struct lock *lock;  /* encl and ch, for the fan-out */
+		struct lock *send_lock; /* held while fanning out */
+		uint64_t n_enc;     /* packets from the encoder */
+		uint64_t n_sent;    /* packets after the fan-out */
+	} shenc;                    /* shared encoder */
+
+	unsigned max_speakers;      /* decoded flows by level, 0 for all */
+	uint64_t speakers_ts;       /* time of the last selection */
+
 	bool is_playing;
 	bool is_recording;
 	bool is_rtp_recording;
@@ -261,7 +317,7 @@ struct voe {
     
 	std::string path_to_files;
     
-	struct tmr tmr_neteq_stats;
+	struct tmr tmr_neteq_stats;  /* stats of channels without RTCP */
     
 	struct mqueue *mq;
 	struct list transportl;
@@ -18,6 +18,11 @@
 
 #include <pthread.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <re.h>
 
@@ -55,6 +60,12 @@ extern "C" {
 #define MAX_PACKET_SIZE_BYTES 512
 #define PACKET_SIZE_MS 40
 
+#define VM_RING_SIZE 128             /* packets, 5 seconds */
+#define VM_WRITE_INTERVAL_MS 200     /* writer thread wakeup */
+#define VM_STATUS_INTERVAL_MS 500    /* record status handler */
+#define VM_IOBUF_SIZE (64 * 1024)    /* stdio buffer of the file */
+#define VM_PREFETCH_PACKETS 50       /* 2 seconds ahead of playback */
+
 static int MakeRTPheader( uint8_t* rtpHeader,
                          const uint8_t payloadType,
                          const uint16_t seqNum,
@@ -471,33 +482,257 @@ static void init_ogg_stream(ogg_packet* op, ogg_stream_state* os, FILE **fpp)
     op->bytes = 0;
 }
 
+/*
+ * Voice message recorder
+ *
+ * The encoder transport runs on the audio thread, and must not wait
+ * for the file. It copies each Opus packet into a single-producer,
+ * single-consumer ring and returns. A writer thread drains the ring,
+ * muxes the packets into Ogg pages and writes them with large buffered
+ * writes. If the ring is full, the packet is dropped and counted.
+ */
+
+struct vm_slot {
+    uint16_t len;
+    uint8_t data[MAX_PACKET_SIZE_BYTES];
+};
+
+struct vm_recorder {
+    FILE *fp;
+    char *iobuf;
+    pthread_t thread;
+    bool thread_started;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool run;                 /* protected by mutex */
+
+    /* SPSC ring, head is written by the writer, tail by the encoder */
+    struct vm_slot slotv[VM_RING_SIZE];
+    uint32_t head;
+    uint32_t tail;
+
+    /* statistics, read with atomic loads from the re thread */
+    uint32_t n_packets;
+    uint32_t n_dropped;
+    uint32_t max_fill;
+};
+
+/* Let the writer thread finish the file, and wait for it */
+static void recorder_stop(struct vm_recorder *rec)
+{
+    if (!rec->thread_started)
+        return;
+    
+    pthread_mutex_lock(&rec->mutex);
+    rec->run = false;
+    pthread_cond_signal(&rec->cond);
+    pthread_mutex_unlock(&rec->mutex);
+    
+    pthread_join(rec->thread, NULL);
+    rec->thread_started = false;
+}
+
+static void recorder_destructor(void *arg)
+{
+    struct vm_recorder *rec = (struct vm_recorder *)arg;
+    
+    recorder_stop(rec);
+    
+    if (rec->fp) {
+        fclose(rec->fp);
+    }
+    
+    pthread_cond_destroy(&rec->cond);
+    pthread_mutex_destroy(&rec->mutex);
+    mem_deref(rec->iobuf);
+}
+
+/* Encoder thread; never blocks */
+static bool recorder_push(struct vm_recorder *rec,
+                          const uint8_t *pld, size_t len)
+{
+    uint32_t head, tail, fill;
+    
+    if (!len)
+        return false;
+    
+    if (len > MAX_PACKET_SIZE_BYTES) {
+        __atomic_fetch_add(&rec->n_dropped, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    
+    tail = rec->tail;
+    head = __atomic_load_n(&rec->head, __ATOMIC_ACQUIRE);
+    
+    fill = tail - head;
+    if (fill >= VM_RING_SIZE) {
+        __atomic_fetch_add(&rec->n_dropped, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    
+    struct vm_slot *slot = &rec->slotv[tail % VM_RING_SIZE];
+    memcpy(slot->data, pld, len);
+    slot->len = (uint16_t)len;
+    
+    __atomic_store_n(&rec->tail, tail + 1, __ATOMIC_RELEASE);
+    
+    __atomic_fetch_add(&rec->n_packets, 1, __ATOMIC_RELAXED);
+    if (fill + 1 > __atomic_load_n(&rec->max_fill, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&rec->max_fill, fill + 1, __ATOMIC_RELAXED);
+    }
+    
+    return true;
+}
+
+static void write_packet(struct vm_recorder *rec, ogg_stream_state *os,
+                         ogg_packet *op)
+{
+    ogg_page og;
+    
+    op->packetno++;
+    op->granulepos += PACKET_SIZE_MS * 48;
+    ogg_stream_packetin(os, op);
+    
+    /* full pages only, the rest goes with the next batch */
+    while (ogg_stream_pageout(os, &og)) {
+        int ret = oe_write_page(&og, rec->fp);
+        if(ret != og.header_len + og.body_len){
+            info("Ogg failed writing data to output stream\n");
+        }
+    }
+    op->bytes = 0;
+}
+
+/*
+ * Writer thread. The last packet is held back, so that the
+ * end-of-stream flag can be set on it when the recording stops.
+ */
+static void *recorder_thread(void *arg)
+{
+    struct vm_recorder *rec = (struct vm_recorder *)arg;
+    uint8_t held[MAX_PACKET_SIZE_BYTES];
+    ogg_stream_state os;
+    ogg_packet op;
+    ogg_page og;
+    bool run = true;
+    
+    init_ogg_stream(&op, &os, &rec->fp);
+    op.packet = held;
+    
+    while (run) {
+        struct timeval now;
+        struct timespec ts;
+        
+        pthread_mutex_lock(&rec->mutex);
+        if (rec->run) {
+            gettimeofday(&now, NULL);
+            ts.tv_sec = now.tv_sec;
+            ts.tv_nsec = now.tv_usec * 1000 +
+                         VM_WRITE_INTERVAL_MS * 1000000L;
+            ts.tv_sec += ts.tv_nsec / 1000000000L;
+            ts.tv_nsec %= 1000000000L;
+            
+            pthread_cond_timedwait(&rec->cond, &rec->mutex, &ts);
+        }
+        run = rec->run;
+        pthread_mutex_unlock(&rec->mutex);
+        
+        /* on stop, the encoder is already stopped: drain it all */
+        uint32_t head = rec->head;
+        const uint32_t tail = __atomic_load_n(&rec->tail,
+                                              __ATOMIC_ACQUIRE);
+        
+        for (; head != tail; ++head) {
+            const struct vm_slot *slot = &rec->slotv[head % VM_RING_SIZE];
+            
+            if (op.bytes) {
+                write_packet(rec, &os, &op);
+            }
+            memcpy(held, slot->data, slot->len);
+            op.bytes = slot->len;
+            
+            __atomic_store_n(&rec->head, head + 1, __ATOMIC_RELEASE);
+        }
+    }
+    
+    op.b_o_s = 0;
+    op.e_o_s = 1;
+    if (op.bytes) {
+        write_packet(rec, &os, &op);
+    }
+    while (ogg_stream_flush(&os, &og)) {
+        int ret = oe_write_page(&og, rec->fp);
+        if(ret != og.header_len + og.body_len){
+            info("Ogg failed writing data to output stream\n");
+        }
+    }
+    ogg_stream_clear(&os);
+    
+    if (fflush(rec->fp) != 0 || fsync(fileno(rec->fp)) != 0) {
+        error("voe: vm: flushing voice message failed (%m)\n", errno);
+    }
+    
+    return NULL;
+}
+
+/* Takes ownership of fp, also if it fails */
+static int recorder_alloc(struct vm_recorder **recp, FILE *fp)
+{
+    struct vm_recorder *rec;
+    int err;
+    
+    rec = (struct vm_recorder *)mem_zalloc(sizeof(*rec),
+                                           recorder_destructor);
+    if (!rec) {
+        fclose(fp);
+        return ENOMEM;
+    }
+    
+    pthread_mutex_init(&rec->mutex, NULL);
+    pthread_cond_init(&rec->cond, NULL);
+    
+    rec->fp = fp;
+    
+    rec->iobuf = (char *)mem_alloc(VM_IOBUF_SIZE, NULL);
+    if (!rec->iobuf) {
+        err = ENOMEM;
+        goto out;
+    }
+    
+    setvbuf(fp, rec->iobuf, _IOFBF, VM_IOBUF_SIZE);
+    
+    rec->run = true;
+    err = pthread_create(&rec->thread, NULL, recorder_thread, rec);
+    if (err) {
+        goto out;
+    }
+    rec->thread_started = true;
+    
+ out:
+    if (err)
+        mem_deref(rec);
+    else
+        *recp = rec;
+    
+    return err;
+}
+
 class VmTransport : public webrtc::Transport {
 public:
-    VmTransport(FILE **fpp, pthread_mutex_t* mutex){
-        _fpp = fpp;
-        _mutex = mutex;
-        
-        if(!fpp || !mutex)
-        return;
-     
-        init_ogg_stream(&_op, &_os, fpp);
+    VmTransport(struct vm_recorder *rec){
+        _rec = rec;
     };
     
     virtual ~VmTransport() {
     };
     
     virtual bool SendRtp(const uint8_t* packet, size_t length, const webrtc::PacketOptions& options) {
-        //printf("SendPacket channel = %d len = %zu \n", channel, len);
         
-        /* First write previous payload to file */
-        write_to_opus_file();
+        if(!_rec || length <= RTP_HEADER_IN_BYTES)
+            return true;
         
-        /* Then copy new payload. By not yet writing to file we can set the end-of-stream bit for the last packet */
-        uint32_t len32 = length - RTP_HEADER_IN_BYTES; // use a type of known length
-        if(len32 > 0 && len32 < sizeof(payload)) {
-            memcpy(payload, packet + RTP_HEADER_IN_BYTES, len32);
-            _op.bytes = len32;
-        }
+        recorder_push(_rec, packet + RTP_HEADER_IN_BYTES,
+                      length - RTP_HEADER_IN_BYTES);
         
         return true;
     };
@@ -506,54 +741,60 @@ public:
         return true;
     };
     
-    void deregister()
-    {
-        _op.b_o_s=0;
-        /* Set end-of-stream flag */
-        _op.e_o_s=1;
-        write_to_opus_file();
-        ogg_stream_clear(&_os);
-    }
-    
 private:
-    void write_to_opus_file() {
-        if(!_fpp || !_mutex)
+    struct vm_recorder *_rec;
+};
+
+static void record_status(bool is_recording)
+{
+    struct vm_recorder *rec = gvoe.vm.rec;
+    uint32_t n_packets, n_dropped, fill;
+    
+    if (!rec || !gvoe.vm.record_statush)
         return;
-        
-        pthread_mutex_lock(_mutex); // use mutex here to make sure we dont close the file in another thread while writing
-        if(*_fpp && _op.bytes){
-            _op.packet = payload;
-            _op.packetno++;
-            _op.granulepos += PACKET_SIZE_MS * 48;
-            ogg_stream_packetin(&_os, &_op);
-            ogg_page og;
-            ogg_stream_flush_fill(&_os, &og, 255*255);
-            int ret=oe_write_page(&og, *_fpp);
-            if(ret!=og.header_len+og.body_len){
-                info("Ogg failed writing data to output stream\n");
-            }
-            _op.bytes = 0;
-        }
-        pthread_mutex_unlock(_mutex);
-    }
     
-    FILE** _fpp;
-    // Add mutex pointer for mutex to protect _fpp
-    pthread_mutex_t* _mutex;
-    struct timeval _startTime;
-    uint8_t payload[MAX_PACKET_SIZE_BYTES];
-    ogg_packet _op;
-    ogg_stream_state _os;
-};
+    n_packets = __atomic_load_n(&rec->n_packets, __ATOMIC_RELAXED);
+    n_dropped = __atomic_load_n(&rec->n_dropped, __ATOMIC_RELAXED);
+    fill = __atomic_load_n(&rec->tail, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&rec->head, __ATOMIC_ACQUIRE);
+    
+    gvoe.vm.record_statush(is_recording,
+                           n_packets * PACKET_SIZE_MS,
+                           fill * PACKET_SIZE_MS,
+                           n_dropped,
+                           gvoe.vm.record_statush_arg);
+}
+
+static void tmr_vm_record_handler(void *arg)
+{
+    (void)arg;
+    
+    record_status(true);
+    
+    tmr_start(&gvoe.vm.tmr_vm_record, VM_STATUS_INTERVAL_MS,
+              tmr_vm_record_handler, NULL);
+}
 
 void voe_vm_init(struct vm_state *vm)
 {
     vm->ch = -1;
     vm->transport = NULL;
     vm->fp = NULL;
-    pthread_mutex_init(&vm->mutex,NULL);
+    vm->rec = NULL;
+    vm->player = NULL;
+    tmr_init(&vm->tmr_vm_record);
     vm->play_statush = NULL;
     vm->play_statush_arg = NULL;
+    vm->record_statush = NULL;
+    vm->record_statush_arg = NULL;
+}
+
+int voe_vm_set_record_status_handler(vm_record_status_h *handler, void *arg)
+{
+    gvoe.vm.record_statush = handler;
+    gvoe.vm.record_statush_arg = arg;
+    
+    return 0;
 }
 
 int voe_vm_start_record(const char fileNameUTF8[1024])
@@ -564,7 +805,7 @@ int voe_vm_start_record(const char fileNameUTF8[1024])
         error("voe_vm_start_record: cannot start when in a call \n");
         return -1;
     }
-    if(gvoe.vm.fp){
+    if(gvoe.vm.fp || gvoe.vm.player){
         error("voe_vm_start_record: A file is allready open this is not supposed to happen \n");
         return -1;
     }
@@ -574,6 +815,14 @@ int voe_vm_start_record(const char fileNameUTF8[1024])
         return -1;
     }
     
+    /* the recorder owns the file from now on, it is closed on error */
+    err = recorder_alloc(&gvoe.vm.rec, gvoe.vm.fp);
+    if (err) {
+        error("voe_vm_start_record: recorder failed (%m)\n", err);
+        gvoe.vm.fp = NULL;
+        return err;
+    }
+    
     gvoe.base->Init();
     
     gvoe.vm.ch = gvoe.base->CreateChannel();
@@ -581,9 +830,7 @@ int voe_vm_start_record(const char fileNameUTF8[1024])
         err = ENOMEM;
     }
     
-    pthread_mutex_init(&gvoe.vm.mutex,NULL); // mutex to make sure we dont close the file while the callback is writing to it
-    
-    gvoe.vm.transport = new VmTransport(&gvoe.vm.fp, &gvoe.vm.mutex);
+    gvoe.vm.transport = new VmTransport(gvoe.vm.rec);
     gvoe.nw->RegisterExternalTransport(gvoe.vm.ch, *gvoe.vm.transport);
     
     webrtc::CodecInst c;
@@ -616,6 +863,9 @@ int voe_vm_start_record(const char fileNameUTF8[1024])
     
     gvoe.base->StartSend(gvoe.vm.ch);
     
+    tmr_start(&gvoe.vm.tmr_vm_record, VM_STATUS_INTERVAL_MS,
+              tmr_vm_record_handler, NULL);
+    
     debug("voe_vm_start_record \n");
     
     return err ? ENOSYS : 0;
@@ -634,12 +884,26 @@ int voe_vm_stop_record()
     gvoe.nw->DeRegisterExternalTransport(gvoe.vm.ch);
     gvoe.base->DeleteChannel(gvoe.vm.ch);
     gvoe.base->Terminate();
-    gvoe.vm.transport->deregister();
     
-    pthread_mutex_lock(&gvoe.vm.mutex);
-    fclose(gvoe.vm.fp);
+    delete gvoe.vm.transport;
+    gvoe.vm.transport = NULL;
+    
+    tmr_cancel(&gvoe.vm.tmr_vm_record);
+    
+    /* the writer thread writes the rest and syncs the file */
+    if (gvoe.vm.rec) {
+        recorder_stop(gvoe.vm.rec);
+        
+        info("voe_vm_stop_record: %u packets, %u dropped,"
+             " max %u queued\n",
+             gvoe.vm.rec->n_packets, gvoe.vm.rec->n_dropped,
+             gvoe.vm.rec->max_fill);
+        
+        record_status(false);
+    }
+    
+    gvoe.vm.rec = (struct vm_recorder *)mem_deref(gvoe.vm.rec);
     gvoe.vm.fp = NULL;
-    pthread_mutex_unlock(&gvoe.vm.mutex);
     
     debug("voe_vm_stop_record \n");
     
@@ -747,85 +1011,447 @@ int voe_me_init_stream(struct vm_state *vm, uint64_t target_pos) {
     return 0;
 }
 
+/*
+ * Voice message player
+ *
+ * The file is mapped into memory, and the Ogg pages are parsed once
+ * when playback starts, into an index of the Opus packets with their
+ * sample positions. The timer handler only copies the next packet from
+ * the mapping, so starting and seeking do not wait for file reads.
+ * The pages ahead of the play position are prefetched with madvise().
+ * If the file grows, the index goes on from the last complete page.
+ */
+
+struct vm_packet {
+    size_t off;             /* in the mapping, or in the spill buffer */
+    size_t moff;            /* of the first segment, in the mapping */
+    uint16_t len;
+    bool spill;             /* the packet spans Ogg pages */
+    uint32_t samplepos;     /* at the start of the packet */
+};
+
+struct vm_player {
+    int fd;
+    uint8_t *map;
+    size_t size;
+    struct vm_packet *pktv;
+    size_t pktc;
+    size_t pktsz;
+    struct mbuf *spill;     /* packets that span pages, copied */
+    uint32_t samplestot;
+    uint32_t frame_samples; /* if all packets have the same length */
+    bool eos;               /* the last packet ends the stream */
+    size_t ix;              /* next packet to play */
+    size_t prefetch_ix;     /* prefetched up to this packet */
+    
+    /* where the index goes on when the file grows */
+    size_t index_pos;       /* after the last complete page */
+    size_t npkt;            /* Ogg packets, with the two headers */
+    struct mbuf *acc;       /* packet that goes on in the next page */
+    size_t acc_moff;        /* of its first segment */
+};
+
+static void player_unmap(struct vm_player *pl)
+{
+    if (pl->map) {
+        munmap(pl->map, pl->size);
+        pl->map = NULL;
+    }
+    pl->size = 0;
+}
+
+static void player_reset(struct vm_player *pl)
+{
+    pl->pktc = 0;
+    pl->samplestot = 0;
+    pl->frame_samples = 0;
+    pl->eos = false;
+    pl->spill = (struct mbuf *)mem_deref(pl->spill);
+    pl->index_pos = 0;
+    pl->npkt = 0;
+    pl->acc = (struct mbuf *)mem_deref(pl->acc);
+    pl->acc_moff = 0;
+}
+
+static void player_destructor(void *arg)
+{
+    struct vm_player *pl = (struct vm_player *)arg;
+    
+    player_unmap(pl);
+    player_reset(pl);
+    mem_deref(pl->pktv);
+    if (pl->fd >= 0) {
+        close(pl->fd);
+    }
+}
+
+static const uint8_t *packet_data(const struct vm_player *pl,
+                                  const struct vm_packet *pkt)
+{
+    return pkt->spill ? pl->spill->buf + pkt->off : pl->map + pkt->off;
+}
+
+/* A complete packet; the first two are the Opus header and tags */
+static int player_add_packet(struct vm_player *pl, size_t npkt,
+                             const uint8_t *data, size_t off, size_t moff,
+                             size_t len, bool spill)
+{
+    struct vm_packet *pkt;
+    int samples;
+    
+    if (npkt == 0) {
+        OpusHeader header;
+        
+        if (opus_header_parse(data, (int)len, &header) == 0) {
+            info("Invalid Ogg/Opus header\n");
+            return EPROTO;
+        }
+        return 0;
+    }
+    if (npkt == 1)
+        return 0;
+    
+    if (!len || len > MAX_PACKET_SIZE_BYTES - RTP_HEADER_IN_BYTES)
+        return 0;
+    
+    samples = packet_get_samples_per_frame(data, 48000) *
+              packet_get_nb_frames(data, (ogg_int32_t)len);
+    if (samples <= 0)
+        return 0;
+    
+    if (pl->pktc == pl->pktsz) {
+        size_t sz = pl->pktsz ? pl->pktsz * 2 : 256;
+        struct vm_packet *pktv;
+        
+        pktv = (struct vm_packet *)mem_reallocarray(pl->pktv, sz,
+                                                    sizeof(*pktv), NULL);
+        if (!pktv)
+            return ENOMEM;
+        
+        pl->pktv = pktv;
+        pl->pktsz = sz;
+    }
+    
+    pkt = &pl->pktv[pl->pktc++];
+    pkt->off = off;
+    pkt->moff = moff;
+    pkt->len = (uint16_t)len;
+    pkt->spill = spill;
+    pkt->samplepos = pl->samplestot;
+    
+    if (pl->pktc == 1)
+        pl->frame_samples = samples;
+    else if (pl->frame_samples != (uint32_t)samples)
+        pl->frame_samples = 0;
+    
+    pl->samplestot += samples;
+    
+    return 0;
+}
+
+/*
+ * Parse the Ogg pages of the mapping, from the end of the last complete
+ * page. A truncated last page, e.g. of a file that is still being
+ * written, ends the index until the file grows.
+ */
+static int player_index(struct vm_player *pl)
+{
+    size_t pos = pl->index_pos;
+    size_t pstart = 0, plen = 0;
+    int err = 0;
+    
+    while (pos + 27 <= pl->size && !pl->eos) {
+        const uint8_t *p = pl->map + pos;
+        size_t nsegs, hlen, blen = 0, off, i;
+        
+        if (memcmp(p, "OggS", 4) != 0) {
+            const uint8_t *q;
+            
+            q = (const uint8_t *)memmem(p + 1, pl->size - pos - 1,
+                                        "OggS", 4);
+            if (!q)
+                break;
+            pos = q - pl->map;
+            pl->index_pos = pos;
+            continue;
+        }
+        
+        nsegs = p[26];
+        hlen = 27 + nsegs;
+        if (pos + hlen > pl->size)
+            break;
+        
+        for (i = 0; i < nsegs; i++)
+            blen += p[27 + i];
+        if (pos + hlen + blen > pl->size)
+            break;
+        
+        /* not a continued page, drop an unfinished packet */
+        if (!(p[5] & 0x01) && pl->acc)
+            pl->acc->end = pl->acc->pos = 0;
+        
+        off = pos + hlen;
+        for (i = 0; i < nsegs; i++) {
+            const size_t lace = p[27 + i];
+            
+            if (!plen)
+                pstart = off;
+            plen += lace;
+            off += lace;
+            
+            if (lace == 255)
+                continue;
+            
+            if (pl->acc && pl->acc->end) {
+                struct mbuf *acc = pl->acc;
+                
+                err = mbuf_write_mem(acc, pl->map + pstart, plen);
+                if (err)
+                    goto out;
+                
+                if (!pl->spill) {
+                    pl->spill = mbuf_alloc(acc->end);
+                    if (!pl->spill) {
+                        err = ENOMEM;
+                        goto out;
+                    }
+                }
+                
+                const size_t soff = pl->spill->end;
+                
+                pl->spill->pos = soff;
+                err = mbuf_write_mem(pl->spill, acc->buf, acc->end);
+                if (err)
+                    goto out;
+                
+                err = player_add_packet(pl, pl->npkt++,
+                                        pl->spill->buf + soff,
+                                        soff, pl->acc_moff, acc->end,
+                                        true);
+                acc->end = acc->pos = 0;
+            }
+            else {
+                err = player_add_packet(pl, pl->npkt++,
+                                        pl->map + pstart,
+                                        pstart, pstart, plen, false);
+            }
+            if (err)
+                goto out;
+            
+            plen = 0;
+        }
+        
+        /* the packet goes on in the next page */
+        if (plen) {
+            if (!pl->acc) {
+                pl->acc = mbuf_alloc(plen * 2);
+                if (!pl->acc) {
+                    err = ENOMEM;
+                    goto out;
+                }
+            }
+            if (!pl->acc->end)
+                pl->acc_moff = pstart;
+            err = mbuf_write_mem(pl->acc, pl->map + pstart, plen);
+            if (err)
+                goto out;
+            plen = 0;
+        }
+        
+        if (p[5] & 0x04)
+            pl->eos = true;
+        
+        pos += hlen + blen;
+        pl->index_pos = pos;
+    }
+    
+    if (pl->npkt < 2)
+        err = EPROTO;
+    
+ out:
+    return err;
+}
+
+/* Map the file, again if it grew, and index the new pages */
+static int player_load(struct vm_player *pl)
+{
+    struct stat st;
+    void *map;
+    int err;
+    
+    if (fstat(pl->fd, &st) != 0)
+        return errno;
+    
+    if (st.st_size < 27)
+        return EPROTO;
+    
+    if (pl->map && (size_t)st.st_size == pl->size)
+        return 0;
+    
+    /* not the file that was indexed */
+    if ((size_t)st.st_size < pl->size)
+        player_reset(pl);
+    
+    player_unmap(pl);
+    
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+               pl->fd, 0);
+    if (map == MAP_FAILED)
+        return errno;
+    
+    pl->map = (uint8_t *)map;
+    pl->size = (size_t)st.st_size;
+    
+    (void)madvise(pl->map, pl->size, MADV_SEQUENTIAL);
+    
+    err = player_index(pl);
+    if (err) {
+        player_unmap(pl);
+        player_reset(pl);
+    }
+    
+    return err;
+}
+
+static int player_alloc(struct vm_player **plp, const char *path)
+{
+    struct vm_player *pl;
+    int err;
+    
+    pl = (struct vm_player *)mem_zalloc(sizeof(*pl), player_destructor);
+    if (!pl)
+        return ENOMEM;
+    
+    pl->fd = open(path, O_RDONLY);
+    if (pl->fd < 0) {
+        err = errno;
+        goto out;
+    }
+    
+    err = player_load(pl);
+    
+ out:
+    if (err)
+        mem_deref(pl);
+    else
+        *plp = pl;
+    
+    return err;
+}
+
+/* Ask the kernel to read the pages of the next packets */
+static void player_prefetch(struct vm_player *pl)
+{
+    const long pagesz = sysconf(_SC_PAGESIZE);
+    size_t end, first, last;
+    
+    if (pl->ix < pl->prefetch_ix || pl->ix >= pl->pktc)
+        return;
+    
+    end = pl->ix + VM_PREFETCH_PACKETS;
+    if (end > pl->pktc)
+        end = pl->pktc;
+    
+    /* up to the first segment of the packet after the last one */
+    first = pl->pktv[pl->ix].moff;
+    last = end < pl->pktc ? pl->pktv[end].moff : pl->size;
+    if (last <= first)
+        last = pl->size;
+    
+    first -= first % pagesz;
+    (void)madvise(pl->map + first, last - first, MADV_WILLNEED);
+    
+    pl->prefetch_ix = pl->ix + VM_PREFETCH_PACKETS / 2;
+}
+
+/* Index of the packet that plays at a sample position */
+static size_t player_seek(struct vm_player *pl, uint32_t samplepos)
+{
+    size_t lo = 0, hi;
+    
+    if (samplepos >= pl->samplestot)
+        return pl->pktc;
+    
+    if (pl->frame_samples)
+        return samplepos / pl->frame_samples;
+    
+    hi = pl->pktc;
+    while (hi - lo > 1) {
+        const size_t mid = lo + (hi - lo) / 2;
+        
+        if (pl->pktv[mid].samplepos <= samplepos)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    
+    return lo;
+}
+
+static void player_set_pos(struct vm_player *pl, size_t ix)
+{
+    pl->ix = ix;
+    pl->prefetch_ix = ix;
+    gvoe.vm.samplepos = ix < pl->pktc ? pl->pktv[ix].samplepos
+                                      : pl->samplestot;
+    player_prefetch(pl);
+}
+
 void tmr_vm_player_handler(void *arg)
 {
     uint8_t RTPpacketBuf[MAX_PACKET_SIZE_BYTES];
+    struct vm_player *pl = gvoe.vm.player;
     
     if (gvoe.vm.finished) {
         voe_vm_stop_play();
         return;
     }
     
-    FILE *fp = gvoe.vm.fp;
-    if(!fp){
-        info("File pointer is null: stop tmr_vm_player_handler \n");
+    if(!pl){
+        info("Player is null: stop tmr_vm_player_handler \n");
         return;
     }
     
     if(gvoe.vm.start_time_ms >= 0) {
-        /* Rewind to start of file, and scan through Ogg stream until the desired start time */
-        if (voe_me_init_stream(&gvoe.vm, gvoe.vm.start_time_ms * 48)){
-            voe_vm_stop_play();
-            return;
-        }
+        /* Find the packet at the desired start time */
+        player_set_pos(pl, player_seek(pl, gvoe.vm.start_time_ms * 48));
         gvoe.vm.start_time_ms = -1;
     }
     
-    /* Extract payload from Ogg stream */
-    int nSamples = 0;
-    ogg_packet op;
-    int nb_read = 1;
-    while (nb_read > 0) {
-        /* Extract all available packets */
-        if (ogg_stream_packetout(&gvoe.vm.os, &op) == 1)
-        {
-            /* Add an RTP header before pushing to NetEQ */
-            nSamples = packet_get_samples_per_frame(op.packet, 48000) * packet_get_nb_frames(op.packet, op.bytes);
-            //printf("playing %d samples; granule position: %d\n", nSamples, (int)op.granulepos);
-            gvoe.vm.seqNum++;
-            gvoe.vm.timeStamp += nSamples;
-            MakeRTPheader(RTPpacketBuf,
-                          gvoe.vm.c.pltype,
-                          gvoe.vm.seqNum,
-                          gvoe.vm.timeStamp,
-                          gvoe.vm.ssrc);
-            
-            memcpy(&RTPpacketBuf[RTP_HEADER_IN_BYTES], op.packet, op.bytes * sizeof(uint8_t));
-            gvoe.nw->ReceivedRTPPacket(gvoe.vm.ch, (const void*)RTPpacketBuf, op.bytes + RTP_HEADER_IN_BYTES);
-            gvoe.vm.samplepos += nSamples;
-            break;
-        }
+    /* The file may still be written, look for more */
+    if (pl->ix >= pl->pktc && !pl->eos) {
+        const size_t ix = pl->ix;
         
-        /* Loop for all complete pages we got (most likely only one) */
-        if(ogg_sync_pageout(&gvoe.vm.oy, &gvoe.vm.og)==1)
-        {
-            /* Add page to the bitstream */
-            ogg_stream_pagein(&gvoe.vm.os, &gvoe.vm.og);
-        } else {
-            /* Read more data */
-            char *data;
-            /* Get the ogg buffer for writing */
-            data = ogg_sync_buffer(&gvoe.vm.oy, 1000);
-            /* Read bitstream from input file */
-            nb_read = fread(data, sizeof(char), 1000, fp);
-            ogg_sync_wrote(&gvoe.vm.oy, nb_read);
-        }
-    }
-    
-    /* Update file length and current position */
-    if (gvoe.vm.samplepos >= gvoe.vm.samplestot && op.e_o_s == 0 && nb_read > 0) {
-        /* Rescan file */
-        uint64_t pos = gvoe.vm.samplepos;
-        if(voe_me_init_stream(&gvoe.vm, UINT32_MAX)){
+        if (player_load(pl)) {
             voe_vm_stop_play();
             return;
         }
-        gvoe.vm.file_length_ms = (int)((gvoe.vm.samplestot + 24) / 48);
+        gvoe.vm.file_length_ms = (pl->samplestot + 24) / 48;
         info("new voice message length: %d ms\n", gvoe.vm.file_length_ms);
-        if(voe_me_init_stream(&gvoe.vm, pos)){
-            voe_vm_stop_play();
-            return;
-        }
+        player_set_pos(pl, ix);
+    }
+    
+    int nSamples = 0;
+    if (pl->ix < pl->pktc) {
+        const struct vm_packet *pkt = &pl->pktv[pl->ix];
+        const uint8_t *data = packet_data(pl, pkt);
+        
+        /* Add an RTP header before pushing to NetEQ */
+        nSamples = packet_get_samples_per_frame(data, 48000) * packet_get_nb_frames(data, pkt->len);
+        gvoe.vm.seqNum++;
+        gvoe.vm.timeStamp += nSamples;
+        MakeRTPheader(RTPpacketBuf,
+                      gvoe.vm.c.pltype,
+                      gvoe.vm.seqNum,
+                      gvoe.vm.timeStamp,
+                      gvoe.vm.ssrc);
+        
+        memcpy(&RTPpacketBuf[RTP_HEADER_IN_BYTES], data, pkt->len);
+        gvoe.nw->ReceivedRTPPacket(gvoe.vm.ch, (const void*)RTPpacketBuf, pkt->len + RTP_HEADER_IN_BYTES);
+        gvoe.vm.samplepos += nSamples;
+        
+        ++pl->ix;
+        player_prefetch(pl);
     }
     
     // Callback with curent playout position
@@ -833,8 +1459,8 @@ void tmr_vm_player_handler(void *arg)
         gvoe.vm.play_statush( true, (unsigned int)(gvoe.vm.samplepos / 48), gvoe.vm.file_length_ms, gvoe.vm.play_statush_arg);
     }
     
-    if (op.e_o_s || nb_read == 0) {
-        info("End of voice message: end of %s \n", op.e_o_s ? "stream" : "file");
+    if (pl->ix >= pl->pktc) {
+        info("End of voice message: end of %s \n", pl->eos ? "stream" : "file");
         gvoe.vm.finished = 1;
         /* Sleep for 250 ms before calling stop_play(), to empty buffers */
         nSamples = 48 * 250;
@@ -858,25 +1484,22 @@ void tmr_vm_player_handler(void *arg)
 int voe_vm_get_length(const char fileNameUTF8[1024],
                       int* length_ms)
 {
-    int err = 0;
-    struct vm_state vm;
-    memset(&vm, 0, sizeof(struct vm_state));
+    struct vm_player *pl = NULL;
+    int err;
     
-    vm.fp = fopen(fileNameUTF8,"rb");
-    if (vm.fp == NULL) {
-        error("voe_vm_start_play: Could not open file: %s\n", fileNameUTF8);
-        return -1;
-    }
-    /* Measure length of Ogg file */
-    vm.samplestot = 0;
-    if(voe_me_init_stream(&vm, UINT32_MAX)) {
+    err = player_alloc(&pl, fileNameUTF8);
+    if (err) {
+        error("voe_vm_get_length: Could not load file: %s (%m)\n",
+              fileNameUTF8, err);
         *length_ms = 0;
-        err = 1;
-    } else {
-        *length_ms = vm.samplestot / 48;
+        return 1;
     }
-    fclose(vm.fp);
-    return err;
+    
+    *length_ms = pl->samplestot / 48;
+    
+    mem_deref(pl);
+    
+    return 0;
 }
 
 int voe_vm_start_play(const char fileNameUTF8[1024],
@@ -884,7 +1507,13 @@ int voe_vm_start_play(const char fileNameUTF8[1024],
                       vm_play_status_h *handler,
                       void *arg)
 {
-    if (gvoe.nch > 0 && gvoe.vm.fp == NULL) {
+    int err;
+    
+    if (gvoe.vm.rec) {
+        error("voe_vm_start_play: cannot start when recording \n");
+        return -1;
+    }
+    if (gvoe.nch > 0 && gvoe.vm.player == NULL) {
         error("voe_vm_start_play: cannot start when in a call \n");
         return -1;
     }
@@ -893,14 +1522,16 @@ int voe_vm_start_play(const char fileNameUTF8[1024],
     
     gvoe.vm.start_time_ms = start_time_ms;
     
-    if(gvoe.vm.fp != NULL){
+    if(gvoe.vm.player != NULL){
         /* Already playing a voice message; all we had to do is set the new start time */
         return 0;
     }
     
-    gvoe.vm.fp = fopen(fileNameUTF8,"rb");
-    if (gvoe.vm.fp == NULL) {
-        error("voe_vm_start_play: Could not open file: %s\n", fileNameUTF8);
+    /* Map and index the file before the channel is created */
+    err = player_alloc(&gvoe.vm.player, fileNameUTF8);
+    if (err) {
+        error("voe_vm_start_play: Could not load file: %s (%m)\n",
+              fileNameUTF8, err);
         return -1;
     }
     
@@ -911,6 +1542,7 @@ int voe_vm_start_play(const char fileNameUTF8[1024],
     
     gvoe.vm.ch = gvoe.base->CreateChannel();
     if (gvoe.vm.ch == -1) {
+        gvoe.vm.player = (struct vm_player *)mem_deref(gvoe.vm.player);
         return ENOMEM;
     }
     
@@ -925,7 +1557,7 @@ int voe_vm_start_play(const char fileNameUTF8[1024],
     }
     
     gvoe.codec->SetRecPayloadType(gvoe.vm.ch, gvoe.vm.c);
-    gvoe.vm.transport = new VmTransport(NULL,NULL);
+    gvoe.vm.transport = new VmTransport(NULL);
     gvoe.nw->RegisterExternalTransport(gvoe.vm.ch, *gvoe.vm.transport);
     
     gvoe.base->StartReceive(gvoe.vm.ch);
@@ -935,13 +1567,8 @@ int voe_vm_start_play(const char fileNameUTF8[1024],
     gvoe.vm.timeStamp = 0;
     gvoe.vm.ssrc = 2345;
     
-    /* Measure length of Ogg file */
-    gvoe.vm.samplestot = 0;
-    if(voe_me_init_stream(&gvoe.vm, UINT32_MAX)) {
-        voe_vm_stop_play();
-        return -1;
-    }
-    gvoe.vm.file_length_ms = gvoe.vm.samplestot / 48;
+    player_set_pos(gvoe.vm.player, 0);
+    gvoe.vm.file_length_ms = gvoe.vm.player->samplestot / 48;
     info("Length of voice message: %d milliseconds\n", gvoe.vm.file_length_ms);
     
     gvoe.vm.finished = 0;
@@ -955,7 +1582,7 @@ int voe_vm_stop_play()
 {
     int err = 0;
     
-    if(!gvoe.vm.fp){
+    if(!gvoe.vm.player){
         debug("voe_vm_stop_play(): allready stopped !! \n");
         return 0;
     }
@@ -968,13 +1595,7 @@ int voe_vm_stop_play()
     gvoe.base->DeleteChannel(gvoe.vm.ch);
     gvoe.base->Terminate();
     
-    fclose(gvoe.vm.fp);
-    gvoe.vm.fp = NULL;
-    
-    if(gvoe.vm.stream_init) {
-        ogg_stream_clear(&gvoe.vm.os);
-    }
-    ogg_sync_clear(&gvoe.vm.oy);
+    gvoe.vm.player = (struct vm_player *)mem_deref(gvoe.vm.player);
     
     // Fire callback telling that we stopped playing
     if(gvoe.vm.play_statush){
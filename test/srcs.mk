@@ -36,8 +36,10 @@ TEST_SRCS	+= test_resampler.cpp
 TEST_SRCS	+= test_rest.cpp
 TEST_SRCS	+= test_self.cpp
 TEST_SRCS	+= test_srtp.cpp
+TEST_SRCS	+= test_srtp_perf.cpp
 TEST_SRCS	+= test_string.cpp
 TEST_SRCS	+= test_turn.cpp
+TEST_SRCS	+= test_udpmux.cpp
 TEST_SRCS	+= test_uuid.cpp
 TEST_SRCS	+= test_vidcodec.cpp
 TEST_SRCS	+= test_voe.cpp
@@ -19,6 +19,9 @@
 #include <avs.h>
 #include <gtest/gtest.h>
 #include <string.h>
+#include <pthread.h>
+#include <algorithm>
+#include <chrono>
 #include "fakes.hpp"
 #include "ztest.h"
 
@@ -455,3 +458,168 @@ TEST_F(FlowmgrTest, call_config)
 		     srvv[0].username);
 	ASSERT_STREQ("stun:54.155.57.143:3478", srvv[1].url);
 }
+
+
+static struct tmr pool_tmr;
+
+
+static void pool_poll_handler(void *arg)
+{
+	struct flowmgr *fm = (struct flowmgr *)arg;
+	struct flowmgr_pool_stats stats;
+
+	if (0 == flowmgr_pool_stats_get(fm, &stats) &&
+	    stats.ready >= stats.size) {
+		re_cancel();
+		return;
+	}
+
+	tmr_start(&pool_tmr, 10, pool_poll_handler, fm);
+}
+
+
+TEST_F(FlowmgrTest, mediaflow_pool)
+{
+	struct flowmgr_pool_stats stats;
+
+	err = flowmgr_set_pool_size(fm, 2);
+	ASSERT_EQ(0, err);
+
+	/* the pool is filled in the background */
+	pool_poll_handler(fm);
+	err = re_main_wait(5000);
+	ASSERT_EQ(0, err);
+
+	err = flowmgr_pool_stats_get(fm, &stats);
+	ASSERT_EQ(0, err);
+	ASSERT_EQ(2, stats.size);
+	ASSERT_EQ(2, stats.ready);
+	ASSERT_EQ(0, stats.n_hit);
+
+	/* a new call takes a gathered mediaflow */
+	err = flowmgr_user_add(fm, convid, "1", "A");
+	ASSERT_EQ(0, err);
+
+	err = flowmgr_acquire_flows(fm, convid, NULL, NULL, NULL);
+	ASSERT_EQ(0, err);
+
+	err = flowmgr_pool_stats_get(fm, &stats);
+	ASSERT_EQ(0, err);
+	ASSERT_EQ(1, stats.n_hit);
+	ASSERT_EQ(0, stats.n_miss);
+	ASSERT_EQ(1, stats.ready);
+
+	flowmgr_release_flows(fm, convid);
+
+	/* and is refilled */
+	pool_poll_handler(fm);
+	err = re_main_wait(5000);
+	ASSERT_EQ(0, err);
+
+	err = flowmgr_set_pool_size(fm, 0);
+	ASSERT_EQ(0, err);
+
+	err = flowmgr_pool_stats_get(fm, &stats);
+	ASSERT_EQ(0, err);
+	ASSERT_EQ(0, stats.size);
+	ASSERT_EQ(0, stats.ready);
+}
+
+
+#define MARSHAL_CALLS 10000
+
+
+struct marshal_bench {
+	struct flowmgr *fm;
+	std::vector<uint64_t> latv;  /* microseconds */
+	uint64_t dur_us;
+	unsigned n_done;
+	int err;
+};
+
+
+static void marshal_done_handler(int err, void *arg)
+{
+	struct marshal_bench *mb = (struct marshal_bench *)arg;
+
+	++mb->n_done;
+	mb->err = err;
+
+	re_cancel();
+}
+
+
+static void *marshal_thread(void *arg)
+{
+	struct marshal_bench *mb = (struct marshal_bench *)arg;
+	std::chrono::steady_clock::time_point t0, t1, t2;
+
+	t0 = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < MARSHAL_CALLS; i++) {
+
+		t1 = std::chrono::steady_clock::now();
+
+		marshal_flowmgr_enable_metrics(mb->fm, false);
+
+		t2 = std::chrono::steady_clock::now();
+
+		mb->latv.push_back(std::chrono::duration_cast
+				   <std::chrono::microseconds>(t2 - t1)
+				   .count());
+	}
+
+	mb->dur_us = std::chrono::duration_cast<std::chrono::microseconds>
+		(std::chrono::steady_clock::now() - t0).count();
+
+	/* fire-and-forget, then stop the re thread from the last call */
+	marshal_flowmgr_set_active_async(mb->fm, "convid", false,
+					 NULL, NULL);
+	mb->err = marshal_flowmgr_enable_metrics_async(mb->fm, false,
+						       marshal_done_handler,
+						       mb);
+	if (mb->err)
+		re_cancel();
+
+	return NULL;
+}
+
+
+TEST_F(FlowmgrTest, marshal_performance)
+{
+	struct marshal_bench mb;
+	pthread_t tid;
+
+	mb.fm = fm;
+	mb.dur_us = 0;
+	mb.n_done = 0;
+	mb.err = 0;
+	mb.latv.reserve(MARSHAL_CALLS);
+
+	err = pthread_create(&tid, NULL, marshal_thread, &mb);
+	ASSERT_EQ(0, err);
+
+	err = re_main(NULL);
+	ASSERT_EQ(0, err);
+
+	pthread_join(tid, NULL);
+
+	ASSERT_EQ(0, mb.err);
+	ASSERT_EQ(1, mb.n_done);
+	ASSERT_EQ(MARSHAL_CALLS, mb.latv.size());
+
+	std::sort(mb.latv.begin(), mb.latv.end());
+
+	uint64_t p50 = mb.latv[mb.latv.size() / 2];
+	uint64_t p99 = mb.latv[mb.latv.size() * 99 / 100];
+	uint64_t cps = (uint64_t)MARSHAL_CALLS * 1000000 / (mb.dur_us + 1);
+
+	re_printf("~~~ marshal performance ~~~\n");
+	re_printf("calls:          %d\n", MARSHAL_CALLS);
+	re_printf("calls/sec:      %llu\n", cps);
+	re_printf("latency p50:    %llu us\n", p50);
+	re_printf("latency p99:    %llu us\n", p99);
+
+	/* the old polling loop slept 40ms per call */
+	ASSERT_LT(p99, 40000);
+}
@@ -15,6 +15,8 @@
 * You should have received a copy of the GNU General Public License
 * along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
+#include <pthread.h>
+#include <sched.h>
 #include "gtest/gtest.h"
 #include <re.h>
 
@@ -68,3 +70,968 @@ TEST(libre, verify_dtls_support)
 	ASSERT_TRUE(tls != NULL);
 	mem_deref(tls);
 }
+
+
+static unsigned mem_test_ndestr;
+
+
+static void mem_test_destructor(void *arg)
+{
+	(void)arg;
+
+	++mem_test_ndestr;
+}
+
+
+/*
+ * Grow and shrink an object across size classes, into and out of the
+ * sizes served by malloc, and check that contents and destructor survive.
+ */
+TEST(libre, mem_realloc)
+{
+	static const size_t sizev[] = {
+		8, 24, 100, 1000, 5000, 20000, 3000, 16, 40000, 8
+	};
+	uint8_t *p, *p2;
+	size_t i, j, prev = 0;
+
+	mem_test_ndestr = 0;
+
+	p = (uint8_t *)mem_alloc(1, mem_test_destructor);
+	ASSERT_TRUE(p != NULL);
+
+	for (i = 0; i < sizeof(sizev)/sizeof(sizev[0]); i++) {
+
+		const size_t n = sizev[i];
+
+		p2 = (uint8_t *)mem_realloc(p, n);
+		ASSERT_TRUE(p2 != NULL);
+		p = p2;
+
+		for (j = 0; j < prev && j < n; j++)
+			ASSERT_EQ((uint8_t)(j + prev), p[j]);
+
+		for (j = 0; j < n; j++)
+			p[j] = (uint8_t)(j + n);
+
+		prev = n;
+	}
+
+	ASSERT_EQ(1, mem_nrefs(p));
+	mem_deref(p);
+	ASSERT_EQ(1u, mem_test_ndestr);
+}
+
+
+extern "C" struct tmrl *tmrl_get(void);
+
+
+static void dummy_tmr_handler(void *arg)
+{
+	(void)arg;
+}
+
+
+#define TMR_ORDER_MAX 16
+
+
+struct tmr_test {
+	struct tmr tmrv[TMR_ORDER_MAX];
+	int orderv[TMR_ORDER_MAX];
+	unsigned n_fired;
+	unsigned n_wait;
+	int cancel_ix;       /* timer cancelled by the first handler */
+	int start_ix;        /* timer started with no delay by a handler */
+};
+
+
+struct tmr_arg {
+	struct tmr_test *tt;
+	int ix;
+};
+
+
+static struct tmr_arg tmr_argv[TMR_ORDER_MAX];
+
+
+static void order_tmr_handler(void *arg)
+{
+	struct tmr_arg *ta = (struct tmr_arg *)arg;
+	struct tmr_test *tt = ta->tt;
+
+	if (tt->n_fired < TMR_ORDER_MAX)
+		tt->orderv[tt->n_fired] = ta->ix;
+
+	if (tt->n_fired++ == 0) {
+
+		if (tt->cancel_ix >= 0)
+			tmr_cancel(&tt->tmrv[tt->cancel_ix]);
+
+		if (tt->start_ix >= 0) {
+			tmr_start(&tt->tmrv[tt->start_ix], 0,
+				  order_tmr_handler,
+				  &tmr_argv[tt->start_ix]);
+		}
+	}
+
+	if (tt->n_fired == tt->n_wait)
+		re_cancel();
+}
+
+
+static void tmr_test_init(struct tmr_test *tt)
+{
+	int i;
+
+	memset(tt, 0, sizeof(*tt));
+
+	for (i = 0; i < TMR_ORDER_MAX; i++) {
+		tmr_init(&tt->tmrv[i]);
+		tmr_argv[i].tt = tt;
+		tmr_argv[i].ix = i;
+		tt->orderv[i] = -1;
+	}
+
+	tt->cancel_ix = -1;
+	tt->start_ix = -1;
+}
+
+
+static void tmr_test_start(struct tmr_test *tt, int ix, uint64_t delay)
+{
+	tmr_start(&tt->tmrv[ix], delay, order_tmr_handler, &tmr_argv[ix]);
+}
+
+
+static void tmr_test_close(struct tmr_test *tt)
+{
+	int i;
+
+	for (i = 0; i < TMR_ORDER_MAX; i++)
+		tmr_cancel(&tt->tmrv[i]);
+}
+
+
+TEST(libre, tmr_order)
+{
+	/* started out of order, across the level 0 and 1 boundary */
+	static const uint64_t delayv[] = {60, 5, 300, 30, 255, 1, 257};
+	static const int orderv[] = {5, 1, 3, 0, 4, 6, 2};
+	struct tmr_test tt;
+	int i, err;
+
+	tmr_test_init(&tt);
+	tt.n_wait = 7;
+
+	for (i = 0; i < 7; i++)
+		tmr_test_start(&tt, i, delayv[i]);
+
+	err = re_main(NULL);
+	ASSERT_EQ(0, err);
+
+	ASSERT_EQ(7, tt.n_fired);
+	for (i = 0; i < 7; i++)
+		ASSERT_EQ(orderv[i], tt.orderv[i]);
+
+	tmr_test_close(&tt);
+}
+
+
+TEST(libre, tmr_same_jiffy)
+{
+	struct tmr_test tt;
+	int i;
+
+	tmr_test_init(&tt);
+
+	/* due at the same jiffy, run in the order they were started */
+	for (i = 0; i < 8; i++)
+		tmr_test_start(&tt, i, 0);
+
+	tmr_poll(tmrl_get());
+
+	ASSERT_EQ(8, tt.n_fired);
+	for (i = 0; i < 8; i++)
+		ASSERT_EQ(i, tt.orderv[i]);
+
+	tmr_test_close(&tt);
+}
+
+
+TEST(libre, tmr_cascade)
+{
+	/* expiry distances that land in each level of the wheel */
+	static const uint64_t rewindv[] = {
+		100, 300, 20000, 1100000
+	};
+	struct tmrl *tmrl = tmrl_get();
+	struct tmr_test tt;
+	struct tmr sentinel;
+	size_t i;
+
+	for (i = 0; i < sizeof(rewindv)/sizeof(rewindv[0]); i++) {
+
+		tmr_test_init(&tt);
+		tmr_init(&sentinel);
+
+		/* keep the wheel busy, so that it is not re-synchronised */
+		tmr_start(&sentinel, 3600000, dummy_tmr_handler, NULL);
+
+		/* let the wheel lag behind, as after a long blocking call */
+		tmrl->jfs -= rewindv[i];
+
+		tmr_test_start(&tt, 0, 0);
+		tmr_test_start(&tt, 1, 0);
+
+		tmr_poll(tmrl);
+
+		ASSERT_EQ(2, tt.n_fired);
+		ASSERT_EQ(0, tt.orderv[0]);
+		ASSERT_EQ(1, tt.orderv[1]);
+		ASSERT_TRUE(tmr_isrunning(&sentinel));
+
+		tmr_cancel(&sentinel);
+		tmr_test_close(&tt);
+	}
+}
+
+
+TEST(libre, tmr_cancel_in_handler)
+{
+	struct tmr_test tt;
+	int err;
+
+	tmr_test_init(&tt);
+	tt.n_wait = 2;
+	tt.cancel_ix = 1;
+
+	/* the second timer is due at the same jiffy, the third later */
+	tmr_test_start(&tt, 0, 10);
+	tmr_test_start(&tt, 1, 10);
+	tmr_test_start(&tt, 2, 50);
+
+	err = re_main(NULL);
+	ASSERT_EQ(0, err);
+
+	ASSERT_EQ(2, tt.n_fired);
+	ASSERT_EQ(0, tt.orderv[0]);
+	ASSERT_EQ(2, tt.orderv[1]);
+	ASSERT_FALSE(tmr_isrunning(&tt.tmrv[1]));
+
+	tmr_test_close(&tt);
+}
+
+
+TEST(libre, tmr_zero_delay)
+{
+	struct tmr_test tt;
+
+	tmr_test_init(&tt);
+	tt.start_ix = 1;
+
+	/* started with no delay from a handler, runs in the same poll */
+	tmr_test_start(&tt, 0, 0);
+
+	tmr_poll(tmrl_get());
+
+	ASSERT_EQ(2, tt.n_fired);
+	ASSERT_EQ(0, tt.orderv[0]);
+	ASSERT_EQ(1, tt.orderv[1]);
+
+	/* started after a poll, within the same jiffy */
+	tmr_test_start(&tt, 2, 0);
+
+	ASSERT_EQ(1, tmr_next_timeout(tmrl_get()));
+
+	tmr_poll(tmrl_get());
+
+	ASSERT_EQ(3, tt.n_fired);
+	ASSERT_EQ(2, tt.orderv[2]);
+
+	tmr_test_close(&tt);
+}
+
+
+#define NUM_TIMERS 100000
+#define NUM_TIMERS_LIST (NUM_TIMERS / 10)
+
+
+/* The sorted timer list that was used before the timer wheel */
+static bool list_inspos_handler(struct le *le, void *arg)
+{
+	struct tmr *tmr = (struct tmr *)le->data;
+
+	return tmr->jfs <= *(uint64_t *)arg;
+}
+
+
+static void list_tmr_start(struct list *tmrl, struct tmr *tmr,
+			   uint64_t delay)
+{
+	struct le *le;
+
+	tmr->jfs = delay + tmr_jiffies();
+
+	le = list_apply(tmrl, false, list_inspos_handler, &tmr->jfs);
+	if (le)
+		list_insert_after(tmrl, le, &tmr->le, tmr);
+	else
+		list_prepend(tmrl, &tmr->le, tmr);
+}
+
+
+TEST(libre, tmr_performance)
+{
+	struct list tmrl = LIST_INIT;
+	struct tmr *tmrv;
+	uint64_t *delayv;
+	uint64_t t1, t2, t3;
+	int i;
+
+	tmrv = (struct tmr *)mem_zalloc(NUM_TIMERS * sizeof(*tmrv), NULL);
+	delayv = (uint64_t *)mem_zalloc(NUM_TIMERS * sizeof(*delayv), NULL);
+	ASSERT_TRUE(tmrv != NULL);
+	ASSERT_TRUE(delayv != NULL);
+
+	for (i = 0; i < NUM_TIMERS; i++)
+		delayv[i] = 20 + rand_u32() % 30000;
+
+	t1 = tmr_jiffies();
+
+	for (i = 0; i < NUM_TIMERS; i++)
+		tmr_start(&tmrv[i], delayv[i], dummy_tmr_handler, NULL);
+
+	for (i = 0; i < NUM_TIMERS; i++) {
+		ASSERT_TRUE(tmr_isrunning(&tmrv[i]));
+		tmr_cancel(&tmrv[i]);
+	}
+
+	t2 = tmr_jiffies();
+
+	/* quadratic, so only a fraction of the timers */
+	for (i = 0; i < NUM_TIMERS_LIST; i++)
+		list_tmr_start(&tmrl, &tmrv[i], delayv[i]);
+
+	for (i = 0; i < NUM_TIMERS_LIST; i++)
+		list_unlink(&tmrv[i].le);
+
+	t3 = tmr_jiffies();
+
+	ASSERT_TRUE(list_isempty(&tmrl));
+
+	re_printf("~~~ performance report ~~~\n");
+	re_printf("wheel: %d timers in %d ms (%.3f us/timer)\n",
+		  NUM_TIMERS, (int)(t2-t1), 1000.0*(t2-t1)/NUM_TIMERS);
+	re_printf("list:  %d timers in %d ms (%.3f us/timer)\n",
+		  NUM_TIMERS_LIST, (int)(t3-t2),
+		  1000.0*(t3-t2)/NUM_TIMERS_LIST);
+	re_printf("~~~ ~~~ ~~~ ~~~ ~~~ ~~~ ~~~\n");
+	re_printf("\n");
+
+	mem_deref(delayv);
+	mem_deref(tmrv);
+}
+
+
+#define NUM_HMAC 100000
+
+
+static unsigned hmac_ns(struct hmac *hmac, const uint8_t *key, size_t key_len,
+		      const uint8_t *data, size_t len, bool keyed)
+{
+	uint8_t md[20];
+	uint64_t t1, t2;
+	int i;
+
+	t1 = tmr_jiffies();
+
+	for (i = 0; i < NUM_HMAC; i++) {
+		if (keyed)
+			hmac_digest(hmac, md, sizeof(md), data, len);
+		else
+			hmac_sha1(key, key_len, data, len, md, sizeof(md));
+	}
+
+	t2 = tmr_jiffies();
+
+	return (unsigned)(1000000 * (t2 - t1) / NUM_HMAC);
+}
+
+
+TEST(libre, hmac_performance)
+{
+	/* RFC 2202, test case 2 */
+	static const uint8_t md_ref[20] = {
+		0xef, 0xfc, 0xdf, 0x6a, 0xe5, 0xeb, 0x2f, 0xa2, 0xd2, 0x74,
+		0x16, 0xd5, 0xf1, 0x84, 0xdf, 0x9c, 0x25, 0x9a, 0x7c, 0x79
+	};
+	static const size_t lenv[] = {100, 200, 1200};
+	uint8_t key[20], data[1200], md[20];
+	struct hmac *hmac;
+	int err;
+
+	err = hmac_create(&hmac, HMAC_HASH_SHA1, (uint8_t *)"Jefe", 4);
+	ASSERT_EQ(0, err);
+
+	err = hmac_digest(hmac, md, sizeof(md),
+			  (uint8_t *)"what do ya want for nothing?", 28);
+	ASSERT_EQ(0, err);
+	ASSERT_EQ(0, memcmp(md_ref, md, sizeof(md)));
+
+	hmac_sha1((uint8_t *)"Jefe", 4,
+		  (uint8_t *)"what do ya want for nothing?", 28,
+		  md, sizeof(md));
+	ASSERT_EQ(0, memcmp(md_ref, md, sizeof(md)));
+
+	mem_deref(hmac);
+
+	rand_bytes(key, sizeof(key));
+	rand_bytes(data, sizeof(data));
+
+	err = hmac_create(&hmac, HMAC_HASH_SHA1, key, sizeof(key));
+	ASSERT_EQ(0, err);
+
+	re_printf("~~~ performance report ~~~\n");
+
+	for (size_t i = 0; i < sizeof(lenv)/sizeof(lenv[0]); i++) {
+
+		re_printf("hmac-sha1 %4zu bytes: %5u ns/call keyed,"
+			  " %5u ns/call one-shot\n", lenv[i],
+			  hmac_ns(hmac, key, sizeof(key), data, lenv[i],
+				  true),
+			  hmac_ns(hmac, key, sizeof(key), data, lenv[i],
+				  false));
+	}
+
+	re_printf("~~~ ~~~ ~~~ ~~~ ~~~ ~~~ ~~~\n");
+	re_printf("\n");
+
+	mem_deref(hmac);
+}
+
+
+#define MQ_PRODUCERS 4
+#define MQ_MESSAGES  100000
+
+
+struct mq_test {
+	struct mqueue *mq;
+	uint32_t nextv[MQ_PRODUCERS];
+	unsigned n_recv;
+	unsigned n_busy;
+	unsigned n_err;
+};
+
+
+static void mq_handler(int id, void *data, void *arg)
+{
+	struct mq_test *mt = (struct mq_test *)arg;
+	uint32_t seq = (uint32_t)(uintptr_t)data;
+
+	/* messages from one producer arrive in order */
+	if (id < 0 || id >= MQ_PRODUCERS || seq != mt->nextv[id])
+		++mt->n_err;
+	else
+		++mt->nextv[id];
+
+	if (++mt->n_recv == MQ_PRODUCERS * MQ_MESSAGES)
+		re_cancel();
+}
+
+
+struct mq_producer {
+	struct mq_test *mt;
+	int id;
+	unsigned n_busy;
+};
+
+
+static void *mq_producer_thread(void *arg)
+{
+	struct mq_producer *mp = (struct mq_producer *)arg;
+	uint32_t i;
+
+	for (i = 0; i < MQ_MESSAGES; i++) {
+
+		while (mqueue_push(mp->mt->mq, mp->id,
+				   (void *)(uintptr_t)i) == ENOBUFS) {
+			++mp->n_busy;
+			sched_yield();
+		}
+	}
+
+	return NULL;
+}
+
+
+TEST(libre, mqueue)
+{
+	struct mq_producer mpv[MQ_PRODUCERS];
+	pthread_t tidv[MQ_PRODUCERS];
+	struct mq_test mt;
+	uint64_t t1, t2;
+	int i, err;
+
+	memset(&mt, 0, sizeof(mt));
+
+	err = mqueue_alloc(&mt.mq, mq_handler, &mt);
+	ASSERT_EQ(0, err);
+
+	t1 = tmr_jiffies();
+
+	for (i = 0; i < MQ_PRODUCERS; i++) {
+		mpv[i].mt = &mt;
+		mpv[i].id = i;
+		mpv[i].n_busy = 0;
+
+		err = pthread_create(&tidv[i], NULL, mq_producer_thread,
+				     &mpv[i]);
+		ASSERT_EQ(0, err);
+	}
+
+	err = re_main(NULL);
+	ASSERT_EQ(0, err);
+
+	t2 = tmr_jiffies();
+
+	for (i = 0; i < MQ_PRODUCERS; i++) {
+		pthread_join(tidv[i], NULL);
+		mt.n_busy += mpv[i].n_busy;
+	}
+
+	ASSERT_EQ(0, mt.n_err);
+	ASSERT_EQ(MQ_PRODUCERS * MQ_MESSAGES, mt.n_recv);
+	for (i = 0; i < MQ_PRODUCERS; i++)
+		ASSERT_EQ(MQ_MESSAGES, mt.nextv[i]);
+
+	re_printf("~~~ performance report ~~~\n");
+	re_printf("mqueue: %u messages from %d threads in %u ms"
+		  " (%u msg/ms, %u full)\n",
+		  mt.n_recv, MQ_PRODUCERS, (unsigned)(t2 - t1),
+		  (unsigned)(mt.n_recv / (t2 - t1 + 1)), mt.n_busy);
+	re_printf("~~~ ~~~ ~~~ ~~~ ~~~ ~~~ ~~~\n");
+	re_printf("\n");
+
+	mem_deref(mt.mq);
+}
+
+
+/*
+ * Frames with a 2 byte type and 2 byte length, padded to 4 bytes like
+ * TURN over TCP. The stream is fed in segments of every size, so that
+ * frames and headers are split at every offset.
+ */
+
+struct frame_test {
+	struct tcp_framer *frm;
+	unsigned n_frame;
+	unsigned n_err;
+	unsigned stop_at;
+};
+
+
+static int frame_len_handler(size_t *lenp, const struct mbuf *mb, void *arg)
+{
+	const uint8_t *p = mbuf_buf(mb);
+	(void)arg;
+
+	if (mbuf_get_left(mb) < 4)
+		return ENODATA;
+
+	*lenp = 4 + (p[2] << 8 | p[3]);
+
+	return 0;
+}
+
+
+static bool frame_handler(struct mbuf *mb, void *arg)
+{
+	struct frame_test *ft = (struct frame_test *)arg;
+	const uint8_t *p = mbuf_buf(mb);
+	size_t i, len;
+
+	len = p[2] << 8 | p[3];
+
+	/* the type is the frame number, the payload is filled with it */
+	if (p[1] != (ft->n_frame & 0xff) || mbuf_get_left(mb) != 4 + len)
+		++ft->n_err;
+
+	for (i = 0; i < len; i++) {
+		if (p[4 + i] != p[1])
+			++ft->n_err;
+	}
+
+	++ft->n_frame;
+
+	return ft->n_frame != ft->stop_at;
+}
+
+
+TEST(libre, tcp_framer)
+{
+	static const size_t lenv[] = {0, 1, 3, 4, 7, 100, 1000, 60};
+	struct frame_test ft;
+	struct mbuf *stream, *seg;
+	size_t i, step;
+	int err;
+
+	stream = mbuf_alloc(2048);
+	seg = mbuf_alloc(2048);
+	ASSERT_TRUE(stream != NULL && seg != NULL);
+
+	for (i = 0; i < ARRAY_SIZE(lenv); i++) {
+
+		const size_t pad = (4 - (lenv[i] & 3)) & 3;
+
+		err  = mbuf_write_u16(stream, htons(i));
+		err |= mbuf_write_u16(stream, htons(lenv[i]));
+		if (lenv[i])
+			err |= mbuf_fill(stream, i, lenv[i]);
+		if (pad)
+			err |= mbuf_fill(stream, 0, pad);
+		ASSERT_EQ(0, err);
+	}
+
+	for (step = 1; step <= stream->end; step++) {
+
+		memset(&ft, 0, sizeof(ft));
+
+		/* stop once in the middle, the rest must be kept */
+		ft.stop_at = 3;
+
+		err = tcp_framer_alloc(&ft.frm, 2048, 4, frame_len_handler,
+				       frame_handler, &ft);
+		ASSERT_EQ(0, err);
+
+		for (stream->pos = 0; stream->pos < stream->end;) {
+
+			size_t n = mbuf_get_left(stream);
+
+			if (n > step)
+				n = step;
+
+			mbuf_reset(seg);
+			err = mbuf_write_mem(seg, mbuf_buf(stream), n);
+			ASSERT_EQ(0, err);
+			seg->pos = 0;
+
+			err = tcp_framer_recv(ft.frm, seg);
+			ASSERT_EQ(0, err);
+
+			stream->pos += n;
+		}
+
+		if (ft.n_frame < ARRAY_SIZE(lenv)) {
+			mbuf_reset(seg);
+			err = tcp_framer_recv(ft.frm, seg);
+			ASSERT_EQ(0, err);
+		}
+
+		ASSERT_EQ(ARRAY_SIZE(lenv), ft.n_frame);
+		ASSERT_EQ(0, ft.n_err);
+		ASSERT_EQ(0, tcp_framer_pending(ft.frm));
+
+		mem_deref(ft.frm);
+	}
+
+	/* a frame larger than the capacity */
+	err = tcp_framer_alloc(&ft.frm, 64, 4, frame_len_handler,
+			       frame_handler, &ft);
+	ASSERT_EQ(0, err);
+
+	stream->pos = 40;  /* the frame with 100 bytes */
+	ASSERT_EQ(EOVERFLOW, tcp_framer_recv(ft.frm, stream));
+
+	mem_deref(ft.frm);
+	mem_deref(seg);
+	mem_deref(stream);
+}
+
+
+/*
+ * Datagrams carry a 4 byte sequence number and a payload filled with
+ * its lowest byte. The receiver uses batched receive, the sender a
+ * transmit queue, so that both are flushed from the main loop.
+ */
+
+#define UDP_NUM_DGRAMS 40
+
+
+struct udp_test {
+	struct udp_sock *us_rx;
+	struct udp_sock *us_tx;
+	uint32_t next_seq;
+	unsigned n_recv;
+	unsigned n_wait;
+	unsigned n_bad;
+	int err_tx;
+	unsigned n_err_tx;
+};
+
+
+static void udp_test_recv_handler(const struct sa *src, struct mbuf *mb,
+				  void *arg)
+{
+	struct udp_test *ut = (struct udp_test *)arg;
+	uint32_t seq;
+	(void)src;
+
+	if (mbuf_get_left(mb) < 4) {
+		++ut->n_bad;
+		goto out;
+	}
+
+	seq = ntohl(mbuf_read_u32(mb));
+	if (seq != ut->next_seq)
+		++ut->n_bad;
+
+	ut->next_seq = seq + 1;
+
+	while (mbuf_get_left(mb)) {
+		if (mbuf_read_u8(mb) != (seq & 0xff))
+			++ut->n_bad;
+	}
+
+ out:
+	if (++ut->n_recv == ut->n_wait)
+		re_cancel();
+}
+
+
+static void udp_test_error_handler(int err, void *arg)
+{
+	struct udp_test *ut = (struct udp_test *)arg;
+
+	ut->err_tx = err;
+	++ut->n_err_tx;
+}
+
+
+static int udp_test_send(struct udp_test *ut, const struct sa *dst,
+			 uint32_t seq, size_t len)
+{
+	struct mbuf *mb = mbuf_alloc(len);
+	int err;
+
+	if (!mb)
+		return ENOMEM;
+
+	err  = mbuf_write_u32(mb, htonl(seq));
+	err |= mbuf_fill(mb, seq & 0xff, len - 4);
+	if (err)
+		goto out;
+
+	mb->pos = 0;
+	err = udp_send(ut->us_tx, dst, mb);
+
+ out:
+	mem_deref(mb);
+	return err;
+}
+
+
+static void udp_test_alloc(struct udp_test *ut, struct sa *dst)
+{
+	struct sa laddr;
+	int err;
+
+	memset(ut, 0, sizeof(*ut));
+
+	err = sa_set_str(&laddr, "127.0.0.1", 0);
+	ASSERT_EQ(0, err);
+
+	err  = udp_listen(&ut->us_rx, &laddr, udp_test_recv_handler, ut);
+	err |= udp_listen(&ut->us_tx, &laddr, NULL, ut);
+	ASSERT_EQ(0, err);
+
+	err = udp_local_get(ut->us_rx, dst);
+	ASSERT_EQ(0, err);
+
+	udp_error_handler_set(ut->us_tx, udp_test_error_handler);
+}
+
+
+TEST(libre, udp_rxbatch)
+{
+	struct udp_test ut;
+	struct sa dst;
+	uint32_t i;
+	int err;
+
+	udp_test_alloc(&ut, &dst);
+
+	err = udp_rxbatch_set(ut.us_rx, 16);
+	ASSERT_EQ(0, err);
+
+	/* more than one batch, of different sizes */
+	for (i = 0; i < UDP_NUM_DGRAMS; i++) {
+		err = udp_test_send(&ut, &dst, i, 8 + (i * 37) % 1200);
+		ASSERT_EQ(0, err);
+	}
+
+	ut.n_wait = UDP_NUM_DGRAMS;
+	err = re_main(NULL);
+	ASSERT_EQ(0, err);
+
+	ASSERT_EQ(UDP_NUM_DGRAMS, ut.n_recv);
+	ASSERT_EQ(0, ut.n_bad);
+
+	mem_deref(ut.us_tx);
+	mem_deref(ut.us_rx);
+}
+
+
+TEST(libre, udp_txqueue)
+{
+	const struct udp_txstat *stat;
+	struct udp_test ut;
+	struct sa dst, bcast, inval;
+	uint32_t i, seq = 0;
+	uint64_t n_gso;
+	int err;
+
+	udp_test_alloc(&ut, &dst);
+
+	err = udp_txqueue_set(ut.us_tx, 32);
+	ASSERT_EQ(0, err);
+
+	/* without SO_BROADCAST this fails with EACCES */
+	err = sa_set_str(&bcast, "255.255.255.255", sa_port(&dst));
+	ASSERT_EQ(0, err);
+
+	/* equal sizes, which may go out as one GSO message */
+	for (i = 0; i < 10; i++) {
+		err = udp_test_send(&ut, &dst, seq++, 1000);
+		ASSERT_EQ(0, err);
+	}
+
+	/* queued, the error is reported later */
+	for (i = 0; i < 3; i++) {
+		err = udp_test_send(&ut, &bcast, 1000 + i, 1000);
+		ASSERT_EQ(0, err);
+	}
+
+	/* more than fit in the queue, which is flushed in between */
+	for (i = 0; i < UDP_NUM_DGRAMS; i++) {
+		err = udp_test_send(&ut, &dst, seq++, 8 + (i * 37) % 1200);
+		ASSERT_EQ(0, err);
+	}
+
+	ut.n_wait = seq;
+	err = re_main(NULL);
+	ASSERT_EQ(0, err);
+
+	ASSERT_EQ(seq, ut.n_recv);
+	ASSERT_EQ(0, ut.n_bad);
+
+	ASSERT_EQ(1, ut.n_err_tx);
+	ASSERT_EQ(EACCES, ut.err_tx);
+
+	stat = udp_txqueue_stat(ut.us_tx);
+	ASSERT_TRUE(stat != NULL);
+	ASSERT_EQ(seq, stat->n_pkt);
+	ASSERT_EQ(3, stat->n_err);
+	ASSERT_TRUE(stat->n_syscall < stat->n_pkt);
+
+	/* a direct flush returns the error instead */
+	err = udp_test_send(&ut, &bcast, 2000, 100);
+	ASSERT_EQ(0, err);
+	ASSERT_EQ(EACCES, udp_txqueue_flush(ut.us_tx));
+	ASSERT_EQ(1, ut.n_err_tx);
+
+	/* EINVAL on a GSO message falls back to single datagrams */
+	err = sa_set_str(&inval, "127.0.0.1", 0);
+	ASSERT_EQ(0, err);
+
+	for (i = 0; i < 4; i++) {
+		err = udp_test_send(&ut, &inval, 3000 + i, 500);
+		ASSERT_EQ(0, err);
+	}
+
+	ASSERT_EQ(EINVAL, udp_txqueue_flush(ut.us_tx));
+	ASSERT_EQ(8, stat->n_err);
+
+	n_gso = stat->n_gso;
+
+	for (i = 0; i < 4; i++) {
+		err = udp_test_send(&ut, &dst, seq++, 500);
+		ASSERT_EQ(0, err);
+	}
+
+	ut.n_wait = seq;
+	err = re_main(NULL);
+	ASSERT_EQ(0, err);
+
+	ASSERT_EQ(seq, ut.n_recv);
+	ASSERT_EQ(0, ut.n_bad);
+	ASSERT_EQ(n_gso, stat->n_gso);
+
+	mem_deref(ut.us_tx);
+	mem_deref(ut.us_rx);
+}
+
+
+struct udp_thread_test {
+	struct udp_test *ut;
+	struct sa dst;
+	unsigned n_err;
+};
+
+
+static void *udp_test_thread(void *arg)
+{
+	struct udp_thread_test *utt = (struct udp_thread_test *)arg;
+	uint32_t i;
+
+	/* a burst of video sized packets, as from an encoder thread */
+	for (i = 0; i < UDP_NUM_DGRAMS; i++) {
+		if (udp_test_send(utt->ut, &utt->dst, i, 1100))
+			++utt->n_err;
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Datagrams sent from another thread are handed off to the thread
+ * of the queue, which sends them in batches.
+ */
+TEST(libre, udp_txqueue_thread)
+{
+	const struct udp_txstat *stat;
+	struct udp_thread_test utt;
+	struct udp_test ut;
+	pthread_t tid;
+	int err;
+
+	udp_test_alloc(&ut, &utt.dst);
+	utt.ut = &ut;
+	utt.n_err = 0;
+
+	err = udp_txqueue_set(ut.us_tx, 32);
+	ASSERT_EQ(0, err);
+
+	err = pthread_create(&tid, NULL, udp_test_thread, &utt);
+	ASSERT_EQ(0, err);
+
+	ut.n_wait = UDP_NUM_DGRAMS;
+	err = re_main(NULL);
+	ASSERT_EQ(0, err);
+
+	pthread_join(tid, NULL);
+
+	ASSERT_EQ(0, utt.n_err);
+	ASSERT_EQ(UDP_NUM_DGRAMS, ut.n_recv);
+	ASSERT_EQ(0, ut.n_bad);
+	ASSERT_EQ(0, ut.n_err_tx);
+
+	stat = udp_txqueue_stat(ut.us_tx);
+	ASSERT_TRUE(stat != NULL);
+	ASSERT_EQ(UDP_NUM_DGRAMS, stat->n_handoff);
+	ASSERT_EQ(UDP_NUM_DGRAMS, stat->n_pkt);
+	ASSERT_TRUE(stat->n_syscall < stat->n_pkt);
+
+	mem_deref(ut.us_tx);
+	mem_deref(ut.us_rx);
+}
@@ -337,6 +337,13 @@ TEST_F(TestMedia, chrome_interop)
 	ASSERT_TRUE(find_in_sdp(answer, "fingerprint:sha-256"));
 	ASSERT_TRUE(find_in_sdp(answer, "rtcp-mux"));
 	ASSERT_FALSE(find_in_sdp(answer, "setup:actpass"));
+
+	/* RFC 6464 audio level, with the id of the offer */
+	ASSERT_TRUE(mediaflow_has_audio_level(mf));
+	ASSERT_TRUE(find_in_sdp(answer, "a=extmap:1 urn:ietf:params:"
+				"rtp-hdrext:ssrc-audio-level"));
+	ASSERT_FALSE(find_in_sdp(answer, "abs-send-time"));
+	ASSERT_EQ(ENOENT, mediaflow_audio_level(mf, NULL, NULL));
 }
 
 
@@ -620,6 +627,7 @@ TEST_F(TestMedia, sdp_offer_with_audio_only)
 	/* verify audio */
 	ASSERT_TRUE(find_in_sdp(sdp, "m=audio"));
 	ASSERT_TRUE(find_in_sdp(sdp, "a=mid:audio"));
+	ASSERT_TRUE(find_in_sdp(sdp, "ssrc-audio-level"));
 
 	/* verify NOT video */
 	ASSERT_FALSE(find_in_sdp(sdp, "m=video"));
@@ -15,6 +15,7 @@
 * You should have received a copy of the GNU General Public License
 * along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
+#include <sys/time.h>
 #include <re.h>
 #include <avs.h>
 #include <gtest/gtest.h>
@@ -29,6 +30,8 @@
 
 
 #define NUM_PACKETS 2
+#define NUM_BENCH_PACKETS 20000
+#define RECV_BENCH_BURST 32     /* UDP_TXQUEUE in mediaflow */
 #define TS 160
 #define SSRC 0x01020304
 #define NTP_SEC 1234
@@ -77,6 +80,12 @@ struct agent {
 	unsigned n_rtp_recv;
 	unsigned n_rtcp_sent;
 	unsigned n_rtcp_recv;
+
+	/* receive benchmark */
+	unsigned n_bench_expect;
+	unsigned n_bench_recv;
+	uint64_t bench_t0;
+	uint64_t bench_t1;
 };
 
 static const uint8_t payload[160] = {0};
@@ -222,6 +231,141 @@ static void send_traffic(struct agent *ag)
 }
 
 
+static uint64_t time_usec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+
+static void perf_report(const char *dir, unsigned num, uint64_t usec)
+{
+	if (!usec)
+		usec = 1;
+
+	re_printf("~~~ performance report ~~~\n");
+	re_printf("%s: %u RTP packets in %u us (%u packets/sec,"
+		  " %u ns/packet)\n",
+		  dir, num, (unsigned)usec,
+		  (unsigned)(1000000ULL * num / usec),
+		  (unsigned)(1000ULL * usec / num));
+	re_printf("~~~ ~~~ ~~~ ~~~ ~~~ ~~~ ~~~\n");
+	re_printf("\n");
+}
+
+
+/*
+ * Send a burst of RTP packets the way the audio encoder does, and
+ * report the packet rate and the time per packet. The sequence numbers
+ * are kept low, the receiver will drop most of them as replayed.
+ */
+static void send_benchmark(struct agent *ag, unsigned num)
+{
+	struct rtp_header hdr;
+	struct mbuf *mb;
+	uint64_t t0;
+	int err;
+
+	memset(&hdr, 0, sizeof(hdr));
+
+	hdr.ver = RTP_VERSION;
+	hdr.ts  = TS;
+	hdr.ssrc = SSRC;
+
+	mb = mbuf_alloc(RTP_HEADER_SIZE + sizeof(payload));
+	ASSERT_TRUE(mb != NULL);
+
+	t0 = time_usec();
+
+	for (unsigned i=0; i<num; i++) {
+
+		hdr.seq = 1 + i % 8;
+
+		mb->pos = mb->end = 0;
+		err  = rtp_hdr_encode(mb, &hdr);
+		err |= mbuf_write_mem(mb, payload, sizeof(payload));
+		ASSERT_EQ(0, err);
+
+		err = mediaflow_send_raw_rtp(ag->mf, mb->buf, mb->end);
+		ASSERT_EQ(0, err);
+	}
+
+	perf_report("send", num, time_usec() - t0);
+
+	mem_deref(mb);
+}
+
+
+/*
+ * Send RTP packets in bursts, and time the receiver from the first to
+ * the last packet of each burst. A burst is no larger than what the
+ * sender flushes from its transmit queue at once, so all of it is
+ * queued before the first packet is read. This is the time of the
+ * receive path for all but the first packet. Via TURN it includes the
+ * fake TURN server relaying the packets.
+ */
+static void recv_benchmark(struct agent *ag, unsigned num)
+{
+	struct agent *rx = ag->other;
+	struct rtp_header hdr;
+	struct mbuf *mb;
+	uint64_t usec = 0;
+	unsigned nrecv = 0;
+	int err;
+
+	memset(&hdr, 0, sizeof(hdr));
+
+	hdr.ver = RTP_VERSION;
+	hdr.ts  = TS;
+	hdr.ssrc = SSRC;
+
+	/* the completion checks would stop the main loop, so wait
+	 * until the rest of the test traffic has arrived */
+	tmr_cancel(&ag->tmr);
+	tmr_cancel(&rx->tmr);
+	while (0 == re_main_wait(100))
+		;
+
+	mb = mbuf_alloc(RTP_HEADER_SIZE + sizeof(payload));
+	ASSERT_TRUE(mb != NULL);
+
+	for (unsigned n=0; n<num; n+=RECV_BENCH_BURST) {
+
+		rx->n_bench_expect = RECV_BENCH_BURST;
+		rx->n_bench_recv = 0;
+
+		for (unsigned i=0; i<RECV_BENCH_BURST; i++) {
+
+			hdr.seq = ++ag->seq;
+
+			mb->pos = mb->end = 0;
+			err  = rtp_hdr_encode(mb, &hdr);
+			err |= mbuf_write_mem(mb, payload, sizeof(payload));
+			ASSERT_EQ(0, err);
+
+			err = mediaflow_send_raw_rtp(ag->mf, mb->buf, mb->end);
+			ASSERT_EQ(0, err);
+		}
+
+		err = re_main_wait(1000);
+		ASSERT_EQ(0, err);
+		ASSERT_EQ(RECV_BENCH_BURST, rx->n_bench_recv);
+
+		usec  += rx->bench_t1 - rx->bench_t0;
+		nrecv += RECV_BENCH_BURST - 1;
+	}
+
+	rx->n_bench_expect = 0;
+
+	perf_report("recv", nrecv, usec);
+
+	mem_deref(mb);
+}
+
+
 static void mediaflow_estab_handler(const char *crypto, const char *codec,
 				    const char *type, const struct sa *sa,
 				    void *arg)
@@ -253,6 +397,17 @@ static void mediaflow_rtp_handler(const struct sa *src,
 {
 	struct agent *ag = static_cast<struct agent *>(arg);
 
+	if (ag->n_bench_expect) {
+
+		ag->bench_t1 = time_usec();
+		if (ag->n_bench_recv++ == 0)
+			ag->bench_t0 = ag->bench_t1;
+
+		if (ag->n_bench_recv == ag->n_bench_expect)
+			re_cancel();
+		return;
+	}
+
 	++ag->n_rtp_recv;
 
 	ASSERT_EQ(RTP_VERSION, hdr->ver);
@@ -566,7 +721,8 @@ static void sdp_exchange(struct agent *a, struct agent *b)
 }
 
 
-static void test_b2b(enum mode a_mode, enum mode b_mode, bool early_dtls)
+static void test_b2b(enum mode a_mode, enum mode b_mode, bool early_dtls,
+		     unsigned bench_packets = 0, bool bench_recv = false)
 {
 	struct test test;
 	struct agent *a = NULL, *b = NULL;
@@ -674,6 +830,10 @@ static void test_b2b(enum mode a_mode, enum mode b_mode, bool early_dtls)
 	ASSERT_EQ(early_dtls, mediaflow_early_dtls_supported(a->mf));
 	ASSERT_EQ(early_dtls, mediaflow_early_dtls_supported(b->mf));
 
+	if (bench_packets && bench_recv)
+		recv_benchmark(a, bench_packets);
+	else if (bench_packets)
+		send_benchmark(a, bench_packets);
 
 	mem_deref(a);
 	mem_deref(b);
@@ -769,3 +929,32 @@ TEST(media, b2b_turnonly_and_lite_earlydtls)
 }
 
 
+/* send and receive path benchmarks, direct and via TURN-relay: */
+
+
+TEST(media, b2b_send_performance_host)
+{
+	test_b2b(TRICKLE_STUN, TRICKLE_STUN, false, NUM_BENCH_PACKETS);
+}
+
+
+TEST(media, b2b_send_performance_turn)
+{
+	test_b2b(TRICKLE_TURN_ONLY, TRICKLE_TURN_ONLY, false,
+		 NUM_BENCH_PACKETS);
+}
+
+
+TEST(media, b2b_recv_performance_host)
+{
+	test_b2b(TRICKLE_STUN, TRICKLE_STUN, false, NUM_BENCH_PACKETS, true);
+}
+
+
+TEST(media, b2b_recv_performance_turn)
+{
+	test_b2b(TRICKLE_TURN_ONLY, TRICKLE_TURN_ONLY, false,
+		 NUM_BENCH_PACKETS, true);
+}
+
+
@@ -54,3 +54,514 @@ TEST(srtp, srtcp_packet)
 	mem_deref(srtp);
 	mem_deref(mb);
 }
+
+
+static void test_srtp_roundtrip(enum srtp_suite suite, size_t key_len,
+				size_t tag_len)
+{
+	static const uint8_t payload[160] = {0x55};
+	struct srtp *srtp_tx = NULL, *srtp_rx = NULL;
+	struct rtp_header hdr;
+	struct mbuf *mb = mbuf_alloc(512);
+	uint8_t key[46], pkt[512];
+	size_t len;
+	int err;
+
+	ASSERT_TRUE(mb != NULL);
+	ASSERT_TRUE(key_len <= sizeof(key));
+
+	rand_bytes(key, key_len);
+
+	err  = srtp_alloc(&srtp_tx, suite, key, key_len, 0);
+	err |= srtp_alloc(&srtp_rx, suite, key, key_len, 0);
+	ASSERT_EQ(0, err);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.ver  = RTP_VERSION;
+	hdr.pt   = 96;
+	hdr.ts   = 160;
+	hdr.ssrc = 0x01020304;
+
+	for (uint16_t seq = 65530; seq != 10; seq++) {
+
+		hdr.seq = seq;
+
+		mb->pos = mb->end = 0;
+		err  = rtp_hdr_encode(mb, &hdr);
+		err |= mbuf_write_mem(mb, payload, sizeof(payload));
+		ASSERT_EQ(0, err);
+		mb->pos = 0;
+
+		len = mb->end;
+
+		err = srtp_encrypt(srtp_tx, mb);
+		ASSERT_EQ(0, err);
+		ASSERT_EQ(len + tag_len, mb->end);
+		ASSERT_TRUE(0 != memcmp(&mb->buf[RTP_HEADER_SIZE],
+					payload, sizeof(payload)));
+
+		memcpy(pkt, mb->buf, mb->end);
+
+		err = srtp_decrypt(srtp_rx, mb);
+		ASSERT_EQ(0, err);
+		ASSERT_EQ(len, mb->end);
+		ASSERT_EQ(0, memcmp(&mb->buf[RTP_HEADER_SIZE],
+				    payload, sizeof(payload)));
+
+		/* a replayed packet must be rejected */
+		mb->pos = 0;
+		mb->end = len + tag_len;
+		memcpy(mb->buf, pkt, mb->end);
+
+		err = srtp_decrypt(srtp_rx, mb);
+		ASSERT_EQ(EALREADY, err);
+	}
+
+	mb->pos = 0;
+	mb->end = len + tag_len;
+	memcpy(mb->buf, pkt, mb->end);
+
+	/* a modified header must fail the authentication */
+	mb->buf[1] ^= 0x01;
+	err = srtp_decrypt(srtp_rx, mb);
+	ASSERT_EQ(EAUTH, err);
+
+	/* SRTCP, Sender Report without report blocks */
+	for (int i = 0; i < 4; i++) {
+
+		mb->pos = mb->end = 0;
+		err  = mbuf_write_u32(mb, htonl(0x80c80006));
+		err |= mbuf_write_u32(mb, htonl(hdr.ssrc));
+		err |= mbuf_write_mem(mb, payload, 20);
+		ASSERT_EQ(0, err);
+		mb->pos = 0;
+
+		len = mb->end;
+
+		err = srtcp_encrypt(srtp_tx, mb);
+		ASSERT_EQ(0, err);
+		ASSERT_EQ(len + 4 + tag_len, mb->end);
+
+		err = srtcp_decrypt(srtp_rx, mb);
+		ASSERT_EQ(0, err);
+		ASSERT_EQ(0, mb->pos);
+		ASSERT_EQ(len, mb->end);
+		ASSERT_EQ(0, memcmp(&mb->buf[8], payload, 20));
+	}
+
+	mem_deref(srtp_tx);
+	mem_deref(srtp_rx);
+	mem_deref(mb);
+}
+
+
+TEST(srtp, aes_cm_128_hmac_sha1_80)
+{
+	test_srtp_roundtrip(SRTP_AES_CM_128_HMAC_SHA1_80, 30, 10);
+}
+
+
+TEST(srtp, aes_128_gcm)
+{
+	test_srtp_roundtrip(SRTP_AES_128_GCM, 28, 16);
+}
+
+
+TEST(srtp, aes_256_gcm)
+{
+	test_srtp_roundtrip(SRTP_AES_256_GCM, 44, 16);
+}
+
+
+static int encrypt_ssrc(struct srtp *srtp, struct mbuf *mb, uint32_t ssrc)
+{
+	struct rtp_header hdr;
+	int err;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.ver  = RTP_VERSION;
+	hdr.seq  = 1;
+	hdr.ssrc = ssrc;
+
+	mb->pos = mb->end = 0;
+	err  = rtp_hdr_encode(mb, &hdr);
+	err |= mbuf_write_u32(mb, htonl(ssrc));
+	if (err)
+		return err;
+	mb->pos = 0;
+
+	return srtp_encrypt(srtp, mb);
+}
+
+
+TEST(srtp, max_streams)
+{
+	struct srtp *srtp_tx = NULL, *srtp_rx = NULL;
+	struct mbuf *mb = mbuf_alloc(64);
+	const uint32_t max_streams = 256;
+	uint8_t key[30];
+	uint32_t i;
+	int err;
+
+	ASSERT_TRUE(mb != NULL);
+
+	rand_bytes(key, sizeof(key));
+
+	err  = srtp_alloc(&srtp_tx, SRTP_AES_CM_128_HMAC_SHA1_80,
+			  key, sizeof(key), 0);
+	err |= srtp_alloc(&srtp_rx, SRTP_AES_CM_128_HMAC_SHA1_80,
+			  key, sizeof(key), 0);
+	ASSERT_EQ(0, err);
+
+	/* the default is 8 streams */
+	for (i = 0; i < 8; i++) {
+		err = encrypt_ssrc(srtp_tx, mb, 1000 + i);
+		ASSERT_EQ(0, err);
+	}
+	ASSERT_EQ(ENOSR, encrypt_ssrc(srtp_tx, mb, 1000 + i));
+
+	ASSERT_EQ(EBUSY, srtp_set_max_streams(srtp_tx, 4));
+	ASSERT_EQ(0, srtp_set_max_streams(srtp_tx, max_streams));
+	ASSERT_EQ(0, srtp_set_max_streams(srtp_rx, max_streams));
+
+	/* consecutive SSRCs, as used for RTX and FEC */
+	for (i = 8; i < max_streams; i++) {
+		err = encrypt_ssrc(srtp_tx, mb, 1000 + i);
+		ASSERT_EQ(0, err);
+	}
+	ASSERT_EQ(ENOSR, encrypt_ssrc(srtp_tx, mb, 1000 + i));
+
+	/* every stream must be found again, with its own state */
+	for (i = 0; i < max_streams; i++) {
+
+		err = encrypt_ssrc(srtp_tx, mb, 1000 + i);
+		ASSERT_EQ(0, err);
+
+		err = srtp_decrypt(srtp_rx, mb);
+		ASSERT_EQ(0, err);
+		ASSERT_EQ(1000 + i, mbuf_buf(mb)[RTP_HEADER_SIZE+3] |
+			  mbuf_buf(mb)[RTP_HEADER_SIZE+2] << 8);
+	}
+
+	mem_deref(srtp_tx);
+	mem_deref(srtp_rx);
+	mem_deref(mb);
+}
+
+
+
+#define BATCH_PACKETS 100
+#define BATCH_LARGE   20000
+
+
+/* two streams, mixed sizes, one larger than a keystream pass */
+static size_t batch_packet(struct mbuf *mb, int i)
+{
+	static const uint8_t payload[BATCH_LARGE] = {0x42};
+	const size_t len = (i == 50) ? BATCH_LARGE : 1 + i * 13;
+	struct rtp_header hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.ver  = RTP_VERSION;
+	hdr.pt   = 96;
+	hdr.ssrc = (i & 1) ? 0x1111 : 0x2222;
+	hdr.seq  = (uint16_t)(65500 + i / 2);
+
+	mb->pos = mb->end = 0;
+	if (rtp_hdr_encode(mb, &hdr) || mbuf_write_mem(mb, payload, len))
+		return 0;
+	mb->pos = 0;
+
+	return len;
+}
+
+
+TEST(srtp, batch)
+{
+	struct srtp *srtp_ref = NULL, *srtp_tx = NULL, *srtp_rx = NULL;
+	struct mbuf *mbv[BATCH_PACKETS];
+	int errv[BATCH_PACKETS];
+	struct mbuf *mb_ref = mbuf_alloc(BATCH_LARGE + 64);
+	uint8_t key[30];
+	int err, i;
+
+	ASSERT_TRUE(mb_ref != NULL);
+
+	rand_bytes(key, sizeof(key));
+
+	err  = srtp_alloc(&srtp_ref, SRTP_AES_CM_128_HMAC_SHA1_80,
+			  key, sizeof(key), 0);
+	err |= srtp_alloc(&srtp_tx, SRTP_AES_CM_128_HMAC_SHA1_80,
+			  key, sizeof(key), 0);
+	err |= srtp_alloc(&srtp_rx, SRTP_AES_CM_128_HMAC_SHA1_80,
+			  key, sizeof(key), 0);
+	ASSERT_EQ(0, err);
+
+	for (i = 0; i < BATCH_PACKETS; i++) {
+		mbv[i] = mbuf_alloc(64);
+		ASSERT_TRUE(mbv[i] != NULL);
+		ASSERT_NE(0, batch_packet(mbv[i], i));
+	}
+
+	err = srtp_encrypt_batch(srtp_tx, mbv, errv, BATCH_PACKETS);
+	ASSERT_EQ(0, err);
+
+	/* must be identical to encrypting one packet at a time */
+	for (i = 0; i < BATCH_PACKETS; i++) {
+
+		ASSERT_EQ(0, errv[i]);
+		ASSERT_EQ(0, mbv[i]->pos);
+
+		batch_packet(mb_ref, i);
+
+		err = srtp_encrypt(srtp_ref, mb_ref);
+		ASSERT_EQ(0, err);
+		ASSERT_EQ(mb_ref->end, mbv[i]->end);
+		ASSERT_EQ(0, memcmp(mb_ref->buf, mbv[i]->buf, mb_ref->end));
+	}
+
+	/* a modified packet fails, the others are still decrypted */
+	mbv[7]->buf[RTP_HEADER_SIZE] ^= 0x01;
+
+	err = srtp_decrypt_batch(srtp_rx, mbv, errv, BATCH_PACKETS);
+	ASSERT_EQ(EAUTH, err);
+
+	for (i = 0; i < BATCH_PACKETS; i++) {
+
+		if (i == 7) {
+			ASSERT_EQ(EAUTH, errv[i]);
+			continue;
+		}
+
+		ASSERT_EQ(0, errv[i]);
+		ASSERT_EQ(0, mbv[i]->pos);
+
+		batch_packet(mb_ref, i);
+
+		ASSERT_EQ(mb_ref->end, mbv[i]->end);
+		ASSERT_EQ(0, memcmp(mb_ref->buf, mbv[i]->buf, mb_ref->end));
+	}
+
+	for (i = 0; i < BATCH_PACKETS; i++)
+		mem_deref(mbv[i]);
+
+	mem_deref(srtp_ref);
+	mem_deref(srtp_tx);
+	mem_deref(srtp_rx);
+	mem_deref(mb_ref);
+}
+
+
+
+static int decrypt_copy(struct srtp *srtp, const struct mbuf *mb)
+{
+	struct mbuf *mbc = mbuf_alloc(mb->end);
+	int err;
+
+	if (!mbc)
+		return ENOMEM;
+
+	mbuf_write_mem(mbc, mb->buf, mb->end);
+	mbc->pos = 0;
+
+	err = srtp_decrypt(srtp, mbc);
+
+	mem_deref(mbc);
+
+	return err;
+}
+
+
+TEST(srtp, replay_window)
+{
+#define REPLAY_PACKETS 2000
+#define REPLAY_DELAY   500
+	struct srtp *srtp_tx = NULL, *srtp_rx = NULL, *srtp_rx64 = NULL;
+	struct mbuf *mbv[REPLAY_PACKETS];
+	struct srtp_stats stats;
+	struct rtp_header hdr;
+	uint8_t key[30];
+	int err, i, n_old = 0;
+
+	rand_bytes(key, sizeof(key));
+
+	err  = srtp_alloc(&srtp_tx, SRTP_AES_CM_128_HMAC_SHA1_80,
+			  key, sizeof(key), 0);
+	err |= srtp_alloc(&srtp_rx, SRTP_AES_CM_128_HMAC_SHA1_80,
+			  key, sizeof(key), 0);
+	err |= srtp_alloc(&srtp_rx64, SRTP_AES_CM_128_HMAC_SHA1_80,
+			  key, sizeof(key), 0);
+	ASSERT_EQ(0, err);
+
+	ASSERT_EQ(EINVAL, srtp_set_replay_window(srtp_rx, 1000000));
+	ASSERT_EQ(0, srtp_set_replay_window(srtp_rx, 1024));
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.ver  = RTP_VERSION;
+	hdr.ssrc = 0x01020304;
+
+	for (i = 0; i < REPLAY_PACKETS; i++) {
+
+		hdr.seq = (uint16_t)(65000 + i);
+
+		mbv[i] = mbuf_alloc(64);
+		ASSERT_TRUE(mbv[i] != NULL);
+
+		err  = rtp_hdr_encode(mbv[i], &hdr);
+		err |= mbuf_write_u32(mbv[i], i);
+		ASSERT_EQ(0, err);
+		mbv[i]->pos = 0;
+
+		err = srtp_encrypt(srtp_tx, mbv[i]);
+		ASSERT_EQ(0, err);
+	}
+
+	/* every 10th packet arrives REPLAY_DELAY packets late */
+	for (i = 0; i < REPLAY_PACKETS + REPLAY_DELAY; i++) {
+		int late = i - REPLAY_DELAY;
+
+		if (i < REPLAY_PACKETS && i % 10) {
+			ASSERT_EQ(0, decrypt_copy(srtp_rx, mbv[i]));
+			ASSERT_EQ(0, decrypt_copy(srtp_rx64, mbv[i]));
+		}
+
+		if (late >= 0 && late < REPLAY_PACKETS && !(late % 10)) {
+			ASSERT_EQ(0, decrypt_copy(srtp_rx, mbv[late]));
+
+			/* after the last packet, the delay is shorter */
+			if (late < REPLAY_PACKETS - 64) {
+				err = decrypt_copy(srtp_rx64, mbv[late]);
+				ASSERT_EQ(EALREADY, err);
+				++n_old;
+			}
+		}
+	}
+
+	/* duplicates */
+	ASSERT_EQ(EALREADY, decrypt_copy(srtp_rx, mbv[REPLAY_PACKETS-1]));
+	ASSERT_EQ(EALREADY, decrypt_copy(srtp_rx, mbv[REPLAY_PACKETS-900]));
+	ASSERT_EQ(EALREADY, decrypt_copy(srtp_rx, mbv[0]));
+
+	ASSERT_EQ(0, srtp_stats_get(srtp_rx, &stats));
+	ASSERT_EQ(2, stats.replay);
+	ASSERT_EQ(1, stats.old);
+
+	ASSERT_EQ(0, srtp_stats_get(srtp_rx64, &stats));
+	ASSERT_EQ(0, stats.replay);
+	ASSERT_EQ(n_old, stats.old);
+
+	ASSERT_EQ(EBUSY, srtp_set_replay_window(srtp_rx, 64));
+
+	for (i = 0; i < REPLAY_PACKETS; i++)
+		mem_deref(mbv[i]);
+
+	mem_deref(srtp_tx);
+	mem_deref(srtp_rx);
+	mem_deref(srtp_rx64);
+}
+
+
+TEST(srtp, decrypt_meta)
+{
+	static const uint8_t payload[64] = {0x5a};
+	struct srtp *srtp_tx = NULL, *srtp_rx = NULL;
+	struct rtp_header hdr, hdr2;
+	struct rtp_meta meta;
+	struct mbuf *mb = mbuf_alloc(512);
+	uint8_t key[30];
+	size_t len;
+	int err;
+
+	ASSERT_TRUE(mb != NULL);
+
+	rand_bytes(key, sizeof(key));
+
+	err  = srtp_alloc(&srtp_tx, SRTP_AES_CM_128_HMAC_SHA1_80,
+			  key, sizeof(key), 0);
+	err |= srtp_alloc(&srtp_rx, SRTP_AES_CM_128_HMAC_SHA1_80,
+			  key, sizeof(key), 0);
+	ASSERT_EQ(0, err);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.ver  = RTP_VERSION;
+	hdr.ext  = true;
+	hdr.cc   = 2;
+	hdr.m    = true;
+	hdr.pt   = 111;
+	hdr.seq  = 4711;
+	hdr.ts   = 0x11223344;
+	hdr.ssrc = 0xcafebabe;
+	hdr.csrc[0] = 1;
+	hdr.csrc[1] = 2;
+
+	/* header with two CSRCs and a one-word RFC 5285 extension */
+	mb->pos = 4;
+	err  = rtp_hdr_encode(mb, &hdr);
+	err |= mbuf_write_u16(mb, htons(0xbede));
+	err |= mbuf_write_u16(mb, htons(1));
+	err |= mbuf_write_u32(mb, htonl(0x10ff0000));
+	err |= mbuf_write_mem(mb, payload, sizeof(payload));
+	ASSERT_EQ(0, err);
+	mb->pos = 4;
+
+	len = mbuf_get_left(mb);
+
+	err = rtp_meta_decode(&meta, mb);
+	ASSERT_EQ(0, err);
+	ASSERT_EQ(4, mb->pos);
+	ASSERT_FALSE(meta.rtcp);
+	ASSERT_EQ(4, meta.start);
+	ASSERT_EQ(RTP_HEADER_SIZE + 8 + 4, meta.ext_off);
+	ASSERT_EQ(RTP_HEADER_SIZE + 8 + 4 + 4, meta.hdr_len);
+
+	err = rtp_hdr_decode(&hdr2, mb);
+	ASSERT_EQ(0, err);
+	ASSERT_EQ(4 + meta.hdr_len, mb->pos);
+	mb->pos = 4;
+
+	ASSERT_EQ(hdr2.m, meta.hdr.m);
+	ASSERT_EQ(hdr2.pt, meta.hdr.pt);
+	ASSERT_EQ(hdr2.seq, meta.hdr.seq);
+	ASSERT_EQ(hdr2.ts, meta.hdr.ts);
+	ASSERT_EQ(hdr2.ssrc, meta.hdr.ssrc);
+	ASSERT_EQ(hdr2.csrc[1], meta.hdr.csrc[1]);
+	ASSERT_EQ(hdr2.x.type, meta.hdr.x.type);
+	ASSERT_EQ(hdr2.x.len, meta.hdr.x.len);
+
+	err = srtp_encrypt(srtp_tx, mb);
+	ASSERT_EQ(0, err);
+
+	/* the metadata must describe the packet at the current position */
+	mb->pos = 5;
+	ASSERT_EQ(EINVAL, srtp_decrypt_meta(srtp_rx, mb, &meta));
+	mb->pos = 4;
+
+	err = srtp_decrypt_meta(srtp_rx, mb, &meta);
+	ASSERT_EQ(0, err);
+	ASSERT_EQ(4, mb->pos);
+	ASSERT_EQ(len, mbuf_get_left(mb));
+	ASSERT_EQ(0, memcmp(&mb->buf[4 + meta.hdr_len],
+			    payload, sizeof(payload)));
+
+	/* truncated extension */
+	mb->end = 4 + meta.hdr_len - 1;
+	ASSERT_EQ(EBADMSG, rtp_meta_decode(&meta, mb));
+
+	/* RTCP Receiver Report */
+	mb->pos = mb->end = 0;
+	err  = mbuf_write_u32(mb, htonl(0x80c90001));
+	err |= mbuf_write_u32(mb, htonl(0x01020304));
+	ASSERT_EQ(0, err);
+	mb->pos = 0;
+
+	err = rtp_meta_decode(&meta, mb);
+	ASSERT_EQ(0, err);
+	ASSERT_TRUE(meta.rtcp);
+	ASSERT_EQ(RTCP_RR, meta.hdr.pt);
+	ASSERT_EQ(0x01020304u, meta.hdr.ssrc);
+	ASSERT_EQ(EINVAL, srtp_decrypt_meta(srtp_rx, mb, &meta));
+
+	mem_deref(srtp_tx);
+	mem_deref(srtp_rx);
+	mem_deref(mb);
+}
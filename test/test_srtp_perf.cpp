@@ -0,0 +1,183 @@
+/*
+* Wire
+* Copyright (C) 2016 Wire Swiss GmbH
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <re.h>
+#include <gtest/gtest.h>
+#include <avs.h>
+
+
+
+
+#define PERF_PACKETS 4096
+#define PERF_ROUNDS  16
+#define PERF_BATCH   32
+
+
+struct perf {
+	struct srtp *tx;
+	struct srtp *rx;
+	struct mbuf *mbv[PERF_PACKETS];
+	size_t pld_len;
+	uint16_t seq;
+	uint64_t t_enc;
+	uint64_t t_dec;
+};
+
+
+static int perf_fill(struct perf *pf)
+{
+	struct rtp_header hdr;
+	int i, err = 0;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.ver  = RTP_VERSION;
+	hdr.pt   = 96;
+	hdr.ssrc = 0x01020304;
+
+	for (i = 0; i < PERF_PACKETS; i++) {
+		struct mbuf *mb = pf->mbv[i];
+
+		hdr.seq = pf->seq++;
+
+		mb->pos = mb->end = 0;
+		err |= rtp_hdr_encode(mb, &hdr);
+		err |= mbuf_fill(mb, 0xa5, pf->pld_len - RTP_HEADER_SIZE);
+		mb->pos = 0;
+	}
+
+	return err;
+}
+
+
+static int perf_run(struct perf *pf, bool batch)
+{
+	uint64_t t0, t1, t2;
+	int i, err = 0;
+
+	t0 = tmr_jiffies();
+
+	for (i = 0; i < PERF_PACKETS && !err; i += PERF_BATCH) {
+
+		if (batch) {
+			err = srtp_encrypt_batch(pf->tx, &pf->mbv[i], NULL,
+						 PERF_BATCH);
+		}
+		else {
+			for (int j = i; j < i + PERF_BATCH; j++)
+				err |= srtp_encrypt(pf->tx, pf->mbv[j]);
+		}
+	}
+
+	t1 = tmr_jiffies();
+
+	for (i = 0; i < PERF_PACKETS && !err; i += PERF_BATCH) {
+
+		if (batch) {
+			err = srtp_decrypt_batch(pf->rx, &pf->mbv[i], NULL,
+						 PERF_BATCH);
+		}
+		else {
+			for (int j = i; j < i + PERF_BATCH; j++)
+				err |= srtp_decrypt(pf->rx, pf->mbv[j]);
+		}
+	}
+
+	t2 = tmr_jiffies();
+
+	pf->t_enc += t1 - t0;
+	pf->t_dec += t2 - t1;
+
+	return err;
+}
+
+
+static double gbps(size_t bytes, uint64_t ms)
+{
+	return ms ? 8.0 * bytes / (1e6 * ms) : 0.0;
+}
+
+
+/*
+ * Encrypts and decrypts the same packets one at a time and in batches,
+ * with a new SRTP context pair for each, and reports the throughput.
+ */
+static void test_srtp_perf(size_t pkt_len)
+{
+	static const bool modev[] = {false, true};
+	uint8_t key[30];
+	int err;
+
+	rand_bytes(key, sizeof(key));
+
+	re_printf("~~~ performance report ~~~\n");
+	re_printf("packet_size:    %zu bytes\n", pkt_len);
+	re_printf("packets:        %d\n", PERF_PACKETS * PERF_ROUNDS);
+
+	for (size_t m = 0; m < sizeof(modev)/sizeof(modev[0]); m++) {
+		const size_t bytes = pkt_len * PERF_PACKETS * PERF_ROUNDS;
+		struct perf pf;
+
+		memset(&pf, 0, sizeof(pf));
+		pf.pld_len = pkt_len;
+
+		err  = srtp_alloc(&pf.tx, SRTP_AES_CM_128_HMAC_SHA1_80,
+				  key, sizeof(key), 0);
+		err |= srtp_alloc(&pf.rx, SRTP_AES_CM_128_HMAC_SHA1_80,
+				  key, sizeof(key), 0);
+		ASSERT_EQ(0, err);
+
+		for (int i = 0; i < PERF_PACKETS; i++) {
+			pf.mbv[i] = mbuf_alloc(pkt_len + 32);
+			ASSERT_TRUE(pf.mbv[i] != NULL);
+		}
+
+		for (int r = 0; r < PERF_ROUNDS; r++) {
+
+			ASSERT_EQ(0, perf_fill(&pf));
+
+			err = perf_run(&pf, modev[m]);
+			ASSERT_EQ(0, err);
+		}
+
+		re_printf("%s encrypt:  %6.2f Gbit/s (%llu ms)\n",
+			  modev[m] ? "batch " : "single",
+			  gbps(bytes, pf.t_enc), pf.t_enc);
+		re_printf("%s decrypt:  %6.2f Gbit/s (%llu ms)\n",
+			  modev[m] ? "batch " : "single",
+			  gbps(bytes, pf.t_dec), pf.t_dec);
+
+		for (int i = 0; i < PERF_PACKETS; i++)
+			mem_deref(pf.mbv[i]);
+		mem_deref(pf.tx);
+		mem_deref(pf.rx);
+	}
+
+	re_printf("~~~ ~~~ ~~~ ~~~ ~~~ ~~~ ~~~\n");
+	re_printf("\n");
+}
+
+
+TEST(srtp, performance_audio)
+{
+	test_srtp_perf(200);
+}
+
+
+TEST(srtp, performance_video)
+{
+	test_srtp_perf(1200);
+}
@@ -528,3 +528,444 @@ TEST(turn, uri)
 		ASSERT_STREQ(test->str, buf);
 	}
 }
+
+
+/*
+ * Two users share one allocation. The second user joins after the
+ * allocation is ready. Each user talks to its own peer, and the data
+ * from the peers is given to the right user.
+ *
+ *    [user A] --\                            /--> [peer A]
+ *                +--> [TURN Server] -- relay +
+ *    [user B] --/                            \--> [peer B]
+ */
+
+
+struct shared_user {
+	struct turn_conn *conn;
+	struct udp_sock *us_peer;
+	struct sa addr_peer;
+	struct sa relay;
+	unsigned n_estab;
+	unsigned n_data;
+	unsigned n_wrong;
+};
+
+static struct shared_user usera, userb;
+static struct sa shared_srv;
+static struct tmr shared_tmr;
+
+
+static void shared_send(struct shared_user *user)
+{
+	struct mbuf *mb = mbuf_alloc(36 + str_len(payload));
+	int err;
+
+	mb->pos = 36;
+	mbuf_write_str(mb, payload);
+	mb->pos = 36;
+
+	err = turnconn_send(user->conn, &user->addr_peer, mb);
+	ASSERT_EQ(0, err);
+
+	mem_deref(mb);
+}
+
+
+static void shared_tmr_handler(void *arg)
+{
+	(void)arg;
+
+	shared_send(&usera);
+	shared_send(&userb);
+}
+
+
+static void shared_data_handler(struct turn_conn *conn,
+				const struct sa *src,
+				struct mbuf *mb, void *arg)
+{
+	struct shared_user *user = (struct shared_user *)arg;
+	(void)conn;
+	(void)mb;
+
+	if (sa_cmp(src, &user->addr_peer, SA_ALL))
+		++user->n_data;
+	else
+		++user->n_wrong;
+
+	if (usera.n_data && userb.n_data)
+		re_cancel();
+}
+
+
+static void shared_error_handler(int err, void *arg)
+{
+	(void)arg;
+
+	ASSERT_EQ(0, err);
+}
+
+
+static void shared_estab_handler(struct turn_conn *conn,
+				 const struct sa *relay_addr,
+				 const struct sa *mapped_addr,
+				 const struct stun_msg *msg, void *arg)
+{
+	struct shared_user *user = (struct shared_user *)arg;
+	int err;
+	(void)mapped_addr;
+	(void)msg;
+
+	++user->n_estab;
+	user->relay = *relay_addr;
+
+	err = turnconn_add_permission(conn, &user->addr_peer);
+	ASSERT_EQ(0, err);
+
+	if (user == &usera) {
+		err = turnconn_alloc_shared(&userb.conn, NULL, &shared_srv,
+					    IPPROTO_UDP, false,
+					    "user", "pass", 0, 0,
+					    shared_estab_handler,
+					    shared_data_handler,
+					    shared_error_handler, &userb);
+		ASSERT_EQ(0, err);
+	}
+	else {
+		/* give the server time for the permissions */
+		tmr_start(&shared_tmr, 100, shared_tmr_handler, NULL);
+	}
+}
+
+
+static void shared_peer_recv(const struct sa *src, struct mbuf *mb,
+			     void *arg)
+{
+	struct shared_user *user = (struct shared_user *)arg;
+
+	/* echo data back to the user */
+	udp_send(user->us_peer, src, mb);
+}
+
+
+TEST(turn, shared_allocation)
+{
+	TurnServer srv;
+	struct sa laddr;
+	int err;
+
+	memset(&usera, 0, sizeof(usera));
+	memset(&userb, 0, sizeof(userb));
+	tmr_init(&shared_tmr);
+
+	shared_srv = srv.addr;
+
+	err = sa_set_str(&laddr, "127.0.0.1", 0);
+	ASSERT_EQ(0, err);
+
+	err  = udp_listen(&usera.us_peer, &laddr, shared_peer_recv, &usera);
+	err |= udp_listen(&userb.us_peer, &laddr, shared_peer_recv, &userb);
+	err |= udp_local_get(usera.us_peer, &usera.addr_peer);
+	err |= udp_local_get(userb.us_peer, &userb.addr_peer);
+	ASSERT_EQ(0, err);
+
+	err = turnconn_alloc_shared(&usera.conn, NULL, &shared_srv,
+				    IPPROTO_UDP, false,
+				    "user", "pass", 0, 0,
+				    shared_estab_handler,
+				    shared_data_handler,
+				    shared_error_handler, &usera);
+	ASSERT_EQ(0, err);
+
+	err = re_main_wait(5000);
+	ASSERT_EQ(0, err);
+
+	/* one allocation, one relay address */
+	ASSERT_EQ(1, turnconn_shared_count());
+	ASSERT_EQ(1, usera.n_estab);
+	ASSERT_EQ(1, userb.n_estab);
+	ASSERT_TRUE(sa_cmp(&usera.relay, &userb.relay, SA_ALL));
+
+	ASSERT_GE(usera.n_data, 1);
+	ASSERT_GE(userb.n_data, 1);
+	ASSERT_EQ(0, usera.n_wrong);
+	ASSERT_EQ(0, userb.n_wrong);
+
+	/* the allocation goes with the last user */
+	mem_deref(usera.conn);
+	ASSERT_EQ(1, turnconn_shared_count());
+	mem_deref(userb.conn);
+	ASSERT_EQ(0, turnconn_shared_count());
+
+	tmr_cancel(&shared_tmr);
+	mem_deref(usera.us_peer);
+	mem_deref(userb.us_peer);
+}
+
+
+/*
+ * The permission for a peer starts the channel binding. The first data
+ * goes in a Send indication before the binding is confirmed, the data
+ * after that uses ChannelData.
+ */
+
+
+static struct turn_conn *chan_conn;
+static struct sa chan_peer;
+static struct tmr chan_tmr;
+static unsigned chan_nrecv;
+
+
+static void chan_send(void)
+{
+	struct mbuf *mb = mbuf_alloc(36 + str_len(payload));
+	int err;
+
+	mb->pos = 36;
+	mbuf_write_str(mb, payload);
+	mb->pos = 36;
+
+	err = turnconn_send(chan_conn, &chan_peer, mb);
+	ASSERT_EQ(0, err);
+
+	mem_deref(mb);
+}
+
+
+static void chan_tmr_handler(void *arg)
+{
+	(void)arg;
+
+	chan_send();
+}
+
+
+static void chan_estab_handler(struct turn_conn *conn,
+			       const struct sa *relay_addr,
+			       const struct sa *mapped_addr,
+			       const struct stun_msg *msg, void *arg)
+{
+	int err;
+	(void)relay_addr;
+	(void)mapped_addr;
+	(void)msg;
+	(void)arg;
+
+	err = turnconn_add_permission(conn, &chan_peer);
+	ASSERT_EQ(0, err);
+
+	chan_send();
+
+	tmr_start(&chan_tmr, 100, chan_tmr_handler, NULL);
+}
+
+
+static void chan_error_handler(int err, void *arg)
+{
+	(void)arg;
+
+	ASSERT_EQ(0, err);
+}
+
+
+static void chan_client_recv(const struct sa *src, struct mbuf *mb,
+			     void *arg)
+{
+	(void)mb;
+	(void)arg;
+
+	ASSERT_TRUE(sa_cmp(src, &chan_peer, SA_ALL));
+
+	if (++chan_nrecv >= 2)
+		re_cancel();
+}
+
+
+static void chan_peer_recv(const struct sa *src, struct mbuf *mb,
+			   void *arg)
+{
+	struct udp_sock *us = (struct udp_sock *)arg;
+
+	udp_send(us, src, mb);
+}
+
+
+TEST(turn, channel_autobind)
+{
+	TurnServer srv;
+	struct udp_sock *us_cli = NULL, *us_peer = NULL;
+	const struct turnc_stats *st;
+	struct sa laddr;
+	int err;
+
+	tmr_init(&chan_tmr);
+	chan_nrecv = 0;
+
+	err = sa_set_str(&laddr, "127.0.0.1", 0);
+	ASSERT_EQ(0, err);
+
+	err  = udp_listen(&us_cli, &laddr, chan_client_recv, NULL);
+	err |= udp_listen(&us_peer, &laddr, NULL, NULL);
+	err |= udp_local_get(us_peer, &chan_peer);
+	ASSERT_EQ(0, err);
+
+	udp_handler_set(us_peer, chan_peer_recv, us_peer);
+
+	err = turnconn_alloc(&chan_conn, NULL, &srv.addr, IPPROTO_UDP, false,
+			     "user", "pass", us_cli, 0, 0,
+			     chan_estab_handler, NULL,
+			     chan_error_handler, NULL);
+	ASSERT_EQ(0, err);
+
+	err = re_main_wait(5000);
+	ASSERT_EQ(0, err);
+
+	ASSERT_EQ(2, chan_nrecv);
+
+	st = turnc_stats_get(chan_conn->turnc);
+	ASSERT_TRUE(st != NULL);
+
+	/* one packet each way in an indication, then on the channel */
+	ASSERT_GT(st->ind_tx, 0);
+	ASSERT_EQ(4 + str_len(payload), st->chan_tx);
+	ASSERT_GT(st->chan_rx, 0);
+
+	tmr_cancel(&chan_tmr);
+	mem_deref(chan_conn);
+	mem_deref(us_peer);
+	mem_deref(us_cli);
+}
+
+
+/* The same over TCP, the frames from the server go through the framer */
+static void chan_tcp_data_handler(struct turn_conn *conn,
+				  const struct sa *src, struct mbuf *mb,
+				  void *arg)
+{
+	(void)conn;
+
+	chan_client_recv(src, mb, arg);
+}
+
+
+TEST(turn, channel_autobind_tcp)
+{
+	TurnServer srv;
+	struct udp_sock *us_peer = NULL;
+	const struct turnc_stats *st;
+	struct sa laddr;
+	int err;
+
+	tmr_init(&chan_tmr);
+	chan_nrecv = 0;
+
+	err = sa_set_str(&laddr, "127.0.0.1", 0);
+	ASSERT_EQ(0, err);
+
+	err  = udp_listen(&us_peer, &laddr, NULL, NULL);
+	err |= udp_local_get(us_peer, &chan_peer);
+	ASSERT_EQ(0, err);
+
+	udp_handler_set(us_peer, chan_peer_recv, us_peer);
+
+	err = turnconn_alloc(&chan_conn, NULL, &srv.addr_tcp, IPPROTO_TCP,
+			     false, "user", "pass", NULL, 0, 0,
+			     chan_estab_handler, chan_tcp_data_handler,
+			     chan_error_handler, NULL);
+	ASSERT_EQ(0, err);
+
+	err = re_main_wait(5000);
+	ASSERT_EQ(0, err);
+
+	ASSERT_EQ(2, chan_nrecv);
+
+	st = turnc_stats_get(chan_conn->turnc);
+	ASSERT_TRUE(st != NULL);
+
+	ASSERT_GT(st->chan_rx, 0);
+	ASSERT_EQ(0, tcp_framer_pending(chan_conn->framer));
+
+	tmr_cancel(&chan_tmr);
+	mem_deref(chan_conn);
+	mem_deref(us_peer);
+}
+
+
+/*
+ * An explicit channel for a peer that already has an automatic binding
+ * reports the binding, first when the pending binding succeeds and then
+ * at once when the channel is bound.
+ */
+static unsigned chan_nadded;
+
+
+static void chan_added_handler(void *arg)
+{
+	struct turnc *turnc = (struct turnc *)arg;
+	int err;
+
+	if (++chan_nadded == 1) {
+		err = turnc_add_chan(turnc, &chan_peer, chan_added_handler,
+				     turnc);
+		ASSERT_EQ(0, err);
+	}
+
+	if (chan_nadded >= 2)
+		re_cancel();
+}
+
+
+static void chan_add_estab_handler(struct turn_conn *conn,
+				   const struct sa *relay_addr,
+				   const struct sa *mapped_addr,
+				   const struct stun_msg *msg, void *arg)
+{
+	int err;
+	(void)relay_addr;
+	(void)mapped_addr;
+	(void)msg;
+	(void)arg;
+
+	err = turnconn_add_permission(conn, &chan_peer);
+	ASSERT_EQ(0, err);
+
+	err = turnc_add_chan(conn->turnc, &chan_peer, chan_added_handler,
+			     conn->turnc);
+	ASSERT_EQ(0, err);
+	ASSERT_EQ(0, chan_nadded);
+}
+
+
+TEST(turn, channel_add_after_autobind)
+{
+	TurnServer srv;
+	struct udp_sock *us_cli = NULL;
+	struct sa laddr;
+	int err;
+
+	chan_nadded = 0;
+
+	err = sa_set_str(&laddr, "127.0.0.1", 0);
+	ASSERT_EQ(0, err);
+
+	err = sa_set_str(&chan_peer, "127.0.0.1", 4242);
+	ASSERT_EQ(0, err);
+
+	err = udp_listen(&us_cli, &laddr, NULL, NULL);
+	ASSERT_EQ(0, err);
+
+	err = turnconn_alloc(&chan_conn, NULL, &srv.addr, IPPROTO_UDP, false,
+			     "user", "pass", us_cli, 0, 0,
+			     chan_add_estab_handler, NULL,
+			     chan_error_handler, NULL);
+	ASSERT_EQ(0, err);
+
+	err = re_main_wait(5000);
+	ASSERT_EQ(0, err);
+
+	ASSERT_EQ(2, chan_nadded);
+
+	mem_deref(chan_conn);
+	mem_deref(us_cli);
+}
@@ -0,0 +1,240 @@
+/*
+* Wire
+* Copyright (C) 2016 Wire Swiss GmbH
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <re.h>
+#include <avs.h>
+#include <gtest/gtest.h>
+#include "ztest.h"
+
+
+/*
+ * Two endpoints share one UDP port. Three peers send STUN requests
+ * and media to the port, and we check that each packet goes to the
+ * right endpoint:
+ *
+ *    [peer 1] ---\                      /--- [endpoint A "aaaa"]
+ *    [peer 2] ----+---> [shared port] -+
+ *    [peer 3] ---/                      \--- [endpoint B "bbbb"]
+ */
+
+
+struct endpoint {
+	struct udpmux_ep *ep;
+	unsigned n_stun;
+	unsigned n_media;
+};
+
+static unsigned n_recv;
+static unsigned n_wait;
+
+
+static void ep_recv_handler(const struct sa *src, struct mbuf *mb, void *arg)
+{
+	struct endpoint *ep = (struct endpoint *)arg;
+	(void)src;
+
+	if (mbuf_get_left(mb) >= 20 && mbuf_buf(mb)[0] < 2)
+		++ep->n_stun;
+	else
+		++ep->n_media;
+
+	if (++n_recv >= n_wait)
+		re_cancel();
+}
+
+
+static void peer_recv_handler(const struct sa *src, struct mbuf *mb,
+			      void *arg)
+{
+	(void)src;
+	(void)mb;
+	(void)arg;
+}
+
+
+static void send_stun(struct udp_sock *us, const struct sa *dst,
+		      const char *username)
+{
+	struct mbuf *mb = mbuf_alloc(256);
+	uint8_t tid[STUN_TID_SIZE];
+	int err;
+
+	rand_bytes(tid, sizeof(tid));
+
+	err = stun_msg_encode(mb, STUN_METHOD_BINDING, STUN_CLASS_REQUEST,
+			      tid, NULL, NULL, 0, false, 0x00, 1,
+			      STUN_ATTR_USERNAME, username);
+	ASSERT_EQ(0, err);
+
+	mb->pos = 0;
+	err = udp_send(us, dst, mb);
+	ASSERT_EQ(0, err);
+
+	mem_deref(mb);
+}
+
+
+static void send_media(struct udp_sock *us, const struct sa *dst)
+{
+	struct mbuf *mb = mbuf_alloc(256);
+	int err;
+
+	/* looks like RTP, version 2 */
+	err  = mbuf_write_u8(mb, 0x80);
+	err |= mbuf_fill(mb, 0x00, 159);
+	ASSERT_EQ(0, err);
+
+	mb->pos = 0;
+	err = udp_send(us, dst, mb);
+	ASSERT_EQ(0, err);
+
+	mem_deref(mb);
+}
+
+
+TEST(media, udpmux)
+{
+	struct udpmux *mux = NULL;
+	struct udpmux_stats stats;
+	struct endpoint a, b;
+	struct udp_sock *peer[3];
+	struct sa laddr, maddr, paddr[3];
+	int i, err;
+
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+
+	err = sa_set_str(&laddr, "127.0.0.1", 0);
+	ASSERT_EQ(0, err);
+
+	err = udpmux_alloc(&mux, 0);
+	ASSERT_EQ(0, err);
+
+	err  = udpmux_ep_alloc(&a.ep, mux, &laddr, "aaaa",
+			       ep_recv_handler, &a);
+	err |= udpmux_ep_alloc(&b.ep, mux, &laddr, "bbbb",
+			       ep_recv_handler, &b);
+	ASSERT_EQ(0, err);
+
+	/* one socket for both */
+	ASSERT_TRUE(udpmux_ep_sock(a.ep) == udpmux_ep_sock(b.ep));
+
+	err = udp_local_get(udpmux_ep_sock(a.ep), &maddr);
+	ASSERT_EQ(0, err);
+
+	for (i = 0; i < 3; i++) {
+		err  = udp_listen(&peer[i], &laddr, peer_recv_handler, NULL);
+		err |= udp_local_get(peer[i], &paddr[i]);
+		ASSERT_EQ(0, err);
+	}
+
+	/* STUN by ufrag. Without an ICE stack to check the requests,
+	 * their source addresses are not learned. */
+	send_stun(peer[0], &maddr, "aaaa:p1");
+	send_stun(peer[1], &maddr, "bbbb:p2");
+	send_stun(peer[2], &maddr, "cccc:p3");
+	send_media(peer[2], &maddr);
+	send_media(peer[0], &maddr);
+
+	n_recv = 0;
+	n_wait = 2;
+	err = re_main_wait(5000);
+	ASSERT_EQ(0, err);
+
+	ASSERT_EQ(1, a.n_stun);
+	ASSERT_EQ(0, a.n_media);
+	ASSERT_EQ(1, b.n_stun);
+	ASSERT_EQ(0, b.n_media);
+
+	/* media from a remote candidate address */
+	err  = udpmux_ep_add_raddr(a.ep, &paddr[0]);
+	err |= udpmux_ep_add_raddr(b.ep, &paddr[1]);
+	ASSERT_EQ(0, err);
+
+	send_media(peer[0], &maddr);
+
+	n_recv = 0;
+	n_wait = 1;
+	err = re_main_wait(5000);
+	ASSERT_EQ(0, err);
+
+	ASSERT_EQ(1, a.n_media);
+	ASSERT_EQ(0, b.n_media);
+
+	/* the selected address wins over a candidate address */
+	err  = udpmux_ep_add_raddr(b.ep, &paddr[0]);
+	err |= udpmux_ep_select(b.ep, &paddr[0]);
+	ASSERT_EQ(0, err);
+
+	send_media(peer[0], &maddr);
+	send_media(peer[1], &maddr);
+
+	n_recv = 0;
+	n_wait = 2;
+	err = re_main_wait(5000);
+	ASSERT_EQ(0, err);
+
+	ASSERT_EQ(1, a.n_media);
+	ASSERT_EQ(2, b.n_media);
+
+	/* a candidate address of two endpoints is ambiguous */
+	err = udpmux_ep_add_raddr(a.ep, &paddr[1]);
+	ASSERT_EQ(0, err);
+
+	send_media(peer[1], &maddr);
+	send_media(peer[0], &maddr);
+
+	n_recv = 0;
+	n_wait = 1;
+	err = re_main_wait(5000);
+	ASSERT_EQ(0, err);
+
+	ASSERT_EQ(1, a.n_media);
+	ASSERT_EQ(3, b.n_media);
+
+	/* the oldest candidate addresses are forgotten */
+	for (i = 0; i < 32; i++) {
+		struct sa addr;
+
+		sa_set_in(&addr, 0x0a000001, 1000 + i);
+
+		err = udpmux_ep_add_raddr(a.ep, &addr);
+		ASSERT_EQ(0, err);
+	}
+
+	send_media(peer[1], &maddr);
+
+	n_recv = 0;
+	n_wait = 1;
+	err = re_main_wait(5000);
+	ASSERT_EQ(0, err);
+
+	ASSERT_EQ(1, a.n_media);
+	ASSERT_EQ(4, b.n_media);
+
+	err = udpmux_stats_get(mux, &laddr, &stats);
+	ASSERT_EQ(0, err);
+	ASSERT_EQ(11, stats.n_rx);
+	ASSERT_EQ(4, stats.n_drop);
+
+	for (i = 0; i < 3; i++)
+		mem_deref(peer[i]);
+
+	mem_deref(a.ep);
+	mem_deref(b.ep);
+	mem_deref(mux);
+}
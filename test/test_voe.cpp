@@ -20,9 +20,12 @@
 #include <avs_voe.h>
 #include <gtest/gtest.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <unistd.h>
 #include <re/re.h>
 #include "avs_audio_io.h"
 #include "webrtc/base/logging.h"
+#include "../src/voe/voe.h"
 
 
 TEST(voe, basic_init_close)
@@ -511,3 +514,433 @@ TEST(voe, enc_dec_alloc_start_stop_interrupt)
 }
 #endif
 
+
+
+/*
+ * Speaker selection: with max_speakers, only the loudest decoders are
+ * mixed. The lowest level in -dBov is the loudest, an equal level goes
+ * to the older decoder, a decoder without levels is always mixed and a
+ * decoder whose levels stopped is mixed last.
+ */
+TEST_F(Voe, max_speakers)
+{
+	static const uint8_t levelv[] = {40, 20, 60, 30};
+	struct audec_state *adsv[5];
+	struct media_ctx *mctxv[5];
+	struct aucodec_param prm;
+	const struct aucodec *ac;
+	size_t i;
+	int err;
+
+	ac = aucodec_find(&aucodecl, "opus", 48000, 2);
+	ASSERT_TRUE(ac != NULL);
+	ASSERT_TRUE(ac->dec_levelh != NULL);
+
+	memset(&prm, 0, sizeof(prm));
+	prm.pt = 96;
+	prm.srate = 48000;
+	prm.ch = 2;
+
+	memset(adsv, 0, sizeof(adsv));
+	memset(mctxv, 0, sizeof(mctxv));
+
+	for (i = 0; i < ARRAY_SIZE(adsv); i++) {
+		err = ac->dec_alloc(&adsv[i], &mctxv[i], ac, NULL, &prm,
+				    NULL, NULL, NULL);
+		ASSERT_EQ(0, err);
+	}
+
+	/* the last decoder has no levels */
+	for (i = 0; i < ARRAY_SIZE(levelv); i++)
+		ac->dec_levelh(adsv[i], levelv[i], true);
+
+	voe_set_max_speakers(0);
+	voe_dec_select_speakers();
+	for (i = 0; i < ARRAY_SIZE(adsv); i++)
+		ASSERT_TRUE(adsv[i]->aulevel.speaker);
+
+	voe_set_max_speakers(3);
+	voe_dec_select_speakers();
+	ASSERT_FALSE(adsv[0]->aulevel.speaker);
+	ASSERT_TRUE(adsv[1]->aulevel.speaker);
+	ASSERT_FALSE(adsv[2]->aulevel.speaker);
+	ASSERT_TRUE(adsv[3]->aulevel.speaker);
+	ASSERT_TRUE(adsv[4]->aulevel.speaker);
+
+	/* the cutoff with an equal level */
+	ac->dec_levelh(adsv[2], 20, true);
+	voe_dec_select_speakers();
+	ASSERT_TRUE(adsv[1]->aulevel.speaker);
+	ASSERT_TRUE(adsv[2]->aulevel.speaker);
+	ASSERT_FALSE(adsv[3]->aulevel.speaker);
+	ASSERT_TRUE(adsv[4]->aulevel.speaker);
+
+	/* a decoder whose levels stopped goes last */
+	adsv[1]->aulevel.ts = tmr_jiffies() - AULEVEL_TIMEOUT - 1;
+	voe_dec_select_speakers();
+	ASSERT_FALSE(adsv[1]->aulevel.speaker);
+	ASSERT_TRUE(adsv[2]->aulevel.speaker);
+	ASSERT_TRUE(adsv[3]->aulevel.speaker);
+
+	voe_set_max_speakers(0);
+	voe_dec_select_speakers();
+	for (i = 0; i < ARRAY_SIZE(adsv); i++)
+		ASSERT_TRUE(adsv[i]->aulevel.speaker);
+
+	for (i = 0; i < ARRAY_SIZE(adsv); i++)
+		mem_deref(adsv[i]);
+}
+
+
+/*
+ * Shared encoder: each peer must get a continuous stream with its own
+ * SSRC, and with the shared encoder all peers get every encoded packet.
+ * A run ends after a fixed number of packets per peer, and the CPU
+ * time is reported per packet, for one encoder per peer and for one
+ * encoder fanned out to all peers.
+ */
+
+#define FANOUT_MAX_PEERS 8
+#define FANOUT_PACKETS 25
+
+struct fanout_test {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int npeers;
+	int ndone;        /* peers with FANOUT_PACKETS packets */
+};
+
+struct fanout_peer {
+	struct fanout_test *ft;
+	struct auenc_state *aes;
+	struct media_ctx *mctx;
+	uint32_t ssrc;
+	uint16_t seq;
+	uint32_t ts;
+	unsigned n_pkt;
+	unsigned n_err;
+};
+
+
+static int fanout_send_rtp(const uint8_t *pkt, size_t len, void *arg)
+{
+	struct fanout_peer *fp = (struct fanout_peer *)arg;
+	struct fanout_test *ft = fp->ft;
+	uint16_t seq = read_uint16(&pkt[2]);
+	uint32_t ts = read_uint32(&pkt[4]);
+
+	pthread_mutex_lock(&ft->mutex);
+
+	if (len < 12 || read_uint32(&pkt[8]) != fp->ssrc)
+		++fp->n_err;
+	if (fp->n_pkt && seq != (uint16_t)(fp->seq + 1))
+		++fp->n_err;
+	if (fp->n_pkt && (int32_t)(ts - fp->ts) <= 0)
+		++fp->n_err;
+
+	fp->seq = seq;
+	fp->ts = ts;
+
+	if (++fp->n_pkt == FANOUT_PACKETS) {
+		++ft->ndone;
+		pthread_cond_signal(&ft->cond);
+	}
+
+	pthread_mutex_unlock(&ft->mutex);
+
+	return 0;
+}
+
+
+static uint64_t cpu_usage_us(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000
+		+ ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+
+static void fanout_run(struct list *aucodecl, bool shared, int npeers,
+		       uint64_t *cpu_us)
+{
+	struct fanout_peer peerv[FANOUT_MAX_PEERS];
+	struct fanout_test ft;
+	struct aucodec_param prm;
+	const struct aucodec *ac;
+	struct timeval now;
+	struct timespec t;
+	unsigned n_min = ~0u, n_max = 0;
+	uint64_t t0;
+	int i, ret = 0, err;
+
+	ac = aucodec_find(aucodecl, "opus", 48000, 2);
+	ASSERT_TRUE(ac != NULL);
+
+	voe_enable_shared_encoder(shared);
+
+	memset(&ft, 0, sizeof(ft));
+	pthread_mutex_init(&ft.mutex, NULL);
+	pthread_cond_init(&ft.cond, NULL);
+	ft.npeers = npeers;
+
+	memset(peerv, 0, sizeof(peerv));
+
+	for (i = 0; i < npeers; i++) {
+		struct fanout_peer *fp = &peerv[i];
+
+		fp->ft = &ft;
+		fp->ssrc = 0x1000 + i;
+
+		memset(&prm, 0, sizeof(prm));
+		prm.local_ssrc = fp->ssrc;
+		prm.pt = 96;
+		prm.srate = 48000;
+		prm.ch = 2;
+
+		err = ac->enc_alloc(&fp->aes, &fp->mctx, ac, NULL, &prm,
+				    fanout_send_rtp, NULL, NULL, NULL, fp);
+		ASSERT_EQ(0, err);
+	}
+
+	t0 = cpu_usage_us();
+
+	for (i = 0; i < npeers; i++)
+		ac->enc_start(peerv[i].aes);
+
+	gettimeofday(&now, NULL);
+	t.tv_sec = now.tv_sec + 10;
+	t.tv_nsec = 0;
+
+	pthread_mutex_lock(&ft.mutex);
+	while (ft.ndone < ft.npeers && !ret)
+		ret = pthread_cond_timedwait(&ft.cond, &ft.mutex, &t);
+
+	/* the fan-out sends to the peers in turn */
+	for (i = 0; i < npeers; i++) {
+		n_min = min(n_min, peerv[i].n_pkt);
+		n_max = max(n_max, peerv[i].n_pkt);
+	}
+	pthread_mutex_unlock(&ft.mutex);
+
+	for (i = 0; i < npeers; i++)
+		ac->enc_stop(peerv[i].aes);
+
+	*cpu_us = cpu_usage_us() - t0;
+
+	ASSERT_EQ(0, ret);
+
+	for (i = 0; i < npeers; i++) {
+		struct fanout_peer *fp = &peerv[i];
+
+		mem_deref(fp->aes);
+
+		ASSERT_EQ(0, fp->n_err);
+	}
+
+	if (shared)
+		ASSERT_LE(n_max - n_min, 1u);
+
+	pthread_cond_destroy(&ft.cond);
+	pthread_mutex_destroy(&ft.mutex);
+
+	voe_enable_shared_encoder(false);
+}
+
+
+TEST_F(Voe, shared_encoder)
+{
+	static const int peerv[] = {1, 2, 4, 8};
+	uint64_t cpu_sep[4], cpu_shared[4];
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(peerv); i++) {
+		fanout_run(&aucodecl, false, peerv[i], &cpu_sep[i]);
+		fanout_run(&aucodecl, true, peerv[i], &cpu_shared[i]);
+	}
+
+	re_printf("~~~ performance report ~~~\n");
+	re_printf("peers   cpu/packet, encoder per peer"
+		  "   cpu/packet, shared encoder\n");
+	for (i = 0; i < ARRAY_SIZE(peerv); i++) {
+		re_printf("%5d   %18llu us   %18llu us\n", peerv[i],
+			  (unsigned long long)cpu_sep[i] / FANOUT_PACKETS,
+			  (unsigned long long)cpu_shared[i] / FANOUT_PACKETS);
+	}
+	re_printf("~~~ ~~~ ~~~ ~~~ ~~~ ~~~ ~~~\n");
+	re_printf("\n");
+}
+
+
+/*
+ * Decoding cost of the speaker selection: one encoder feeds the same
+ * packets to SPEAKERS_NDEC decoders with distinct levels, played from
+ * a real time audio device. The CPU time per packet is reported with
+ * all decoders mixed and with only the two loudest mixed.
+ */
+
+#define SPEAKERS_NDEC 8
+#define SPEAKERS_PACKETS 100
+#define SPEAKERS_QLEN 16
+
+struct speakers_test {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	uint8_t pktv[SPEAKERS_QLEN][512];
+	size_t lenv[SPEAKERS_QLEN];
+	unsigned head;
+	unsigned tail;
+};
+
+
+static int speakers_send_rtp(const uint8_t *pkt, size_t len, void *arg)
+{
+	struct speakers_test *st = (struct speakers_test *)arg;
+
+	if (len > sizeof(st->pktv[0]))
+		return EMSGSIZE;
+
+	pthread_mutex_lock(&st->mutex);
+
+	if (st->head - st->tail < SPEAKERS_QLEN) {
+		const unsigned ix = st->head++ % SPEAKERS_QLEN;
+
+		memcpy(st->pktv[ix], pkt, len);
+		st->lenv[ix] = len;
+		pthread_cond_signal(&st->cond);
+	}
+
+	pthread_mutex_unlock(&st->mutex);
+
+	return 0;
+}
+
+
+static void speakers_run(struct list *aucodecl, unsigned max_speakers,
+			 uint64_t *cpu_us)
+{
+	struct audec_state *adsv[SPEAKERS_NDEC];
+	struct media_ctx *mctxv[SPEAKERS_NDEC];
+	struct auenc_state *aes = NULL;
+	struct media_ctx *mctx = NULL;
+	struct speakers_test st;
+	struct aucodec_param prm;
+	const struct aucodec *ac;
+	uint8_t pkt[512];
+	unsigned n, i;
+	uint64_t t0;
+	int ret = 0, err;
+
+	ac = aucodec_find(aucodecl, "opus", 48000, 2);
+	ASSERT_TRUE(ac != NULL);
+
+	memset(&st, 0, sizeof(st));
+	pthread_mutex_init(&st.mutex, NULL);
+	pthread_cond_init(&st.cond, NULL);
+
+	memset(&prm, 0, sizeof(prm));
+	prm.local_ssrc = 0x2000;
+	prm.pt = 96;
+	prm.srate = 48000;
+	prm.ch = 2;
+
+	err = ac->enc_alloc(&aes, &mctx, ac, NULL, &prm,
+			    speakers_send_rtp, NULL, NULL, NULL, &st);
+	ASSERT_EQ(0, err);
+
+	memset(mctxv, 0, sizeof(mctxv));
+
+	for (i = 0; i < SPEAKERS_NDEC; i++) {
+		err = ac->dec_alloc(&adsv[i], &mctxv[i], ac, NULL, &prm,
+				    NULL, NULL, NULL);
+		ASSERT_EQ(0, err);
+
+		ac->dec_start(adsv[i]);
+	}
+
+	voe_set_max_speakers(max_speakers);
+
+	ac->enc_start(aes);
+
+	t0 = cpu_usage_us();
+
+	for (n = 0; n < SPEAKERS_PACKETS && !ret; n++) {
+		struct timeval now;
+		struct timespec t;
+		size_t len = 0;
+
+		gettimeofday(&now, NULL);
+		t.tv_sec = now.tv_sec + 2;
+		t.tv_nsec = 0;
+
+		pthread_mutex_lock(&st.mutex);
+		while (st.head == st.tail && !ret)
+			ret = pthread_cond_timedwait(&st.cond, &st.mutex, &t);
+		if (!ret) {
+			const unsigned ix = st.tail++ % SPEAKERS_QLEN;
+
+			len = st.lenv[ix];
+			memcpy(pkt, st.pktv[ix], len);
+		}
+		pthread_mutex_unlock(&st.mutex);
+
+		if (ret)
+			break;
+
+		/* the first decoder is the loudest */
+		for (i = 0; i < SPEAKERS_NDEC; i++) {
+			ac->dec_levelh(adsv[i], 10 + 5*i, true);
+			ac->dec_rtph(adsv[i], pkt, len);
+		}
+	}
+
+	*cpu_us = cpu_usage_us() - t0;
+
+	ac->enc_stop(aes);
+
+	ASSERT_EQ(0, ret);
+
+	for (i = 0; i < SPEAKERS_NDEC; i++) {
+		const bool speaker = !max_speakers || i < max_speakers;
+
+		ASSERT_EQ(speaker, adsv[i]->aulevel.speaker);
+		if (!speaker)
+			ASSERT_GT(adsv[i]->aulevel.n_skip, 0u);
+
+		ac->dec_stop(adsv[i]);
+		mem_deref(adsv[i]);
+	}
+
+	mem_deref(aes);
+
+	voe_set_max_speakers(0);
+
+	pthread_cond_destroy(&st.cond);
+	pthread_mutex_destroy(&st.mutex);
+}
+
+
+TEST_F(Voe, max_speakers_cpu)
+{
+	webrtc::fake_audiodevice rt_ad(true);
+	uint64_t cpu_all, cpu_two;
+
+	voe_deregister_adm();
+	voe_register_adm((void*)&rt_ad);
+
+	speakers_run(&aucodecl, 0, &cpu_all);
+	speakers_run(&aucodecl, 2, &cpu_two);
+
+	voe_deregister_adm();
+	voe_register_adm((void*)&ad);
+
+	re_printf("~~~ performance report ~~~\n");
+	re_printf("decoders   cpu/packet, all mixed   cpu/packet, 2 mixed\n");
+	re_printf("%8d   %17llu us   %15llu us\n", SPEAKERS_NDEC,
+		  (unsigned long long)cpu_all / SPEAKERS_PACKETS,
+		  (unsigned long long)cpu_two / SPEAKERS_PACKETS);
+	re_printf("~~~ ~~~ ~~~ ~~~ ~~~ ~~~ ~~~\n");
+	re_printf("\n");
+}